@@ -40,21 +40,78 @@ CREATE TABLE group_members (
 
 -- Messages table
 CREATE TABLE messages (
-    id INT AUTO_INCREMENT PRIMARY KEY,
+    id BIGINT AUTO_INCREMENT PRIMARY KEY,
     sender_id INT NOT NULL,
     receiver_id INT DEFAULT NULL,
     group_id INT DEFAULT NULL,
+    -- -group_id cho tin nhóm, (id nhỏ << 32) | id lớn cho tin riêng: mỗi cuộc chat một khóa
+    conversation_id BIGINT NOT NULL,
     message_content TEXT NOT NULL,
     timestamp DATETIME NOT NULL,
+    -- Sequence của bản ghi trong WAL của server, để replay không ghi trùng
+    wal_id BIGINT DEFAULT NULL UNIQUE,
     FOREIGN KEY (sender_id) REFERENCES users(id),
     FOREIGN KEY (receiver_id) REFERENCES users(id),
     FOREIGN KEY (group_id) REFERENCES `groups`(group_id)
 );
 
+-- Tóm tắt hội thoại riêng: mỗi người tham gia một dòng, cập nhật khi ghi tin
+CREATE TABLE dm_summaries (
+    user_id INT NOT NULL,
+    peer_id INT NOT NULL,
+    sender_id INT NOT NULL,
+    last_message VARCHAR(255) NOT NULL,
+    last_time DATETIME NOT NULL,
+    PRIMARY KEY (user_id, peer_id),
+    FOREIGN KEY (user_id) REFERENCES users(id),
+    FOREIGN KEY (peer_id) REFERENCES users(id),
+    FOREIGN KEY (sender_id) REFERENCES users(id)
+);
+
+-- Tóm tắt hội thoại nhóm: một dòng mỗi nhóm
+CREATE TABLE group_summaries (
+    group_id INT PRIMARY KEY,
+    sender_id INT NOT NULL,
+    last_message VARCHAR(255) NOT NULL,
+    last_time DATETIME NOT NULL,
+    FOREIGN KEY (group_id) REFERENCES `groups`(group_id),
+    FOREIGN KEY (sender_id) REFERENCES users(id)
+);
+
 -- Add indexes for performance
 CREATE INDEX idx_users_username ON users(username);
 CREATE INDEX idx_group_members_user ON group_members(user_id);
 CREATE INDEX idx_group_members_group ON group_members(group_id);
 CREATE INDEX idx_messages_sender ON messages(sender_id);
 CREATE INDEX idx_messages_receiver ON messages(receiver_id);
-CREATE INDEX idx_messages_group ON messages(group_id);
\ No newline at end of file
+CREATE INDEX idx_messages_group ON messages(group_id);
+-- Lịch sử một cuộc chat đọc liên tục trên index này theo thứ tự id (khóa chính nằm sẵn trong index)
+CREATE INDEX idx_messages_conversation ON messages(conversation_id, id);
+
+-- Existing databases: ALTER TABLE messages ADD COLUMN wal_id BIGINT DEFAULT NULL UNIQUE;
+
+-- Existing databases: run `chat_app --migrate` once. It adds conversation_id and its index online,
+-- then backfills old rows in id ranges of migrate.batch_size. After every server runs the new
+-- version, finish with (the id change copies the table, run it in a quiet period):
+-- ALTER TABLE messages MODIFY conversation_id BIGINT NOT NULL;
+-- ALTER TABLE messages MODIFY id BIGINT AUTO_INCREMENT;
+
+-- Existing databases: create dm_summaries and group_summaries above, then fill them once
+-- (the server keeps them up to date from then on):
+-- INSERT INTO dm_summaries (user_id, peer_id, sender_id, last_message, last_time)
+--     SELECT x.user_id, x.peer_id, m.sender_id, LEFT(SUBSTRING_INDEX(m.message_content, '\n', 1), 255), m.timestamp
+--     FROM (SELECT sender_id AS user_id, receiver_id AS peer_id, MAX(id) AS last_id FROM messages
+--               WHERE group_id IS NULL GROUP BY sender_id, receiver_id
+--           UNION ALL
+--           SELECT receiver_id, sender_id, MAX(id) FROM messages
+--               WHERE group_id IS NULL AND receiver_id <> sender_id GROUP BY receiver_id, sender_id) x
+--     JOIN messages m ON m.id = x.last_id
+--     ON DUPLICATE KEY UPDATE
+--         sender_id = IF(VALUES(last_time) >= last_time, VALUES(sender_id), sender_id),
+--         last_message = IF(VALUES(last_time) >= last_time, VALUES(last_message), last_message),
+--         last_time = GREATEST(last_time, VALUES(last_time));
+-- INSERT INTO group_summaries (group_id, sender_id, last_message, last_time)
+--     SELECT m.group_id, m.sender_id, LEFT(SUBSTRING_INDEX(m.message_content, '\n', 1), 255), m.timestamp
+--     FROM messages m
+--     JOIN (SELECT group_id, MAX(id) AS last_id FROM messages WHERE group_id IS NOT NULL GROUP BY group_id) x
+--         ON m.id = x.last_id;
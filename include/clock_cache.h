@@ -0,0 +1,50 @@
+#ifndef CLOCK_CACHE_H
+#define CLOCK_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct
+{
+    long long hits;
+    long long misses;
+    long long evictions;
+    int size;
+    int capacity;
+} ClockCacheStats;
+
+/**
+ * Bounded map from int key to a fixed-size value, evicting with the CLOCK
+ * algorithm: a hit only sets the entry's reference bit, and the hand clears
+ * bits until it finds an entry that was not used since its last pass.
+ * Values are copied in and out, so callers never hold pointers into the
+ * cache. All operations are thread-safe.
+ */
+typedef struct ClockCache ClockCache;
+
+ClockCache *clock_cache_create(int capacity, size_t value_size);
+void clock_cache_destroy(ClockCache *cache);
+
+/**
+ * Copy the value stored under key into out
+ * @return false on a miss
+ */
+bool clock_cache_get(ClockCache *cache, int key, void *out);
+
+/**
+ * Insert or overwrite key, evicting one entry when the cache is full
+ */
+void clock_cache_put(ClockCache *cache, int key, const void *value);
+void clock_cache_remove(ClockCache *cache, int key);
+
+/**
+ * Read-through loaders take the version before querying the database and
+ * store with clock_cache_put_if, which refuses the value when any
+ * clock_cache_remove happened in between (the row may have changed).
+ */
+unsigned long long clock_cache_version(ClockCache *cache);
+bool clock_cache_put_if(ClockCache *cache, int key, const void *value, unsigned long long version);
+
+ClockCacheStats clock_cache_get_stats(ClockCache *cache);
+
+#endif
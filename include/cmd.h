@@ -34,4 +34,9 @@
 #define GROUP_NOTIFICATION 0x16
 
 #define SEARCH_USERS 0x17
+
+#define SUBSCRIBE_PRESENCE 0x18
+#define PRESENCE_UPDATE 0x19
+
+#define SEARCH_MESSAGES 0x1A
 #endif
@@ -11,6 +11,38 @@ typedef struct {
     char *db_user;
     char *db_password;
     char *db_name;
+    int presence_tick_ms;
+    int db_pool_min;
+    int db_pool_max;
+    int db_pool_wait_ms;
+    int db_pool_idle_check_ms;
+    int persist_flush_ms;
+    int persist_batch_size;
+    int persist_max_pending;
+    char *wal_path;
+    int db_executor_threads;
+    int db_executor_queue_max;
+    int db_async_connections;
+    int user_cache_capacity;
+    int group_cache_capacity;
+    int migrate_batch_size;
+    int migrate_pause_ms;
+    char *index_path;
+    int index_segment_docs;
+    int index_poll_ms;
+    char *storage_backend;
+    char *storage_sqlite_path;
+    int message_log_enabled;
+    char *message_log_path;
+    int message_log_segment_bytes;
+    int message_log_index_interval;
+    int message_log_compact_ms;
+    int message_log_compact_segments;
+    int archive_enabled;
+    char *archive_path;
+    int archive_age_days;
+    int archive_interval_ms;
+    int archive_segment_rows;
 } Config;
 
 
@@ -26,6 +58,38 @@ int config_get_db_port();
 const char* config_get_db_user();
 const char* config_get_db_password();
 const char* config_get_db_name();
+int config_get_presence_tick_ms();
+int config_get_db_pool_min();
+int config_get_db_pool_max();
+int config_get_db_pool_wait_ms();
+int config_get_db_pool_idle_check_ms();
+int config_get_persist_flush_ms();
+int config_get_persist_batch_size();
+int config_get_persist_max_pending();
+const char* config_get_wal_path();
+int config_get_db_executor_threads();
+int config_get_db_executor_queue_max();
+int config_get_db_async_connections();
+int config_get_user_cache_capacity();
+int config_get_group_cache_capacity();
+int config_get_migrate_batch_size();
+int config_get_migrate_pause_ms();
+const char* config_get_index_path();
+int config_get_index_segment_docs();
+int config_get_index_poll_ms();
+const char* config_get_storage_backend();
+const char* config_get_storage_sqlite_path();
+int config_get_message_log_enabled();
+const char* config_get_message_log_path();
+int config_get_message_log_segment_bytes();
+int config_get_message_log_index_interval();
+int config_get_message_log_compact_ms();
+int config_get_message_log_compact_segments();
+int config_get_archive_enabled();
+const char* config_get_archive_path();
+int config_get_archive_age_days();
+int config_get_archive_interval_ms();
+int config_get_archive_segment_rows();
 
 void config_cleanup();
 
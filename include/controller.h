@@ -35,7 +35,8 @@ void handle_login(Session* session, Message* message);
 void handle_logout(Session* session, Message* message);
 void handle_register(Session* session, Message* message);
 void handle_search_user(Session* session, Message* msg);
-void get_users(Session* session);
+void handle_search_messages(Session* session, Message* msg);
+void get_users(Session* session, Message* msg);
 void get_joined_groups(Session* session, Message* msg);
 void server_handle_join_group(Session* session, Message* msg);
 void server_handle_leave_group(Session* session, Message* msg);
@@ -46,4 +47,5 @@ void get_chat_history(Session* session, Message* msg);
 void server_create_group(Session* session, Message* msg);
 void get_user_message(Session* session, Message* msg);
 void get_group_message(Session* session, Message* msg);
+void handle_subscribe_presence(Session* session, Message* msg);
 #endif
\ No newline at end of file
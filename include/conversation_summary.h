@@ -0,0 +1,39 @@
+#ifndef CONVERSATION_SUMMARY_H
+#define CONVERSATION_SUMMARY_H
+
+#include <time.h>
+
+// Bằng dm_summaries.last_message / group_summaries.last_message
+#define SUMMARY_PREVIEW_SIZE 256
+
+typedef struct
+{
+    int sender_id;
+    int receiver_id;
+    // <= 0 nghĩa là tin riêng
+    int group_id;
+    const char *content;
+    time_t timestamp;
+} SummaryMessage;
+
+// Một dòng cần upsert: (user_id, peer_id) của dm_summaries hoặc group_id của group_summaries
+typedef struct
+{
+    int key;
+    int peer_id;
+    int sender_id;
+    time_t timestamp;
+    char preview[SUMMARY_PREVIEW_SIZE];
+} SummaryRow;
+
+/**
+ * Fold a batch of messages that were just written to `messages` into the
+ * per-conversation summary tables (dm_summaries, one row per participant,
+ * and group_summaries). Only the newest message of each conversation is
+ * upserted, and an older timestamp never overwrites a newer summary, so
+ * replaying a batch is harmless. Failures are logged; the messages
+ * themselves are already safe.
+ */
+void conversation_summary_apply(const SummaryMessage *messages, int count);
+
+#endif
@@ -5,11 +5,61 @@
 #include <mysql/mysql.h>
 #include <pthread.h>
 
+#define DB_POOL_DEFAULT_MIN 2
+#define DB_POOL_DEFAULT_MAX 10
+#define DB_POOL_DEFAULT_WAIT_MS 5000
+#define DB_POOL_DEFAULT_IDLE_CHECK_MS 30000
+#define DB_POOL_MAX_CONNECTIONS 64
+
+#define DB_STATEMENT_CACHE_SIZE 64
+
+typedef struct
+{
+    unsigned int hash;
+    char *sql;
+    MYSQL_STMT *stmt;
+    unsigned long last_used;
+} DbCachedStatement;
+
+typedef struct
+{
+    MYSQL *mysql;
+    bool in_use;
+    // Thời điểm trả về pool (monotonic ms), dùng để quyết định có cần ping hay không
+    long long last_used_ms;
+
+    // Prepared statement của connection này, chỉ owner đang checkout mới được chạm vào
+    DbCachedStatement statements[DB_STATEMENT_CACHE_SIZE];
+    int statement_count;
+    unsigned long statement_clock;
+    unsigned long statement_hits;
+    unsigned long statement_misses;
+} DbConnection;
+
+typedef struct
+{
+    unsigned long checkouts;
+    unsigned long waits;
+    unsigned long timeouts;
+    unsigned long reconnects;
+    unsigned long statement_hits;
+    unsigned long statement_misses;
+    int active;
+    int idle;
+    int size;
+} DbPoolStats;
+
 typedef struct
 {
-    MYSQL *connections[10];
-    int active_connections;
+    DbConnection connections[DB_POOL_MAX_CONNECTIONS];
+    int size;
+    int min_size;
+    int max_size;
+    int wait_ms;
+    int idle_check_ms;
+    DbPoolStats stats;
     pthread_mutex_t mutex;
+    pthread_cond_t available;
     bool initialized;
 
     char *host;
@@ -19,6 +69,31 @@ typedef struct
     int port;
 } DbManager;
 
+typedef enum
+{
+    DB_PARAM_NULL,
+    DB_PARAM_INT,
+    DB_PARAM_LONG,
+    DB_PARAM_STRING
+} DbParamType;
+
+// Một tham số của prepared statement; string không được copy, phải sống tới lúc execute
+typedef struct
+{
+    DbParamType type;
+    union
+    {
+        int int_value;
+        long long_value;
+        const char *string_value;
+    };
+} DbParam;
+
+#define DB_NULL ((DbParam){.type = DB_PARAM_NULL})
+#define DB_INT(v) ((DbParam){.type = DB_PARAM_INT, .int_value = (v)})
+#define DB_LONG(v) ((DbParam){.type = DB_PARAM_LONG, .long_value = (v)})
+#define DB_STRING(v) ((DbParam){.type = DB_PARAM_STRING, .string_value = (v)})
+
 typedef struct
 {
     char *key;
@@ -32,7 +107,7 @@ typedef struct
     int field_count;
 } DbResultRow;
 
-typedef struct
+typedef struct DbResultSet
 {
     DbResultRow **rows;
     int current_row;
@@ -44,10 +119,29 @@ DbManager *db_manager_get_instance();
 bool db_manager_start();
 void db_manager_shutdown();
 
-MYSQL *db_manager_get_connection();
-void db_manager_release_connection(MYSQL *conn);
+/**
+ * Check out a connection for exclusive use. Waits up to db.pool.wait_ms
+ * when every connection is busy and the pool is at db.pool.max.
+ * Connections idle longer than db.pool.idle_check_ms are pinged first.
+ * @return NULL on timeout or when no connection can be opened
+ */
+DbConnection *db_manager_get_connection();
+void db_manager_release_connection(DbConnection *conn);
+DbPoolStats db_manager_get_stats();
+
+/**
+ * Statements sent to MySQL by the calling thread so far. Take the
+ * difference around a unit of work to count its round trips.
+ */
+unsigned long db_manager_thread_queries();
+void db_manager_count_query();
 
 int db_manager_update(const char *sql, ...);
+/**
+ * Run a prepared statement with param_count DbParam arguments,
+ * e.g. db_manager_update_with_params(sql, 2, DB_INT(id), DB_STRING(name)).
+ * @return affected rows, -1 on error
+ */
 int db_manager_update_with_params(const char *sql, int param_count, ...);
 DbResultSet *db_manager_query(const char *sql);
 
@@ -0,0 +1,44 @@
+#ifndef DB_ASYNC_H
+#define DB_ASYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "db_result.h"
+
+#define DB_ASYNC_DEFAULT_CONNECTIONS 4
+#define DB_ASYNC_QUEUE_MAX 4096
+// epoll_wait timeout, cũng là chu kỳ thử nối lại connection bị rớt
+#define DB_ASYNC_POLL_MS 100
+
+/**
+ * Called once per query with the full result, NULL when the query failed
+ * or did not finish within the loop's query timeout.
+ * The callback owns the result and frees it with db_result_free().
+ * It runs on the DB executor, so it may block and use the pool.
+ */
+typedef void (*DbAsyncCallback)(DbResult *result, void *arg);
+
+/**
+ * Open db.async.connections connections and start the epoll thread that
+ * drives them with the MySQL nonblocking API. Needs libmysqlclient 8.0.16+;
+ * with an older client this logs once and returns false.
+ */
+bool db_async_start();
+
+/**
+ * Finish queued and in-flight queries, then close the connections.
+ * Call before db_executor_stop so completions can still be delivered.
+ */
+void db_async_stop();
+
+/**
+ * Queue a text-protocol SELECT. The SQL is copied and sent as is, so it
+ * must not carry unescaped client input. With a non-zero key the caller
+ * has called db_executor_hold(key) and the callback runs as the key's
+ * continuation, before any later task of the key.
+ * @return false if the loop is not running or DB_ASYNC_QUEUE_MAX queries
+ * are waiting; the caller should run the query itself (and release key)
+ */
+bool db_async_query(uint64_t key, const char *sql, DbAsyncCallback callback, void *arg);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef DB_EXECUTOR_H
+#define DB_EXECUTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DB_EXECUTOR_DEFAULT_THREADS 8
+#define DB_EXECUTOR_DEFAULT_QUEUE_MAX 4096
+// Số task của một run_all chạy cùng lúc, tính cả caller; luôn nhỏ hơn db.pool.max
+#define DB_EXECUTOR_FANOUT_MAX 4
+// db_executor_stop chờ các key đang bị giữ tối đa chừng này trước khi bỏ hold
+#define DB_EXECUTOR_STOP_WAIT_MS 5000
+
+typedef void (*DbTaskFn)(void *arg);
+
+typedef struct
+{
+    DbTaskFn fn;
+    void *arg;
+} DbTask;
+
+/**
+ * Start the worker threads (db.executor.threads, at most db.pool.max since
+ * every worker can hold one pooled connection).
+ */
+bool db_executor_start();
+
+/**
+ * Run what is still queued, then join the workers. Keys still held are
+ * waited for up to DB_EXECUTOR_STOP_WAIT_MS, then their holds are dropped
+ * so the tasks behind them can run.
+ */
+void db_executor_stop();
+
+/**
+ * Queue fn(arg) on a worker. Tasks sharing a non-zero key run one at a time
+ * in submission order; key 0 tasks may run concurrently with anything.
+ * Blocks while db.executor.queue_max tasks are waiting.
+ * @return false if the executor is not running, the caller should run fn itself
+ */
+bool db_executor_submit(uint64_t key, DbTaskFn fn, void *arg);
+
+/**
+ * Keep the other tasks of key waiting after the running task returns, so a
+ * task can hand its work to a callback without losing the key's order.
+ * Call from the task running under key, then end the hold with exactly one
+ * db_executor_resume or db_executor_release.
+ * @return false if the executor is not running; nothing is held
+ */
+bool db_executor_hold(uint64_t key);
+
+/**
+ * Queue fn(arg) as the continuation of a held key: it runs before every
+ * other task of key once the holding task returned, and the hold ends when
+ * it starts. Accepted while the executor is stopping.
+ * @return false if the executor is not running (the hold is dropped), the
+ * caller should run fn itself
+ */
+bool db_executor_resume(uint64_t key, DbTaskFn fn, void *arg);
+
+/**
+ * Drop a hold without a continuation
+ */
+void db_executor_release(uint64_t key);
+
+/**
+ * Run independent tasks in parallel and return once all of them finished.
+ * At most DB_EXECUTOR_FANOUT_MAX of them run at a time, so one call cannot
+ * take every pooled connection. The calling thread works through the tasks
+ * too, so calling this from a worker cannot deadlock even when every other
+ * worker is busy.
+ */
+void db_executor_run_all(DbTask *tasks, int count);
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef DB_MAPPER_H
+#define DB_MAPPER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "db_result.h"
+
+#define DB_MAPPER_MAX_FIELDS 32
+
+typedef enum
+{
+    DB_FIELD_INT,
+    DB_FIELD_LONG,
+    DB_FIELD_BOOL,
+    // char * field, value is strdup'd (caller frees)
+    DB_FIELD_STRDUP,
+    // char[] field, value is copied and truncated to the array size
+    DB_FIELD_CHARS
+} DbFieldKind;
+
+typedef struct
+{
+    const char *column;
+    DbFieldKind kind;
+    size_t offset;
+    size_t size;
+} DbFieldBinding;
+
+/**
+ * Declarative description of a query's output: which column goes into
+ * which struct field and how it is decoded. Columns are matched by name
+ * once per result, rows are then decoded by index with no string compares.
+ */
+typedef struct
+{
+    const char *name;
+    const char *sql;
+    const DbFieldBinding *fields;
+    int field_count;
+    size_t row_size;
+} DbRowMapper;
+
+// 1 nếu member có đúng kiểu mà kind ghi vào: int, long, bool, char * hoặc mảng char
+#define DB_FIELD_TYPE_MATCHES(kind, type, member)                                   \
+    _Generic(&((type *)0)->member,                                                 \
+        int *: (kind) == DB_FIELD_INT,                                             \
+        long *: (kind) == DB_FIELD_LONG,                                           \
+        bool *: (kind) == DB_FIELD_BOOL,                                           \
+        char **: (kind) == DB_FIELD_STRDUP,                                        \
+        char (*)[sizeof(((type *)0)->member)]: (kind) == DB_FIELD_CHARS,           \
+        default: 0)
+
+// Hằng 0, chỉ để đặt _Static_assert vào trong initializer
+#define DB_FIELD_STATIC_CHECK(condition, message) \
+    (0 * sizeof(struct { _Static_assert(condition, message); int unused; }))
+
+/**
+ * Binding of column to type.member. A kind that does not match the
+ * member's declared type (e.g. DB_FIELD_LONG on an int) fails to compile.
+ */
+#define DB_FIELD(column, kind, type, member)                                                              \
+    {column, kind,                                                                                        \
+     offsetof(type, member) + DB_FIELD_STATIC_CHECK(DB_FIELD_TYPE_MATCHES(kind, type, member),            \
+                                                    "DB_FIELD kind does not match " #type "." #member),   \
+     sizeof(((type *)0)->member)}
+
+#define DB_ROW_MAPPER(name, sql, type, fields) \
+    {name, sql, fields, (int)(sizeof(fields) / sizeof((fields)[0])), sizeof(type)}
+
+/**
+ * Resolve mapper fields to result columns
+ * @param columns out, one column index per mapper field
+ * @return false if a column is missing from the result
+ */
+bool db_mapper_resolve(const DbRowMapper *mapper, const DbResult *result, int *columns);
+
+void db_mapper_decode(const DbRowMapper *mapper, const DbResult *result, const int *columns, int row, void *out);
+
+/**
+ * db_mapper_resolve and db_mapper_decode for the current row of a cursor.
+ * DB_FIELD_STRDUP fields point into the cursor instead of being copied,
+ * so they are only valid until the next row.
+ */
+bool db_mapper_resolve_cursor(const DbRowMapper *mapper, const DbCursor *cursor, int *columns);
+void db_mapper_decode_cursor(const DbRowMapper *mapper, const DbCursor *cursor, const int *columns, void *out);
+
+/**
+ * Decode every row into a zeroed array of mapper->row_size elements
+ * @return malloc'd array or NULL when there are no rows / on error
+ */
+void *db_map_rows(const DbRowMapper *mapper, const DbResult *result, int *count);
+
+/**
+ * Execute stmt (caller still frees it) and decode the rows with mapper
+ */
+void *db_query_rows(const DbRowMapper *mapper, DbStatement *stmt, int *count);
+
+#endif
@@ -4,6 +4,9 @@
 
 #ifndef ONLINE_MESSAGE_H
 #define ONLINE_MESSAGE_H
+
+#include <stdbool.h>
+
 typedef struct {
     int id;                   // nếu âm là group, dương là user
     char sender_name[64];       // Ví dụ: "4" hoặc "G5"
@@ -12,19 +15,61 @@ typedef struct {
     long last_time;           // Thời gian
 } ChatHistory;
 typedef struct {
+    long id;
     int sender_id;
     char* sender_name;
     char* content;
     long timestamp;
 } MessageData;
 
+typedef struct {
+    long id;
+    long conversation_id;
+    int sender_id;
+    char* sender_name;
+    char* content;
+    long timestamp;
+} MessageSearchResult;
+
 
 ChatHistory* get_chat_histories_by_user(int user_id, int* out_count);
 
-void save_private_message(int sender_id, int receiver_id, const char* content);
+/**
+ * Log the message to the WAL and queue it for storage
+ * @return false if it could not be made durable; nothing was stored then, and
+ * the sender must not be told it was sent
+ */
+bool save_private_message(int sender_id, int receiver_id, const char* content);
+
+bool save_group_message(int sender_id, int group_id, const char* content);
 
-void save_group_message(int sender_id, int group_id, const char* content);
+/**
+ * Canonical key of a conversation, stored in messages.conversation_id:
+ * -group_id for a group, (smaller user id << 32) | larger user id for a
+ * private chat, so both directions share one key.
+ */
+long long message_conversation_id(int sender_id, int receiver_id, int group_id);
 
 MessageData* get_chat_messages(int user_id, int chat_with_id, int group_id, int* count);
 
+/**
+ * Called once per message of a streamed history; sender_name and content
+ * are only valid during the call. Return false to stop.
+ */
+typedef bool (*MessageRowFn)(const MessageData* message, void* arg);
+
+/**
+ * Same messages as get_chat_messages, archived ones included, handed to
+ * each in id order as they are read instead of collected in an array
+ * @return false on a storage error; stopping early is not an error
+ */
+bool for_each_chat_message(int user_id, int chat_with_id, int group_id, MessageRowFn each, void* arg);
+
+/**
+ * Full-text search over the messages the user can see, newest first.
+ * Hits come from the message index, their content from the storage backend.
+ * The caller frees each sender_name and content, then the array.
+ */
+MessageSearchResult* search_messages(int user_id, const char* query, int limit, int* count);
+
 #endif //ONLINE_MESSAGE_H
@@ -0,0 +1,19 @@
+#ifndef DB_MIGRATE_H
+#define DB_MIGRATE_H
+
+#include <stdbool.h>
+
+#define MIGRATE_DEFAULT_BATCH_SIZE 5000
+#define MIGRATE_DEFAULT_PAUSE_MS 50
+
+/**
+ * Bring an existing messages table to the conversation-keyed schema while
+ * the old server keeps running: add conversation_id and its
+ * (conversation_id, id) index online if missing, then fill the column for
+ * old rows in id ranges of migrate.batch_size, pausing migrate.pause_ms
+ * between ranges so normal traffic keeps its locks short. Safe to re-run.
+ * @return false if a step failed, rows done so far stay done
+ */
+bool db_migrate_conversations();
+
+#endif
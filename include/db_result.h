@@ -0,0 +1,100 @@
+#ifndef DB_RESULT_H
+#define DB_RESULT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <mysql/mysql.h>
+
+typedef struct DbStatement DbStatement;
+
+#define DB_RESULT_NULL_CELL UINT32_MAX
+
+typedef struct
+{
+    const char *name;
+    int type;
+} DbColumn;
+
+/**
+ * Flat result set. Column metadata is stored once; every cell is an
+ * (offset, length) pair into a single data arena holding the text value
+ * followed by '\0'. A NULL cell has offset DB_RESULT_NULL_CELL.
+ * Freeing the result is a fixed handful of free() calls whatever its size.
+ */
+typedef struct
+{
+    int column_count;
+    DbColumn *columns;
+
+    int row_count;
+    int row_capacity;
+    uint32_t *offsets;
+    uint32_t *lengths;
+
+    char *data;
+    size_t data_size;
+    size_t data_capacity;
+} DbResult;
+
+/**
+ * Execute a prepared SELECT and copy every row into a DbResult
+ * @return NULL on error (the statement is still owned by the caller)
+ */
+DbResult *db_execute_rows(DbStatement *stmt);
+DbResult *db_result_from_mysql(MYSQL_RES *res);
+
+// Buffer đầu tiên của mỗi cột trong DbCursor, nới ra khi gặp giá trị dài hơn
+#define DB_CURSOR_COLUMN_BYTES 256
+
+typedef struct DbCursor DbCursor;
+
+/**
+ * Execute a prepared SELECT and read its rows one at a time as the server
+ * sends them, without mysql_stmt_store_result, so memory stays at one row
+ * whatever the size of the result. Values are text as in DbResult and are
+ * valid until the next db_cursor_next. The statement's connection is busy
+ * until db_cursor_close: nothing else may run on it meanwhile.
+ * @return NULL on error (the statement is still owned by the caller)
+ */
+DbCursor *db_cursor_open(DbStatement *stmt);
+/**
+ * Load the next row
+ * @return false after the last row or on error, see db_cursor_failed
+ */
+bool db_cursor_next(DbCursor *cursor);
+bool db_cursor_failed(const DbCursor *cursor);
+/**
+ * Drop the rows not read yet and free the cursor; the statement stays with the caller
+ */
+void db_cursor_close(DbCursor *cursor);
+
+int db_cursor_column_index(const DbCursor *cursor, const char *name);
+/* Current row by column index, a NULL cell reads as NULL */
+const char *db_cursor_string(const DbCursor *cursor, int column);
+
+/**
+ * Build a result row by row, for rows that do not come from MySQL.
+ * types is optional and only kept for the DbResultSet shim.
+ * A NULL value is stored as a NULL cell.
+ */
+DbResult *db_result_create(int column_count, const char *const *names, const int *types);
+bool db_result_append_row(DbResult *result, const char *const *values, const unsigned long *lengths);
+void db_result_free(DbResult *result);
+
+int db_result_column_index(const DbResult *result, const char *name);
+bool db_result_is_null(const DbResult *result, int row, int column);
+
+/* Typed accessors by column index, NULL cells read as 0 / NULL */
+const char *db_result_string(const DbResult *result, int row, int column);
+int db_result_int(const DbResult *result, int row, int column);
+long long db_result_long(const DbResult *result, int row, int column);
+double db_result_double(const DbResult *result, int row, int column);
+bool db_result_bool(const DbResult *result, int row, int column);
+
+/**
+ * Shim for callers still on the DbResultSet API: converts (and frees) a DbResult
+ */
+typedef struct DbResultSet DbResultSet;
+DbResultSet *db_result_to_result_set(DbResult *result);
+
+#endif
@@ -7,22 +7,96 @@
 
 typedef struct DbStatement DbStatement;
 struct DbStatement{
-    MYSQL *conn;
+    DbConnection *conn;
     MYSQL_STMT *stmt;
     MYSQL_BIND *binds;
     unsigned long *lengths;
+    // Giá trị số được bind, sống cùng binds
+    long long *values;
     unsigned long param_count;
     bool is_bound;
+    // stmt thuộc cache của conn, không được mysql_stmt_close khi free
+    bool cached;
+    // conn thuộc một DbTransaction, free không trả nó về pool
+    bool in_transaction;
 };
+
+// Một connection giữ riêng từ db_begin tới db_commit/db_rollback
+typedef struct
+{
+    DbConnection *conn;
+} DbTransaction;
+
+/**
+ * Statement that writes many rows at once: prefix, row repeated once per
+ * row joined by ", ", then suffix. params is the number of ? in row.
+ */
+typedef struct
+{
+    const char *prefix;
+    const char *row;
+    const char *suffix;
+    int params;
+} DbArrayStatement;
+
+// Số dòng mỗi câu của db_transaction_execute_array, dùng lần lượt từ lớn tới nhỏ
+#define DB_ARRAY_CHUNK_SIZES {64, 16, 4, 1}
+
+/**
+ * Check out a connection and get a prepared statement for query.
+ * Statements are cached per connection by SQL text, so a query that was
+ * already prepared on that connection costs a single execute round trip.
+ */
 DbStatement* db_prepare(const char* query);
+/**
+ * Close every cached statement of a pooled connection.
+ * Must be called before the connection's MYSQL handle is closed.
+ */
+void db_statement_cache_clear(DbConnection *conn);
 bool db_bind_string(DbStatement* stmt, int index, const char* value);
 bool db_execute(DbStatement* stmt);
 DbResultSet *db_execute_query(DbStatement *stmt);
 bool db_return_execute(DbStatement *stmt, int *result);
 void diagnose_statement(DbStatement *stmt);
 void db_statement_free(DbStatement *stmt);
+bool db_bind_param(DbStatement *stmt, int index, const DbParam *param);
+
+/**
+ * Check out a connection and start a transaction on it. Every statement
+ * of the transaction runs on that connection and they are made durable
+ * together by a single commit.
+ * @return NULL if no connection is available or START TRANSACTION fails
+ */
+DbTransaction *db_begin();
+/**
+ * Like db_prepare on the transaction's connection; db_statement_free
+ * leaves the connection to the transaction
+ */
+DbStatement *db_transaction_prepare(DbTransaction *tx, const char *query);
+/**
+ * Prepare, bind params and execute one statement in the transaction
+ */
+bool db_transaction_execute(DbTransaction *tx, const char *query, const DbParam *params, int param_count);
+/**
+ * Write row_count rows (row_count * shape->params values in row order) with
+ * as few multi-row statements as DB_ARRAY_CHUNK_SIZES allows
+ */
+bool db_transaction_execute_array(DbTransaction *tx, const DbArrayStatement *shape, const DbParam *params,
+                                  int row_count);
+/**
+ * Commit and give the connection back; on failure the transaction is rolled back.
+ * tx is freed either way.
+ */
+bool db_commit(DbTransaction *tx);
+void db_rollback(DbTransaction *tx);
+
+/**
+ * SQL of shape with rows rows, malloc'd
+ */
+char *db_array_sql(const DbArrayStatement *shape, int rows);
 bool db_bind_int(DbStatement *stmt, int index, int value);
 bool db_bind_long(DbStatement *stmt, int index, long value);
+bool db_bind_null(DbStatement *stmt, int index);
 int db_get_insert_id(DbStatement *stmt) ;
 bool db_fetch_row(DbResultSet *result_set, bool is_loop);
 bool db_get_int(DbResultSet *result_set, int column_index, int *result);
@@ -0,0 +1,19 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/**
+ * Epoch based reclamation for lock-free readers.
+ *
+ * Readers wrap every access to shared pointers in epoch_enter()/epoch_exit()
+ * (calls may nest). A writer unpublishes an object, calls epoch_synchronize()
+ * and may free it afterwards: synchronize returns once every reader that
+ * could still see the old object has left its critical section.
+ *
+ * Never call epoch_synchronize() between epoch_enter() and epoch_exit()
+ * on the same thread.
+ */
+void epoch_enter();
+void epoch_exit();
+void epoch_synchronize();
+
+#endif
@@ -11,6 +11,7 @@ typedef struct Group {
     char name[50];
     char password[256];
     long created_at;
+    int creator_id;
     User* created_by;
     int member_count;
 } Group;
@@ -0,0 +1,37 @@
+#ifndef GROUP_CACHE_H
+#define GROUP_CACHE_H
+
+#include <stdbool.h>
+#include "clock_cache.h"
+
+#define GROUP_CACHE_DEFAULT_CAPACITY 1024
+// Bằng Group.name
+#define GROUP_CACHE_NAME_SIZE 50
+
+typedef struct
+{
+    int id;
+    char name[GROUP_CACHE_NAME_SIZE];
+    long created_at;
+    int creator_id;
+    int member_count;
+} GroupCacheEntry;
+
+/**
+ * Read-through lookup of a group's metadata (never the password), kept in a
+ * CLOCK cache of group_cache.capacity entries. member_count is read from
+ * the membership index on every call, so joins and leaves never make a
+ * cached entry stale.
+ * @return false if the group does not exist or the query failed
+ */
+bool group_cache_get(int group_id, GroupCacheEntry *out);
+
+/**
+ * Seed the cache with a group that was just created
+ */
+void group_cache_put(const GroupCacheEntry *entry);
+void group_cache_invalidate(int group_id);
+
+ClockCacheStats group_cache_get_stats();
+
+#endif
@@ -14,6 +14,7 @@ typedef struct {
 } TimeoutData;
 
 void utils_set_timeout(TimeoutCallback callback, void* data, int milliseconds);
+long long utils_now_ms();
 
 bool is_port_available(int port);
 int utils_next_int(int max);
@@ -0,0 +1,47 @@
+#ifndef MEMBERSHIP_INDEX_H
+#define MEMBERSHIP_INDEX_H
+
+#include <stdbool.h>
+
+#define MEMBERSHIP_INDEX_BUCKETS 1024
+
+/**
+ * In-memory group membership in both directions (group -> members,
+ * user -> groups). A group or user is loaded from group_members the first
+ * time it is asked about; after that, add/remove/drop keep it in sync
+ * (call them only after the DB write succeeded). A load that overlaps a
+ * write is returned to the caller but not kept, so the index never holds a
+ * list older than the last write. A group without members is not kept
+ * either, so unknown group ids cannot grow the index. Concurrent misses on
+ * one key wait for a single load.
+ */
+
+/**
+ * @return false if the user is not a member or the load failed
+ */
+bool membership_index_contains(int group_id, int user_id);
+
+/**
+ * @return malloc'd copy of the group's member ids, NULL on error
+ */
+int *membership_index_members(int group_id, int *out_count);
+
+/**
+ * @return number of members, -1 if the load failed
+ */
+int membership_index_count(int group_id);
+
+/**
+ * @return malloc'd copy of the ids of the groups the user belongs to, NULL on error
+ */
+int *membership_index_groups(int user_id, int *out_count);
+
+void membership_index_add(int group_id, int user_id);
+void membership_index_remove(int group_id, int user_id);
+
+/**
+ * Forget a deleted group, on both sides of the index
+ */
+void membership_index_drop_group(int group_id);
+
+#endif
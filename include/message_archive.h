@@ -0,0 +1,66 @@
+#ifndef MESSAGE_ARCHIVE_H
+#define MESSAGE_ARCHIVE_H
+
+#include <stdbool.h>
+#include "db_message.h"
+
+#define MESSAGE_ARCHIVE_DEFAULT_PATH "archive"
+#define MESSAGE_ARCHIVE_DEFAULT_AGE_DAYS 90
+#define MESSAGE_ARCHIVE_DEFAULT_INTERVAL_MS (60 * 60 * 1000)
+#define MESSAGE_ARCHIVE_DEFAULT_SEGMENT_ROWS 100000
+// Số dòng mỗi lần đọc hoặc xóa ở bảng messages
+#define MESSAGE_ARCHIVE_FETCH_ROWS 1000
+// Kích thước chưa nén tối đa của một block
+#define MESSAGE_ARCHIVE_BLOCK_BYTES (64 * 1024)
+#define MESSAGE_ARCHIVE_COMPRESSION_LEVEL 6
+
+/**
+ * Cold tier of the messages table. With archive.enabled a background job
+ * runs every archive.interval_ms, moves messages older than
+ * archive.age_days into immutable zlib-compressed segment files under
+ * archive.path, then deletes them from the table. A segment holds up to
+ * archive.segment_rows messages in blocks of one conversation each, with
+ * a directory sorted by conversation and id that records every block's
+ * id and time range.
+ *
+ * Segments already on disk are loaded and readable even while tiering is
+ * off. Not available with message_log.enabled, which has no hot table.
+ */
+bool message_archive_start();
+void message_archive_stop();
+
+/**
+ * Archived messages of a conversation in id order
+ */
+bool message_archive_read(long long conversation_id, MessageData **out, int *count);
+
+/**
+ * message_archive_read one message at a time, same contract as
+ * StorageBackend.conversation_messages_each
+ */
+bool message_archive_each(long long conversation_id, MessageRowFn each, void *arg);
+
+/**
+ * While pinned, tiering does not delete archived messages from storage, so
+ * a reader that goes through the archive and then the table in several
+ * steps sees every message in one of them. Tiering waits for every pin to
+ * be released; keep them short.
+ */
+void message_archive_pin();
+void message_archive_unpin();
+
+/**
+ * Same contract as StorageBackend.messages_after over the archive. Every
+ * archived id is lower than the ids still in storage, so a reader that
+ * tails messages by id reads here first and goes on in storage once this
+ * returns nothing.
+ */
+bool message_archive_after(long long after_id, int limit, MessageSearchResult **out, int *count);
+
+/**
+ * Archived messages with these ids, in no particular order; ids that are
+ * not archived are skipped
+ */
+bool message_archive_by_ids(const long long *ids, int id_count, MessageSearchResult **out, int *count);
+
+#endif
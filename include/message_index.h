@@ -0,0 +1,53 @@
+#ifndef MESSAGE_INDEX_H
+#define MESSAGE_INDEX_H
+
+#include <stdbool.h>
+
+#define MESSAGE_INDEX_DEFAULT_PATH "search_index"
+#define MESSAGE_INDEX_DEFAULT_SEGMENT_DOCS 100000
+#define MESSAGE_INDEX_DEFAULT_POLL_MS 1000
+// Số tin đọc từ database mỗi lần bắt kịp
+#define MESSAGE_INDEX_FETCH_ROWS 1000
+// Token dài hơn bị cắt, ngắn hơn MIN bị bỏ qua
+#define MESSAGE_INDEX_MIN_TOKEN 2
+#define MESSAGE_INDEX_MAX_TOKEN 32
+#define MESSAGE_INDEX_MAX_TERMS 8
+#define MESSAGE_INDEX_MAX_RESULTS 100
+
+typedef struct
+{
+    long long message_id;
+    long long conversation_id;
+} MessageIndexHit;
+
+/**
+ * Full-text index over message content. A background thread tails the
+ * messages table by id, archived messages first, (woken by message_index_notify after every write
+ * and every index.poll_ms otherwise) and adds rows to an in-memory
+ * segment. Once index.segment_docs messages are in it, the segment is
+ * written under index.path as an immutable file (sorted term dictionary,
+ * delta-varint posting lists) and mmap'd. On start the segments are
+ * loaded and tailing resumes after the newest one, so only the unflushed
+ * tail is re-read from storage.
+ */
+bool message_index_start();
+
+/**
+ * Stop the indexer and write what is in memory as a segment
+ */
+void message_index_stop();
+
+/**
+ * New rows were written to messages, index them soon
+ */
+void message_index_notify();
+
+/**
+ * Messages containing every word of query (case-insensitive ASCII, other
+ * bytes kept as is) in a conversation the user belongs to: private chats
+ * the user is part of and the user's current groups. Newest first.
+ * @return malloc'd hits, NULL if none or the index is not running
+ */
+MessageIndexHit *message_index_search(int user_id, const char *query, int limit, int *out_count);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef MESSAGE_LOG_H
+#define MESSAGE_LOG_H
+
+#include <stdbool.h>
+#include "storage.h"
+
+#define MESSAGE_LOG_DEFAULT_PATH "messages"
+#define MESSAGE_LOG_DEFAULT_SEGMENT_BYTES (1024 * 1024)
+#define MESSAGE_LOG_DEFAULT_INDEX_INTERVAL 64
+#define MESSAGE_LOG_DEFAULT_COMPACT_MS 60000
+#define MESSAGE_LOG_DEFAULT_COMPACT_SEGMENTS 4
+// Segment sau khi gộp không lớn hơn chừng này lần segment_bytes
+#define MESSAGE_LOG_COMPACT_FACTOR 16
+// Lúc tìm wal_id đã ghi, dừng sau chừng này id liên tiếp cũ hơn tin đầu tiên được replay
+#define MESSAGE_LOG_DEDUPE_SLACK 1024
+#define MESSAGE_LOG_CONVERSATION_BUCKETS 4096
+
+/**
+ * Append-only message store used instead of the messages table when
+ * message_log.enabled is set; users, groups and summaries stay in the
+ * storage backend. Every conversation has its own directory of segment
+ * files under message_log.path. A batch is appended to the newest
+ * segment of each conversation it touches and fdatasync'd, and a new
+ * segment is started once it passes message_log.segment_bytes. Each
+ * segment has a sparse index with the offset of every
+ * message_log.index_interval-th record. A global id file maps message
+ * ids to conversations. Reads mmap the segments. A background thread
+ * merges runs of message_log.compact_segments closed segments.
+ */
+bool message_log_open();
+void message_log_close();
+
+/**
+ * Same contract as StorageBackend.messages_insert. Messages whose wal_id
+ * is already in the log are skipped, as the UNIQUE key does in SQL.
+ */
+int message_log_append(StoredMessage *messages, int count);
+
+/**
+ * Same contract as StorageBackend.max_wal_id
+ */
+bool message_log_max_wal_id(long long *out);
+
+/**
+ * Messages of a conversation in id order
+ */
+bool message_log_read(long long conversation_id, MessageData **out, int *count);
+/**
+ * Same contract as StorageBackend.conversation_messages_each, reading one
+ * segment at a time
+ */
+bool message_log_each(long long conversation_id, MessageRowFn each, void *arg);
+
+/**
+ * Same contracts as StorageBackend.messages_after and messages_by_ids
+ */
+bool message_log_after(long long after_id, int limit, MessageSearchResult **out, int *count);
+bool message_log_by_ids(const long long *ids, int id_count, MessageSearchResult **out, int *count);
+
+/**
+ * Delete every segment of a conversation, e.g. a deleted group
+ */
+bool message_log_drop(long long conversation_id);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef MESSAGE_STREAM_H
+#define MESSAGE_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "message.h"
+#include "session.h"
+
+// Frame được gửi khi phần đã ghi vượt quá chừng này byte
+#define MESSAGE_STREAM_FRAME_BYTES (16 * 1024)
+// Số message chờ gửi của session trước khi encoder dừng lại đợi sender
+#define MESSAGE_STREAM_MAX_PENDING 8
+#define MESSAGE_STREAM_WAIT_US 10000
+// Thời gian chờ sender tối đa trước khi session bị ngắt
+#define MESSAGE_STREAM_WAIT_MAX_MS 2000
+
+/**
+ * Writes the rows of a list response into outgoing frames as they are
+ * produced, so a response never has to be collected first.
+ *
+ * Chunked, every frame is: bool more | int rows | rows, and a frame is
+ * queued as soon as it passes MESSAGE_STREAM_FRAME_BYTES; the last one has
+ * more = false. The encoder waits while the session already has
+ * MESSAGE_STREAM_MAX_PENDING messages queued, so a slow client slows the
+ * reader down instead of growing the queue. The reader keeps its database
+ * connection while it waits, so a client that drains nothing for
+ * MESSAGE_STREAM_WAIT_MAX_MS is disconnected and the stream fails.
+ *
+ * Otherwise the response is a single frame in the old format: int rows |
+ * rows, preceded by bool rows > 0 when flagged (a flagged empty response is
+ * just bool false).
+ */
+typedef struct
+{
+    Session *session;
+    uint8_t command;
+    bool chunked;
+    bool flagged;
+    Message *frame;
+    // Vị trí của int số dòng trong frame
+    size_t count_position;
+    int frame_rows;
+    int rows;
+    bool failed;
+} MessageStream;
+
+bool message_stream_begin(MessageStream *stream, Session *session, uint8_t command, bool chunked, bool flagged);
+/**
+ * Frame to write the next row into, after queueing the current one if it is full
+ * @return NULL if the stream failed or the session went away; stop producing rows
+ */
+Message *message_stream_row(MessageStream *stream);
+/**
+ * Queue the last frame. Rows already queued stay sent if the producer failed
+ * midway, the response then just ends early.
+ */
+void message_stream_end(MessageStream *stream);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef MESSAGE_WAL_H
+#define MESSAGE_WAL_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#define MESSAGE_WAL_DEFAULT_PATH "message.wal"
+// Khi mọi bản ghi đã vào MySQL và file lớn hơn ngưỡng này thì cắt file
+#define MESSAGE_WAL_TRUNCATE_BYTES (4 * 1024 * 1024)
+
+/**
+ * Open the message WAL (wal.path) and replay every record after the last
+ * checkpoint into the persistence queue. New sequence numbers continue after
+ * both the log and the largest wal_id in storage, so they never collide
+ * with a stored row even if the WAL files were lost. Must run after
+ * storage_start and persist_queue_start, and before clients are accepted.
+ * @return false if the checkpoint exists but cannot be read
+ */
+bool message_wal_open();
+
+/**
+ * Checkpoint and close the WAL. Call after persist_queue_stop so every
+ * queued record has been applied; the file is emptied if nothing is left.
+ */
+void message_wal_close();
+
+/**
+ * Append a message and wait until it is on disk. Concurrent appends share
+ * one fdatasync (group commit).
+ * @return the record's sequence number (its wal_id), 0 if the WAL is not
+ * open, -1 if the record could not be made durable. After a failed
+ * fdatasync every later append fails too until the server is restarted.
+ */
+long long message_wal_append(int sender_id, int receiver_id, int group_id, const char *content, time_t timestamp);
+
+/**
+ * Largest sequence number replayed by message_wal_open, 0 if none. Records
+ * appended later always have larger ones, so only a message with a wal_id
+ * up to this can already be in storage.
+ */
+long long message_wal_replayed_seq();
+
+/**
+ * Called by the persistence queue after a flush with the number of
+ * records now in storage. The WAL is truncated once every record is
+ * applied or dead-lettered.
+ */
+void message_wal_applied(int applied);
+
+/**
+ * Give up on a record storage keeps rejecting: append it to
+ * <wal.path>.dead (same record format, for manual recovery) and count it
+ * as applied so the WAL can be truncated.
+ * @return false if the dead letter could not be written; the record then
+ * stays unapplied and is replayed on the next start
+ */
+bool message_wal_dead_letter(long long seq, int sender_id, int receiver_id, int group_id, const char *content,
+                             time_t timestamp);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef PERSIST_QUEUE_H
+#define PERSIST_QUEUE_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#define PERSIST_DEFAULT_FLUSH_MS 50
+#define PERSIST_DEFAULT_BATCH_SIZE 64
+#define PERSIST_DEFAULT_MAX_PENDING 10000
+// Tin có trong WAL mà storage từ chối được ghi lại chừng này lần, cách nhau flush_ms * 2^lần thử
+// (tối đa PERSIST_RETRY_MAX_MS), rồi chuyển sang dead letter của WAL
+#define PERSIST_RETRY_ATTEMPTS 10
+#define PERSIST_RETRY_MAX_MS 60000
+
+typedef struct
+{
+    // Số tin đang chờ ghi và đỉnh cao nhất từng đạt
+    int depth;
+    int max_depth;
+    long long enqueued;
+    long long written;
+    long long failed;
+    long long flushes;
+    // Thời gian một lần flush (ms), tính cả chờ connection
+    long long last_flush_ms;
+    long long max_flush_ms;
+    long long total_flush_ms;
+} PersistQueueStats;
+
+/**
+ * Start the write-behind flusher thread.
+ * Messages are written in one storage batch (multi-row INSERTs on MySQL,
+ * one transaction on SQLite) once persist.batch_size are pending or
+ * persist.flush_ms after the oldest one was queued. A WAL-logged message
+ * the backend rejects is retried with backoff and dead-lettered after
+ * PERSIST_RETRY_ATTEMPTS attempts.
+ */
+bool persist_queue_start();
+
+/**
+ * Stop the flusher after writing everything that is still queued
+ */
+void persist_queue_stop();
+
+/**
+ * Queue a message for insertion. group_id <= 0 means a private message.
+ * wal_id is the message's WAL sequence (0 if it was not logged); the row is
+ * inserted idempotently on it. When the queue is not running, or the
+ * message cannot be queued, it is written synchronously. A WAL-logged
+ * message is already durable, so if that write fails it still counts as
+ * saved (a sender asked to resend it would get a second copy once the WAL
+ * is replayed): it is dead-lettered, or left for the next start's replay
+ * if the queue is stopped.
+ * @return false if a message without a WAL record could not be written
+ */
+bool persist_queue_push(int sender_id, int receiver_id, int group_id, const char *content, time_t timestamp,
+                        long long wal_id);
+
+/**
+ * Block until every message queued before the call has been written.
+ * Used before reads and deletes that must see queued messages.
+ */
+void persist_queue_flush();
+
+PersistQueueStats persist_queue_get_stats();
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <stdbool.h>
+
+#define PRESENCE_DEFAULT_TICK_MS 200
+
+/**
+ * Start the presence ticker thread.
+ * Online/offline changes are collected between ticks and pushed to
+ * subscribers as a single PRESENCE_UPDATE message per tick.
+ */
+bool presence_start();
+
+/**
+ * Stop the ticker thread and drop all subscriptions
+ */
+void presence_stop();
+
+/**
+ * Record an online/offline transition of a user.
+ * Several transitions of the same user inside one tick are coalesced into
+ * the last state; a user that goes offline and back online before the tick
+ * fires produces no event at all.
+ */
+void presence_notify(int user_id, bool online);
+
+bool presence_subscribe(int user_id);
+void presence_unsubscribe(int user_id);
+
+#endif
@@ -4,13 +4,13 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include "user.h"
+#include "user_registry.h"
 
-#define MAX_USERS 1000
+#define MAX_IPS 1000
 
 typedef struct {
-    User *users[MAX_USERS];
-    int user_count;
-    char *ips[MAX_USERS];
+    UserRegistry users;
+    char *ips[MAX_IPS];
     int ip_count;
     pthread_rwlock_t lock_user;
     pthread_rwlock_t lock_session;
@@ -20,9 +20,17 @@ typedef struct {
 
 ServerManager *server_manager_get_instance();
 
-void server_manager_get_users(User *buffer[], int *count);
+/**
+ * Ids of the users currently online (malloc'd, caller frees)
+ */
+int *server_manager_get_online_ids(int *count);
 int server_manager_get_number_online();
 int server_manager_frequency(const char *ip);
+/**
+ * Lookups take no lock. The returned pointer stays valid only while the
+ * caller is inside epoch_enter()/epoch_exit(); remove_user waits for those
+ * sections to end before the User can be freed.
+ */
 User *server_manager_find_user_by_id(int id);
 User *server_manager_find_user_by_username(const char *username);
 void server_manager_add_user(User *user);
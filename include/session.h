@@ -4,6 +4,7 @@
 #include "controller.h"
 #include "service.h"
 #include "message.h"
+#include "session_table.h"
 #include <stdbool.h>
 
 // Forward declarations
@@ -18,6 +19,7 @@ typedef unsigned char byte;
 struct Session {
     int id;
     int socket;
+    SessionHandle handle;
     User* user;
     Controller* handler;
     Service* service;
@@ -51,6 +53,10 @@ void destroySession(Session* session);
 void session_set_handler(Session* session, Controller* handler);
 void session_set_service(Session* session, Service* service);
 void session_send_message(Session* session, Message* message);
+/**
+ * Number of messages queued for the sender thread and not sent yet
+ */
+int session_pending_messages(Session* session);
 void session_close(Session* session);
 int session_login(Session *self, Message *msg, char *errorMessage, size_t errorSize);
 bool session_register(Session *self, Message *msg, char *errorMessage, size_t errorSize);
@@ -61,6 +67,7 @@ void session_on_message(Session* session, Message* message);
 void session_process_message(Session* session, Message* message);
 Message* session_read_message(Session* session);
 void session_close_message(Session* session);
+void session_close_handle(SessionHandle handle);
 
 
 #endif
\ No newline at end of file
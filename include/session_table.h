@@ -0,0 +1,54 @@
+#ifndef SESSION_TABLE_H
+#define SESSION_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct Session Session;
+typedef struct Message Message;
+
+/**
+ * Stable reference to a session: slot index plus the slot generation at
+ * registration time. A handle goes stale as soon as the session is detached,
+ * and a reused slot never matches an old handle, so handles can be kept by
+ * timers, fan-out and async completions without holding any lock.
+ */
+typedef struct {
+    uint32_t index;
+    uint32_t generation;
+} SessionHandle;
+
+#define SESSION_HANDLE_INVALID ((SessionHandle){0, 0})
+#define SESSION_TABLE_PAGE_SIZE 256
+#define SESSION_TABLE_MAX_PAGES 1024
+
+/**
+ * Register a session and return its handle
+ * (SESSION_HANDLE_INVALID when the table is full)
+ */
+SessionHandle session_table_register(Session *session);
+
+/**
+ * Pin the session behind a handle. Returns NULL if the handle is stale.
+ * Every successful acquire must be paired with session_table_release().
+ */
+Session *session_table_acquire(SessionHandle handle);
+void session_table_release(SessionHandle handle);
+
+/**
+ * Invalidate the handle and wait until nobody holds the session pinned.
+ * Exactly one caller wins for a given handle and gets the session back;
+ * everybody else gets NULL. The slot is recycled before returning.
+ * Must not be called while pinning the same session.
+ */
+Session *session_table_detach(SessionHandle handle);
+
+bool session_handle_is_valid(SessionHandle handle);
+
+/**
+ * Queue a message on the session behind the handle.
+ * Takes ownership of msg: it is destroyed if the handle is stale.
+ */
+bool session_table_send(SessionHandle handle, Message *msg);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SQL_CATALOG_H
+#define SQL_CATALOG_H
+
+#include "db_mapper.h"
+#include "sql_statement.h"
+
+/*
+ * Output columns of the SELECT queries in sql_statement.h and the struct
+ * fields they decode into. Keep the column lists in the same order as the
+ * SELECT so the mapper resolves every column on the first try.
+ */
+
+// User
+extern const DbRowMapper SQL_MAP_USER_BY_ID;
+extern const DbRowMapper SQL_MAP_ALL_USERS;
+extern const DbRowMapper SQL_MAP_ALL_USERS_EXCEPT;
+extern const DbRowMapper SQL_MAP_USERS_BY_USERNAME;
+extern const DbRowMapper SQL_MAP_ALL_USERNAMES;
+
+// Group
+extern const DbRowMapper SQL_MAP_GROUP;
+extern const DbRowMapper SQL_MAP_GROUP_BY_NAME;
+extern const DbRowMapper SQL_MAP_GROUPS_BY_USER;
+
+// Message
+extern const DbRowMapper SQL_MAP_CONVERSATION_MESSAGES;
+extern const DbRowMapper SQL_MAP_MESSAGES_BY_IDS;
+extern const DbRowMapper SQL_MAP_MESSAGES_AFTER;
+extern const DbRowMapper SQL_MAP_CHAT_HISTORIES_BY_USER;
+
+#endif
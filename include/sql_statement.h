@@ -1,88 +1,138 @@
 #ifndef SQL_STATEMENT_H
 #define SQL_STATEMENT_H
 
+#define SQL_START_TRANSACTION "START TRANSACTION"
+
 // 📌 User Queries
 #define SQL_REGISTER "INSERT INTO users (username, password) VALUES (?, ?)"
 #define SQL_UPDATE_USER_LOGIN "UPDATE users SET online=?, last_attendance_at=? WHERE id=? LIMIT 1"
 #define SQL_UPDATE_USER_LOGOUT "UPDATE users SET online=? WHERE id=? LIMIT 1"
-#define SQL_GET_USER_BY_ID "SELECT * FROM users WHERE id=?"
-#define SQL_GET_ALL_USERS_EXCEPT "SELECT id, username, password, online, last_attendance_at FROM users WHERE id != ?"
-#define SQL_GET_ALL_USERS "SELECT id, username, password, online, last_attendance_at FROM users"
-#define SQL_GET_ALL_USERS_BY_USERNAME "SELECT id, username FROM users WHERE username LIKE ?"
+#define SQL_GET_USER_BY_ID "SELECT id, username FROM users WHERE id=?"
+#define SQL_GET_ALL_USERS_EXCEPT "SELECT id, username, password, online, UNIX_TIMESTAMP(last_attendance_at) AS last_attendance_at FROM users WHERE id != ?"
+#define SQL_GET_ALL_USERS "SELECT id, username, password, online, UNIX_TIMESTAMP(last_attendance_at) AS last_attendance_at FROM users"
+// Chỉ dùng khi username index chưa sẵn sàng, LIMIT bằng USERNAME_SEARCH_LIMIT
+#define SQL_GET_ALL_USERS_BY_USERNAME "SELECT id, username FROM users WHERE username LIKE ? ORDER BY CHAR_LENGTH(username), username LIMIT 50"
+#define SQL_GET_ALL_USERNAMES "SELECT id, username FROM users"
 #define SQL_LOGIN "SELECT id , password FROM users WHERE username = ?"
 
 // 📌 Group Queries
 #define SQL_CREATE_GROUP "INSERT INTO `groups` (group_name, created_by, created_at, password) VALUES (?, ?, FROM_UNIXTIME(?), ?)"
 #define SQL_DELETE_GROUP_MEMBERS "DELETE FROM group_members WHERE group_id = ?"
 #define SQL_DELETE_MESSAGES      "DELETE FROM messages WHERE group_id = ?"
+#define SQL_DELETE_GROUP_SUMMARY "DELETE FROM group_summaries WHERE group_id = ?"
 #define SQL_DELETE_GROUP_ONLY    "DELETE FROM `groups` WHERE group_id = ?"
 
 
-#define SQL_GET_GROUP "SELECT * FROM `groups` WHERE group_id=?"
+#define SQL_GET_GROUP "SELECT group_id, group_name, UNIX_TIMESTAMP(created_at) AS created_at, created_by, password FROM `groups` WHERE group_id=?"
 #define SQL_GET_ALL_GROUPS "SELECT * FROM `groups` ORDER BY create_at DESC"
-#define SQL_FIND_GROUP_BY_NAME "SELECT * FROM `groups` WHERE group_name = ?"
+#define SQL_FIND_GROUP_BY_NAME "SELECT group_id, group_name, UNIX_TIMESTAMP(created_at) AS created_at, created_by, password FROM `groups` WHERE group_name = ?"
 // 📌 GroupMember Queries
 #define SQL_ADD_GROUP_MEMBER "INSERT INTO group_members (group_id, user_id, joined_at, role) VALUES (?, ?, FROM_UNIXTIME(?), ?)"
 #define SQL_REMOVE_GROUP_MEMBER "DELETE FROM group_members WHERE group_id=? AND user_id=?"
 #define SQL_GET_GROUP_MEMBERS "SELECT * FROM group_members WHERE group_id=?"
-#define SQL_GET_GROUPS_BY_USER "SELECT g.group_id, g.group_name, g.created_at, g.created_by FROM `groups` g JOIN group_members gm ON g.group_id = gm.group_id WHERE gm.user_id=? ORDER BY g.created_at DESC"
+// Tên chủ nhóm lấy luôn trong cùng câu, không tra từng user sau đó
+#define SQL_GET_GROUPS_BY_USER \
+"SELECT g.group_id, g.group_name, UNIX_TIMESTAMP(g.created_at) AS created_at, g.created_by, u.username AS creator_name " \
+"FROM `groups` g " \
+"JOIN group_members gm ON g.group_id = gm.group_id " \
+"LEFT JOIN users u ON u.id = g.created_by " \
+"WHERE gm.user_id=? ORDER BY g.created_at DESC"
 #define SQL_UPDATE_MEMBER_ROLE "UPDATE group_members SET role=? WHERE group_id=? AND user_id=?"
-#define SQL_CHECK_MEMBER_EXISTENCE "SELECT COUNT(*) FROM group_members WHERE group_id = ? AND user_id = ?"
+#define SQL_GET_GROUP_MEMBER_IDS "SELECT user_id FROM group_members WHERE group_id = ?"
+#define SQL_GET_USER_GROUP_IDS "SELECT group_id FROM group_members WHERE user_id = ?"
 
 // 📌 Message Queries
+// Đọc từ hai bảng tóm tắt: mỗi hội thoại một dòng, không quét messages
 #define SQL_GET_CHAT_HISTORIES_BY_USER \
 "SELECT " \
-"  sub.chat_id, " \
-"  UNIX_TIMESTAMP(m.timestamp) AS last_time, " \
-"  SUBSTRING_INDEX(m.message_content, '\n', 1) AS last_message, " \
-"  m.sender_id, " \
-"  u.username AS sender_name " \
-"FROM ( " \
-"  SELECT " \
-"    CASE " \
-"      WHEN group_id IS NOT NULL THEN -group_id " \
-"      WHEN sender_id = ? THEN receiver_id " \
-"      ELSE sender_id " \
-"    END AS chat_id, " \
-"    MAX(timestamp) AS last_time " \
-"  FROM messages " \
-"  WHERE sender_id = ? " \
-"     OR receiver_id = ? " \
-"     OR group_id IN (SELECT group_id FROM group_members WHERE user_id = ?) " \
-"  GROUP BY chat_id " \
-") sub " \
-"JOIN messages m ON ( " \
-"  (CASE " \
-"    WHEN m.group_id IS NOT NULL THEN -m.group_id " \
-"    WHEN m.sender_id = ? THEN m.receiver_id " \
-"    ELSE m.sender_id " \
-"  END = sub.chat_id AND m.timestamp = sub.last_time) " \
-") " \
-"LEFT JOIN users u ON u.id = m.sender_id " \
-"ORDER BY sub.last_time DESC"
-#define SQL_GET_MESSAGES_WITH_USER \
-"SELECT m.sender_id, u.username AS sender_name, m.message_content, UNIX_TIMESTAMP(m.timestamp) AS timestamp " \
+"  d.peer_id AS chat_id, " \
+"  UNIX_TIMESTAMP(d.last_time) AS last_time, " \
+"  d.last_message, " \
+"  u.username AS sender_name, " \
+"  CASE WHEN d.peer_id = d.user_id THEN '' ELSE COALESCE(p.username, 'Unknown User') END AS chat_with " \
+"FROM dm_summaries d " \
+"LEFT JOIN users u ON u.id = d.sender_id " \
+"LEFT JOIN users p ON p.id = d.peer_id " \
+"WHERE d.user_id = ? " \
+"UNION ALL " \
+"SELECT " \
+"  -s.group_id AS chat_id, " \
+"  UNIX_TIMESTAMP(s.last_time) AS last_time, " \
+"  s.last_message, " \
+"  u.username AS sender_name, " \
+"  g.group_name AS chat_with " \
+"FROM group_members gm " \
+"JOIN group_summaries s ON s.group_id = gm.group_id " \
+"JOIN `groups` g ON g.group_id = s.group_id " \
+"LEFT JOIN users u ON u.id = s.sender_id " \
+"WHERE gm.user_id = ? " \
+"ORDER BY last_time DESC"
+// Tin riêng và tin nhóm cùng đọc theo conversation_id, đi thẳng vào index (conversation_id, id)
+#define SQL_GET_CONVERSATION_MESSAGES \
+"SELECT m.id, m.sender_id, u.username AS sender_name, m.message_content, UNIX_TIMESTAMP(m.timestamp) AS timestamp " \
 "FROM messages m " \
 "JOIN users u ON m.sender_id = u.id " \
-"WHERE ((m.sender_id = ? AND m.receiver_id = ?) OR (m.sender_id = ? AND m.receiver_id = ?)) " \
-"AND m.group_id IS NULL " \
-"ORDER BY m.timestamp ASC"
+"WHERE m.conversation_id = ? " \
+"ORDER BY m.id ASC"
 
-#define SQL_GET_MESSAGES_WITH_GROUP \
-"SELECT m.sender_id, u.username AS sender_name, m.message_content, UNIX_TIMESTAMP(m.timestamp) AS timestamp " \
-"FROM messages m " \
-"JOIN users u ON m.sender_id = u.id " \
-"WHERE m.group_id = ? " \
-"ORDER BY m.timestamp ASC"
+// Ghi nhiều tin một lần: prefix, lặp ROW nối bằng ", ", rồi suffix.
+// wal_id là UNIQUE nên replay WAL ghi lại cùng một tin không tạo bản sao
+#define SQL_INSERT_MESSAGE_BATCH_PREFIX \
+"INSERT INTO messages (sender_id, receiver_id, group_id, conversation_id, message_content, timestamp, wal_id) VALUES "
+#define SQL_INSERT_MESSAGE_BATCH_ROW "(?, ?, ?, ?, ?, FROM_UNIXTIME(?), ?)"
+#define SQL_INSERT_MESSAGE_BATCH_SUFFIX " ON DUPLICATE KEY UPDATE wal_id = wal_id"
+#define SQL_INSERT_MESSAGE_BATCH_PARAMS 7
+
+// wal_id là UNIQUE nên MAX chỉ đọc đầu index
+#define SQL_GET_MAX_WAL_ID "SELECT COALESCE(MAX(wal_id), 0) AS wal_id FROM messages"
+
+// Tóm tắt hội thoại: chỉ ghi đè khi tin mới không cũ hơn tin đang giữ.
+// last_time phải gán sau cùng vì các IF phía trước đọc giá trị cũ của nó
+#define SQL_SUMMARY_UPSERT_SUFFIX \
+" ON DUPLICATE KEY UPDATE " \
+"sender_id = IF(VALUES(last_time) >= last_time, VALUES(sender_id), sender_id), " \
+"last_message = IF(VALUES(last_time) >= last_time, VALUES(last_message), last_message), " \
+"last_time = GREATEST(last_time, VALUES(last_time))"
+#define SQL_UPSERT_DM_SUMMARY_PREFIX \
+"INSERT INTO dm_summaries (user_id, peer_id, sender_id, last_message, last_time) VALUES "
+#define SQL_UPSERT_DM_SUMMARY_ROW "(?, ?, ?, ?, FROM_UNIXTIME(?))"
+#define SQL_UPSERT_DM_SUMMARY_PARAMS 5
+#define SQL_UPSERT_GROUP_SUMMARY_PREFIX \
+"INSERT INTO group_summaries (group_id, sender_id, last_message, last_time) VALUES "
+#define SQL_UPSERT_GROUP_SUMMARY_ROW "(?, ?, ?, FROM_UNIXTIME(?))"
+#define SQL_UPSERT_GROUP_SUMMARY_PARAMS 4
 
-// Gửi tin nhắn riêng
-#define SQL_INSERT_PRIVATE_MESSAGE \
-"INSERT INTO messages (sender_id, receiver_id, message_content, timestamp) " \
-"VALUES (?, ?, ?, ?)"
+// 📌 Migration: conversation_id cho các tin cũ
+// Cùng công thức với message_conversation_id(): -group_id, hoặc id nhỏ << 32 | id lớn
+#define SQL_CONVERSATION_ID_EXPR \
+"IF(group_id IS NOT NULL, -group_id, (LEAST(sender_id, receiver_id) << 32) | GREATEST(sender_id, receiver_id))"
+#define SQL_HAS_CONVERSATION_COLUMN \
+"SELECT COUNT(*) AS found FROM information_schema.COLUMNS " \
+"WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = 'messages' AND COLUMN_NAME = 'conversation_id'"
+#define SQL_ADD_CONVERSATION_COLUMN \
+"ALTER TABLE messages ADD COLUMN conversation_id BIGINT DEFAULT NULL, " \
+"ADD INDEX idx_messages_conversation (conversation_id, id), ALGORITHM=INPLACE, LOCK=NONE"
+#define SQL_GET_MESSAGE_ID_RANGE "SELECT COALESCE(MIN(id), 0) AS min_id, COALESCE(MAX(id), 0) AS max_id FROM messages"
+#define SQL_BACKFILL_CONVERSATION_RANGE \
+"UPDATE messages SET conversation_id = " SQL_CONVERSATION_ID_EXPR " " \
+"WHERE id BETWEEN ? AND ? AND conversation_id IS NULL"
+// 📌 Full-text index: đọc tiếp các tin sau tin cuối cùng đã index
+#define SQL_INDEX_MESSAGES_AFTER \
+"SELECT id, COALESCE(conversation_id, " SQL_CONVERSATION_ID_EXPR ") AS conversation_id, sender_id, " \
+"message_content, UNIX_TIMESTAMP(timestamp) AS timestamp FROM messages WHERE id > ? ORDER BY id LIMIT ?"
+// Nội dung các tin tìm được, thêm "?, " cho từng id rồi đóng bằng SQL_GET_MESSAGES_BY_IDS_SUFFIX
+#define SQL_GET_MESSAGES_BY_IDS_PREFIX \
+"SELECT m.id, COALESCE(m.conversation_id, " SQL_CONVERSATION_ID_EXPR ") AS conversation_id, m.sender_id, " \
+"u.username AS sender_name, m.message_content, UNIX_TIMESTAMP(m.timestamp) AS timestamp " \
+"FROM messages m JOIN users u ON m.sender_id = u.id WHERE m.id IN ("
+#define SQL_GET_MESSAGES_BY_IDS_SUFFIX ") ORDER BY m.id DESC"
+// Xóa các tin đã chuyển sang archive, ghép "?, " như trên
+#define SQL_DELETE_MESSAGES_BY_IDS_PREFIX "DELETE FROM messages WHERE id IN ("
+#define SQL_DELETE_MESSAGES_BY_IDS_SUFFIX ")"
 
-// Gửi tin nhắn nhóm
-#define SQL_INSERT_GROUP_MESSAGE \
-"INSERT INTO messages (sender_id, group_id, message_content, timestamp) " \
-"VALUES (?, ?, ?, ?)"
+// Dòng server cũ ghi vào trong lúc backfill, tìm qua index nên không quét bảng
+#define SQL_BACKFILL_CONVERSATION_REST \
+"UPDATE messages SET conversation_id = " SQL_CONVERSATION_ID_EXPR " " \
+"WHERE conversation_id IS NULL LIMIT ?"
 
 #endif // SQL_STATEMENT_H
@@ -0,0 +1,171 @@
+#ifndef SQL_STATEMENT_SQLITE_H
+#define SQL_STATEMENT_SQLITE_H
+
+/*
+ * SQLite versions of the queries in sql_statement.h. Column names match the
+ * MySQL ones so the mappers in sql_catalog.h decode both. Times are stored
+ * as unix seconds, so there is no FROM_UNIXTIME / UNIX_TIMESTAMP.
+ */
+
+// 📌 Schema
+// AUTOINCREMENT trên messages: id không bao giờ được dùng lại, message index đọc tiếp theo id
+#define SQLITE_CREATE_SCHEMA \
+"CREATE TABLE IF NOT EXISTS users (" \
+"  id INTEGER PRIMARY KEY AUTOINCREMENT," \
+"  username TEXT NOT NULL UNIQUE," \
+"  password TEXT NOT NULL," \
+"  online INTEGER DEFAULT 0," \
+"  last_attendance_at INTEGER);" \
+"CREATE TABLE IF NOT EXISTS \"groups\" (" \
+"  group_id INTEGER PRIMARY KEY AUTOINCREMENT," \
+"  group_name TEXT NOT NULL," \
+"  created_by INTEGER NOT NULL REFERENCES users(id)," \
+"  created_at INTEGER NOT NULL," \
+"  password TEXT);" \
+"CREATE TABLE IF NOT EXISTS group_members (" \
+"  id INTEGER PRIMARY KEY AUTOINCREMENT," \
+"  group_id INTEGER NOT NULL REFERENCES \"groups\"(group_id)," \
+"  user_id INTEGER NOT NULL REFERENCES users(id)," \
+"  joined_at INTEGER NOT NULL," \
+"  role TEXT);" \
+"CREATE TABLE IF NOT EXISTS messages (" \
+"  id INTEGER PRIMARY KEY AUTOINCREMENT," \
+"  sender_id INTEGER NOT NULL REFERENCES users(id)," \
+"  receiver_id INTEGER REFERENCES users(id)," \
+"  group_id INTEGER REFERENCES \"groups\"(group_id)," \
+"  conversation_id INTEGER NOT NULL," \
+"  message_content TEXT NOT NULL," \
+"  timestamp INTEGER NOT NULL," \
+"  wal_id INTEGER UNIQUE);" \
+"CREATE TABLE IF NOT EXISTS dm_summaries (" \
+"  user_id INTEGER NOT NULL REFERENCES users(id)," \
+"  peer_id INTEGER NOT NULL REFERENCES users(id)," \
+"  sender_id INTEGER NOT NULL REFERENCES users(id)," \
+"  last_message TEXT NOT NULL," \
+"  last_time INTEGER NOT NULL," \
+"  PRIMARY KEY (user_id, peer_id)) WITHOUT ROWID;" \
+"CREATE TABLE IF NOT EXISTS group_summaries (" \
+"  group_id INTEGER PRIMARY KEY REFERENCES \"groups\"(group_id)," \
+"  sender_id INTEGER NOT NULL REFERENCES users(id)," \
+"  last_message TEXT NOT NULL," \
+"  last_time INTEGER NOT NULL);" \
+"CREATE INDEX IF NOT EXISTS idx_group_members_user ON group_members(user_id);" \
+"CREATE INDEX IF NOT EXISTS idx_group_members_group ON group_members(group_id);" \
+"CREATE INDEX IF NOT EXISTS idx_messages_group ON messages(group_id);" \
+"CREATE INDEX IF NOT EXISTS idx_messages_conversation ON messages(conversation_id, id);"
+
+// WAL: reader không chặn writer, synchronous=NORMAL chỉ fsync lúc checkpoint
+#define SQLITE_PRAGMAS \
+"PRAGMA journal_mode = WAL;" \
+"PRAGMA synchronous = NORMAL;" \
+"PRAGMA foreign_keys = ON;" \
+"PRAGMA temp_store = MEMORY;" \
+"PRAGMA cache_size = -65536;" \
+"PRAGMA mmap_size = 268435456;"
+
+#define SQLITE_BEGIN_TRANSACTION "BEGIN IMMEDIATE"
+#define SQLITE_COMMIT_TRANSACTION "COMMIT"
+#define SQLITE_ROLLBACK_TRANSACTION "ROLLBACK"
+
+// 📌 User Queries
+#define SQLITE_LOGIN "SELECT id, password FROM users WHERE username = ?"
+#define SQLITE_REGISTER "INSERT INTO users (username, password) VALUES (?, ?)"
+#define SQLITE_GET_USER_BY_ID "SELECT id, username FROM users WHERE id = ?"
+#define SQLITE_GET_ALL_USERS "SELECT id, username, password, online, last_attendance_at FROM users"
+#define SQLITE_GET_ALL_USERS_EXCEPT SQLITE_GET_ALL_USERS " WHERE id != ?"
+#define SQLITE_GET_USERS_BY_USERNAME \
+"SELECT id, username FROM users WHERE username LIKE ? ORDER BY LENGTH(username), username LIMIT ?"
+#define SQLITE_GET_ALL_USERNAMES "SELECT id, username FROM users"
+// Đọc danh sách theo trang để không giữ connection chung trong lúc caller xử lý từng dòng
+#define SQLITE_GET_USERS_PAGE SQLITE_GET_ALL_USERS " WHERE id > ? ORDER BY id LIMIT ?"
+
+// 📌 Group Queries
+#define SQLITE_CREATE_GROUP "INSERT INTO \"groups\" (group_name, created_by, created_at, password) VALUES (?, ?, ?, ?)"
+#define SQLITE_DELETE_GROUP_MEMBERS "DELETE FROM group_members WHERE group_id = ?"
+#define SQLITE_DELETE_MESSAGES "DELETE FROM messages WHERE group_id = ?"
+#define SQLITE_DELETE_GROUP_SUMMARY "DELETE FROM group_summaries WHERE group_id = ?"
+#define SQLITE_DELETE_GROUP_ONLY "DELETE FROM \"groups\" WHERE group_id = ?"
+#define SQLITE_GET_GROUP \
+"SELECT group_id, group_name, created_at, created_by, password FROM \"groups\" WHERE group_id = ?"
+#define SQLITE_FIND_GROUP_BY_NAME \
+"SELECT group_id, group_name, created_at, created_by, password FROM \"groups\" WHERE group_name = ?"
+
+// 📌 GroupMember Queries
+#define SQLITE_ADD_GROUP_MEMBER "INSERT INTO group_members (group_id, user_id, joined_at, role) VALUES (?, ?, ?, ?)"
+#define SQLITE_REMOVE_GROUP_MEMBER "DELETE FROM group_members WHERE group_id = ? AND user_id = ?"
+#define SQLITE_GET_GROUP_MEMBER_IDS "SELECT user_id FROM group_members WHERE group_id = ?"
+#define SQLITE_GET_USER_GROUP_IDS "SELECT group_id FROM group_members WHERE user_id = ?"
+#define SQLITE_GET_GROUPS_BY_USER \
+"SELECT g.group_id, g.group_name, g.created_at, g.created_by, u.username AS creator_name " \
+"FROM \"groups\" g " \
+"JOIN group_members gm ON g.group_id = gm.group_id " \
+"LEFT JOIN users u ON u.id = g.created_by " \
+"WHERE gm.user_id = ? ORDER BY g.created_at DESC"
+
+// 📌 Message Queries
+#define SQLITE_GET_CHAT_HISTORIES_BY_USER \
+"SELECT " \
+"  d.peer_id AS chat_id, " \
+"  d.last_time, " \
+"  d.last_message, " \
+"  u.username AS sender_name, " \
+"  CASE WHEN d.peer_id = d.user_id THEN '' ELSE COALESCE(p.username, 'Unknown User') END AS chat_with " \
+"FROM dm_summaries d " \
+"LEFT JOIN users u ON u.id = d.sender_id " \
+"LEFT JOIN users p ON p.id = d.peer_id " \
+"WHERE d.user_id = ? " \
+"UNION ALL " \
+"SELECT " \
+"  -s.group_id AS chat_id, " \
+"  s.last_time, " \
+"  s.last_message, " \
+"  u.username AS sender_name, " \
+"  g.group_name AS chat_with " \
+"FROM group_members gm " \
+"JOIN group_summaries s ON s.group_id = gm.group_id " \
+"JOIN \"groups\" g ON g.group_id = s.group_id " \
+"LEFT JOIN users u ON u.id = s.sender_id " \
+"WHERE gm.user_id = ? " \
+"ORDER BY last_time DESC"
+#define SQLITE_GET_CONVERSATION_MESSAGES \
+"SELECT m.id, m.sender_id, u.username AS sender_name, m.message_content, m.timestamp " \
+"FROM messages m " \
+"JOIN users u ON m.sender_id = u.id " \
+"WHERE m.conversation_id = ? " \
+"ORDER BY m.id ASC"
+#define SQLITE_GET_CONVERSATION_MESSAGES_PAGE \
+"SELECT m.id, m.sender_id, u.username AS sender_name, m.message_content, m.timestamp " \
+"FROM messages m " \
+"JOIN users u ON m.sender_id = u.id " \
+"WHERE m.conversation_id = ? AND m.id > ? " \
+"ORDER BY m.id ASC LIMIT ?"
+
+// Mỗi tin một lần step trong cùng transaction, không cần câu nhiều dòng như MySQL
+#define SQLITE_INSERT_MESSAGE \
+"INSERT INTO messages (sender_id, receiver_id, group_id, conversation_id, message_content, timestamp, wal_id) " \
+"VALUES (?, ?, ?, ?, ?, ?, ?) ON CONFLICT(wal_id) DO NOTHING"
+
+#define SQLITE_GET_MAX_WAL_ID "SELECT COALESCE(MAX(wal_id), 0) AS wal_id FROM messages"
+
+// Vế SET đọc giá trị cũ của cả dòng nên thứ tự các cột không quan trọng như ở MySQL
+#define SQLITE_SUMMARY_UPSERT_SET \
+"sender_id = CASE WHEN excluded.last_time >= last_time THEN excluded.sender_id ELSE sender_id END, " \
+"last_message = CASE WHEN excluded.last_time >= last_time THEN excluded.last_message ELSE last_message END, " \
+"last_time = MAX(last_time, excluded.last_time)"
+#define SQLITE_UPSERT_DM_SUMMARY \
+"INSERT INTO dm_summaries (user_id, peer_id, sender_id, last_message, last_time) VALUES (?, ?, ?, ?, ?) " \
+"ON CONFLICT(user_id, peer_id) DO UPDATE SET " SQLITE_SUMMARY_UPSERT_SET
+#define SQLITE_UPSERT_GROUP_SUMMARY \
+"INSERT INTO group_summaries (group_id, sender_id, last_message, last_time) VALUES (?, ?, ?, ?) " \
+"ON CONFLICT(group_id) DO UPDATE SET " SQLITE_SUMMARY_UPSERT_SET
+
+// 📌 Full-text index
+#define SQLITE_INDEX_MESSAGES_AFTER \
+"SELECT id, conversation_id, sender_id, message_content, timestamp FROM messages WHERE id > ? ORDER BY id LIMIT ?"
+// Tra từng id trên khóa chính: không có round trip nên không cần ghép câu IN
+#define SQLITE_GET_MESSAGE_BY_ID \
+"SELECT m.id, m.conversation_id, m.sender_id, u.username AS sender_name, m.message_content, m.timestamp " \
+"FROM messages m JOIN users u ON m.sender_id = u.id WHERE m.id = ?"
+#define SQLITE_DELETE_MESSAGE_BY_ID "DELETE FROM messages WHERE id = ?"
+
+#endif // SQL_STATEMENT_SQLITE_H
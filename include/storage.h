@@ -0,0 +1,144 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include "user.h"
+#include "group.h"
+#include "db_message.h"
+#include "conversation_summary.h"
+#include "db_mapper.h"
+
+#define STORAGE_DEFAULT_BACKEND "mysql"
+#define STORAGE_DEFAULT_SQLITE_PATH "chat.db"
+#define STORAGE_SQLITE_BUSY_TIMEOUT_MS 5000
+// Đủ cho mọi câu cố định của backend SQLite
+#define STORAGE_SQLITE_STATEMENT_CACHE_SIZE 48
+// Số dòng mỗi trang của users_each và conversation_messages_each trên SQLite
+#define STORAGE_SQLITE_PAGE_ROWS 256
+
+typedef enum
+{
+    STORAGE_MYSQL,
+    STORAGE_SQLITE
+} StorageKind;
+
+// Một tin chờ ghi vào messages
+typedef struct
+{
+    int sender_id;
+    int receiver_id;
+    // <= 0 nghĩa là tin riêng
+    int group_id;
+    char *content;
+    time_t timestamp;
+    // Sequence trong WAL, 0 nếu tin không được log; dòng trùng wal_id bị bỏ qua
+    long long wal_id;
+    // Backend đánh dấu các tin không ghi được
+    bool failed;
+} StoredMessage;
+
+/**
+ * Persistence of users, groups, group members and messages. The model
+ * layer keeps its caches and indexes and reaches the database only
+ * through these calls, so a backend only has to provide them.
+ *
+ * List calls return false on a storage error. An empty result is
+ * true with *out NULL and *count 0. Arrays are malloc'd and strings
+ * inside them strdup'd; the caller frees both.
+ */
+typedef struct
+{
+    const char *name;
+    StorageKind kind;
+    bool (*start)();
+    void (*stop)();
+
+    // Users
+    /** @return user id, 0 if there is no such user, -1 on error. password gets the stored password */
+    int (*user_lookup)(const char *username, char *password, size_t password_size);
+    /** @return new user id, 0 on failure */
+    int (*user_insert)(const char *username, const char *password);
+    /** @return false if the user does not exist or on error */
+    bool (*user_name)(int id, char *username, size_t username_size);
+    /** Every user with all User columns, except_id <= 0 keeps everyone */
+    bool (*users_list)(int except_id, User **out, int *count);
+    /**
+     * users_list(0) one row at a time as it is read. The strings are only
+     * valid during the call. Stopping early is not an error.
+     */
+    bool (*users_each)(UserRowFn each, void *arg);
+    /** Usernames matching a LIKE pattern, shortest first */
+    bool (*users_search)(const char *pattern, int limit, User **out, int *count);
+    /** id and username of every user */
+    bool (*usernames)(User **out, int *count);
+
+    // Groups
+    /** Insert name, creator_id, created_at and password of group. @return group id, 0 on failure */
+    int (*group_insert)(const Group *group);
+    /** Delete the group with its members, messages and summary */
+    bool (*group_delete)(int group_id);
+    /** @return false if the group does not exist or on error */
+    bool (*group_get)(int group_id, Group *out);
+    /** Groups with this name, password included */
+    bool (*groups_by_name)(const char *name, Group **out, int *count);
+    /** Groups the user belongs to, newest first; created_by is a calloc'd User or NULL */
+    bool (*groups_by_user)(int user_id, Group ***out, int *count);
+
+    // Members
+    bool (*member_insert)(int group_id, int user_id, time_t joined_at);
+    bool (*member_delete)(int group_id, int user_id);
+    bool (*group_member_ids)(int group_id, int **out, int *count);
+    bool (*user_group_ids)(int user_id, int **out, int *count);
+
+    // Messages
+    /** Write a batch in order. @return number of messages that failed, each marked failed */
+    int (*messages_insert)(StoredMessage *messages, int count);
+    /** Largest wal_id stored, 0 if there is none */
+    bool (*max_wal_id)(long long *out);
+    /** Upsert summary rows; an older last_time never replaces a newer one */
+    bool (*dm_summaries_upsert)(const SummaryRow *rows, int count);
+    bool (*group_summaries_upsert)(const SummaryRow *rows, int count);
+    bool (*conversation_messages)(long long conversation_id, MessageData **out, int *count);
+    /** conversation_messages one row at a time, same contract as users_each */
+    bool (*conversation_messages_each)(long long conversation_id, MessageRowFn each, void *arg);
+    bool (*chat_histories)(int user_id, ChatHistory **out, int *count);
+    /** Up to limit messages with id > after_id in id order; sender_name is not set */
+    bool (*messages_after)(long long after_id, int limit, MessageSearchResult **out, int *count);
+    /** Messages with these ids, newest first; ids that no longer exist are skipped */
+    bool (*messages_by_ids)(const long long *ids, int id_count, MessageSearchResult **out, int *count);
+    /** Delete the messages with these ids; ids that no longer exist are skipped */
+    bool (*messages_delete)(const long long *ids, int id_count);
+} StorageBackend;
+
+extern const StorageBackend MYSQL_STORAGE;
+#ifdef HAVE_SQLITE3
+extern const StorageBackend SQLITE_STORAGE;
+#endif
+
+/**
+ * Pick the backend named by storage.backend ("mysql" or "sqlite") and start it
+ */
+bool storage_start();
+void storage_stop();
+
+/**
+ * The running backend, MySQL until storage_start picked another one. With
+ * message_log.enabled its message calls are served by the message log.
+ */
+const StorageBackend *storage();
+
+/* Shared by backends whose queries produce a DbResult. Both take ownership of result. */
+
+/**
+ * Decode result with mapper, false if result is NULL or cannot be decoded
+ */
+bool storage_map_rows(const DbRowMapper *mapper, DbResult *result, void **out, int *count);
+
+/**
+ * Decode the rows of a groups-by-user query (SQL_MAP_GROUPS_BY_USER columns plus creator_name)
+ */
+bool storage_map_groups(DbResult *result, Group ***out, int *count);
+
+#endif
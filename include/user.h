@@ -6,6 +6,9 @@
 #include "service.h"
 #include <stddef.h>
 
+// users.password là VARCHAR(255)
+#define USER_PASSWORD_SIZE 256
+
 typedef struct User User;
 typedef struct Session Session;
 typedef struct Service Service;
@@ -37,11 +40,28 @@ void destroyUser(User *user);
 void user_set_session(User *user, Session *session);
 void user_set_service(User *user, Service *service);
 void close_session_callback(void *arg);
+/**
+ * Look a user up through the user cache. Only id and username are filled;
+ * the caller frees the result with destroyUser().
+ */
 User *findUserById(int id);
 
 User* get_all_users_except(User* current_user, int* count);
 User* get_all_users(int* count);
 
+/**
+ * Called once per row of a streamed list; the strings inside are only
+ * valid during the call. Return false to stop.
+ */
+typedef bool (*UserRowFn)(const User* user, void* arg);
+
+/**
+ * Every user, one row at a time as storage reads it, without
+ * building the array get_all_users returns
+ * @return false on a storage error
+ */
+bool for_each_user(UserRowFn each, void* arg);
+
 User* search_user(char *username, int *count);
 
 #endif
@@ -0,0 +1,38 @@
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <stdbool.h>
+#include "clock_cache.h"
+
+#define USER_CACHE_DEFAULT_CAPACITY 4096
+// users.username là VARCHAR(100)
+#define USER_CACHE_NAME_SIZE 101
+
+typedef struct
+{
+    int id;
+    char username[USER_CACHE_NAME_SIZE];
+} UserCacheEntry;
+
+/**
+ * Read-through lookup of a user's immutable fields. A miss loads the row
+ * (id and username only, never the password) and keeps it in a CLOCK cache
+ * of user_cache.capacity entries.
+ * @return false if the user does not exist or the query failed
+ */
+bool user_cache_get(int id, UserCacheEntry *out);
+
+/**
+ * Seed the cache with a row the caller already has, e.g. after login
+ */
+void user_cache_put(int id, const char *username);
+
+/**
+ * Drop the cached row after the user changed. A load that raced with the
+ * invalidation is not stored.
+ */
+void user_cache_invalidate(int id);
+
+ClockCacheStats user_cache_get_stats();
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef USER_REGISTRY_H
+#define USER_REGISTRY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "user.h"
+
+#define USER_REGISTRY_INITIAL_CAPACITY 1024
+
+typedef struct {
+    size_t capacity;
+    _Atomic(User *) *by_id;
+    _Atomic(User *) *by_name;
+} UserRegistryTable;
+
+/**
+ * Online user registry: two open-addressing (linear probing) tables
+ * holding the same User pointers, one keyed by id and one by username.
+ * Both tables share one power-of-two capacity and grow without a limit.
+ *
+ * Writers (insert/remove) must be serialized by the caller, ServerManager
+ * uses lock_user for that. Readers take no lock: they run inside
+ * epoch_enter()/epoch_exit() and see either the old or the new slot value.
+ * Tables replaced by a resize are freed after epoch_synchronize().
+ */
+typedef struct {
+    _Atomic(UserRegistryTable *) table;
+    atomic_size_t count;
+    size_t tombstones;
+} UserRegistry;
+
+bool user_registry_init(UserRegistry *registry, size_t initial_capacity);
+void user_registry_destroy(UserRegistry *registry);
+
+bool user_registry_insert(UserRegistry *registry, User *user);
+User *user_registry_remove(UserRegistry *registry, int id);
+
+User *user_registry_find_by_id(UserRegistry *registry, int id);
+User *user_registry_find_by_username(UserRegistry *registry, const char *username);
+
+size_t user_registry_count(UserRegistry *registry);
+
+/**
+ * Copy the ids of up to max_count online users into buffer
+ * @return number of ids copied
+ */
+size_t user_registry_snapshot_ids(UserRegistry *registry, int *buffer, size_t max_count);
+
+#endif
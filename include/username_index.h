@@ -0,0 +1,38 @@
+#ifndef USERNAME_INDEX_H
+#define USERNAME_INDEX_H
+
+#include <stdbool.h>
+#include "user.h"
+
+#define USERNAME_INDEX_BUCKETS 4096
+// Số kết quả tối đa của một lần tìm, bằng LIMIT trong SQL_GET_ALL_USERS_BY_USERNAME
+#define USERNAME_SEARCH_LIMIT 50
+
+/**
+ * In-memory trigram index over every username, for SEARCH_USERS.
+ * Matching is a case-insensitive (ASCII) substring match like the LIKE
+ * query it replaces. Queries of three bytes or more only look at the users
+ * sharing the query's rarest trigram; shorter ones scan the in-memory
+ * names. Results are ranked exact match, then prefix, then substring,
+ * shorter names first.
+ */
+
+/**
+ * Load every username. Called once at startup; until it succeeds
+ * search_user falls back to MySQL.
+ */
+bool username_index_build();
+bool username_index_ready();
+
+/**
+ * Add a user that was just registered
+ */
+void username_index_add(int id, const char *username);
+
+/**
+ * @return calloc'd array of at most limit users with id and username set
+ *         (free each username, then the array), NULL if nothing matched
+ */
+User *username_index_search(const char *query, int limit, int *out_count);
+
+#endif
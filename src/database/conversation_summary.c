@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "conversation_summary.h"
+#include "storage.h"
+#include "log.h"
+
+typedef struct
+{
+    // 0: tin riêng, 1: tin nhóm
+    int kind;
+    // Tin riêng: cặp id nhỏ/lớn để hai chiều của một hội thoại trùng khóa
+    int a;
+    int b;
+    time_t timestamp;
+    int index;
+} SummaryRef;
+
+// Dòng đầu của tin, cắt ở ranh giới ký tự UTF-8 cho vừa cột VARCHAR
+static void make_preview(const char *content, char *out)
+{
+    size_t length = strcspn(content, "\n");
+    if (length > SUMMARY_PREVIEW_SIZE - 1)
+    {
+        length = SUMMARY_PREVIEW_SIZE - 1;
+        while (length > 0 && ((unsigned char)content[length] & 0xC0) == 0x80)
+        {
+            length--;
+        }
+    }
+    memcpy(out, content, length);
+    out[length] = '\0';
+}
+
+static int compare_refs(const void *x, const void *y)
+{
+    const SummaryRef *a = x, *b = y;
+    if (a->kind != b->kind)
+        return a->kind - b->kind;
+    if (a->a != b->a)
+        return (a->a > b->a) - (a->a < b->a);
+    if (a->b != b->b)
+        return (a->b > b->b) - (a->b < b->b);
+    if (a->timestamp != b->timestamp)
+        return (a->timestamp > b->timestamp) - (a->timestamp < b->timestamp);
+    return a->index - b->index;
+}
+
+void conversation_summary_apply(const SummaryMessage *messages, int count)
+{
+    if (!messages || count <= 0)
+    {
+        return;
+    }
+
+    SummaryRef *refs = malloc(sizeof(SummaryRef) * count);
+    // Mỗi hội thoại riêng cần hai dòng, mỗi nhóm một dòng
+    SummaryRow *dm_rows = malloc(sizeof(SummaryRow) * 2 * count);
+    SummaryRow *group_rows = malloc(sizeof(SummaryRow) * count);
+    if (!refs || !dm_rows || !group_rows)
+    {
+        log_message(ERROR, "Memory allocation failed for conversation summaries");
+        free(refs);
+        free(dm_rows);
+        free(group_rows);
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const SummaryMessage *message = &messages[i];
+        SummaryRef *ref = &refs[i];
+        ref->kind = message->group_id > 0 ? 1 : 0;
+        ref->a = ref->kind ? message->group_id
+                           : (message->sender_id < message->receiver_id ? message->sender_id : message->receiver_id);
+        ref->b = ref->kind ? 0
+                           : (message->sender_id < message->receiver_id ? message->receiver_id : message->sender_id);
+        ref->timestamp = message->timestamp;
+        ref->index = i;
+    }
+    // Sau khi sắp xếp, phần tử cuối của mỗi khóa là tin mới nhất của hội thoại
+    qsort(refs, count, sizeof(SummaryRef), compare_refs);
+
+    int dm_count = 0;
+    int group_count = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (i + 1 < count && refs[i + 1].kind == refs[i].kind && refs[i + 1].a == refs[i].a && refs[i + 1].b == refs[i].b)
+        {
+            continue;
+        }
+
+        const SummaryMessage *message = &messages[refs[i].index];
+        SummaryRow row;
+        row.sender_id = message->sender_id;
+        row.timestamp = message->timestamp;
+        make_preview(message->content ? message->content : "", row.preview);
+        if (refs[i].kind)
+        {
+            row.key = message->group_id;
+            row.peer_id = 0;
+            group_rows[group_count++] = row;
+        }
+        else
+        {
+            row.key = refs[i].a;
+            row.peer_id = refs[i].b;
+            dm_rows[dm_count++] = row;
+            // Chat với chính mình chỉ có một dòng
+            if (refs[i].a != refs[i].b)
+            {
+                row.key = refs[i].b;
+                row.peer_id = refs[i].a;
+                dm_rows[dm_count++] = row;
+            }
+        }
+    }
+
+    if (dm_count > 0 && !storage()->dm_summaries_upsert(dm_rows, dm_count))
+    {
+        log_message(WARN, "Failed to update %d private conversation summaries", dm_count);
+    }
+    if (group_count > 0 && !storage()->group_summaries_upsert(group_rows, group_count))
+    {
+        log_message(WARN, "Failed to update %d group conversation summaries", group_count);
+    }
+
+    free(refs);
+    free(dm_rows);
+    free(group_rows);
+}
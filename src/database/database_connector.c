@@ -3,12 +3,20 @@
 #include <string.h>
 #include <stdarg.h>
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
 #include <pthread.h>
+#include <errno.h>
+#include <time.h>
 #include "database_connector.h"
+#include "db_statement.h"
+#include "db_result.h"
 #include "config.h"
+#include "m_utils.h"
 #include "log.h"
 
 static DbManager *instance = NULL;
+// Số câu lệnh thread này đã gửi tới MySQL
+static __thread unsigned long thread_queries = 0;
 
 static MYSQL *create_connection()
 {
@@ -48,6 +56,12 @@ static MYSQL *create_connection()
 
     return conn;
 }
+
+static int config_or_default(int value, int fallback)
+{
+    return value > 0 ? value : fallback;
+}
+
 DbManager *db_manager_get_instance()
 {
     if (instance == NULL)
@@ -59,6 +73,14 @@ DbManager *db_manager_get_instance()
             return NULL;
         }
         pthread_mutex_init(&instance->mutex, NULL);
+
+        // Dùng CLOCK_MONOTONIC cho timedwait để không bị ảnh hưởng khi đổi giờ hệ thống
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&instance->available, &attr);
+        pthread_condattr_destroy(&attr);
+
         instance->initialized = false;
     }
     return instance;
@@ -94,10 +116,37 @@ bool db_manager_start()
     manager->password = strdup(config_get_db_password());
     manager->database = strdup(config_get_db_name());
     manager->port = config_get_db_port();
-    manager->active_connections = 0;
 
-    MYSQL *conn = create_connection();
-    if (conn == NULL)
+    manager->max_size = config_or_default(config_get_db_pool_max(), DB_POOL_DEFAULT_MAX);
+    if (manager->max_size > DB_POOL_MAX_CONNECTIONS)
+    {
+        log_message(WARN, "db.pool.max=%d exceeds the limit, using %d", manager->max_size, DB_POOL_MAX_CONNECTIONS);
+        manager->max_size = DB_POOL_MAX_CONNECTIONS;
+    }
+    manager->min_size = config_or_default(config_get_db_pool_min(), DB_POOL_DEFAULT_MIN);
+    if (manager->min_size > manager->max_size)
+    {
+        manager->min_size = manager->max_size;
+    }
+    manager->wait_ms = config_or_default(config_get_db_pool_wait_ms(), DB_POOL_DEFAULT_WAIT_MS);
+    manager->idle_check_ms = config_or_default(config_get_db_pool_idle_check_ms(), DB_POOL_DEFAULT_IDLE_CHECK_MS);
+    manager->size = 0;
+    memset(&manager->stats, 0, sizeof(manager->stats));
+
+    for (int i = 0; i < manager->min_size; i++)
+    {
+        MYSQL *conn = create_connection();
+        if (conn == NULL)
+        {
+            break;
+        }
+        manager->connections[i].mysql = conn;
+        manager->connections[i].in_use = false;
+        manager->connections[i].last_used_ms = utils_now_ms();
+        manager->size++;
+    }
+
+    if (manager->size == 0)
     {
         log_message(ERROR, "Failed to create test connection");
 
@@ -110,10 +159,10 @@ bool db_manager_start()
         return false;
     }
 
-    manager->connections[manager->active_connections++] = conn;
     manager->initialized = true;
 
-    log_message(INFO, "Database connection established successfully");
+    log_message(INFO, "Database pool started with %d connections (min=%d, max=%d)",
+                manager->size, manager->min_size, manager->max_size);
     pthread_mutex_unlock(&manager->mutex);
     return true;
 }
@@ -129,13 +178,28 @@ void db_manager_shutdown()
 
     if (instance->initialized)
     {
+        instance->initialized = false;
 
-        for (int i = 0; i < instance->active_connections; i++)
+        // Chờ các connection đang được dùng trả về trước khi đóng
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += instance->wait_ms / 1000 + 1;
+        while (instance->stats.active > 0)
         {
-            if (instance->connections[i])
+            if (pthread_cond_timedwait(&instance->available, &instance->mutex, &deadline) != 0)
             {
-                mysql_close(instance->connections[i]);
-                instance->connections[i] = NULL;
+                log_message(WARN, "Closing database pool with %d connections still checked out", instance->stats.active);
+                break;
+            }
+        }
+
+        for (int i = 0; i < DB_POOL_MAX_CONNECTIONS; i++)
+        {
+            if (instance->connections[i].mysql && !instance->connections[i].in_use)
+            {
+                db_statement_cache_clear(&instance->connections[i]);
+                mysql_close(instance->connections[i].mysql);
+                instance->connections[i].mysql = NULL;
             }
         }
 
@@ -144,16 +208,74 @@ void db_manager_shutdown()
         free(instance->password);
         free(instance->database);
 
-        instance->active_connections = 0;
-        instance->initialized = false;
+        instance->size = 0;
+        pthread_cond_broadcast(&instance->available);
 
-        log_message(INFO, "Database manager shut down");
+        log_message(INFO, "Database manager shut down (checkouts=%lu, waits=%lu, timeouts=%lu, reconnects=%lu, statement hits=%lu, misses=%lu)",
+                    instance->stats.checkouts, instance->stats.waits, instance->stats.timeouts, instance->stats.reconnects,
+                    instance->stats.statement_hits, instance->stats.statement_misses);
     }
 
     pthread_mutex_unlock(&instance->mutex);
 }
 
-MYSQL *db_manager_get_connection()
+static DbConnection *find_idle(DbManager *manager)
+{
+    for (int i = 0; i < DB_POOL_MAX_CONNECTIONS; i++)
+    {
+        DbConnection *conn = &manager->connections[i];
+        if (conn->mysql != NULL && !conn->in_use)
+        {
+            return conn;
+        }
+    }
+    return NULL;
+}
+
+static DbConnection *find_empty(DbManager *manager)
+{
+    for (int i = 0; i < DB_POOL_MAX_CONNECTIONS; i++)
+    {
+        DbConnection *conn = &manager->connections[i];
+        if (conn->mysql == NULL && !conn->in_use)
+        {
+            return conn;
+        }
+    }
+    return NULL;
+}
+
+// Gọi khi đang giữ connection độc quyền, không giữ mutex
+static bool ensure_alive(DbManager *manager, DbConnection *conn)
+{
+    if (utils_now_ms() - conn->last_used_ms < manager->idle_check_ms)
+    {
+        return true;
+    }
+
+    if (mysql_ping(conn->mysql) == 0)
+    {
+        return true;
+    }
+
+    log_message(WARN, "Idle database connection lost (%s), reconnecting", mysql_error(conn->mysql));
+    // Statement đã prepare gắn với session cũ trên server, phải prepare lại
+    db_statement_cache_clear(conn);
+    mysql_close(conn->mysql);
+    conn->mysql = create_connection();
+
+    pthread_mutex_lock(&manager->mutex);
+    manager->stats.reconnects++;
+    if (conn->mysql == NULL)
+    {
+        manager->size--;
+    }
+    pthread_mutex_unlock(&manager->mutex);
+
+    return conn->mysql != NULL;
+}
+
+DbConnection *db_manager_get_connection()
 {
     DbManager *manager = db_manager_get_instance();
     if (manager == NULL || !manager->initialized)
@@ -162,242 +284,250 @@ MYSQL *db_manager_get_connection()
         return NULL;
     }
 
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += manager->wait_ms / 1000;
+    deadline.tv_nsec += (long)(manager->wait_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
     pthread_mutex_lock(&manager->mutex);
 
-    MYSQL *conn = NULL;
+    DbConnection *conn = NULL;
+    bool create = false;
+    bool waited = false;
 
-    if (manager->active_connections > 0)
+    while (manager->initialized)
     {
+        conn = find_idle(manager);
+        if (conn != NULL)
+        {
+            break;
+        }
 
-        conn = manager->connections[0];
-
-        if (mysql_ping(conn) != 0)
+        if (manager->size < manager->max_size && (conn = find_empty(manager)) != NULL)
         {
+            // Giữ chỗ slot, tạo connection bên ngoài mutex
+            manager->size++;
+            create = true;
+            break;
+        }
 
-            mysql_close(conn);
-            conn = create_connection();
-            if (conn != NULL)
-            {
-                manager->connections[0] = conn;
-            }
-            else
-            {
+        if (!waited)
+        {
+            manager->stats.waits++;
+            waited = true;
+        }
 
-                manager->active_connections--;
-            }
+        if (pthread_cond_timedwait(&manager->available, &manager->mutex, &deadline) == ETIMEDOUT)
+        {
+            manager->stats.timeouts++;
+            log_message(ERROR, "Timed out after %d ms waiting for a database connection (%d/%d in use)",
+                        manager->wait_ms, manager->stats.active, manager->size);
+            pthread_mutex_unlock(&manager->mutex);
+            return NULL;
         }
     }
-    else
+
+    if (conn == NULL)
     {
+        pthread_mutex_unlock(&manager->mutex);
+        return NULL;
+    }
+
+    conn->in_use = true;
+    manager->stats.active++;
+    manager->stats.checkouts++;
+    pthread_mutex_unlock(&manager->mutex);
 
-        conn = create_connection();
-        if (conn != NULL && manager->active_connections < 10)
+    if (create)
+    {
+        conn->mysql = create_connection();
+        conn->last_used_ms = utils_now_ms();
+        if (conn->mysql == NULL)
         {
-            manager->connections[manager->active_connections++] = conn;
+            pthread_mutex_lock(&manager->mutex);
+            conn->in_use = false;
+            manager->size--;
+            manager->stats.active--;
+            pthread_cond_signal(&manager->available);
+            pthread_mutex_unlock(&manager->mutex);
+            return NULL;
         }
+        return conn;
+    }
+
+    if (!ensure_alive(manager, conn))
+    {
+        pthread_mutex_lock(&manager->mutex);
+        conn->in_use = false;
+        manager->stats.active--;
+        pthread_cond_signal(&manager->available);
+        pthread_mutex_unlock(&manager->mutex);
+        return NULL;
     }
 
-    pthread_mutex_unlock(&manager->mutex);
     return conn;
 }
 
-void db_manager_release_connection(MYSQL *conn)
+void db_manager_release_connection(DbConnection *conn)
 {
-    if (conn == NULL) {
+    if (conn == NULL)
+    {
         return;
     }
-    
+
     DbManager *manager = db_manager_get_instance();
-    if (manager == NULL) {
-        mysql_close(conn);
+    if (manager == NULL)
+    {
         return;
     }
-    
-    if (mysql_ping(conn) != 0) {
-        for (int i = 0; i < manager->active_connections; i++) {
-            if (manager->connections[i] == conn) {
-                mysql_close(conn);
-                
-                for (int j = i; j < manager->active_connections - 1; j++) {
-                    manager->connections[j] = manager->connections[j+1];
-                }
-                
-                manager->active_connections--;
-                break;
-            }
+
+    // Connection bị rớt trong lúc dùng: bỏ đi, lần checkout sau sẽ mở connection mới
+    bool broken = false;
+    if (conn->mysql != NULL)
+    {
+        unsigned int error = mysql_errno(conn->mysql);
+        broken = error == CR_SERVER_GONE_ERROR || error == CR_SERVER_LOST;
+    }
+    if (broken || (conn->mysql != NULL && !manager->initialized))
+    {
+        db_statement_cache_clear(conn);
+        mysql_close(conn->mysql);
+        conn->mysql = NULL;
+    }
+
+    pthread_mutex_lock(&manager->mutex);
+    if (conn->mysql == NULL && manager->initialized)
+    {
+        manager->size--;
+        if (broken)
+        {
+            manager->stats.reconnects++;
         }
     }
+    manager->stats.statement_hits += conn->statement_hits;
+    manager->stats.statement_misses += conn->statement_misses;
+    conn->statement_hits = 0;
+    conn->statement_misses = 0;
+    conn->in_use = false;
+    conn->last_used_ms = utils_now_ms();
+    manager->stats.active--;
+    pthread_cond_signal(&manager->available);
+    pthread_mutex_unlock(&manager->mutex);
+}
+
+DbPoolStats db_manager_get_stats()
+{
+    DbPoolStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    DbManager *manager = db_manager_get_instance();
+    if (manager == NULL)
+    {
+        return stats;
+    }
+
+    pthread_mutex_lock(&manager->mutex);
+    stats = manager->stats;
+    stats.size = manager->size;
+    stats.idle = manager->size - manager->stats.active;
+    pthread_mutex_unlock(&manager->mutex);
+    return stats;
+}
+
+void db_manager_count_query()
+{
+    thread_queries++;
+}
+
+unsigned long db_manager_thread_queries()
+{
+    return thread_queries;
 }
 
 int db_manager_update(const char *sql, ...)
 {
-    MYSQL *conn = db_manager_get_connection();
+    DbConnection *conn = db_manager_get_connection();
     if (conn == NULL)
     {
         log_message(ERROR, "Failed to get database connection");
         return -1;
     }
 
-    if (mysql_query(conn, sql) != 0)
+    db_manager_count_query();
+    if (mysql_query(conn->mysql, sql) != 0)
     {
-        log_message(ERROR, "Query failed: %s", mysql_error(conn));
+        log_message(ERROR, "Query failed: %s", mysql_error(conn->mysql));
+        db_manager_release_connection(conn);
         return -1;
     }
 
-    int affected_rows = mysql_affected_rows(conn);
+    int affected_rows = mysql_affected_rows(conn->mysql);
+    db_manager_release_connection(conn);
     return affected_rows;
 }
 
-DbResultSet *create_result_set(MYSQL_RES *mysql_result)
+int db_manager_update_with_params(const char *sql, int param_count, ...)
 {
-    if (mysql_result == NULL)
+    DbStatement *stmt = db_prepare(sql);
+    if (stmt == NULL)
     {
-        return NULL;
-    }
-
-    my_ulonglong num_rows = mysql_num_rows(mysql_result);
-    unsigned int num_fields = mysql_num_fields(mysql_result);
-
-    DbResultSet *result_set = calloc(1, sizeof(DbResultSet));
-    if (result_set == NULL)
-    {
-        mysql_free_result(mysql_result);
-        return NULL;
+        return -1;
     }
 
-    result_set->capacity = num_rows;
-    result_set->row_count = 0;
-    result_set->rows = calloc(num_rows, sizeof(DbResultRow *));
-    if (result_set->rows == NULL)
+    va_list args;
+    va_start(args, param_count);
+    bool ok = true;
+    for (int i = 0; i < param_count && ok; i++)
     {
-        free(result_set);
-        mysql_free_result(mysql_result);
-        return NULL;
+        DbParam param = va_arg(args, DbParam);
+        ok = db_bind_param(stmt, i, &param);
     }
+    va_end(args);
 
-    MYSQL_FIELD *fields = mysql_fetch_fields(mysql_result);
-
-    MYSQL_ROW row;
-    while ((row = mysql_fetch_row(mysql_result)))
-    {
-
-        DbResultRow *result_row = calloc(1, sizeof(DbResultRow));
-        if (result_row == NULL)
-            continue;
-
-        result_row->field_count = num_fields;
-        result_row->fields = calloc(num_fields, sizeof(DbResultField *));
-        if (result_row->fields == NULL)
-        {
-            free(result_row);
-            continue;
-        }
-
-        for (unsigned int i = 0; i < num_fields; i++)
-        {
-            if (row[i] != NULL)
-            {
-
-                DbResultField *field = calloc(1, sizeof(DbResultField));
-                if (field == NULL)
-                    continue;
-
-                field->key = strdup(fields[i].name);
-                field->type = fields[i].type;
-
-                switch (field->type)
-                {
-                case MYSQL_TYPE_LONGLONG:
-                {
-                    long long *val = malloc(sizeof(long long));
-                    if (val)
-                    {
-                        *val = strtoll(row[i], NULL, 10);
-                        field->value = val;
-                    }
-                    break;
-                }
-                case MYSQL_TYPE_FLOAT:
-                {
-                    float *val = malloc(sizeof(float));
-                    if (val)
-                    {
-                        *val = strtof(row[i], NULL);
-                        field->value = val;
-                    }
-                    break;
-                }
-                case MYSQL_TYPE_STRING:
-                case MYSQL_TYPE_VAR_STRING:
-                    field->value = strdup(row[i]);
-                    break;
-                case MYSQL_TYPE_LONG:
-                {
-                    int *val = malloc(sizeof(int));
-                    if (val)
-                    {
-                        *val = atoi(row[i]);
-                        field->value = val;
-                    }
-                    break;
-                }
-                case MYSQL_TYPE_TINY:
-                {
-                    int *val = malloc(sizeof(int));
-                    if (val)
-                    {
-                        *val = (atoi(row[i]) != 0);
-                        field->value = val;
-                    }
-                    break;
-                }
-                default:
-                    field->value = strdup(row[i]);
-                    break;
-                }
-
-                result_row->fields[i] = field;
-            }
-        }
-
-        result_set->rows[result_set->row_count++] = result_row;
-    }
+    int affected_rows = ok && db_execute(stmt) ? (int)mysql_stmt_affected_rows(stmt->stmt) : -1;
+    db_statement_free(stmt);
+    return affected_rows;
+}
 
-    mysql_free_result(mysql_result);
-    return result_set;
+DbResultSet *create_result_set(MYSQL_RES *mysql_result)
+{
+    return db_result_to_result_set(db_result_from_mysql(mysql_result));
 }
 
 DbResultSet *db_manager_query(const char *sql)
 {
-    MYSQL *conn = db_manager_get_connection();
+    DbConnection *conn = db_manager_get_connection();
     if (conn == NULL)
     {
         log_message(ERROR, "Failed to get database connection");
         return NULL;
     }
 
-    if (mysql_query(conn, sql) != 0)
+    db_manager_count_query();
+    if (mysql_query(conn->mysql, sql) != 0)
     {
-        log_message(ERROR, "Query failed: %s", mysql_error(conn));
+        log_message(ERROR, "Query failed: %s", mysql_error(conn->mysql));
+        db_manager_release_connection(conn);
         return NULL;
     }
 
-    MYSQL_RES *result = mysql_store_result(conn);
+    MYSQL_RES *result = mysql_store_result(conn->mysql);
     if (result == NULL)
     {
-        if (mysql_field_count(conn) == 0)
-        {
-
-            return NULL;
-        }
-        else
+        if (mysql_field_count(conn->mysql) != 0)
         {
-
-            log_message(ERROR, "Failed to store result: %s", mysql_error(conn));
-            return NULL;
+            log_message(ERROR, "Failed to store result: %s", mysql_error(conn->mysql));
         }
+        db_manager_release_connection(conn);
+        return NULL;
     }
 
+    db_manager_release_connection(conn);
     return create_result_set(result);
 }
 
@@ -0,0 +1,587 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <mysql/mysql.h>
+#include "db_async.h"
+#include "log.h"
+
+#if defined(MYSQL_VERSION_ID) && MYSQL_VERSION_ID >= 80016 && !defined(MARIADB_BASE_VERSION)
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "db_executor.h"
+#include "config.h"
+#include "m_utils.h"
+
+#define DB_ASYNC_CONNECT_TIMEOUT_MS 5000
+// Query chưa xong sau chừng này thì bị hủy cùng connection, để key của session và db_async_stop không chờ mãi
+#define DB_ASYNC_QUERY_TIMEOUT_MS 10000
+#define DB_ASYNC_RETRY_MS 1000
+#define DB_ASYNC_MAX_EVENTS 64
+
+typedef struct DbAsyncQuery
+{
+    char *sql;
+    unsigned long length;
+    DbAsyncCallback callback;
+    void *arg;
+    uint64_t key;
+    struct DbAsyncQuery *next;
+} DbAsyncQuery;
+
+typedef enum
+{
+    DB_ASYNC_BROKEN,
+    DB_ASYNC_CONNECTING,
+    DB_ASYNC_IDLE,
+    DB_ASYNC_QUERY,
+    DB_ASYNC_STORE
+} DbAsyncState;
+
+// Mọi field của connection chỉ do thread của loop đọc/ghi
+typedef struct
+{
+    MYSQL *mysql;
+    // -1 khi socket chưa được đăng ký với epoll
+    int fd;
+    DbAsyncState state;
+    DbAsyncQuery *query;
+    // Query vừa được giao, chưa gửi lần nào
+    bool query_pending;
+    // Hạn của lần connect hoặc của query đang chạy
+    long long deadline_ms;
+    long long retry_at_ms;
+    bool failure_logged;
+} DbAsyncConn;
+
+typedef struct
+{
+    DbAsyncConn *conns;
+    int conn_count;
+
+    // Queue query chờ connection rảnh, bảo vệ bởi mutex
+    DbAsyncQuery *head;
+    DbAsyncQuery *tail;
+    int queued;
+    // Số connection đã kết nối, để db_async_query từ chối sớm khi MySQL không tới được
+    int connected;
+
+    int epoll_fd;
+    int wake_fd;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    bool running;
+    bool stopping;
+} DbAsyncLoop;
+
+typedef struct
+{
+    DbAsyncCallback callback;
+    void *arg;
+    DbResult *result;
+} DbAsyncCompletion;
+
+static DbAsyncLoop loop = {
+    .head = NULL,
+    .tail = NULL,
+    .epoll_fd = -1,
+    .wake_fd = -1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .running = false,
+    .stopping = false};
+
+static void wake_loop()
+{
+    uint64_t one = 1;
+    if (write(loop.wake_fd, &one, sizeof(one)) < 0)
+    {
+        // eventfd đầy nghĩa là loop đã có tín hiệu chưa đọc, bỏ qua được
+    }
+}
+
+static void run_completion(void *arg)
+{
+    DbAsyncCompletion *completion = (DbAsyncCompletion *)arg;
+    completion->callback(completion->result, completion->arg);
+    free(completion);
+}
+
+// Callback chạy trên executor để loop không bao giờ phải chờ code của handler
+static void complete_query(DbAsyncQuery *query, DbResult *result)
+{
+    DbAsyncCompletion *completion = malloc(sizeof(DbAsyncCompletion));
+    if (completion == NULL)
+    {
+        query->callback(result, query->arg);
+        if (query->key != 0)
+        {
+            db_executor_release(query->key);
+        }
+    }
+    else
+    {
+        completion->callback = query->callback;
+        completion->arg = query->arg;
+        completion->result = result;
+        bool queued = query->key != 0 ? db_executor_resume(query->key, run_completion, completion)
+                                      : db_executor_submit(0, run_completion, completion);
+        if (!queued)
+        {
+            run_completion(completion);
+        }
+    }
+    free(query->sql);
+    free(query);
+}
+
+static void set_connected(DbAsyncConn *conn, bool connected)
+{
+    bool was_connected = conn->state >= DB_ASYNC_IDLE;
+    if (was_connected == connected)
+    {
+        return;
+    }
+    pthread_mutex_lock(&loop.mutex);
+    loop.connected += connected ? 1 : -1;
+    pthread_mutex_unlock(&loop.mutex);
+}
+
+static void watch(DbAsyncConn *conn)
+{
+    if (conn->fd >= 0 || conn->mysql->net.fd < 0)
+    {
+        return;
+    }
+    // Edge-triggered: API nonblocking chỉ trả NOT_READY sau khi socket báo EAGAIN,
+    // nên mỗi lần socket đọc/ghi được lại là đủ để gọi tiếp
+    struct epoll_event event = {.events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = conn};
+    if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, conn->mysql->net.fd, &event) != 0)
+    {
+        log_message(WARN, "Failed to watch async DB socket, falling back to polling");
+        return;
+    }
+    conn->fd = conn->mysql->net.fd;
+}
+
+static void unwatch(DbAsyncConn *conn)
+{
+    if (conn->fd >= 0)
+    {
+        epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        conn->fd = -1;
+    }
+}
+
+static void close_conn(DbAsyncConn *conn, long long retry_at_ms)
+{
+    set_connected(conn, false);
+    unwatch(conn);
+    if (conn->mysql)
+    {
+        mysql_close(conn->mysql);
+        conn->mysql = NULL;
+    }
+    conn->state = DB_ASYNC_BROKEN;
+    conn->retry_at_ms = retry_at_ms;
+}
+
+static void begin_connect(DbAsyncConn *conn)
+{
+    conn->mysql = mysql_init(NULL);
+    if (conn->mysql == NULL)
+    {
+        log_message(ERROR, "Failed to initialize async MySQL connection");
+        conn->failure_logged = true;
+        conn->retry_at_ms = utils_now_ms() + DB_ASYNC_RETRY_MS;
+        return;
+    }
+    mysql_options(conn->mysql, MYSQL_SET_CHARSET_NAME, "utf8mb4");
+    // Lưới an toàn ở tầng socket, hạn chính là deadline_ms do loop kiểm tra
+    unsigned int timeout_s = (DB_ASYNC_QUERY_TIMEOUT_MS + 999) / 1000;
+    mysql_options(conn->mysql, MYSQL_OPT_READ_TIMEOUT, &timeout_s);
+    mysql_options(conn->mysql, MYSQL_OPT_WRITE_TIMEOUT, &timeout_s);
+    conn->state = DB_ASYNC_CONNECTING;
+    conn->deadline_ms = utils_now_ms() + DB_ASYNC_CONNECT_TIMEOUT_MS;
+}
+
+static void fail_query(DbAsyncConn *conn)
+{
+    unsigned int error = mysql_errno(conn->mysql);
+    log_message(ERROR, "Async query failed: %s", mysql_error(conn->mysql));
+
+    DbAsyncQuery *query = conn->query;
+    conn->query = NULL;
+    // Sau lỗi giữa chừng không biết protocol còn đồng bộ không, mở lại cho chắc
+    // trừ khi đó là lỗi SQL bình thường do server trả về
+    if (error >= 2000 && error < 3000)
+    {
+        close_conn(conn, utils_now_ms());
+    }
+    else
+    {
+        conn->state = DB_ASYNC_IDLE;
+    }
+    complete_query(query, NULL);
+}
+
+// MySQL không trả lời kịp: không hủy được query giữa chừng trên connection này nên đóng nó
+static void expire_query(DbAsyncConn *conn)
+{
+    log_message(ERROR, "Async query timed out after %d ms", DB_ASYNC_QUERY_TIMEOUT_MS);
+    DbAsyncQuery *query = conn->query;
+    conn->query = NULL;
+    conn->query_pending = false;
+    close_conn(conn, utils_now_ms());
+    complete_query(query, NULL);
+}
+
+// Đẩy state machine của connection đi xa nhất có thể mà không block
+static void step(DbAsyncConn *conn)
+{
+    enum net_async_status status;
+
+    if (conn->state == DB_ASYNC_CONNECTING)
+    {
+        status = mysql_real_connect_nonblocking(conn->mysql,
+                                                config_get_db_host(),
+                                                config_get_db_user(),
+                                                config_get_db_password(),
+                                                config_get_db_name(),
+                                                config_get_db_port(),
+                                                NULL, 0);
+        if (status == NET_ASYNC_NOT_READY && utils_now_ms() < conn->deadline_ms)
+        {
+            watch(conn);
+            return;
+        }
+        if (status != NET_ASYNC_COMPLETE)
+        {
+            if (!conn->failure_logged)
+            {
+                log_message(ERROR, "Async DB connection failed: %s",
+                            status == NET_ASYNC_ERROR ? mysql_error(conn->mysql) : "timed out");
+                conn->failure_logged = true;
+            }
+            close_conn(conn, utils_now_ms() + DB_ASYNC_RETRY_MS);
+            return;
+        }
+        watch(conn);
+        set_connected(conn, true);
+        conn->state = DB_ASYNC_IDLE;
+        conn->failure_logged = false;
+        return;
+    }
+
+    if (conn->state == DB_ASYNC_QUERY)
+    {
+        status = mysql_real_query_nonblocking(conn->mysql, conn->query->sql, conn->query->length);
+        if (status == NET_ASYNC_NOT_READY)
+        {
+            return;
+        }
+        if (status == NET_ASYNC_ERROR)
+        {
+            fail_query(conn);
+            return;
+        }
+        conn->state = DB_ASYNC_STORE;
+    }
+
+    if (conn->state == DB_ASYNC_STORE)
+    {
+        MYSQL_RES *res = NULL;
+        status = mysql_store_result_nonblocking(conn->mysql, &res);
+        if (status == NET_ASYNC_NOT_READY)
+        {
+            return;
+        }
+        if (status == NET_ASYNC_ERROR || res == NULL)
+        {
+            fail_query(conn);
+            return;
+        }
+        DbAsyncQuery *query = conn->query;
+        conn->query = NULL;
+        conn->state = DB_ASYNC_IDLE;
+        complete_query(query, db_result_from_mysql(res));
+    }
+}
+
+static bool is_busy(const DbAsyncConn *conn)
+{
+    return conn->state == DB_ASYNC_CONNECTING || conn->state == DB_ASYNC_QUERY || conn->state == DB_ASYNC_STORE;
+}
+
+static void *loop_thread(void *arg)
+{
+    (void)arg;
+    struct epoll_event events[DB_ASYNC_MAX_EVENTS];
+
+    while (true)
+    {
+        long long now = utils_now_ms();
+        DbAsyncQuery *dropped = NULL;
+        bool stopping;
+
+        pthread_mutex_lock(&loop.mutex);
+        stopping = loop.stopping;
+        bool any_busy = false;
+        bool any_usable = false;
+        for (int i = 0; i < loop.conn_count; i++)
+        {
+            DbAsyncConn *conn = &loop.conns[i];
+            if (conn->state == DB_ASYNC_IDLE && loop.head)
+            {
+                conn->query = loop.head;
+                loop.head = loop.head->next;
+                if (!loop.head)
+                {
+                    loop.tail = NULL;
+                }
+                loop.queued--;
+                conn->state = DB_ASYNC_QUERY;
+                conn->query_pending = true;
+                conn->deadline_ms = now + DB_ASYNC_QUERY_TIMEOUT_MS;
+            }
+            any_busy = any_busy || is_busy(conn);
+            // Connection rớt giữa query vẫn được mở lại khi đang dừng,
+            // chỉ bỏ cuộc khi chính lần connect cũng lỗi
+            any_usable = any_usable || conn->state != DB_ASYNC_BROKEN || !conn->failure_logged;
+        }
+        if (stopping && !any_usable)
+        {
+            // Không còn connection nào để chạy nốt phần còn lại
+            dropped = loop.head;
+            loop.head = loop.tail = NULL;
+            loop.queued = 0;
+        }
+        bool done = stopping && !any_busy && loop.head == NULL;
+        pthread_mutex_unlock(&loop.mutex);
+
+        while (dropped)
+        {
+            DbAsyncQuery *next = dropped->next;
+            complete_query(dropped, NULL);
+            dropped = next;
+        }
+        if (done)
+        {
+            break;
+        }
+
+        for (int i = 0; i < loop.conn_count; i++)
+        {
+            DbAsyncConn *conn = &loop.conns[i];
+            if (conn->state == DB_ASYNC_BROKEN && now >= conn->retry_at_ms && !(stopping && conn->failure_logged))
+            {
+                begin_connect(conn);
+            }
+            // Kiểm tra ở mọi vòng, không chỉ khi epoll_wait hết giờ: connection khác có thể báo liên tục
+            if (is_busy(conn) && now >= conn->deadline_ms)
+            {
+                if (conn->state == DB_ASYNC_CONNECTING)
+                {
+                    // step thấy đã quá hạn thì đóng connection
+                    step(conn);
+                }
+                else
+                {
+                    expire_query(conn);
+                }
+                continue;
+            }
+            // Query mới cần lần gọi đầu tiên để gửi đi; connection chưa có socket
+            // trong epoll thì chỉ tiến được bằng cách gọi lại mỗi vòng
+            if (conn->query_pending || (is_busy(conn) && conn->fd < 0))
+            {
+                conn->query_pending = false;
+                step(conn);
+            }
+        }
+
+        int count = epoll_wait(loop.epoll_fd, events, DB_ASYNC_MAX_EVENTS, DB_ASYNC_POLL_MS);
+        if (count == 0)
+        {
+            // Lưới an toàn nếu lỡ mất một edge, và để kiểm tra timeout lúc connect
+            for (int i = 0; i < loop.conn_count; i++)
+            {
+                if (is_busy(&loop.conns[i]))
+                {
+                    step(&loop.conns[i]);
+                }
+            }
+        }
+        for (int i = 0; i < count; i++)
+        {
+            DbAsyncConn *conn = (DbAsyncConn *)events[i].data.ptr;
+            if (conn == NULL)
+            {
+                uint64_t value;
+                if (read(loop.wake_fd, &value, sizeof(value)) < 0)
+                {
+                    // Đã có thread khác đọc, không sao
+                }
+                continue;
+            }
+            if (is_busy(conn))
+            {
+                step(conn);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Gọi khi đang giữ mutex và thread của loop không chạy
+static void free_loop()
+{
+    free(loop.conns);
+    loop.conns = NULL;
+    loop.conn_count = 0;
+    if (loop.epoll_fd >= 0)
+        close(loop.epoll_fd);
+    if (loop.wake_fd >= 0)
+        close(loop.wake_fd);
+    loop.epoll_fd = loop.wake_fd = -1;
+}
+
+bool db_async_start()
+{
+    pthread_mutex_lock(&loop.mutex);
+    if (loop.running)
+    {
+        pthread_mutex_unlock(&loop.mutex);
+        return true;
+    }
+
+    int connections = config_get_db_async_connections();
+    loop.conn_count = connections > 0 ? connections : DB_ASYNC_DEFAULT_CONNECTIONS;
+    loop.conns = calloc(loop.conn_count, sizeof(DbAsyncConn));
+    loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    if (!loop.conns || loop.epoll_fd < 0 || loop.wake_fd < 0 ||
+        epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, loop.wake_fd, &event) != 0)
+    {
+        log_message(ERROR, "Failed to set up async DB loop");
+        free_loop();
+        pthread_mutex_unlock(&loop.mutex);
+        return false;
+    }
+
+    // Connection được mở dần trong loop bằng mysql_real_connect_nonblocking
+    for (int i = 0; i < loop.conn_count; i++)
+    {
+        loop.conns[i].fd = -1;
+        loop.conns[i].state = DB_ASYNC_BROKEN;
+        loop.conns[i].retry_at_ms = 0;
+    }
+    loop.connected = 0;
+    loop.stopping = false;
+    if (pthread_create(&loop.thread, NULL, loop_thread, NULL) != 0)
+    {
+        log_message(ERROR, "Failed to create async DB thread");
+        free_loop();
+        pthread_mutex_unlock(&loop.mutex);
+        return false;
+    }
+    loop.running = true;
+    log_message(INFO, "Async DB loop started (connections=%d)", loop.conn_count);
+    pthread_mutex_unlock(&loop.mutex);
+    return true;
+}
+
+void db_async_stop()
+{
+    pthread_mutex_lock(&loop.mutex);
+    if (!loop.running)
+    {
+        pthread_mutex_unlock(&loop.mutex);
+        return;
+    }
+    loop.stopping = true;
+    pthread_mutex_unlock(&loop.mutex);
+    wake_loop();
+
+    pthread_join(loop.thread, NULL);
+
+    for (int i = 0; i < loop.conn_count; i++)
+    {
+        close_conn(&loop.conns[i], 0);
+    }
+
+    pthread_mutex_lock(&loop.mutex);
+    free_loop();
+    loop.running = false;
+    pthread_mutex_unlock(&loop.mutex);
+    log_message(INFO, "Async DB loop stopped");
+}
+
+bool db_async_query(uint64_t key, const char *sql, DbAsyncCallback callback, void *arg)
+{
+    if (sql == NULL || callback == NULL)
+    {
+        return false;
+    }
+
+    DbAsyncQuery *query = calloc(1, sizeof(DbAsyncQuery));
+    char *copy = strdup(sql);
+    if (!query || !copy)
+    {
+        log_message(ERROR, "Failed to allocate async query");
+        free(query);
+        free(copy);
+        return false;
+    }
+    query->sql = copy;
+    query->length = strlen(copy);
+    query->callback = callback;
+    query->arg = arg;
+    query->key = key;
+
+    pthread_mutex_lock(&loop.mutex);
+    if (!loop.running || loop.stopping || loop.connected == 0 || loop.queued >= DB_ASYNC_QUEUE_MAX)
+    {
+        pthread_mutex_unlock(&loop.mutex);
+        free(copy);
+        free(query);
+        return false;
+    }
+    if (loop.tail)
+        loop.tail->next = query;
+    else
+        loop.head = query;
+    loop.tail = query;
+    loop.queued++;
+    pthread_mutex_unlock(&loop.mutex);
+
+    wake_loop();
+    return true;
+}
+
+#else
+
+// libmysqlclient không có API nonblocking (MariaDB Connector/C hoặc MySQL < 8.0.16):
+// db_async_query luôn trả false và caller chạy query đồng bộ như trước
+
+bool db_async_start()
+{
+    log_message(INFO, "MySQL client has no nonblocking API, async queries disabled");
+    return false;
+}
+
+void db_async_stop()
+{
+}
+
+bool db_async_query(uint64_t key, const char *sql, DbAsyncCallback callback, void *arg)
+{
+    (void)key;
+    (void)sql;
+    (void)callback;
+    (void)arg;
+    return false;
+}
+
+#endif
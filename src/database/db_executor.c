@@ -0,0 +1,582 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "db_executor.h"
+#include "config.h"
+#include "m_utils.h"
+#include "log.h"
+
+#define DB_EXECUTOR_KEY_BUCKETS 256
+
+// Nhóm task của một lần run_all, sống đến khi node cuối cùng trong queue được lấy ra
+typedef struct
+{
+    DbTask *tasks;
+    int count;
+    // Task tiếp theo chưa ai nhận; caller và các worker cùng lấy theo thứ tự
+    int next;
+    int remaining;
+    int refs;
+} DbFanout;
+
+typedef struct DbKeyState DbKeyState;
+
+typedef struct DbTaskNode
+{
+    uint64_t key;
+    DbTaskFn fn;
+    void *arg;
+    // Khác NULL: node là một worker của run_all, chạy các task chưa ai nhận của fanout
+    DbFanout *fanout;
+    // Trạng thái key của node, NULL với key 0
+    DbKeyState *state;
+    struct DbTaskNode *next;
+} DbTaskNode;
+
+/**
+ * Task chờ của một key. Mỗi lúc chỉ một task của key nằm trong ready hoặc đang chạy,
+ * các task sau chờ trong pending, nên lấy task ra không bao giờ phải duyệt qua task bị chặn.
+ * Tồn tại khi key còn task hoặc còn bị giữ.
+ */
+struct DbKeyState
+{
+    uint64_t key;
+    DbTaskNode *pending_head;
+    DbTaskNode *pending_tail;
+    // Continuation của hold, chạy trước mọi task trong pending
+    DbTaskNode *resume;
+    // Một task của key đang nằm trong ready
+    bool scheduled;
+    bool running;
+    bool held;
+    DbKeyState *next;
+};
+
+typedef struct
+{
+    // Chỉ chứa task chạy được ngay
+    DbTaskNode *head;
+    DbTaskNode *tail;
+    // Mọi task chưa chạy: ready, pending và continuation
+    int queued;
+    int queue_max;
+    int fanout_max;
+
+    DbKeyState *keys[DB_EXECUTOR_KEY_BUCKETS];
+    // Số key đang bị giữ (db_executor_hold)
+    int held_count;
+    pthread_t *threads;
+    int thread_count;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+    pthread_cond_t fanout_done;
+    // Báo cho stop khi một hold kết thúc, timedwait theo CLOCK_MONOTONIC
+    pthread_cond_t released;
+    bool running;
+    bool stopping;
+} DbExecutor;
+
+static DbExecutor executor = {
+    .head = NULL,
+    .tail = NULL,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .ready = PTHREAD_COND_INITIALIZER,
+    .space = PTHREAD_COND_INITIALIZER,
+    .fanout_done = PTHREAD_COND_INITIALIZER,
+    .running = false,
+    .stopping = false};
+
+static inline uint32_t bucket_of(uint64_t key)
+{
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) % DB_EXECUTOR_KEY_BUCKETS;
+}
+
+static DbKeyState *find_key(uint64_t key)
+{
+    for (DbKeyState *state = executor.keys[bucket_of(key)]; state; state = state->next)
+    {
+        if (state->key == key)
+        {
+            return state;
+        }
+    }
+    return NULL;
+}
+
+static DbKeyState *find_or_add_key(uint64_t key)
+{
+    DbKeyState *state = find_key(key);
+    if (state)
+    {
+        return state;
+    }
+    state = calloc(1, sizeof(DbKeyState));
+    if (!state)
+    {
+        log_message(ERROR, "Failed to allocate DB executor key");
+        return NULL;
+    }
+    state->key = key;
+    state->next = executor.keys[bucket_of(key)];
+    executor.keys[bucket_of(key)] = state;
+    return state;
+}
+
+static void remove_key(DbKeyState *state)
+{
+    DbKeyState **link = &executor.keys[bucket_of(state->key)];
+    while (*link != state)
+    {
+        link = &(*link)->next;
+    }
+    *link = state->next;
+    free(state);
+}
+
+static void push_ready(DbTaskNode *node)
+{
+    node->next = NULL;
+    if (executor.tail)
+        executor.tail->next = node;
+    else
+        executor.head = node;
+    executor.tail = node;
+    pthread_cond_signal(&executor.ready);
+}
+
+static void set_held(DbKeyState *state, bool held)
+{
+    if (state->held != held)
+    {
+        state->held = held;
+        executor.held_count += held ? 1 : -1;
+        if (!held)
+        {
+            pthread_cond_broadcast(&executor.released);
+            // Worker đang chờ thoát cần thấy held_count về 0
+            if (executor.stopping)
+            {
+                pthread_cond_broadcast(&executor.ready);
+            }
+        }
+    }
+}
+
+/**
+ * Đưa task kế tiếp của key vào ready nếu key đang rảnh. Gọi khi đang giữ mutex, sau mọi thay đổi
+ * của state; state không còn gì thì bị xóa.
+ */
+static void schedule_key(DbKeyState *state)
+{
+    if (state->running || state->scheduled)
+    {
+        return;
+    }
+    DbTaskNode *node = NULL;
+    if (state->resume)
+    {
+        // Hold kết thúc khi continuation được đưa ra, các task trong pending vẫn phải chờ nó chạy xong
+        node = state->resume;
+        state->resume = NULL;
+        set_held(state, false);
+    }
+    else if (!state->held && state->pending_head)
+    {
+        node = state->pending_head;
+        state->pending_head = node->next;
+        if (!state->pending_head)
+        {
+            state->pending_tail = NULL;
+        }
+    }
+
+    if (node)
+    {
+        state->scheduled = true;
+        push_ready(node);
+    }
+    else if (!state->held && !state->pending_head)
+    {
+        remove_key(state);
+    }
+}
+
+// Gọi khi đang giữ mutex
+static bool enqueue(uint64_t key, DbTaskNode *node)
+{
+    if (key == 0)
+    {
+        push_ready(node);
+        executor.queued++;
+        return true;
+    }
+    DbKeyState *state = find_or_add_key(key);
+    if (!state)
+    {
+        return false;
+    }
+    node->state = state;
+    node->next = NULL;
+    if (state->pending_tail)
+        state->pending_tail->next = node;
+    else
+        state->pending_head = node;
+    state->pending_tail = node;
+    executor.queued++;
+    schedule_key(state);
+    return true;
+}
+
+// Gọi khi đang giữ mutex
+static DbTaskNode *take_ready()
+{
+    DbTaskNode *node = executor.head;
+    if (!node)
+    {
+        return NULL;
+    }
+    executor.head = node->next;
+    if (!executor.head)
+    {
+        executor.tail = NULL;
+    }
+    executor.queued--;
+    pthread_cond_signal(&executor.space);
+    if (node->state)
+    {
+        node->state->scheduled = false;
+        node->state->running = true;
+    }
+    return node;
+}
+
+// Gọi khi đang giữ mutex
+static void fanout_release(DbFanout *fanout)
+{
+    if (--fanout->refs == 0)
+    {
+        free(fanout);
+    }
+}
+
+// Gọi khi đang giữ mutex, trả mutex trong lúc chạy task. Chạy các task chưa ai nhận cho tới hết
+static void run_fanout_tasks(DbFanout *fanout)
+{
+    while (fanout->next < fanout->count)
+    {
+        DbTask *task = &fanout->tasks[fanout->next++];
+        pthread_mutex_unlock(&executor.mutex);
+        task->fn(task->arg);
+        pthread_mutex_lock(&executor.mutex);
+        if (--fanout->remaining == 0)
+        {
+            pthread_cond_broadcast(&executor.fanout_done);
+        }
+    }
+}
+
+static void *worker_thread(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&executor.mutex);
+    while (true)
+    {
+        DbTaskNode *node = take_ready();
+        if (!node)
+        {
+            // Task phía sau một key bị giữ chỉ chạy được khi hold kết thúc
+            if (executor.stopping && executor.queued == 0 && executor.held_count == 0)
+            {
+                break;
+            }
+            pthread_cond_wait(&executor.ready, &executor.mutex);
+            continue;
+        }
+
+        if (node->fanout)
+        {
+            // Caller của run_all có thể đã tự chạy hết các task
+            run_fanout_tasks(node->fanout);
+            fanout_release(node->fanout);
+            free(node);
+            continue;
+        }
+
+        DbKeyState *state = node->state;
+        pthread_mutex_unlock(&executor.mutex);
+
+        node->fn(node->arg);
+        free(node);
+
+        pthread_mutex_lock(&executor.mutex);
+        if (state)
+        {
+            state->running = false;
+            schedule_key(state);
+        }
+        if (executor.stopping)
+        {
+            // Worker đang chờ có thể đang đợi điều kiện thoát
+            pthread_cond_broadcast(&executor.ready);
+        }
+    }
+    pthread_mutex_unlock(&executor.mutex);
+    return NULL;
+}
+
+bool db_executor_start()
+{
+    pthread_mutex_lock(&executor.mutex);
+    if (executor.running)
+    {
+        pthread_mutex_unlock(&executor.mutex);
+        return true;
+    }
+
+    int threads = config_get_db_executor_threads();
+    int pool_max = config_get_db_pool_max();
+    int queue_max = config_get_db_executor_queue_max();
+    executor.thread_count = threads > 0 ? threads : DB_EXECUTOR_DEFAULT_THREADS;
+    if (pool_max > 0 && executor.thread_count > pool_max)
+    {
+        executor.thread_count = pool_max;
+    }
+    executor.queue_max = queue_max > 0 ? queue_max : DB_EXECUTOR_DEFAULT_QUEUE_MAX;
+    // Một run_all không được chiếm hết pool, luôn chừa connection cho các request khác
+    executor.fanout_max = DB_EXECUTOR_FANOUT_MAX;
+    if (pool_max > 0 && executor.fanout_max > pool_max - 1)
+    {
+        executor.fanout_max = pool_max > 1 ? pool_max - 1 : 1;
+    }
+
+    executor.threads = calloc(executor.thread_count, sizeof(pthread_t));
+    if (!executor.threads)
+    {
+        log_message(ERROR, "Failed to allocate DB executor");
+        pthread_mutex_unlock(&executor.mutex);
+        return false;
+    }
+
+    // Deadline của timedwait tính bằng utils_now_ms (CLOCK_MONOTONIC)
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&executor.released, &attr);
+    pthread_condattr_destroy(&attr);
+
+    executor.stopping = false;
+    int started = 0;
+    for (; started < executor.thread_count; started++)
+    {
+        if (pthread_create(&executor.threads[started], NULL, worker_thread, NULL) != 0)
+        {
+            break;
+        }
+    }
+
+    if (started == 0)
+    {
+        log_message(ERROR, "Failed to create DB executor threads");
+        free(executor.threads);
+        pthread_cond_destroy(&executor.released);
+        pthread_mutex_unlock(&executor.mutex);
+        return false;
+    }
+    executor.thread_count = started;
+    executor.running = true;
+
+    log_message(INFO, "DB executor started (threads=%d, queue_max=%d)", executor.thread_count, executor.queue_max);
+    pthread_mutex_unlock(&executor.mutex);
+    return true;
+}
+
+void db_executor_stop()
+{
+    pthread_mutex_lock(&executor.mutex);
+    if (!executor.running)
+    {
+        pthread_mutex_unlock(&executor.mutex);
+        return;
+    }
+    executor.stopping = true;
+    pthread_cond_broadcast(&executor.ready);
+    pthread_cond_broadcast(&executor.space);
+
+    // Continuation của key bị giữ thường tới ngay sau đó (db_async đã dừng trước), nhưng một hold
+    // không bao giờ được resume không được chặn shutdown mãi
+    long long deadline_ms = utils_now_ms() + DB_EXECUTOR_STOP_WAIT_MS;
+    while (executor.held_count > 0 && utils_now_ms() < deadline_ms)
+    {
+        struct timespec deadline = {.tv_sec = deadline_ms / 1000, .tv_nsec = (deadline_ms % 1000) * 1000000};
+        pthread_cond_timedwait(&executor.released, &executor.mutex, &deadline);
+    }
+    if (executor.held_count > 0)
+    {
+        log_message(WARN, "DB executor: dropping %d keys still held after %d ms", executor.held_count,
+                    DB_EXECUTOR_STOP_WAIT_MS);
+        for (int i = 0; i < DB_EXECUTOR_KEY_BUCKETS; i++)
+        {
+            DbKeyState *state = executor.keys[i];
+            while (state)
+            {
+                // schedule_key có thể xóa state
+                DbKeyState *next = state->next;
+                set_held(state, false);
+                schedule_key(state);
+                state = next;
+            }
+        }
+        pthread_cond_broadcast(&executor.ready);
+    }
+    pthread_mutex_unlock(&executor.mutex);
+
+    for (int i = 0; i < executor.thread_count; i++)
+    {
+        pthread_join(executor.threads[i], NULL);
+    }
+
+    pthread_mutex_lock(&executor.mutex);
+    executor.running = false;
+    free(executor.threads);
+    executor.threads = NULL;
+    executor.thread_count = 0;
+    pthread_cond_destroy(&executor.released);
+    pthread_mutex_unlock(&executor.mutex);
+    log_message(INFO, "DB executor stopped");
+}
+
+bool db_executor_submit(uint64_t key, DbTaskFn fn, void *arg)
+{
+    DbTaskNode *node = calloc(1, sizeof(DbTaskNode));
+    if (!node)
+    {
+        log_message(ERROR, "Failed to allocate DB task");
+        return false;
+    }
+    node->key = key;
+    node->fn = fn;
+    node->arg = arg;
+
+    pthread_mutex_lock(&executor.mutex);
+    while (executor.running && !executor.stopping && executor.queued >= executor.queue_max)
+    {
+        pthread_cond_wait(&executor.space, &executor.mutex);
+    }
+    if (!executor.running || executor.stopping || !enqueue(key, node))
+    {
+        pthread_mutex_unlock(&executor.mutex);
+        free(node);
+        return false;
+    }
+    pthread_mutex_unlock(&executor.mutex);
+    return true;
+}
+
+bool db_executor_hold(uint64_t key)
+{
+    pthread_mutex_lock(&executor.mutex);
+    DbKeyState *state = key != 0 && executor.running && !executor.stopping ? find_or_add_key(key) : NULL;
+    if (state)
+    {
+        set_held(state, true);
+    }
+    pthread_mutex_unlock(&executor.mutex);
+    return state != NULL;
+}
+
+bool db_executor_resume(uint64_t key, DbTaskFn fn, void *arg)
+{
+    DbTaskNode *node = calloc(1, sizeof(DbTaskNode));
+    pthread_mutex_lock(&executor.mutex);
+    DbKeyState *state = find_key(key);
+    // Được nhận cả khi đang stop: các task phía sau key chỉ chạy được sau continuation.
+    // Không còn state nghĩa là hold đã bị stop bỏ đi
+    if (!node || !executor.running || !state)
+    {
+        if (state)
+        {
+            set_held(state, false);
+            schedule_key(state);
+        }
+        pthread_mutex_unlock(&executor.mutex);
+        free(node);
+        return false;
+    }
+    node->key = key;
+    node->fn = fn;
+    node->arg = arg;
+    node->state = state;
+    state->resume = node;
+    executor.queued++;
+    schedule_key(state);
+    pthread_mutex_unlock(&executor.mutex);
+    return true;
+}
+
+void db_executor_release(uint64_t key)
+{
+    pthread_mutex_lock(&executor.mutex);
+    DbKeyState *state = find_key(key);
+    if (state)
+    {
+        set_held(state, false);
+        schedule_key(state);
+    }
+    pthread_mutex_unlock(&executor.mutex);
+}
+
+void db_executor_run_all(DbTask *tasks, int count)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    DbFanout *fanout = calloc(1, sizeof(DbFanout));
+    pthread_mutex_lock(&executor.mutex);
+    if (!fanout || !executor.running || executor.stopping || count == 1)
+    {
+        // Không song song được: chạy lần lượt trên thread hiện tại
+        pthread_mutex_unlock(&executor.mutex);
+        free(fanout);
+        for (int i = 0; i < count; i++)
+        {
+            tasks[i].fn(tasks[i].arg);
+        }
+        return;
+    }
+
+    fanout->tasks = tasks;
+    fanout->count = count;
+    fanout->next = 0;
+    fanout->remaining = count;
+    fanout->refs = 1;
+    // Caller là một trong fanout_max luồng chạy task, các worker node nhận phần còn lại theo thứ tự.
+    // Được phép vượt queue_max vì caller sẽ tự chạy những task chưa có worker nào lấy
+    int helpers = (count < executor.fanout_max ? count : executor.fanout_max) - 1;
+    for (int i = 0; i < helpers; i++)
+    {
+        DbTaskNode *node = calloc(1, sizeof(DbTaskNode));
+        if (!node)
+        {
+            break;
+        }
+        node->fanout = fanout;
+        fanout->refs++;
+        enqueue(0, node);
+    }
+
+    run_fanout_tasks(fanout);
+    while (fanout->remaining > 0)
+    {
+        pthread_cond_wait(&executor.fanout_done, &executor.mutex);
+    }
+    // tasks thuộc stack của caller; node còn trong queue thấy next == count và không đụng tới nó
+    fanout->tasks = NULL;
+    fanout_release(fanout);
+    pthread_mutex_unlock(&executor.mutex);
+}
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "db_mapper.h"
+#include "log.h"
+
+bool db_mapper_resolve(const DbRowMapper *mapper, const DbResult *result, int *columns)
+{
+    for (int i = 0; i < mapper->field_count; i++)
+    {
+        const DbFieldBinding *field = &mapper->fields[i];
+
+        // Catalog liệt kê cột theo đúng thứ tự SELECT, thử vị trí i trước
+        if (i < result->column_count && strcmp(result->columns[i].name, field->column) == 0)
+        {
+            columns[i] = i;
+        }
+        else
+        {
+            columns[i] = db_result_column_index(result, field->column);
+        }
+
+        if (columns[i] < 0)
+        {
+            log_message(ERROR, "Query %s: column '%s' missing from result", mapper->name, field->column);
+            return false;
+        }
+    }
+    return true;
+}
+
+// copy = false để trường DB_FIELD_STRDUP trỏ thẳng vào value thay vì strdup
+static void decode_field(const DbFieldBinding *field, const char *value, bool copy, void *target)
+{
+    switch (field->kind)
+    {
+    case DB_FIELD_INT:
+        *(int *)target = value ? (int)strtol(value, NULL, 10) : 0;
+        break;
+    case DB_FIELD_LONG:
+        *(long *)target = value ? (long)strtoll(value, NULL, 10) : 0;
+        break;
+    case DB_FIELD_BOOL:
+        *(bool *)target = value ? strtol(value, NULL, 10) != 0 : false;
+        break;
+    case DB_FIELD_STRDUP:
+        *(char **)target = value && copy ? strdup(value) : (char *)value;
+        break;
+    case DB_FIELD_CHARS:
+        snprintf((char *)target, field->size, "%s", value ? value : "");
+        break;
+    }
+}
+
+void db_mapper_decode(const DbRowMapper *mapper, const DbResult *result, const int *columns, int row, void *out)
+{
+    char *base = (char *)out;
+    for (int i = 0; i < mapper->field_count; i++)
+    {
+        const DbFieldBinding *field = &mapper->fields[i];
+        decode_field(field, db_result_string(result, row, columns[i]), true, base + field->offset);
+    }
+}
+
+bool db_mapper_resolve_cursor(const DbRowMapper *mapper, const DbCursor *cursor, int *columns)
+{
+    for (int i = 0; i < mapper->field_count; i++)
+    {
+        columns[i] = db_cursor_column_index(cursor, mapper->fields[i].column);
+        if (columns[i] < 0)
+        {
+            log_message(ERROR, "Query %s: column '%s' missing from result", mapper->name, mapper->fields[i].column);
+            return false;
+        }
+    }
+    return true;
+}
+
+void db_mapper_decode_cursor(const DbRowMapper *mapper, const DbCursor *cursor, const int *columns, void *out)
+{
+    char *base = (char *)out;
+    for (int i = 0; i < mapper->field_count; i++)
+    {
+        const DbFieldBinding *field = &mapper->fields[i];
+        decode_field(field, db_cursor_string(cursor, columns[i]), false, base + field->offset);
+    }
+}
+
+void *db_map_rows(const DbRowMapper *mapper, const DbResult *result, int *count)
+{
+    *count = 0;
+    if (!mapper || !result || result->row_count == 0)
+    {
+        return NULL;
+    }
+
+    if (mapper->field_count > DB_MAPPER_MAX_FIELDS)
+    {
+        log_message(ERROR, "Query %s maps too many columns", mapper->name);
+        return NULL;
+    }
+
+    int columns[DB_MAPPER_MAX_FIELDS];
+    if (!db_mapper_resolve(mapper, result, columns))
+    {
+        return NULL;
+    }
+
+    char *rows = calloc(result->row_count, mapper->row_size);
+    if (!rows)
+    {
+        log_message(ERROR, "Failed to allocate %d rows for query %s", result->row_count, mapper->name);
+        return NULL;
+    }
+
+    for (int row = 0; row < result->row_count; row++)
+    {
+        db_mapper_decode(mapper, result, columns, row, rows + (size_t)row * mapper->row_size);
+    }
+
+    *count = result->row_count;
+    return rows;
+}
+
+void *db_query_rows(const DbRowMapper *mapper, DbStatement *stmt, int *count)
+{
+    *count = 0;
+    DbResult *result = db_execute_rows(stmt);
+    if (!result)
+    {
+        return NULL;
+    }
+
+    void *rows = db_map_rows(mapper, result, count);
+    db_result_free(result);
+    return rows;
+}
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "db_migrate.h"
+#include "database_connector.h"
+#include "db_statement.h"
+#include "db_result.h"
+#include "sql_statement.h"
+#include "config.h"
+#include "m_utils.h"
+#include "log.h"
+
+// Đọc một hoặc hai cột số ở dòng đầu của một câu SELECT không tham số
+static bool query_longs(const char *sql, long long *first, long long *second)
+{
+    DbStatement *stmt = db_prepare(sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    DbResult *result = db_execute_rows(stmt);
+    db_statement_free(stmt);
+    if (!result)
+    {
+        return false;
+    }
+
+    bool ok = result->row_count > 0;
+    if (ok)
+    {
+        *first = db_result_long(result, 0, 0);
+        if (second)
+        {
+            *second = result->column_count > 1 ? db_result_long(result, 0, 1) : 0;
+        }
+    }
+    db_result_free(result);
+    return ok;
+}
+
+// Chạy một câu UPDATE đã bind, trả về số dòng đổi, -1 nếu lỗi
+static long long run_update(DbStatement *stmt)
+{
+    if (!stmt)
+    {
+        return -1;
+    }
+    long long changed = db_execute(stmt) ? (long long)mysql_stmt_affected_rows(stmt->stmt) : -1;
+    db_statement_free(stmt);
+    return changed;
+}
+
+static bool ensure_column()
+{
+    long long found = 0;
+    if (!query_longs(SQL_HAS_CONVERSATION_COLUMN, &found, NULL))
+    {
+        log_message(ERROR, "Failed to inspect messages table");
+        return false;
+    }
+    if (found > 0)
+    {
+        log_message(INFO, "messages.conversation_id already exists");
+        return true;
+    }
+
+    log_message(INFO, "Adding messages.conversation_id and its index (online)");
+    if (db_manager_update(SQL_ADD_CONVERSATION_COLUMN) < 0)
+    {
+        log_message(ERROR, "Failed to add messages.conversation_id");
+        return false;
+    }
+    return true;
+}
+
+bool db_migrate_conversations()
+{
+    if (!ensure_column())
+    {
+        return false;
+    }
+
+    int batch_size = config_get_migrate_batch_size();
+    int pause_ms = config_get_migrate_pause_ms();
+    batch_size = batch_size > 0 ? batch_size : MIGRATE_DEFAULT_BATCH_SIZE;
+    pause_ms = pause_ms >= 0 ? pause_ms : MIGRATE_DEFAULT_PAUSE_MS;
+
+    long long min_id = 0, max_id = 0;
+    if (!query_longs(SQL_GET_MESSAGE_ID_RANGE, &min_id, &max_id))
+    {
+        log_message(ERROR, "Failed to read message id range");
+        return false;
+    }
+
+    // Mỗi câu chỉ khóa một khoảng khóa chính ngắn, server vẫn ghi bình thường giữa các batch
+    long long started = utils_now_ms();
+    long long filled = 0;
+    for (long long low = min_id; max_id > 0 && low <= max_id; low += batch_size)
+    {
+        DbStatement *stmt = db_prepare(SQL_BACKFILL_CONVERSATION_RANGE);
+        if (stmt && !(db_bind_long(stmt, 0, (long)low) && db_bind_long(stmt, 1, (long)(low + batch_size - 1))))
+        {
+            db_statement_free(stmt);
+            stmt = NULL;
+        }
+        long long changed = run_update(stmt);
+        if (changed < 0)
+        {
+            log_message(ERROR, "Backfill failed at ids %lld-%lld, re-run to continue", low, low + batch_size - 1);
+            return false;
+        }
+        filled += changed;
+        log_message(LOG_DEBUG, "Backfilled ids %lld-%lld of %lld (%lld rows)", low, low + batch_size - 1, max_id, changed);
+        if (pause_ms > 0)
+        {
+            usleep(pause_ms * 1000);
+        }
+    }
+
+    // Dòng mà server cũ ghi sau khi vòng trên đã đi qua
+    long long changed;
+    do
+    {
+        DbStatement *stmt = db_prepare(SQL_BACKFILL_CONVERSATION_REST);
+        if (stmt && !db_bind_int(stmt, 0, batch_size))
+        {
+            db_statement_free(stmt);
+            stmt = NULL;
+        }
+        changed = run_update(stmt);
+        if (changed < 0)
+        {
+            log_message(ERROR, "Backfill of late rows failed, re-run to continue");
+            return false;
+        }
+        filled += changed;
+    } while (changed == batch_size);
+
+    log_message(INFO, "Backfilled conversation_id on %lld messages in %lldms", filled, utils_now_ms() - started);
+    return true;
+}
@@ -0,0 +1,707 @@
+#include <stdlib.h>
+#include <string.h>
+#include <mysql/mysql.h>
+#include "db_result.h"
+#include "db_statement.h"
+#include "database_connector.h"
+#include "log.h"
+#if MYSQL_VERSION_ID >= 80000
+    typedef bool my_bool;
+#endif
+
+DbResult *db_result_create(int column_count, const char *const *names, const int *types)
+{
+    DbResult *result = calloc(1, sizeof(DbResult));
+    if (!result)
+    {
+        return NULL;
+    }
+
+    // Metadata và tên cột nằm chung một block, mỗi tên chỉ lưu một lần
+    size_t names_size = 0;
+    for (int i = 0; i < column_count; i++)
+    {
+        names_size += strlen(names[i]) + 1;
+    }
+
+    result->columns = malloc(sizeof(DbColumn) * column_count + names_size);
+    if (!result->columns)
+    {
+        free(result);
+        return NULL;
+    }
+
+    char *block = (char *)(result->columns + column_count);
+    for (int i = 0; i < column_count; i++)
+    {
+        size_t length = strlen(names[i]) + 1;
+        memcpy(block, names[i], length);
+        result->columns[i].name = block;
+        result->columns[i].type = types ? types[i] : 0;
+        block += length;
+    }
+    result->column_count = column_count;
+    return result;
+}
+
+static DbResult *result_create(MYSQL_FIELD *fields, unsigned int column_count)
+{
+    const char **names = malloc((sizeof(char *) + sizeof(int)) * (column_count > 0 ? column_count : 1));
+    if (!names)
+    {
+        return NULL;
+    }
+    int *types = (int *)(names + column_count);
+    for (unsigned int i = 0; i < column_count; i++)
+    {
+        names[i] = fields[i].name;
+        types[i] = fields[i].type;
+    }
+    DbResult *result = db_result_create((int)column_count, names, types);
+    free(names);
+    return result;
+}
+
+static bool reserve_rows(DbResult *result, int rows)
+{
+    if (rows <= result->row_capacity)
+    {
+        return true;
+    }
+
+    int capacity = result->row_capacity > 0 ? result->row_capacity : 16;
+    while (capacity < rows)
+    {
+        capacity *= 2;
+    }
+
+    size_t cells = (size_t)capacity * (result->column_count > 0 ? result->column_count : 1);
+    uint32_t *offsets = realloc(result->offsets, cells * sizeof(uint32_t));
+    if (!offsets)
+    {
+        return false;
+    }
+    result->offsets = offsets;
+
+    uint32_t *lengths = realloc(result->lengths, cells * sizeof(uint32_t));
+    if (!lengths)
+    {
+        return false;
+    }
+    result->lengths = lengths;
+    result->row_capacity = capacity;
+    return true;
+}
+
+static bool reserve_data(DbResult *result, size_t extra)
+{
+    if (result->data_size + extra <= result->data_capacity)
+    {
+        return true;
+    }
+
+    size_t capacity = result->data_capacity > 0 ? result->data_capacity : 4096;
+    while (capacity < result->data_size + extra)
+    {
+        capacity *= 2;
+    }
+    if (capacity > UINT32_MAX)
+    {
+        log_message(ERROR, "Result set exceeds %u bytes", UINT32_MAX);
+        return false;
+    }
+
+    char *data = realloc(result->data, capacity);
+    if (!data)
+    {
+        return false;
+    }
+    result->data = data;
+    result->data_capacity = capacity;
+    return true;
+}
+
+static bool append_row(DbResult *result, const char *const *values, const unsigned long *lengths, const my_bool *is_null)
+{
+    if (!reserve_rows(result, result->row_count + 1))
+    {
+        return false;
+    }
+
+    size_t base = (size_t)result->row_count * result->column_count;
+    for (int i = 0; i < result->column_count; i++)
+    {
+        if (values[i] == NULL || (is_null && is_null[i]))
+        {
+            result->offsets[base + i] = DB_RESULT_NULL_CELL;
+            result->lengths[base + i] = 0;
+            continue;
+        }
+
+        if (!reserve_data(result, lengths[i] + 1))
+        {
+            return false;
+        }
+        memcpy(result->data + result->data_size, values[i], lengths[i]);
+        result->data[result->data_size + lengths[i]] = '\0';
+        result->offsets[base + i] = (uint32_t)result->data_size;
+        result->lengths[base + i] = (uint32_t)lengths[i];
+        result->data_size += lengths[i] + 1;
+    }
+
+    result->row_count++;
+    return true;
+}
+
+DbResult *db_execute_rows(DbStatement *stmt)
+{
+    if (!stmt || !stmt->stmt)
+    {
+        log_message(ERROR, "Invalid statement for execute_rows");
+        return NULL;
+    }
+
+    // Cần max_length của từng cột để cấp buffer fetch vừa đủ, không cắt giá trị dài
+    my_bool update_max_length = 1;
+    mysql_stmt_attr_set(stmt->stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length);
+
+    if (!db_execute(stmt))
+    {
+        return NULL;
+    }
+
+    MYSQL_RES *meta = mysql_stmt_result_metadata(stmt->stmt);
+    if (!meta)
+    {
+        log_message(ERROR, "No result metadata available: %s", mysql_stmt_error(stmt->stmt));
+        return NULL;
+    }
+
+    if (mysql_stmt_store_result(stmt->stmt) != 0)
+    {
+        log_message(ERROR, "Failed to store result: %s", mysql_stmt_error(stmt->stmt));
+        mysql_free_result(meta);
+        return NULL;
+    }
+
+    unsigned int column_count = mysql_num_fields(meta);
+    MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+    my_ulonglong row_count = mysql_stmt_num_rows(stmt->stmt);
+
+    DbResult *result = result_create(fields, column_count);
+    if (!result || !reserve_rows(result, row_count > 0 ? (int)row_count : 1))
+    {
+        log_message(ERROR, "Failed to allocate result set");
+        db_result_free(result);
+        mysql_free_result(meta);
+        mysql_stmt_free_result(stmt->stmt);
+        return NULL;
+    }
+
+    // Một block cho binds, độ dài, cờ NULL, con trỏ và buffer của mọi cột
+    size_t buffer_size = 0;
+    for (unsigned int i = 0; i < column_count; i++)
+    {
+        buffer_size += fields[i].max_length + 1;
+    }
+    size_t header_size = column_count * (sizeof(MYSQL_BIND) + sizeof(unsigned long) + sizeof(my_bool) + sizeof(char *));
+    char *block = calloc(1, header_size + buffer_size + 1);
+    if (!block)
+    {
+        log_message(ERROR, "Failed to allocate fetch buffers");
+        db_result_free(result);
+        mysql_free_result(meta);
+        mysql_stmt_free_result(stmt->stmt);
+        return NULL;
+    }
+
+    MYSQL_BIND *binds = (MYSQL_BIND *)block;
+    unsigned long *lengths = (unsigned long *)(binds + column_count);
+    char **values = (char **)(lengths + column_count);
+    my_bool *is_null = (my_bool *)(values + column_count);
+    char *buffer = (char *)(is_null + column_count);
+
+    for (unsigned int i = 0; i < column_count; i++)
+    {
+        values[i] = buffer;
+        binds[i].buffer_type = MYSQL_TYPE_STRING;
+        binds[i].buffer = buffer;
+        binds[i].buffer_length = fields[i].max_length + 1;
+        binds[i].length = &lengths[i];
+        binds[i].is_null = &is_null[i];
+        buffer += fields[i].max_length + 1;
+    }
+
+    bool ok = mysql_stmt_bind_result(stmt->stmt, binds) == 0;
+    if (!ok)
+    {
+        log_message(ERROR, "Failed to bind result: %s", mysql_stmt_error(stmt->stmt));
+    }
+
+    while (ok)
+    {
+        int status = mysql_stmt_fetch(stmt->stmt);
+        if (status == MYSQL_NO_DATA)
+        {
+            break;
+        }
+        if (status == 1)
+        {
+            log_message(ERROR, "Failed to fetch row: %s", mysql_stmt_error(stmt->stmt));
+            ok = false;
+            break;
+        }
+        if (status == MYSQL_DATA_TRUNCATED)
+        {
+            log_message(WARN, "Column value truncated in row %d", result->row_count);
+        }
+        if (!append_row(result, (const char *const *)values, lengths, is_null))
+        {
+            log_message(ERROR, "Failed to grow result set");
+            ok = false;
+        }
+    }
+
+    free(block);
+    mysql_free_result(meta);
+    mysql_stmt_free_result(stmt->stmt);
+
+    if (!ok)
+    {
+        db_result_free(result);
+        return NULL;
+    }
+    return result;
+}
+
+struct DbCursor
+{
+    DbStatement *stmt;
+    MYSQL_RES *meta;
+    int column_count;
+    MYSQL_BIND *binds;
+    unsigned long *lengths;
+    my_bool *is_null;
+    char **buffers;
+    bool done;
+    bool failed;
+};
+
+DbCursor *db_cursor_open(DbStatement *stmt)
+{
+    if (!stmt || !stmt->stmt)
+    {
+        log_message(ERROR, "Invalid statement for cursor");
+        return NULL;
+    }
+
+    // Statement trong cache có thể đã được db_execute_rows bật max_length, cursor không cần
+    my_bool update_max_length = 0;
+    mysql_stmt_attr_set(stmt->stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length);
+
+    if (!db_execute(stmt))
+    {
+        return NULL;
+    }
+
+    MYSQL_RES *meta = mysql_stmt_result_metadata(stmt->stmt);
+    if (!meta)
+    {
+        log_message(ERROR, "No result metadata available: %s", mysql_stmt_error(stmt->stmt));
+        mysql_stmt_free_result(stmt->stmt);
+        return NULL;
+    }
+
+    int column_count = (int)mysql_num_fields(meta);
+    size_t slots = column_count > 0 ? column_count : 1;
+    DbCursor *cursor = calloc(1, sizeof(DbCursor));
+    if (cursor)
+    {
+        cursor->stmt = stmt;
+        cursor->meta = meta;
+        cursor->column_count = column_count;
+        cursor->binds = calloc(slots, sizeof(MYSQL_BIND));
+        cursor->lengths = calloc(slots, sizeof(unsigned long));
+        cursor->is_null = calloc(slots, sizeof(my_bool));
+        cursor->buffers = calloc(slots, sizeof(char *));
+    }
+    if (!cursor || !cursor->binds || !cursor->lengths || !cursor->is_null || !cursor->buffers)
+    {
+        log_message(ERROR, "Failed to allocate cursor");
+        if (cursor)
+        {
+            db_cursor_close(cursor);
+        }
+        else
+        {
+            mysql_free_result(meta);
+            mysql_stmt_free_result(stmt->stmt);
+        }
+        return NULL;
+    }
+
+    for (int i = 0; i < column_count; i++)
+    {
+        cursor->buffers[i] = malloc(DB_CURSOR_COLUMN_BYTES);
+        if (!cursor->buffers[i])
+        {
+            log_message(ERROR, "Failed to allocate cursor buffers");
+            db_cursor_close(cursor);
+            return NULL;
+        }
+        cursor->binds[i].buffer_type = MYSQL_TYPE_STRING;
+        cursor->binds[i].buffer = cursor->buffers[i];
+        cursor->binds[i].buffer_length = DB_CURSOR_COLUMN_BYTES;
+        cursor->binds[i].length = &cursor->lengths[i];
+        cursor->binds[i].is_null = &cursor->is_null[i];
+    }
+
+    if (mysql_stmt_bind_result(stmt->stmt, cursor->binds) != 0)
+    {
+        log_message(ERROR, "Failed to bind result: %s", mysql_stmt_error(stmt->stmt));
+        db_cursor_close(cursor);
+        return NULL;
+    }
+    return cursor;
+}
+
+// Đọc lại các cột dài hơn buffer vào buffer lớn hơn; buffer mới được giữ cho các dòng sau
+static bool fetch_truncated(DbCursor *cursor)
+{
+    MYSQL_STMT *stmt = cursor->stmt->stmt;
+    bool grown = false;
+    for (int i = 0; i < cursor->column_count; i++)
+    {
+        MYSQL_BIND *bind = &cursor->binds[i];
+        if (cursor->is_null[i] || cursor->lengths[i] < bind->buffer_length)
+        {
+            continue;
+        }
+
+        unsigned long capacity = bind->buffer_length;
+        while (capacity <= cursor->lengths[i])
+        {
+            capacity *= 2;
+        }
+        char *buffer = realloc(cursor->buffers[i], capacity);
+        if (!buffer)
+        {
+            log_message(ERROR, "Failed to grow cursor buffer to %lu bytes", capacity);
+            return false;
+        }
+        cursor->buffers[i] = buffer;
+        bind->buffer = buffer;
+        bind->buffer_length = capacity;
+        grown = true;
+
+        if (mysql_stmt_fetch_column(stmt, bind, (unsigned int)i, 0) != 0)
+        {
+            log_message(ERROR, "Failed to fetch column %d: %s", i, mysql_stmt_error(stmt));
+            return false;
+        }
+    }
+
+    if (grown && mysql_stmt_bind_result(stmt, cursor->binds) != 0)
+    {
+        log_message(ERROR, "Failed to bind result: %s", mysql_stmt_error(stmt));
+        return false;
+    }
+    return true;
+}
+
+bool db_cursor_next(DbCursor *cursor)
+{
+    if (!cursor || cursor->done || cursor->failed)
+    {
+        return false;
+    }
+
+    int status = mysql_stmt_fetch(cursor->stmt->stmt);
+    if (status == MYSQL_NO_DATA)
+    {
+        cursor->done = true;
+        return false;
+    }
+    if (status == 1)
+    {
+        log_message(ERROR, "Failed to fetch row: %s", mysql_stmt_error(cursor->stmt->stmt));
+        cursor->failed = true;
+        return false;
+    }
+    if (status == MYSQL_DATA_TRUNCATED && !fetch_truncated(cursor))
+    {
+        cursor->failed = true;
+        return false;
+    }
+
+    for (int i = 0; i < cursor->column_count; i++)
+    {
+        if (!cursor->is_null[i])
+        {
+            cursor->buffers[i][cursor->lengths[i]] = '\0';
+        }
+    }
+    return true;
+}
+
+bool db_cursor_failed(const DbCursor *cursor)
+{
+    return !cursor || cursor->failed;
+}
+
+void db_cursor_close(DbCursor *cursor)
+{
+    if (!cursor)
+    {
+        return;
+    }
+
+    // Server vẫn gửi các dòng chưa đọc, free_result đọc bỏ chúng để connection dùng lại được
+    mysql_stmt_free_result(cursor->stmt->stmt);
+    mysql_free_result(cursor->meta);
+    if (cursor->buffers)
+    {
+        for (int i = 0; i < cursor->column_count; i++)
+        {
+            free(cursor->buffers[i]);
+        }
+    }
+    free(cursor->buffers);
+    free(cursor->is_null);
+    free(cursor->lengths);
+    free(cursor->binds);
+    free(cursor);
+}
+
+int db_cursor_column_index(const DbCursor *cursor, const char *name)
+{
+    if (!cursor || !name)
+    {
+        return -1;
+    }
+    MYSQL_FIELD *fields = mysql_fetch_fields(cursor->meta);
+    for (int i = 0; i < cursor->column_count; i++)
+    {
+        if (strcmp(fields[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *db_cursor_string(const DbCursor *cursor, int column)
+{
+    if (!cursor || column < 0 || column >= cursor->column_count || cursor->is_null[column])
+    {
+        return NULL;
+    }
+    return cursor->buffers[column];
+}
+
+bool db_result_append_row(DbResult *result, const char *const *values, const unsigned long *lengths)
+{
+    return append_row(result, values, lengths, NULL);
+}
+
+DbResult *db_result_from_mysql(MYSQL_RES *res)
+{
+    if (!res)
+    {
+        return NULL;
+    }
+
+    unsigned int column_count = mysql_num_fields(res);
+    DbResult *result = result_create(mysql_fetch_fields(res), column_count);
+    if (!result || !reserve_rows(result, (int)mysql_num_rows(res) + 1))
+    {
+        log_message(ERROR, "Failed to allocate result set");
+        db_result_free(result);
+        mysql_free_result(res);
+        return NULL;
+    }
+
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(res)))
+    {
+        if (!append_row(result, (const char *const *)row, mysql_fetch_lengths(res), NULL))
+        {
+            log_message(ERROR, "Failed to grow result set");
+            db_result_free(result);
+            mysql_free_result(res);
+            return NULL;
+        }
+    }
+
+    mysql_free_result(res);
+    return result;
+}
+
+void db_result_free(DbResult *result)
+{
+    if (!result)
+    {
+        return;
+    }
+    free(result->columns);
+    free(result->offsets);
+    free(result->lengths);
+    free(result->data);
+    free(result);
+}
+
+int db_result_column_index(const DbResult *result, const char *name)
+{
+    if (!result || !name)
+    {
+        return -1;
+    }
+    for (int i = 0; i < result->column_count; i++)
+    {
+        if (strcmp(result->columns[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static const char *cell(const DbResult *result, int row, int column)
+{
+    if (!result || row < 0 || row >= result->row_count || column < 0 || column >= result->column_count)
+    {
+        return NULL;
+    }
+    uint32_t offset = result->offsets[(size_t)row * result->column_count + column];
+    return offset == DB_RESULT_NULL_CELL ? NULL : result->data + offset;
+}
+
+bool db_result_is_null(const DbResult *result, int row, int column)
+{
+    return cell(result, row, column) == NULL;
+}
+
+const char *db_result_string(const DbResult *result, int row, int column)
+{
+    return cell(result, row, column);
+}
+
+int db_result_int(const DbResult *result, int row, int column)
+{
+    const char *value = cell(result, row, column);
+    return value ? (int)strtol(value, NULL, 10) : 0;
+}
+
+long long db_result_long(const DbResult *result, int row, int column)
+{
+    const char *value = cell(result, row, column);
+    return value ? strtoll(value, NULL, 10) : 0;
+}
+
+double db_result_double(const DbResult *result, int row, int column)
+{
+    const char *value = cell(result, row, column);
+    return value ? strtod(value, NULL) : 0.0;
+}
+
+bool db_result_bool(const DbResult *result, int row, int column)
+{
+    const char *value = cell(result, row, column);
+    return value ? strtol(value, NULL, 10) != 0 : false;
+}
+
+static void *legacy_value(const DbResult *result, int row, int column)
+{
+    const char *text = db_result_string(result, row, column);
+    switch (result->columns[column].type)
+    {
+    case MYSQL_TYPE_LONGLONG:
+    {
+        long long *value = malloc(sizeof(long long));
+        if (value)
+            *value = strtoll(text, NULL, 10);
+        return value;
+    }
+    case MYSQL_TYPE_FLOAT:
+    {
+        float *value = malloc(sizeof(float));
+        if (value)
+            *value = strtof(text, NULL);
+        return value;
+    }
+    case MYSQL_TYPE_LONG:
+    {
+        int *value = malloc(sizeof(int));
+        if (value)
+            *value = atoi(text);
+        return value;
+    }
+    case MYSQL_TYPE_TINY:
+    {
+        int *value = malloc(sizeof(int));
+        if (value)
+            *value = (atoi(text) != 0);
+        return value;
+    }
+    default:
+        return strdup(text);
+    }
+}
+
+DbResultSet *db_result_to_result_set(DbResult *result)
+{
+    if (!result)
+    {
+        return NULL;
+    }
+
+    DbResultSet *result_set = calloc(1, sizeof(DbResultSet));
+    if (!result_set)
+    {
+        db_result_free(result);
+        return NULL;
+    }
+
+    result_set->capacity = result->row_count;
+    result_set->rows = calloc(result->row_count > 0 ? result->row_count : 1, sizeof(DbResultRow *));
+    if (!result_set->rows)
+    {
+        free(result_set);
+        db_result_free(result);
+        return NULL;
+    }
+
+    for (int r = 0; r < result->row_count; r++)
+    {
+        DbResultRow *row = calloc(1, sizeof(DbResultRow));
+        if (!row)
+            continue;
+
+        row->field_count = result->column_count;
+        row->fields = calloc(result->column_count, sizeof(DbResultField *));
+        if (!row->fields)
+        {
+            free(row);
+            continue;
+        }
+
+        for (int c = 0; c < result->column_count; c++)
+        {
+            if (db_result_is_null(result, r, c))
+                continue;
+
+            DbResultField *field = calloc(1, sizeof(DbResultField));
+            if (!field)
+                continue;
+            field->key = strdup(result->columns[c].name);
+            field->type = result->columns[c].type;
+            field->value = legacy_value(result, r, c);
+            row->fields[c] = field;
+        }
+
+        result_set->rows[result_set->row_count++] = row;
+    }
+
+    db_result_free(result);
+    return result_set;
+}
@@ -3,13 +3,97 @@
 #include <stdlib.h>
 #include <string.h>
 #include <mysql/mysql.h>
+#include "db_result.h"
+#include "sql_statement.h"
 #include "log.h"
 #include "stdbool.h"
-#if MYSQL_VERSION_ID >= 80000
-    typedef bool my_bool;
-#endif
 
-DbStatement *db_prepare(const char *query)
+static unsigned int hash_sql(const char *sql)
+{
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)sql; *p; p++)
+    {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void close_cached(DbCachedStatement *entry)
+{
+    if (entry->stmt)
+    {
+        mysql_stmt_close(entry->stmt);
+    }
+    free(entry->sql);
+    memset(entry, 0, sizeof(DbCachedStatement));
+}
+
+void db_statement_cache_clear(DbConnection *conn)
+{
+    if (!conn)
+    {
+        return;
+    }
+    for (int i = 0; i < conn->statement_count; i++)
+    {
+        close_cached(&conn->statements[i]);
+    }
+    conn->statement_count = 0;
+}
+
+static MYSQL_STMT *cache_lookup(DbConnection *conn, const char *query, unsigned int hash)
+{
+    for (int i = 0; i < conn->statement_count; i++)
+    {
+        DbCachedStatement *entry = &conn->statements[i];
+        if (entry->hash == hash && strcmp(entry->sql, query) == 0)
+        {
+            entry->last_used = ++conn->statement_clock;
+            return entry->stmt;
+        }
+    }
+    return NULL;
+}
+
+static bool cache_insert(DbConnection *conn, const char *query, unsigned int hash, MYSQL_STMT *stmt)
+{
+    DbCachedStatement *entry;
+    if (conn->statement_count < DB_STATEMENT_CACHE_SIZE)
+    {
+        entry = &conn->statements[conn->statement_count];
+    }
+    else
+    {
+        // Cache đầy: bỏ statement ít dùng gần đây nhất
+        entry = &conn->statements[0];
+        for (int i = 1; i < conn->statement_count; i++)
+        {
+            if (conn->statements[i].last_used < entry->last_used)
+            {
+                entry = &conn->statements[i];
+            }
+        }
+        close_cached(entry);
+    }
+
+    entry->sql = strdup(query);
+    if (!entry->sql)
+    {
+        return false;
+    }
+    entry->hash = hash;
+    entry->stmt = stmt;
+    entry->last_used = ++conn->statement_clock;
+    if (entry == &conn->statements[conn->statement_count])
+    {
+        conn->statement_count++;
+    }
+    return true;
+}
+
+// Statement trên conn đã checkout; lỗi thì conn vẫn thuộc về caller
+static DbStatement *prepare_on(DbConnection *conn, const char *query)
 {
     DbStatement *statement = calloc(1, sizeof(DbStatement));
     if (!statement)
@@ -18,36 +102,97 @@ DbStatement *db_prepare(const char *query)
         return NULL;
     }
 
-    statement->conn = db_manager_get_connection();
-    if (!statement->conn)
+    statement->conn = conn;
+    unsigned int hash = hash_sql(query);
+    statement->stmt = cache_lookup(conn, query, hash);
+    if (statement->stmt)
     {
-        free(statement);
-        return NULL;
+        conn->statement_hits++;
+        statement->cached = true;
     }
-
-    statement->stmt = mysql_stmt_init(statement->conn);
-    if (!statement->stmt || mysql_stmt_prepare(statement->stmt, query, strlen(query)) != 0)
+    else
     {
-        log_message(ERROR, "Failed to prepare statement: %s", mysql_stmt_error(statement->stmt));
-        db_manager_release_connection(statement->conn);
-        if (statement->stmt)
-            mysql_stmt_close(statement->stmt);
-        free(statement);
-        return NULL;
+        conn->statement_misses++;
+        statement->stmt = mysql_stmt_init(conn->mysql);
+        if (!statement->stmt || mysql_stmt_prepare(statement->stmt, query, strlen(query)) != 0)
+        {
+            log_message(ERROR, "Failed to prepare statement: %s",
+                        statement->stmt ? mysql_stmt_error(statement->stmt) : mysql_error(conn->mysql));
+            if (statement->stmt)
+                mysql_stmt_close(statement->stmt);
+            free(statement);
+            return NULL;
+        }
+        statement->cached = cache_insert(conn, query, hash, statement->stmt);
     }
 
     statement->binds = NULL;
     statement->lengths = NULL;
+    statement->values = NULL;
     statement->param_count = mysql_stmt_param_count(statement->stmt);
     statement->is_bound = false;
 
     return statement;
 }
 
-bool db_execute(DbStatement *stmt)
+DbStatement *db_prepare(const char *query)
+{
+    DbConnection *conn = db_manager_get_connection();
+    if (!conn)
+    {
+        return NULL;
+    }
+    DbStatement *statement = prepare_on(conn, query);
+    if (!statement)
+    {
+        db_manager_release_connection(conn);
+    }
+    return statement;
+}
+
+static void free_binds(DbStatement *stmt)
+{
+    free(stmt->binds);
+    free(stmt->lengths);
+    free(stmt->values);
+    stmt->binds = NULL;
+    stmt->lengths = NULL;
+    stmt->values = NULL;
+}
+
+// Cấp phát mảng bind theo số tham số hiện tại của statement
+static bool ensure_binds(DbStatement *stmt)
 {
-    bool success = false;
+    unsigned long current_param_count = mysql_stmt_param_count(stmt->stmt);
+    if (stmt->binds && stmt->param_count == current_param_count)
+    {
+        return true;
+    }
+
+    free_binds(stmt);
+    stmt->param_count = current_param_count;
+    if (stmt->param_count == 0)
+    {
+        log_message(ERROR, "Statement has no parameters to bind");
+        return false;
+    }
 
+    stmt->binds = calloc(stmt->param_count, sizeof(MYSQL_BIND));
+    stmt->lengths = calloc(stmt->param_count, sizeof(unsigned long));
+    stmt->values = calloc(stmt->param_count, sizeof(long long));
+    if (!stmt->binds || !stmt->lengths || !stmt->values)
+    {
+        free_binds(stmt);
+        log_message(ERROR, "Failed to allocate memory for parameter bindings");
+        return false;
+    }
+
+    stmt->is_bound = false;
+    return true;
+}
+
+bool db_execute(DbStatement *stmt)
+{
     if (!stmt || !stmt->stmt)
     {
         return false;
@@ -57,26 +202,20 @@ bool db_execute(DbStatement *stmt)
     {
         if (mysql_stmt_bind_param(stmt->stmt, stmt->binds) != 0)
         {
-            goto cleanup;
+            // Statement thuộc về caller, caller sẽ gọi db_statement_free
+            log_message(ERROR, "Failed to bind parameters: %s", mysql_stmt_error(stmt->stmt));
+            return false;
         }
         stmt->is_bound = true;
     }
 
-    success = mysql_stmt_execute(stmt->stmt) == 0;
-    return success;
-cleanup:
-
-    if (stmt->binds)
+    db_manager_count_query();
+    if (mysql_stmt_execute(stmt->stmt) != 0)
     {
-        free(stmt->binds);
-        stmt->binds = NULL;
+        log_message(ERROR, "Failed to execute statement: %s", mysql_stmt_error(stmt->stmt));
+        return false;
     }
-
-    mysql_stmt_close(stmt->stmt);
-    db_manager_release_connection(stmt->conn);
-    free(stmt);
-
-    return success;
+    return true;
 }
 
 bool db_bind_string(DbStatement *stmt, int index, const char *value)
@@ -93,49 +232,9 @@ bool db_bind_string(DbStatement *stmt, int index, const char *value)
         return false;
     }
 
-    unsigned long current_param_count = mysql_stmt_param_count(stmt->stmt);
-
-    if (!stmt->binds || stmt->param_count != current_param_count)
+    if (!ensure_binds(stmt))
     {
-
-        if (stmt->binds)
-        {
-            free(stmt->binds);
-            stmt->binds = NULL;
-        }
-
-        if (stmt->lengths)
-        {
-            free(stmt->lengths);
-            stmt->lengths = NULL;
-        }
-
-        stmt->param_count = current_param_count;
-        log_message(LOG_DEBUG, "Statement has %lu parameters", stmt->param_count);
-
-        if (stmt->param_count == 0)
-        {
-            log_message(ERROR, "Statement has no parameters to bind");
-            return false;
-        }
-
-        stmt->binds = calloc(stmt->param_count, sizeof(MYSQL_BIND));
-        if (!stmt->binds)
-        {
-            log_message(ERROR, "Failed to allocate memory for parameter bindings");
-            return false;
-        }
-
-        stmt->lengths = calloc(stmt->param_count, sizeof(unsigned long));
-        if (!stmt->lengths)
-        {
-            free(stmt->binds);
-            stmt->binds = NULL;
-            log_message(ERROR, "Failed to allocate memory for length values");
-            return false;
-        }
-
-        stmt->is_bound = false;
+        return false;
     }
 
     if (index >= stmt->param_count)
@@ -152,6 +251,7 @@ bool db_bind_string(DbStatement *stmt, int index, const char *value)
     stmt->binds[index].buffer_length = stmt->lengths[index];
     stmt->binds[index].length = &stmt->lengths[index];
     stmt->binds[index].is_null = 0;
+    stmt->is_bound = false;
 
     log_message(LOG_DEBUG, "Successfully bound string value: %s (length: %lu) at index %d",
                 value, stmt->lengths[index], index);
@@ -183,7 +283,6 @@ bool db_return_execute(DbStatement *stmt, int *result) {
         db_result_set_free(result_set);  // Giải phóng tài nguyên của result_set
         return false;
     }
-    result_set = NULL;
     db_result_set_free(result_set);
     return true;
 }
@@ -232,348 +331,205 @@ bool db_get_int(DbResultSet *result_set, int column_index, int *result) {
 
     *result = *((int*)field->value);
 
-    free(field);
-    free(row);
-
     return true;
 }
 
 
 DbResultSet *db_execute_query(DbStatement *stmt)
 {
-    if (!stmt || !stmt->stmt)
-    {
-        log_message(ERROR, "Invalid statement for execute_query");
-        return NULL;
-    }
+    // Giữ API cũ: đọc bằng db_execute_rows rồi chuyển sang DbResultSet
+    return db_result_to_result_set(db_execute_rows(stmt));
+}
+void db_statement_free(DbStatement *stmt) {
+    if (!stmt) return;
 
-    log_message(LOG_DEBUG, "Executing prepared query");
+    free_binds(stmt);
 
-    if (stmt->binds && !stmt->is_bound)
-    {
-        log_message(LOG_DEBUG, "Binding parameters to statement");
-        if (mysql_stmt_bind_param(stmt->stmt, stmt->binds) != 0)
-        {
-            log_message(ERROR, "Failed to bind parameters: %s",
-                        mysql_stmt_error(stmt->stmt));
-            goto cleanup_no_result;
+    if (stmt->stmt) {
+        if (stmt->cached) {
+            // Giữ statement trong cache của connection, chỉ dọn result và trạng thái
+            mysql_stmt_free_result(stmt->stmt);
+            mysql_stmt_reset(stmt->stmt);
+        } else {
+            mysql_stmt_close(stmt->stmt);
         }
-        stmt->is_bound = true;
-        log_message(LOG_DEBUG, "Parameters bound successfully");
+        stmt->stmt = NULL;
     }
 
-    if (mysql_stmt_execute(stmt->stmt) != 0)
-    {
-        log_message(ERROR, "Failed to execute statement: %s",
-                    mysql_stmt_error(stmt->stmt));
-        goto cleanup_no_result;
+    if (stmt->conn && !stmt->in_transaction) {
+        db_manager_release_connection(stmt->conn);
     }
+    stmt->conn = NULL;
 
-    MYSQL_RES *meta = mysql_stmt_result_metadata(stmt->stmt);
-    if (!meta)
-    {
-        log_message(ERROR, "No result metadata available: %s",
-                    mysql_stmt_error(stmt->stmt));
-        goto cleanup_no_result;
-    }
-    log_message(LOG_DEBUG, "Got result metadata");
+    free(stmt);
+}
 
-    if (mysql_stmt_store_result(stmt->stmt) != 0)
-    {
-        log_message(ERROR, "Failed to store result: %s",
-                    mysql_stmt_error(stmt->stmt));
-        mysql_free_result(meta);
-        goto cleanup_no_result;
-    }
-    log_message(LOG_DEBUG, "Stored result");
+bool db_bind_param(DbStatement *stmt, int index, const DbParam *param) {
+    switch (param->type) {
+        case DB_PARAM_INT:
+            return db_bind_int(stmt, index, param->int_value);
+        case DB_PARAM_LONG:
+            return db_bind_long(stmt, index, param->long_value);
+        case DB_PARAM_STRING:
+            return db_bind_string(stmt, index, param->string_value);
+        case DB_PARAM_NULL:
+            return db_bind_null(stmt, index);
+    }
+    log_message(ERROR, "Unknown parameter type %d at index %d", param->type, index);
+    return false;
+}
 
-    unsigned int num_fields = mysql_num_fields(meta);
-    MYSQL_FIELD *fields = mysql_fetch_fields(meta);
-    my_ulonglong num_rows = mysql_stmt_num_rows(stmt->stmt);
+// ---------------------------------------------------------------- transactions
 
-    DbResultSet *result_set = calloc(1, sizeof(DbResultSet));
-    if (!result_set)
-    {
-        log_message(ERROR, "Failed to allocate memory for result set");
-        mysql_free_result(meta);
-        goto cleanup_no_result;
-    }
+static void end_transaction(DbTransaction *tx)
+{
+    db_manager_release_connection(tx->conn);
+    free(tx);
+}
 
-    result_set->capacity = num_rows;
-    result_set->row_count = 0;
-    result_set->rows = calloc(num_rows, sizeof(DbResultRow *));
-    if (!result_set->rows)
+DbTransaction *db_begin()
+{
+    DbTransaction *tx = calloc(1, sizeof(DbTransaction));
+    if (!tx)
     {
-        log_message(ERROR, "Failed to allocate memory for result rows");
-        free(result_set);
-        mysql_free_result(meta);
-        goto cleanup_no_result;
+        log_message(ERROR, "Failed to allocate transaction");
+        return NULL;
     }
-
-    MYSQL_BIND *result_binds = calloc(num_fields, sizeof(MYSQL_BIND));
-    if (!result_binds)
+    tx->conn = db_manager_get_connection();
+    if (!tx->conn)
     {
-        log_message(ERROR, "Failed to allocate memory for result bindings");
-        free(result_set->rows);
-        free(result_set);
-        mysql_free_result(meta);
-        goto cleanup_no_result;
+        free(tx);
+        return NULL;
     }
-
-    my_bool *is_null = calloc(num_fields, sizeof(my_bool));
-    if (!is_null)
+    db_manager_count_query();
+    if (mysql_real_query(tx->conn->mysql, SQL_START_TRANSACTION, strlen(SQL_START_TRANSACTION)) != 0)
     {
-        log_message(ERROR, "Failed to allocate memory for NULL indicators");
-        free(result_binds);
-        free(result_set->rows);
-        free(result_set);
-        mysql_free_result(meta);
-        goto cleanup_no_result;
+        log_message(ERROR, "Failed to start transaction: %s", mysql_error(tx->conn->mysql));
+        end_transaction(tx);
+        return NULL;
     }
+    return tx;
+}
 
-    my_bool *error = calloc(num_fields, sizeof(my_bool));
-    if (!error)
+DbStatement *db_transaction_prepare(DbTransaction *tx, const char *query)
+{
+    if (!tx)
     {
-        log_message(ERROR, "Failed to allocate memory for error indicators");
-        free(is_null);
-        free(result_binds);
-        free(result_set->rows);
-        free(result_set);
-        mysql_free_result(meta);
-        goto cleanup_no_result;
+        return NULL;
     }
-
-    unsigned long *lengths = calloc(num_fields, sizeof(unsigned long));
-    if (!lengths)
+    DbStatement *statement = prepare_on(tx->conn, query);
+    if (statement)
     {
-        log_message(ERROR, "Failed to allocate memory for length indicators");
-        free(error);
-        free(is_null);
-        free(result_binds);
-        free(result_set->rows);
-        free(result_set);
-        mysql_free_result(meta);
-        goto cleanup_no_result;
+        statement->in_transaction = true;
     }
+    return statement;
+}
 
-    char **string_buffers = calloc(num_fields, sizeof(char *));
-    if (!string_buffers)
+static bool execute_with(DbStatement *stmt, const DbParam *params, int param_count)
+{
+    bool ok = true;
+    for (int i = 0; i < param_count && ok; i++)
     {
-        log_message(ERROR, "Failed to allocate memory for string buffers");
-        free(lengths);
-        free(error);
-        free(is_null);
-        free(result_binds);
-        free(result_set->rows);
-        free(result_set);
-        mysql_free_result(meta);
-        goto cleanup_no_result;
+        ok = db_bind_param(stmt, i, &params[i]);
     }
+    return ok && db_execute(stmt);
+}
 
-    for (unsigned int i = 0; i < num_fields; i++)
-    {
-
-        string_buffers[i] = calloc(1024, sizeof(char));
-        if (!string_buffers[i])
-        {
-
-            for (unsigned int j = 0; j < i; j++)
-                free(string_buffers[j]);
-            free(string_buffers);
-            free(lengths);
-            free(error);
-            free(is_null);
-            free(result_binds);
-            free(result_set->rows);
-            free(result_set);
-            mysql_free_result(meta);
-            goto cleanup_no_result;
-        }
-
-        memset(&result_binds[i], 0, sizeof(MYSQL_BIND));
-        result_binds[i].buffer_type = MYSQL_TYPE_STRING;
-        result_binds[i].buffer = string_buffers[i];
-        result_binds[i].buffer_length = 1024;
-        result_binds[i].is_null = &is_null[i];
-        result_binds[i].length = &lengths[i];
-        result_binds[i].error = &error[i];
-    }
+bool db_transaction_execute(DbTransaction *tx, const char *query, const DbParam *params, int param_count)
+{
+    DbStatement *stmt = db_transaction_prepare(tx, query);
+    bool ok = stmt && execute_with(stmt, params, param_count);
+    db_statement_free(stmt);
+    return ok;
+}
 
-    if (mysql_stmt_bind_result(stmt->stmt, result_binds) != 0)
+char *db_array_sql(const DbArrayStatement *shape, int rows)
+{
+    size_t prefix_length = strlen(shape->prefix);
+    size_t row_length = strlen(shape->row);
+    size_t suffix_length = strlen(shape->suffix);
+    char *sql = malloc(prefix_length + (size_t)rows * (row_length + 2) + suffix_length + 1);
+    if (!sql)
     {
-        log_message(ERROR, "Failed to bind result: %s", mysql_stmt_error(stmt->stmt));
-
-        for (unsigned int i = 0; i < num_fields; i++)
-            free(string_buffers[i]);
-        free(string_buffers);
-        free(lengths);
-        free(error);
-        free(is_null);
-        free(result_binds);
-        free(result_set->rows);
-        free(result_set);
-        mysql_free_result(meta);
-        goto cleanup_no_result;
+        return NULL;
     }
 
-    int row_idx = 0;
-    while (mysql_stmt_fetch(stmt->stmt) == 0 && row_idx < num_rows)
+    char *p = sql;
+    memcpy(p, shape->prefix, prefix_length);
+    p += prefix_length;
+    for (int i = 0; i < rows; i++)
     {
-        DbResultRow *row = calloc(1, sizeof(DbResultRow));
-        if (!row)
+        if (i > 0)
         {
-            log_message(ERROR, "Failed to allocate memory for row");
-            continue;
+            *p++ = ',';
+            *p++ = ' ';
         }
+        memcpy(p, shape->row, row_length);
+        p += row_length;
+    }
+    memcpy(p, shape->suffix, suffix_length);
+    p[suffix_length] = '\0';
+    return sql;
+}
 
-        row->field_count = num_fields;
-        row->fields = calloc(num_fields, sizeof(DbResultField *));
-        if (!row->fields)
+bool db_transaction_execute_array(DbTransaction *tx, const DbArrayStatement *shape, const DbParam *params,
+                                  int row_count)
+{
+    // Ít kích thước câu để statement cache của connection dùng lại được
+    static const int chunk_sizes[] = DB_ARRAY_CHUNK_SIZES;
+    int chunk = 0;
+    for (int offset = 0; offset < row_count;)
+    {
+        while (chunk_sizes[chunk] > row_count - offset)
         {
-            log_message(ERROR, "Failed to allocate memory for fields");
-            free(row);
-            continue;
+            chunk++;
         }
-
-        for (unsigned int i = 0; i < num_fields; i++)
+        int rows = chunk_sizes[chunk];
+        char *sql = db_array_sql(shape, rows);
+        DbStatement *stmt = sql ? db_transaction_prepare(tx, sql) : NULL;
+        free(sql);
+        bool ok = stmt && execute_with(stmt, params + (size_t)offset * shape->params, rows * shape->params);
+        db_statement_free(stmt);
+        if (!ok)
         {
-            if (!is_null[i])
-            {
-                DbResultField *field = calloc(1, sizeof(DbResultField));
-                if (!field)
-                {
-                    log_message(ERROR, "Failed to allocate memory for field");
-                    continue;
-                }
-
-                field->key = strdup(fields[i].name);
-                field->type = fields[i].type;
-
-                log_message(LOG_DEBUG, "Field %d: %s = %s",
-                            i, field->key, string_buffers[i]);
-
-                switch (fields[i].type)
-                {
-                case MYSQL_TYPE_LONGLONG:
-                {
-                    long long *val = malloc(sizeof(long long));
-                    if (val)
-                    {
-                        *val = strtoll(string_buffers[i], NULL, 10);
-                        field->value = val;
-                    }
-                    break;
-                }
-                case MYSQL_TYPE_FLOAT:
-                {
-                    float *val = malloc(sizeof(float));
-                    if (val)
-                    {
-                        *val = strtof(string_buffers[i], NULL);
-                        field->value = val;
-                    }
-                    break;
-                }
-                case MYSQL_TYPE_STRING:
-                case MYSQL_TYPE_VAR_STRING:
-                    field->value = strdup(string_buffers[i]);
-                    break;
-                case MYSQL_TYPE_LONG:
-                {
-                    int *val = malloc(sizeof(int));
-                    if (val)
-                    {
-                        *val = atoi(string_buffers[i]);
-                        field->value = val;
-                    }
-                    break;
-                }
-                case MYSQL_TYPE_TINY:
-                {
-                    int *val = malloc(sizeof(int));
-                    if (val)
-                    {
-                        *val = (atoi(string_buffers[i]) != 0);
-                        field->value = val;
-                    }
-                    break;
-                }
-                default:
-                    field->value = strdup(string_buffers[i]);
-                    break;
-                }
-                row->fields[i] = field;
-            }
+            log_message(ERROR, "Failed to write %d rows at row %d of %d", rows, offset, row_count);
+            return false;
         }
-
-        result_set->rows[result_set->row_count++] = row;
-        row_idx++;
+        offset += rows;
     }
+    return true;
+}
 
-    for (unsigned int i = 0; i < num_fields; i++)
-        free(string_buffers[i]);
-    free(string_buffers);
-    free(lengths);
-    free(error);
-    free(is_null);
-    free(result_binds);
-    mysql_free_result(meta);
-
-    if (stmt->binds)
+bool db_commit(DbTransaction *tx)
+{
+    if (!tx)
     {
-        free(stmt->binds);
-        stmt->binds = NULL;
+        return false;
     }
-    if (stmt->lengths)
+    db_manager_count_query();
+    bool ok = mysql_commit(tx->conn->mysql) == 0;
+    if (!ok)
     {
-        free(stmt->lengths);
-        stmt->lengths = NULL;
+        log_message(ERROR, "Failed to commit transaction: %s", mysql_error(tx->conn->mysql));
+        db_manager_count_query();
+        mysql_rollback(tx->conn->mysql);
     }
+    end_transaction(tx);
+    return ok;
+}
 
-    mysql_stmt_close(stmt->stmt);
-    stmt->stmt = NULL;
-
-    return result_set;
-
-cleanup_no_result:
-    log_message(ERROR, "Cleanup after error");
-    if (stmt->binds)
+void db_rollback(DbTransaction *tx)
+{
+    if (!tx)
     {
-        free(stmt->binds);
-        stmt->binds = NULL;
+        return;
     }
-    if (stmt->lengths)
+    db_manager_count_query();
+    if (mysql_rollback(tx->conn->mysql) != 0)
     {
-        free(stmt->lengths);
-        stmt->lengths = NULL;
+        log_message(ERROR, "Failed to roll back transaction: %s", mysql_error(tx->conn->mysql));
     }
-    return NULL;
-}
-void db_statement_free(DbStatement *stmt) {
-    if (!stmt) return;  // ✅ Kiểm tra NULL tránh lỗi
-
-    if (stmt->binds) {
-        free(stmt->binds);
-        stmt->binds = NULL;
-    }
-
-    if (stmt->lengths) {
-        free(stmt->lengths);
-        stmt->lengths = NULL;
-    }
-
-    if (stmt->stmt) {
-        mysql_stmt_close(stmt->stmt);
-        stmt->stmt = NULL;
-    }
-
-    if (stmt->conn) {
-        db_manager_release_connection(stmt->conn);
-        stmt->conn = NULL;
-    }
-
-    free(stmt);
-    stmt = NULL;  // ✅ Tránh truy cập sau khi giải phóng
+    end_transaction(tx);
 }
 
 
@@ -621,61 +577,25 @@ bool db_bind_int(DbStatement *stmt, int index, int value) {
         return false;
     }
 
-    unsigned long current_param_count = mysql_stmt_param_count(stmt->stmt);
-    if (index >= current_param_count) {
-        log_message(ERROR, "Parameter index %d out of bounds (max: %lu)", index, current_param_count - 1);
+    if (!ensure_binds(stmt)) {
         return false;
     }
 
-    // Nếu mảng binds chưa được khởi tạo hoặc số tham số không khớp, cần khởi tạo lại
-    if (!stmt->binds || stmt->param_count != current_param_count) {
-        if (stmt->binds) {
-            free(stmt->binds);
-            stmt->binds = NULL;
-        }
-        if (stmt->lengths) {
-            free(stmt->lengths);
-            stmt->lengths = NULL;
-        }
-        stmt->param_count = current_param_count;
-        stmt->binds = calloc(stmt->param_count, sizeof(MYSQL_BIND));
-        if (!stmt->binds) {
-            log_message(ERROR, "Failed to allocate memory for parameter bindings");
-            return false;
-        }
-        stmt->lengths = calloc(stmt->param_count, sizeof(unsigned long));
-        if (!stmt->lengths) {
-            free(stmt->binds);
-            stmt->binds = NULL;
-            log_message(ERROR, "Failed to allocate memory for length values");
-            return false;
-        }
-        stmt->is_bound = false;
-    }
-
-    // Cấp phát bộ nhớ cho giá trị int (và lưu lại để dùng sau khi statement thực thi)
-    int *pValue = malloc(sizeof(int));
-    if (!pValue) {
-        log_message(ERROR, "Failed to allocate memory for int parameter at index %d", index);
+    if (index >= stmt->param_count) {
+        log_message(ERROR, "Parameter index %d out of bounds (max: %lu)", index, stmt->param_count - 1);
         return false;
     }
+
+    // Giá trị lưu trong stmt->values để còn sống tới lúc execute
+    int *pValue = (int *)&stmt->values[index];
     *pValue = value;
 
     memset(&stmt->binds[index], 0, sizeof(MYSQL_BIND));
     stmt->binds[index].buffer_type = MYSQL_TYPE_LONG;
     stmt->binds[index].buffer = pValue;
     stmt->binds[index].buffer_length = sizeof(int);
-
-    unsigned long *len = malloc(sizeof(unsigned long));
-    if (!len) {
-        log_message(ERROR, "Failed to allocate memory for length at index %d", index);
-        free(pValue);
-        return false;
-    }
-    *len = sizeof(int);
-    stmt->binds[index].length = len;
-
     stmt->binds[index].is_null = 0;
+    stmt->is_bound = false;
 
     log_message(LOG_DEBUG, "Successfully bound int value %d at index %d", value, index);
     return true;
@@ -687,62 +607,45 @@ bool db_bind_long(DbStatement *stmt, int index, long value) {
         return false;
     }
 
-    unsigned long current_param_count = mysql_stmt_param_count(stmt->stmt);
-    if (index >= current_param_count) {
-        log_message(ERROR, "Parameter index %d out of bounds (max: %lu)", index, current_param_count - 1);
+    if (!ensure_binds(stmt)) {
         return false;
     }
 
-    if (!stmt->binds || stmt->param_count != current_param_count) {
-        if (stmt->binds) {
-            free(stmt->binds);
-            stmt->binds = NULL;
-        }
-        if (stmt->lengths) {
-            free(stmt->lengths);
-            stmt->lengths = NULL;
-        }
-        stmt->param_count = current_param_count;
-        stmt->binds = calloc(stmt->param_count, sizeof(MYSQL_BIND));
-        if (!stmt->binds) {
-            log_message(ERROR, "Failed to allocate memory for parameter bindings");
-            return false;
-        }
-        stmt->lengths = calloc(stmt->param_count, sizeof(unsigned long));
-        if (!stmt->lengths) {
-            free(stmt->binds);
-            stmt->binds = NULL;
-            log_message(ERROR, "Failed to allocate memory for length values");
-            return false;
-        }
-        stmt->is_bound = false;
-    }
-
-    // Cấp phát bộ nhớ cho giá trị long
-    long *pValue = malloc(sizeof(long));
-    if (!pValue) {
-        log_message(ERROR, "Failed to allocate memory for long parameter at index %d", index);
+    if (index >= stmt->param_count) {
+        log_message(ERROR, "Parameter index %d out of bounds (max: %lu)", index, stmt->param_count - 1);
         return false;
     }
-    *pValue = value;
+
+    stmt->values[index] = value;
 
     memset(&stmt->binds[index], 0, sizeof(MYSQL_BIND));
-    stmt->binds[index].buffer_type = MYSQL_TYPE_LONGLONG;  // Sử dụng MYSQL_TYPE_LONGLONG cho giá trị long
-    stmt->binds[index].buffer = pValue;
-    stmt->binds[index].buffer_length = sizeof(long);
+    stmt->binds[index].buffer_type = MYSQL_TYPE_LONGLONG;
+    stmt->binds[index].buffer = &stmt->values[index];
+    stmt->binds[index].buffer_length = sizeof(long long);
+    stmt->binds[index].is_null = 0;
+    stmt->is_bound = false;
 
-    unsigned long *len = malloc(sizeof(unsigned long));
-    if (!len) {
-        log_message(ERROR, "Failed to allocate memory for length at index %d", index);
-        free(pValue);
+    log_message(LOG_DEBUG, "Successfully bound long value %ld at index %d", value, index);
+    return true;
+}
+bool db_bind_null(DbStatement *stmt, int index) {
+    if (!stmt || !stmt->stmt || index < 0) {
+        log_message(ERROR, "Invalid statement or index for binding NULL");
         return false;
     }
-    *len = sizeof(long);
-    stmt->binds[index].length = len;
 
-    stmt->binds[index].is_null = 0;
+    if (!ensure_binds(stmt)) {
+        return false;
+    }
 
-    log_message(LOG_DEBUG, "Successfully bound long value %ld at index %d", value, index);
+    if (index >= stmt->param_count) {
+        log_message(ERROR, "Parameter index %d out of bounds (max: %lu)", index, stmt->param_count - 1);
+        return false;
+    }
+
+    memset(&stmt->binds[index], 0, sizeof(MYSQL_BIND));
+    stmt->binds[index].buffer_type = MYSQL_TYPE_NULL;
+    stmt->is_bound = false;
     return true;
 }
 int db_get_insert_id(DbStatement *stmt) {
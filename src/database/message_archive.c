@@ -0,0 +1,1281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "message_archive.h"
+#include "storage.h"
+#include "user_cache.h"
+#include "config.h"
+#include "m_utils.h"
+#include "log.h"
+
+/*
+ * <dir>/arc-<max id>.seg: header | block nén zlib ... | directory
+ *   Block: các bản ghi của một conversation theo thứ tự id, raw không quá MESSAGE_ARCHIVE_BLOCK_BYTES
+ *          (trừ khi một tin đã lớn hơn). Record: id (8) | sender (4) | timestamp (8) | length (4) | content
+ *   Directory: một ArchiveBlock cho mỗi block, sắp theo (conversation_id, first_id)
+ * <dir>/applied: max id của segment cuối đã xóa xong khỏi bảng messages.
+ * Segment mới chứa các id ngay sau segment trước nên thứ tự tên file cũng là thứ tự id.
+ * Số nguyên ghi theo byte order của máy như message log.
+ */
+#define ARCHIVE_MAGIC 0x56435241u
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_RECORD_FIXED 24
+#define ARCHIVE_PREFIX "arc-"
+#define ARCHIVE_SUFFIX ".seg"
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_count;
+    uint32_t message_count;
+    int64_t min_id;
+    int64_t max_id;
+    int64_t min_time;
+    int64_t max_time;
+    uint64_t directory_offset;
+    uint64_t file_size;
+} ArchiveHeader;
+
+typedef struct
+{
+    int64_t conversation_id;
+    int64_t first_id;
+    int64_t last_id;
+    int64_t min_time;
+    int64_t max_time;
+    uint64_t offset;
+    uint32_t compressed_length;
+    uint32_t raw_length;
+    uint32_t message_count;
+    // crc32 của phần đã nén
+    uint32_t crc;
+} ArchiveBlock;
+
+typedef struct
+{
+    uint8_t *data;
+    size_t size;
+    const ArchiveHeader *header;
+    const ArchiveBlock *blocks;
+} ArchiveSegment;
+
+typedef struct
+{
+    long long id;
+    int sender_id;
+    long long timestamp;
+    // Trỏ vào block đã giải nén, không kết thúc bằng '\0'
+    const char *content;
+    size_t content_length;
+} ArchiveRecord;
+
+static struct
+{
+    char *dir;
+    long long age_seconds;
+    int interval_ms;
+    int segment_rows;
+    // Tăng dần theo max_id; chỉ thread tiering thêm segment, dưới write lock
+    ArchiveSegment *segments;
+    int segment_count;
+    int segment_capacity;
+    pthread_rwlock_t lock;
+    // Reader cần bảng và archive nhất quán trong suốt một lần đọc giữ read lock này;
+    // tiering chỉ xóa tin khỏi bảng dưới write lock
+    pthread_rwlock_t pin;
+    // Chỉ thread tiering đọc ghi sau khi start
+    long long applied_id;
+    bool started;
+    bool tiering;
+    bool stopping;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+} message_archive = {
+    .lock = PTHREAD_RWLOCK_INITIALIZER,
+    .pin = PTHREAD_RWLOCK_INITIALIZER,
+    .mutex = PTHREAD_MUTEX_INITIALIZER};
+
+// ---------------------------------------------------------------- helpers
+
+static bool write_all(int fd, const void *data, size_t length)
+{
+    const char *p = data;
+    while (length > 0)
+    {
+        ssize_t n = write(fd, p, length);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+static bool reserve(void **items, int *capacity, int needed, size_t item_size)
+{
+    if (needed <= *capacity)
+    {
+        return true;
+    }
+    int next = *capacity > 0 ? *capacity * 2 : 64;
+    while (next < needed)
+    {
+        next *= 2;
+    }
+    void *grown = realloc(*items, next * item_size);
+    if (!grown)
+    {
+        return false;
+    }
+    *items = grown;
+    *capacity = next;
+    return true;
+}
+
+static bool stopping()
+{
+    pthread_mutex_lock(&message_archive.mutex);
+    bool stop = message_archive.stopping;
+    pthread_mutex_unlock(&message_archive.mutex);
+    return stop;
+}
+
+static void segment_path(long long max_id, char *path, size_t size)
+{
+    snprintf(path, size, "%s/" ARCHIVE_PREFIX "%020lld" ARCHIVE_SUFFIX, message_archive.dir, max_id);
+}
+
+// File mới chỉ chắc chắn còn sau crash khi thư mục chứa nó đã được fsync
+static void sync_dir(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+static int compare_long_long(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Vị trí đầu tiên có giá trị >= key
+static int lower_bound(const long long *values, int count, long long key)
+{
+    int low = 0, high = count;
+    while (low < high)
+    {
+        int mid = low + (high - low) / 2;
+        if (values[mid] < key)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// ---------------------------------------------------------------- segments
+
+static void segment_close(ArchiveSegment *segment)
+{
+    if (segment->data)
+    {
+        munmap(segment->data, segment->size);
+    }
+    memset(segment, 0, sizeof(*segment));
+}
+
+static bool segment_open(const char *path, ArchiveSegment *out)
+{
+    memset(out, 0, sizeof(*out));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        log_message(ERROR, "Failed to open archive segment %s: %s", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ArchiveHeader);
+    if (ok)
+    {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ok = data != MAP_FAILED;
+        if (ok)
+        {
+            out->data = data;
+            out->size = st.st_size;
+        }
+    }
+    close(fd);
+    if (!ok)
+    {
+        log_message(ERROR, "Failed to map archive segment %s", path);
+        return false;
+    }
+
+    const ArchiveHeader *header = (const ArchiveHeader *)out->data;
+    uint64_t directory_end = header->directory_offset + (uint64_t)header->block_count * sizeof(ArchiveBlock);
+    ok = header->magic == ARCHIVE_MAGIC && header->version == ARCHIVE_VERSION && header->file_size == out->size &&
+         header->directory_offset >= sizeof(ArchiveHeader) && header->directory_offset % 8 == 0 &&
+         directory_end == out->size;
+    for (uint32_t i = 0; ok && i < header->block_count; i++)
+    {
+        const ArchiveBlock *block =
+            (const ArchiveBlock *)(out->data + header->directory_offset) + i;
+        ok = block->offset >= sizeof(ArchiveHeader) &&
+             block->offset + block->compressed_length <= header->directory_offset;
+    }
+    if (!ok)
+    {
+        log_message(ERROR, "Archive segment %s is corrupt, skipped", path);
+        segment_close(out);
+        return false;
+    }
+    out->header = header;
+    out->blocks = (const ArchiveBlock *)(out->data + header->directory_offset);
+    return true;
+}
+
+// Block giải nén vào buffer malloc'd, caller free
+static uint8_t *inflate_block(const ArchiveSegment *segment, const ArchiveBlock *block)
+{
+    const uint8_t *compressed = segment->data + block->offset;
+    if (crc32(0L, compressed, block->compressed_length) != block->crc)
+    {
+        log_message(ERROR, "Archive block of conversation %lld at id %lld has a bad checksum",
+                    (long long)block->conversation_id, (long long)block->first_id);
+        return NULL;
+    }
+    uint8_t *raw = malloc(block->raw_length > 0 ? block->raw_length : 1);
+    if (!raw)
+    {
+        return NULL;
+    }
+    uLongf raw_length = block->raw_length;
+    if (uncompress(raw, &raw_length, compressed, block->compressed_length) != Z_OK ||
+        raw_length != block->raw_length)
+    {
+        log_message(ERROR, "Failed to inflate archive block of conversation %lld at id %lld",
+                    (long long)block->conversation_id, (long long)block->first_id);
+        free(raw);
+        return NULL;
+    }
+    return raw;
+}
+
+static bool next_record(const uint8_t *raw, size_t size, size_t *offset, ArchiveRecord *out)
+{
+    if (size - *offset < ARCHIVE_RECORD_FIXED)
+    {
+        return false;
+    }
+    const uint8_t *p = raw + *offset;
+    int64_t id, timestamp;
+    int32_t sender;
+    uint32_t length;
+    memcpy(&id, p, 8);
+    memcpy(&sender, p + 8, 4);
+    memcpy(&timestamp, p + 12, 8);
+    memcpy(&length, p + 20, 4);
+    if (length > size - *offset - ARCHIVE_RECORD_FIXED)
+    {
+        return false;
+    }
+    out->id = id;
+    out->sender_id = sender;
+    out->timestamp = timestamp;
+    out->content = (const char *)p + ARCHIVE_RECORD_FIXED;
+    out->content_length = length;
+    *offset += ARCHIVE_RECORD_FIXED + length;
+    return true;
+}
+
+// Id của mọi tin trong segment, tăng dần
+static bool segment_ids(const ArchiveSegment *segment, long long **out, int *count)
+{
+    *out = NULL;
+    *count = 0;
+    int capacity = 0;
+    for (uint32_t b = 0; b < segment->header->block_count; b++)
+    {
+        uint8_t *raw = inflate_block(segment, &segment->blocks[b]);
+        if (!raw)
+        {
+            free(*out);
+            *out = NULL;
+            return false;
+        }
+        size_t offset = 0;
+        ArchiveRecord record;
+        while (next_record(raw, segment->blocks[b].raw_length, &offset, &record))
+        {
+            if (!reserve((void **)out, &capacity, *count + 1, sizeof(long long)))
+            {
+                free(raw);
+                free(*out);
+                *out = NULL;
+                return false;
+            }
+            (*out)[(*count)++] = record.id;
+        }
+        free(raw);
+    }
+    if (*count > 0)
+    {
+        qsort(*out, *count, sizeof(long long), compare_long_long);
+    }
+    return true;
+}
+
+static int compare_segments(const void *a, const void *b)
+{
+    long long x = ((const ArchiveSegment *)a)->header->max_id;
+    long long y = ((const ArchiveSegment *)b)->header->max_id;
+    return (x > y) - (x < y);
+}
+
+static bool load_segments()
+{
+    DIR *dir = opendir(message_archive.dir);
+    if (!dir)
+    {
+        // Chưa từng tier thì chưa có thư mục
+        return errno == ENOENT;
+    }
+    size_t prefix_length = strlen(ARCHIVE_PREFIX);
+    size_t suffix_length = strlen(ARCHIVE_SUFFIX);
+    struct dirent *entry;
+    bool ok = true;
+    while (ok && (entry = readdir(dir)) != NULL)
+    {
+        size_t length = strlen(entry->d_name);
+        if (length <= prefix_length || strncmp(entry->d_name, ARCHIVE_PREFIX, prefix_length) != 0)
+        {
+            continue;
+        }
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", message_archive.dir, entry->d_name);
+        // Segment ghi dở lúc crash, các tin của nó vẫn còn trong bảng
+        if (length > 4 && strcmp(entry->d_name + length - 4, ".tmp") == 0)
+        {
+            unlink(path);
+            continue;
+        }
+        if (length <= suffix_length || strcmp(entry->d_name + length - suffix_length, ARCHIVE_SUFFIX) != 0)
+        {
+            continue;
+        }
+        ArchiveSegment segment;
+        if (!segment_open(path, &segment))
+        {
+            continue;
+        }
+        ok = reserve((void **)&message_archive.segments, &message_archive.segment_capacity,
+                     message_archive.segment_count + 1, sizeof(ArchiveSegment));
+        if (ok)
+        {
+            message_archive.segments[message_archive.segment_count++] = segment;
+        }
+        else
+        {
+            segment_close(&segment);
+        }
+    }
+    closedir(dir);
+    if (message_archive.segment_count > 1)
+    {
+        qsort(message_archive.segments, message_archive.segment_count, sizeof(ArchiveSegment), compare_segments);
+    }
+    return ok;
+}
+
+static long long read_applied()
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/applied", message_archive.dir);
+    FILE *file = fopen(path, "r");
+    long long applied = 0;
+    if (file)
+    {
+        if (fscanf(file, "%lld", &applied) != 1)
+        {
+            applied = 0;
+        }
+        fclose(file);
+    }
+    return applied;
+}
+
+static bool write_applied(long long applied)
+{
+    char path[1024], tmp[1040];
+    snprintf(path, sizeof(path), "%s/applied", message_archive.dir);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%lld\n", applied);
+    bool ok = fd >= 0 && write_all(fd, text, (size_t)length) && fsync(fd) == 0;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok)
+    {
+        log_message(ERROR, "Failed to write archive marker %s: %s", path, strerror(errno));
+        unlink(tmp);
+        return false;
+    }
+    sync_dir(message_archive.dir);
+    return true;
+}
+
+// ---------------------------------------------------------------- writing
+
+static int compare_rows(const void *a, const void *b)
+{
+    const MessageSearchResult *x = a;
+    const MessageSearchResult *y = b;
+    if (x->conversation_id != y->conversation_id)
+    {
+        return (x->conversation_id > y->conversation_id) - (x->conversation_id < y->conversation_id);
+    }
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+typedef struct
+{
+    int fd;
+    uint64_t offset;
+    uint8_t *raw;
+    size_t raw_length;
+    size_t raw_capacity;
+    uint8_t *compressed;
+    size_t compressed_capacity;
+    ArchiveBlock *blocks;
+    int block_count;
+    int block_capacity;
+    ArchiveBlock current;
+} SegmentWriter;
+
+static bool writer_flush(SegmentWriter *writer)
+{
+    if (writer->current.message_count == 0)
+    {
+        return true;
+    }
+    uLongf bound = compressBound(writer->raw_length);
+    if (bound > writer->compressed_capacity)
+    {
+        uint8_t *grown = realloc(writer->compressed, bound);
+        if (!grown)
+        {
+            return false;
+        }
+        writer->compressed = grown;
+        writer->compressed_capacity = bound;
+    }
+    uLongf compressed_length = bound;
+    if (compress2(writer->compressed, &compressed_length, writer->raw, writer->raw_length,
+                  MESSAGE_ARCHIVE_COMPRESSION_LEVEL) != Z_OK ||
+        !write_all(writer->fd, writer->compressed, compressed_length) ||
+        !reserve((void **)&writer->blocks, &writer->block_capacity, writer->block_count + 1, sizeof(ArchiveBlock)))
+    {
+        return false;
+    }
+    writer->current.offset = writer->offset;
+    writer->current.compressed_length = (uint32_t)compressed_length;
+    writer->current.raw_length = (uint32_t)writer->raw_length;
+    writer->current.crc = (uint32_t)crc32(0L, writer->compressed, compressed_length);
+    writer->blocks[writer->block_count++] = writer->current;
+    writer->offset += compressed_length;
+    writer->raw_length = 0;
+    memset(&writer->current, 0, sizeof(writer->current));
+    return true;
+}
+
+static bool writer_add(SegmentWriter *writer, const MessageSearchResult *row)
+{
+    size_t content_length = row->content ? strlen(row->content) : 0;
+    size_t record_length = ARCHIVE_RECORD_FIXED + content_length;
+    // Mỗi block chỉ có một conversation, đóng block khi đổi conversation hoặc đầy
+    if (writer->current.message_count > 0 &&
+        (writer->current.conversation_id != row->conversation_id ||
+         writer->raw_length + record_length > MESSAGE_ARCHIVE_BLOCK_BYTES) &&
+        !writer_flush(writer))
+    {
+        return false;
+    }
+    if (writer->raw_length + record_length > writer->raw_capacity)
+    {
+        size_t capacity = writer->raw_length + record_length > MESSAGE_ARCHIVE_BLOCK_BYTES
+                              ? writer->raw_length + record_length
+                              : MESSAGE_ARCHIVE_BLOCK_BYTES;
+        uint8_t *grown = realloc(writer->raw, capacity);
+        if (!grown)
+        {
+            return false;
+        }
+        writer->raw = grown;
+        writer->raw_capacity = capacity;
+    }
+
+    int64_t id = row->id;
+    int32_t sender = row->sender_id;
+    int64_t timestamp = row->timestamp;
+    uint32_t length = (uint32_t)content_length;
+    uint8_t *p = writer->raw + writer->raw_length;
+    memcpy(p, &id, 8);
+    memcpy(p + 8, &sender, 4);
+    memcpy(p + 12, &timestamp, 8);
+    memcpy(p + 20, &length, 4);
+    if (content_length > 0)
+    {
+        memcpy(p + ARCHIVE_RECORD_FIXED, row->content, content_length);
+    }
+    writer->raw_length += record_length;
+
+    ArchiveBlock *block = &writer->current;
+    if (block->message_count == 0)
+    {
+        block->conversation_id = row->conversation_id;
+        block->first_id = row->id;
+        block->min_time = row->timestamp;
+        block->max_time = row->timestamp;
+    }
+    block->last_id = row->id;
+    block->min_time = row->timestamp < block->min_time ? row->timestamp : block->min_time;
+    block->max_time = row->timestamp > block->max_time ? row->timestamp : block->max_time;
+    block->message_count++;
+    return true;
+}
+
+// rows bị sắp lại theo (conversation, id). Segment chỉ được map sau khi đã fsync và rename
+static bool write_segment(MessageSearchResult *rows, int count, ArchiveSegment *out)
+{
+    ArchiveHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = ARCHIVE_MAGIC;
+    header.version = ARCHIVE_VERSION;
+    header.message_count = (uint32_t)count;
+    header.min_id = rows[0].id;
+    header.max_id = rows[count - 1].id;
+    header.min_time = rows[0].timestamp;
+    header.max_time = rows[0].timestamp;
+    for (int i = 0; i < count; i++)
+    {
+        header.min_time = rows[i].timestamp < header.min_time ? rows[i].timestamp : header.min_time;
+        header.max_time = rows[i].timestamp > header.max_time ? rows[i].timestamp : header.max_time;
+    }
+    qsort(rows, count, sizeof(MessageSearchResult), compare_rows);
+
+    char path[1024], tmp[1040];
+    segment_path(header.max_id, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    SegmentWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    writer.offset = sizeof(ArchiveHeader);
+    // Header ghi lại ở cuối khi đã biết directory nằm đâu
+    bool ok = writer.fd >= 0 && write_all(writer.fd, &header, sizeof(header));
+    for (int i = 0; i < count && ok; i++)
+    {
+        ok = writer_add(&writer, &rows[i]);
+    }
+    ok = ok && writer_flush(&writer);
+    // Directory được đọc thẳng từ vùng map nên phải căn 8 byte
+    static const uint8_t padding[8] = {0};
+    size_t padding_length = (8 - writer.offset % 8) % 8;
+    ok = ok && write_all(writer.fd, padding, padding_length);
+    writer.offset += padding_length;
+    if (ok)
+    {
+        header.block_count = (uint32_t)writer.block_count;
+        header.directory_offset = writer.offset;
+        header.file_size = writer.offset + (uint64_t)writer.block_count * sizeof(ArchiveBlock);
+        ok = write_all(writer.fd, writer.blocks, (size_t)writer.block_count * sizeof(ArchiveBlock)) &&
+             pwrite(writer.fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) && fsync(writer.fd) == 0;
+    }
+    if (writer.fd >= 0)
+    {
+        close(writer.fd);
+    }
+    free(writer.raw);
+    free(writer.compressed);
+    free(writer.blocks);
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok)
+    {
+        log_message(ERROR, "Failed to write archive segment %s: %s", path, strerror(errno));
+        unlink(tmp);
+        return false;
+    }
+    sync_dir(message_archive.dir);
+    return segment_open(path, out);
+}
+
+// ---------------------------------------------------------------- tiering
+
+// Xóa khỏi bảng các tin của segment chưa được áp dụng, ví dụ vì crash giữa chừng
+static bool apply_pending()
+{
+    // Chỉ thread này thêm segment nên đọc danh sách không cần lock
+    for (int i = 0; i < message_archive.segment_count; i++)
+    {
+        const ArchiveSegment *segment = &message_archive.segments[i];
+        if (segment->header->max_id <= message_archive.applied_id)
+        {
+            continue;
+        }
+        long long *ids = NULL;
+        int id_count = 0;
+        bool ok = segment_ids(segment, &ids, &id_count);
+        for (int start = 0; ok && start < id_count; start += MESSAGE_ARCHIVE_FETCH_ROWS)
+        {
+            int chunk = id_count - start < MESSAGE_ARCHIVE_FETCH_ROWS ? id_count - start : MESSAGE_ARCHIVE_FETCH_ROWS;
+            pthread_rwlock_wrlock(&message_archive.pin);
+            ok = storage()->messages_delete(ids + start, chunk);
+            pthread_rwlock_unlock(&message_archive.pin);
+        }
+        free(ids);
+        if (!ok || !write_applied(segment->header->max_id))
+        {
+            log_message(ERROR, "Failed to remove archived messages up to id %lld from storage",
+                        (long long)segment->header->max_id);
+            return false;
+        }
+        message_archive.applied_id = segment->header->max_id;
+    }
+    return true;
+}
+
+static void free_rows(MessageSearchResult *rows, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        free(rows[i].sender_name);
+        free(rows[i].content);
+    }
+    free(rows);
+}
+
+/*
+ * Các tin cũ hơn cutoff liền sau applied_id theo thứ tự id, dừng ở tin đầu tiên còn mới.
+ * Mọi id <= applied_id đã rời bảng nên segment sau luôn chứa id lớn hơn segment trước.
+ */
+static bool collect_rows(long long cutoff, MessageSearchResult **out, int *count)
+{
+    *out = NULL;
+    *count = 0;
+    int capacity = 0;
+    long long after_id = message_archive.applied_id;
+    while (*count < message_archive.segment_rows)
+    {
+        int limit = message_archive.segment_rows - *count < MESSAGE_ARCHIVE_FETCH_ROWS
+                        ? message_archive.segment_rows - *count
+                        : MESSAGE_ARCHIVE_FETCH_ROWS;
+        MessageSearchResult *batch = NULL;
+        int batch_count = 0;
+        if (!storage()->messages_after(after_id, limit, &batch, &batch_count) ||
+            !reserve((void **)out, &capacity, *count + batch_count, sizeof(MessageSearchResult)))
+        {
+            free_rows(batch, batch_count);
+            free_rows(*out, *count);
+            *out = NULL;
+            *count = 0;
+            return false;
+        }
+        int taken = 0;
+        while (taken < batch_count && batch[taken].timestamp < cutoff)
+        {
+            (*out)[(*count)++] = batch[taken++];
+        }
+        bool reached_cutoff = taken < batch_count;
+        for (int i = taken; i < batch_count; i++)
+        {
+            free(batch[i].sender_name);
+            free(batch[i].content);
+        }
+        free(batch);
+        if (reached_cutoff || batch_count < limit)
+        {
+            break;
+        }
+        after_id = (*out)[*count - 1].id;
+    }
+    return true;
+}
+
+static void run_tiering()
+{
+    if (!apply_pending())
+    {
+        return;
+    }
+    long long cutoff = (long long)time(NULL) - message_archive.age_seconds;
+    while (!stopping())
+    {
+        MessageSearchResult *rows = NULL;
+        int count = 0;
+        if (!collect_rows(cutoff, &rows, &count))
+        {
+            log_message(ERROR, "Failed to read messages to archive");
+            return;
+        }
+        if (count == 0)
+        {
+            free(rows);
+            return;
+        }
+        ArchiveSegment segment;
+        bool written = write_segment(rows, count, &segment);
+        free_rows(rows, count);
+        if (!written)
+        {
+            return;
+        }
+
+        // Segment phải đọc được trước khi tin rời bảng, reader đọc bảng trước rồi mới tới archive
+        pthread_rwlock_wrlock(&message_archive.lock);
+        bool added = reserve((void **)&message_archive.segments, &message_archive.segment_capacity,
+                             message_archive.segment_count + 1, sizeof(ArchiveSegment));
+        if (added)
+        {
+            message_archive.segments[message_archive.segment_count++] = segment;
+        }
+        pthread_rwlock_unlock(&message_archive.lock);
+        if (!added)
+        {
+            // File vẫn còn và được nạp lại lúc khởi động sau
+            segment_close(&segment);
+            return;
+        }
+        log_message(INFO, "Archived %d messages with ids %lld-%lld in %u blocks", count,
+                    (long long)segment.header->min_id, (long long)segment.header->max_id,
+                    segment.header->block_count);
+
+        if (!apply_pending() || count < message_archive.segment_rows)
+        {
+            return;
+        }
+    }
+}
+
+static void *archive_thread(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&message_archive.mutex);
+    while (!message_archive.stopping)
+    {
+        pthread_mutex_unlock(&message_archive.mutex);
+        run_tiering();
+        pthread_mutex_lock(&message_archive.mutex);
+        if (message_archive.stopping)
+        {
+            break;
+        }
+        long long deadline_ms = utils_now_ms() + message_archive.interval_ms;
+        struct timespec deadline = {.tv_sec = deadline_ms / 1000, .tv_nsec = (deadline_ms % 1000) * 1000000};
+        pthread_cond_timedwait(&message_archive.wake, &message_archive.mutex, &deadline);
+    }
+    pthread_mutex_unlock(&message_archive.mutex);
+    return NULL;
+}
+
+// ---------------------------------------------------------------- reading
+
+// Điền sender_name từ user cache; tin của user không còn tồn tại bị bỏ như JOIN users trong SQL
+static void resolve_message_senders(MessageData *messages, int *count)
+{
+    int kept = 0;
+    for (int i = 0; i < *count; i++)
+    {
+        UserCacheEntry user;
+        if (user_cache_get(messages[i].sender_id, &user) && (messages[i].sender_name = strdup(user.username)))
+        {
+            messages[kept++] = messages[i];
+        }
+        else
+        {
+            free(messages[i].content);
+        }
+    }
+    *count = kept;
+}
+
+static void resolve_result_senders(MessageSearchResult *results, int *count)
+{
+    int kept = 0;
+    for (int i = 0; i < *count; i++)
+    {
+        UserCacheEntry user;
+        if (user_cache_get(results[i].sender_id, &user) && (results[i].sender_name = strdup(user.username)))
+        {
+            results[kept++] = results[i];
+        }
+        else
+        {
+            free(results[i].content);
+        }
+    }
+    *count = kept;
+}
+
+// Block đầu tiên của conversation trong directory, block_count nếu không có
+static uint32_t first_block(const ArchiveSegment *segment, long long conversation_id)
+{
+    uint32_t low = 0, high = segment->header->block_count;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (segment->blocks[mid].conversation_id < conversation_id)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Gọi visit cho từng tin đã archive của conversation theo thứ tự id, dưới read lock; visit trả
+// false để dừng. false nếu có block không đọc được
+static bool visit_conversation(long long conversation_id, bool (*visit)(const ArchiveRecord *record, void *context),
+                               void *context)
+{
+    bool ok = true;
+    bool more = true;
+    pthread_rwlock_rdlock(&message_archive.lock);
+    for (int s = 0; s < message_archive.segment_count && ok && more; s++)
+    {
+        const ArchiveSegment *segment = &message_archive.segments[s];
+        for (uint32_t b = first_block(segment, conversation_id); ok && more && b < segment->header->block_count; b++)
+        {
+            const ArchiveBlock *block = &segment->blocks[b];
+            if (block->conversation_id != conversation_id)
+            {
+                break;
+            }
+            uint8_t *raw = inflate_block(segment, block);
+            ok = raw != NULL;
+            size_t offset = 0;
+            ArchiveRecord record;
+            while (ok && more && next_record(raw, block->raw_length, &offset, &record))
+            {
+                more = visit(&record, context);
+            }
+            free(raw);
+        }
+    }
+    pthread_rwlock_unlock(&message_archive.lock);
+    return ok;
+}
+
+typedef struct
+{
+    MessageData *messages;
+    int capacity;
+    int total;
+    bool failed;
+} ArchiveCollect;
+
+static bool collect_record(const ArchiveRecord *record, void *context)
+{
+    ArchiveCollect *collect = context;
+    char *content = NULL;
+    if (reserve((void **)&collect->messages, &collect->capacity, collect->total + 1, sizeof(MessageData)))
+    {
+        content = strndup(record->content, record->content_length);
+    }
+    if (!content)
+    {
+        collect->failed = true;
+        return false;
+    }
+    MessageData *message = &collect->messages[collect->total++];
+    message->id = (long)record->id;
+    message->sender_id = record->sender_id;
+    message->sender_name = NULL;
+    message->content = content;
+    message->timestamp = (long)record->timestamp;
+    return true;
+}
+
+bool message_archive_read(long long conversation_id, MessageData **out, int *count)
+{
+    *out = NULL;
+    *count = 0;
+    ArchiveCollect collect = {0};
+    bool ok = visit_conversation(conversation_id, collect_record, &collect);
+
+    if (!ok || collect.failed)
+    {
+        for (int i = 0; i < collect.total; i++)
+        {
+            free(collect.messages[i].content);
+        }
+        free(collect.messages);
+        return false;
+    }
+    resolve_message_senders(collect.messages, &collect.total);
+    if (collect.total == 0)
+    {
+        free(collect.messages);
+        return true;
+    }
+    *out = collect.messages;
+    *count = collect.total;
+    return true;
+}
+
+typedef struct
+{
+    MessageRowFn each;
+    void *arg;
+    bool failed;
+} ArchiveVisit;
+
+static bool visit_record(const ArchiveRecord *record, void *context)
+{
+    ArchiveVisit *visit = context;
+    UserCacheEntry user;
+    // Bỏ tin của user không còn tồn tại như resolve_message_senders
+    if (!user_cache_get(record->sender_id, &user))
+    {
+        return true;
+    }
+    char *content = strndup(record->content, record->content_length);
+    if (!content)
+    {
+        visit->failed = true;
+        return false;
+    }
+    MessageData message = {(long)record->id, record->sender_id, user.username, content, (long)record->timestamp};
+    bool more = visit->each(&message, visit->arg);
+    free(content);
+    return more;
+}
+
+bool message_archive_each(long long conversation_id, MessageRowFn each, void *arg)
+{
+    ArchiveVisit visit = {each, arg, false};
+    bool ok = visit_conversation(conversation_id, visit_record, &visit);
+    return ok && !visit.failed;
+}
+
+void message_archive_pin()
+{
+    pthread_rwlock_rdlock(&message_archive.pin);
+}
+
+void message_archive_unpin()
+{
+    pthread_rwlock_unlock(&message_archive.pin);
+}
+
+static int compare_results_by_id(const void *a, const void *b)
+{
+    long x = ((const MessageSearchResult *)a)->id;
+    long y = ((const MessageSearchResult *)b)->id;
+    return (x > y) - (x < y);
+}
+
+bool message_archive_after(long long after_id, int limit, MessageSearchResult **out, int *count)
+{
+    *out = NULL;
+    *count = 0;
+    if (limit <= 0)
+    {
+        return true;
+    }
+    MessageSearchResult *results = NULL;
+    int capacity = 0;
+    int total = 0;
+    bool ok = true;
+
+    pthread_rwlock_rdlock(&message_archive.lock);
+    // Segment đầu tiên còn id > after_id; các block chia theo conversation nên phải đọc cả segment rồi sắp lại
+    int s = 0;
+    while (s < message_archive.segment_count && message_archive.segments[s].header->max_id <= after_id)
+    {
+        s++;
+    }
+    for (; s < message_archive.segment_count && ok && total < limit; s++)
+    {
+        const ArchiveSegment *segment = &message_archive.segments[s];
+        int segment_start = total;
+        for (uint32_t b = 0; b < segment->header->block_count && ok; b++)
+        {
+            const ArchiveBlock *block = &segment->blocks[b];
+            if (block->last_id <= after_id)
+            {
+                continue;
+            }
+            uint8_t *raw = inflate_block(segment, block);
+            ok = raw != NULL;
+            size_t offset = 0;
+            ArchiveRecord record;
+            while (ok && next_record(raw, block->raw_length, &offset, &record))
+            {
+                if (record.id <= after_id)
+                {
+                    continue;
+                }
+                ok = reserve((void **)&results, &capacity, total + 1, sizeof(MessageSearchResult));
+                char *content = ok ? strndup(record.content, record.content_length) : NULL;
+                ok = content != NULL;
+                if (ok)
+                {
+                    memset(&results[total], 0, sizeof(MessageSearchResult));
+                    results[total].id = (long)record.id;
+                    results[total].conversation_id = (long)block->conversation_id;
+                    results[total].sender_id = record.sender_id;
+                    results[total].content = content;
+                    results[total].timestamp = (long)record.timestamp;
+                    total++;
+                }
+            }
+            free(raw);
+        }
+        if (ok && total - segment_start > 1)
+        {
+            qsort(results + segment_start, total - segment_start, sizeof(MessageSearchResult), compare_results_by_id);
+        }
+    }
+    pthread_rwlock_unlock(&message_archive.lock);
+
+    if (!ok)
+    {
+        for (int i = 0; i < total; i++)
+        {
+            free(results[i].content);
+        }
+        free(results);
+        return false;
+    }
+    // Segment cuối có thể cho nhiều hơn limit
+    for (int i = limit; i < total; i++)
+    {
+        free(results[i].content);
+    }
+    total = total < limit ? total : limit;
+    if (total <= 0)
+    {
+        free(results);
+        return true;
+    }
+    *out = results;
+    *count = total;
+    return true;
+}
+
+bool message_archive_by_ids(const long long *ids, int id_count, MessageSearchResult **out, int *count)
+{
+    *out = NULL;
+    *count = 0;
+    if (id_count <= 0)
+    {
+        return true;
+    }
+    long long *sorted = malloc(sizeof(long long) * id_count);
+    if (!sorted)
+    {
+        return false;
+    }
+    memcpy(sorted, ids, sizeof(long long) * id_count);
+    qsort(sorted, id_count, sizeof(long long), compare_long_long);
+
+    MessageSearchResult *results = NULL;
+    int capacity = 0;
+    int total = 0;
+    bool ok = true;
+
+    pthread_rwlock_rdlock(&message_archive.lock);
+    for (int s = 0; s < message_archive.segment_count && ok; s++)
+    {
+        const ArchiveSegment *segment = &message_archive.segments[s];
+        int first = lower_bound(sorted, id_count, segment->header->min_id);
+        if (first == id_count || sorted[first] > segment->header->max_id)
+        {
+            continue;
+        }
+        // Chỉ giải nén block có id cần tìm trong khoảng [first_id, last_id] của nó
+        for (uint32_t b = 0; b < segment->header->block_count && ok; b++)
+        {
+            const ArchiveBlock *block = &segment->blocks[b];
+            int hit = lower_bound(sorted, id_count, block->first_id);
+            if (hit == id_count || sorted[hit] > block->last_id)
+            {
+                continue;
+            }
+            uint8_t *raw = inflate_block(segment, block);
+            ok = raw != NULL;
+            size_t offset = 0;
+            ArchiveRecord record;
+            while (ok && next_record(raw, block->raw_length, &offset, &record))
+            {
+                int at = lower_bound(sorted, id_count, record.id);
+                if (at == id_count || sorted[at] != record.id)
+                {
+                    continue;
+                }
+                ok = reserve((void **)&results, &capacity, total + 1, sizeof(MessageSearchResult));
+                char *content = ok ? strndup(record.content, record.content_length) : NULL;
+                ok = content != NULL;
+                if (ok)
+                {
+                    memset(&results[total], 0, sizeof(MessageSearchResult));
+                    results[total].id = (long)record.id;
+                    results[total].conversation_id = (long)block->conversation_id;
+                    results[total].sender_id = record.sender_id;
+                    results[total].content = content;
+                    results[total].timestamp = (long)record.timestamp;
+                    total++;
+                }
+            }
+            free(raw);
+        }
+    }
+    pthread_rwlock_unlock(&message_archive.lock);
+    free(sorted);
+
+    if (!ok)
+    {
+        for (int i = 0; i < total; i++)
+        {
+            free(results[i].content);
+        }
+        free(results);
+        return false;
+    }
+    resolve_result_senders(results, &total);
+    if (total == 0)
+    {
+        free(results);
+        return true;
+    }
+    *out = results;
+    *count = total;
+    return true;
+}
+
+// ---------------------------------------------------------------- lifecycle
+
+bool message_archive_start()
+{
+    if (message_archive.started)
+    {
+        return true;
+    }
+    const char *dir = config_get_archive_path();
+    int age_days = config_get_archive_age_days();
+    int interval_ms = config_get_archive_interval_ms();
+    int segment_rows = config_get_archive_segment_rows();
+    message_archive.dir = strdup(dir && *dir ? dir : MESSAGE_ARCHIVE_DEFAULT_PATH);
+    message_archive.age_seconds = (long long)(age_days > 0 ? age_days : MESSAGE_ARCHIVE_DEFAULT_AGE_DAYS) * 86400;
+    message_archive.interval_ms = interval_ms > 0 ? interval_ms : MESSAGE_ARCHIVE_DEFAULT_INTERVAL_MS;
+    message_archive.segment_rows = segment_rows > 0 ? segment_rows : MESSAGE_ARCHIVE_DEFAULT_SEGMENT_ROWS;
+    if (!message_archive.dir)
+    {
+        return false;
+    }
+
+    bool tiering = config_get_archive_enabled();
+    if (tiering && config_get_message_log_enabled())
+    {
+        log_message(WARN, "Message archive tiers the messages table, tiering is off with message_log.enabled");
+        tiering = false;
+    }
+    if (tiering && mkdir(message_archive.dir, 0755) != 0 && errno != EEXIST)
+    {
+        log_message(ERROR, "Failed to create archive directory %s: %s", message_archive.dir, strerror(errno));
+        free(message_archive.dir);
+        message_archive.dir = NULL;
+        return false;
+    }
+    if (!load_segments())
+    {
+        log_message(ERROR, "Failed to load archive segments from %s", message_archive.dir);
+        message_archive_stop();
+        return false;
+    }
+    message_archive.applied_id = read_applied();
+
+    if (tiering)
+    {
+        // Deadline của timedwait tính bằng utils_now_ms (CLOCK_MONOTONIC)
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&message_archive.wake, &attr);
+        pthread_condattr_destroy(&attr);
+
+        message_archive.stopping = false;
+        if (pthread_create(&message_archive.thread, NULL, archive_thread, NULL) != 0)
+        {
+            log_message(ERROR, "Failed to create message archive thread");
+            pthread_cond_destroy(&message_archive.wake);
+            message_archive_stop();
+            return false;
+        }
+        message_archive.tiering = true;
+    }
+    message_archive.started = true;
+    log_message(INFO, "Message archive in %s: %d segments, tiering %s", message_archive.dir,
+                message_archive.segment_count, tiering ? "on" : "off");
+    return true;
+}
+
+void message_archive_stop()
+{
+    if (message_archive.tiering)
+    {
+        pthread_mutex_lock(&message_archive.mutex);
+        message_archive.stopping = true;
+        pthread_cond_signal(&message_archive.wake);
+        pthread_mutex_unlock(&message_archive.mutex);
+        pthread_join(message_archive.thread, NULL);
+        pthread_cond_destroy(&message_archive.wake);
+        message_archive.tiering = false;
+    }
+
+    pthread_rwlock_wrlock(&message_archive.lock);
+    for (int i = 0; i < message_archive.segment_count; i++)
+    {
+        segment_close(&message_archive.segments[i]);
+    }
+    free(message_archive.segments);
+    message_archive.segments = NULL;
+    message_archive.segment_count = 0;
+    message_archive.segment_capacity = 0;
+    pthread_rwlock_unlock(&message_archive.lock);
+
+    free(message_archive.dir);
+    message_archive.dir = NULL;
+    message_archive.started = false;
+}
@@ -0,0 +1,1053 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "message_index.h"
+#include "membership_index.h"
+#include "message_archive.h"
+#include "storage.h"
+#include "config.h"
+#include "m_utils.h"
+#include "log.h"
+
+/*
+ * Segment file: header | docs | terms | strings | postings
+ * docs:     doc_count x (message id, conversation id), tăng dần theo message id
+ * terms:    term_count x SegmentTerm, sắp xếp theo bytes của term
+ * postings: mỗi term một dãy chỉ số doc tăng dần, mã hóa varint của hiệu hai số liên tiếp
+ * Số nguyên ghi theo byte order của máy như WAL, file chỉ dùng lại trên chính server này.
+ */
+#define SEGMENT_MAGIC 0x5844494Du
+#define SEGMENT_VERSION 1
+#define ACTIVE_BUCKETS 65536
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t doc_count;
+    uint32_t term_count;
+    uint64_t docs_offset;
+    uint64_t terms_offset;
+    uint64_t strings_offset;
+    uint64_t postings_offset;
+    uint64_t file_size;
+} SegmentHeader;
+
+typedef struct
+{
+    int64_t message_id;
+    int64_t conversation_id;
+} SegmentDoc;
+
+typedef struct
+{
+    uint64_t postings_offset;
+    uint32_t string_offset;
+    uint32_t postings_length;
+    uint32_t doc_freq;
+    uint16_t length;
+    uint16_t reserved;
+} SegmentTerm;
+
+typedef struct
+{
+    uint8_t *map;
+    size_t size;
+    const SegmentHeader *header;
+    const SegmentDoc *docs;
+    const SegmentTerm *terms;
+    const char *strings;
+    const uint8_t *postings;
+    long long max_id;
+} Segment;
+
+typedef struct ActiveTerm
+{
+    char *term;
+    int length;
+    uint32_t *docs;
+    int count;
+    int capacity;
+    struct ActiveTerm *next;
+} ActiveTerm;
+
+// Segment đang xây trong bộ nhớ, chỉ thread indexer ghi vào
+typedef struct
+{
+    SegmentDoc *docs;
+    int doc_count;
+    int doc_capacity;
+    ActiveTerm **buckets;
+    int term_count;
+} ActiveSegment;
+
+typedef struct
+{
+    char term[MESSAGE_INDEX_MAX_TOKEN + 1];
+    int length;
+} Token;
+
+typedef struct
+{
+    Segment *segments;
+    int segment_count;
+    ActiveSegment active;
+    // id lớn nhất đã được index (kể cả trong active)
+    long long last_id;
+
+    char *dir;
+    int segment_docs;
+    int poll_ms;
+
+    // segments và active; search giữ read lock, indexer giữ write lock khi sửa
+    pthread_rwlock_t lock;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_t thread;
+    bool running;
+    bool stopping;
+    bool notified;
+} MessageIndex;
+
+static MessageIndex message_index = {
+    .segments = NULL,
+    .segment_count = 0,
+    .last_id = 0,
+    .lock = PTHREAD_RWLOCK_INITIALIZER,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .running = false,
+    .stopping = false,
+    .notified = false};
+
+static inline bool is_word_byte(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+/**
+ * Tách text thành các token chữ thường (ASCII), gọi on_token cho từng token.
+ * Token dài hơn MESSAGE_INDEX_MAX_TOKEN bị cắt, query và tin cùng cắt như nhau nên vẫn khớp
+ */
+static void tokenize(const char *text, void (*on_token)(const Token *, void *), void *arg)
+{
+    const unsigned char *p = (const unsigned char *)text;
+    while (*p)
+    {
+        while (*p && !is_word_byte(*p))
+        {
+            p++;
+        }
+        Token token;
+        token.length = 0;
+        while (*p && is_word_byte(*p))
+        {
+            if (token.length < MESSAGE_INDEX_MAX_TOKEN)
+            {
+                token.term[token.length++] = (*p >= 'A' && *p <= 'Z') ? (char)(*p + 32) : (char)*p;
+            }
+            p++;
+        }
+        if (token.length >= MESSAGE_INDEX_MIN_TOKEN)
+        {
+            token.term[token.length] = '\0';
+            on_token(&token, arg);
+        }
+    }
+}
+
+static inline uint32_t hash_term(const char *term, int length)
+{
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < length; i++)
+    {
+        h = (h ^ (unsigned char)term[i]) * 16777619u;
+    }
+    return h;
+}
+
+static int compare_terms(const char *a, int a_length, const char *b, int b_length)
+{
+    int cmp = memcmp(a, b, a_length < b_length ? a_length : b_length);
+    return cmp != 0 ? cmp : a_length - b_length;
+}
+
+// ---------------------------------------------------------------- active segment
+
+static ActiveTerm *active_find(const ActiveSegment *active, const char *term, int length)
+{
+    for (ActiveTerm *entry = active->buckets[hash_term(term, length) % ACTIVE_BUCKETS]; entry; entry = entry->next)
+    {
+        if (entry->length == length && memcmp(entry->term, term, length) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    ActiveSegment *active;
+    uint32_t doc;
+    bool failed;
+} AddContext;
+
+static void active_add_token(const Token *token, void *arg)
+{
+    AddContext *context = (AddContext *)arg;
+    ActiveSegment *active = context->active;
+    ActiveTerm *entry = active_find(active, token->term, token->length);
+    if (!entry)
+    {
+        entry = calloc(1, sizeof(ActiveTerm));
+        char *term = entry ? malloc(token->length) : NULL;
+        if (!term)
+        {
+            free(entry);
+            context->failed = true;
+            return;
+        }
+        memcpy(term, token->term, token->length);
+        entry->term = term;
+        entry->length = token->length;
+        uint32_t bucket = hash_term(token->term, token->length) % ACTIVE_BUCKETS;
+        entry->next = active->buckets[bucket];
+        active->buckets[bucket] = entry;
+        active->term_count++;
+    }
+
+    // Từ lặp lại trong cùng một tin chỉ ghi một lần
+    if (entry->count > 0 && entry->docs[entry->count - 1] == context->doc)
+    {
+        return;
+    }
+    if (entry->count == entry->capacity)
+    {
+        int capacity = entry->capacity > 0 ? entry->capacity * 2 : 4;
+        uint32_t *docs = realloc(entry->docs, capacity * sizeof(uint32_t));
+        if (!docs)
+        {
+            context->failed = true;
+            return;
+        }
+        entry->docs = docs;
+        entry->capacity = capacity;
+    }
+    entry->docs[entry->count++] = context->doc;
+}
+
+// Gọi khi đang giữ write lock. false nếu không thêm được doc
+static bool active_add(ActiveSegment *active, long long message_id, long long conversation_id, const char *content)
+{
+    if (!active->buckets)
+    {
+        active->buckets = calloc(ACTIVE_BUCKETS, sizeof(ActiveTerm *));
+        if (!active->buckets)
+        {
+            return false;
+        }
+    }
+    if (active->doc_count == active->doc_capacity)
+    {
+        int capacity = active->doc_capacity > 0 ? active->doc_capacity * 2 : 1024;
+        SegmentDoc *docs = realloc(active->docs, capacity * sizeof(SegmentDoc));
+        if (!docs)
+        {
+            return false;
+        }
+        active->docs = docs;
+        active->doc_capacity = capacity;
+    }
+
+    AddContext context = {active, (uint32_t)active->doc_count, false};
+    active->docs[active->doc_count].message_id = message_id;
+    active->docs[active->doc_count].conversation_id = conversation_id;
+    active->doc_count++;
+    tokenize(content, active_add_token, &context);
+    if (context.failed)
+    {
+        // Doc đã có chỉ số nên giữ lại, chỉ thiếu vài từ
+        log_message(WARN, "Message index out of memory, message %lld is partially indexed", message_id);
+    }
+    return true;
+}
+
+static void active_free(ActiveSegment *active)
+{
+    if (active->buckets)
+    {
+        for (int i = 0; i < ACTIVE_BUCKETS; i++)
+        {
+            ActiveTerm *entry = active->buckets[i];
+            while (entry)
+            {
+                ActiveTerm *next = entry->next;
+                free(entry->term);
+                free(entry->docs);
+                free(entry);
+                entry = next;
+            }
+        }
+    }
+    free(active->buckets);
+    free(active->docs);
+    memset(active, 0, sizeof(ActiveSegment));
+}
+
+// ---------------------------------------------------------------- segment files
+
+static void segment_close(Segment *segment)
+{
+    if (segment->map)
+    {
+        munmap(segment->map, segment->size);
+    }
+    memset(segment, 0, sizeof(Segment));
+}
+
+static bool segment_open(const char *path, Segment *out)
+{
+    memset(out, 0, sizeof(Segment));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        log_message(ERROR, "Failed to open index segment %s: %s", path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SegmentHeader);
+    uint8_t *map = ok ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        log_message(ERROR, "Failed to map index segment %s", path);
+        return false;
+    }
+
+    const SegmentHeader *header = (const SegmentHeader *)map;
+    size_t size = st.st_size;
+    ok = header->magic == SEGMENT_MAGIC && header->version == SEGMENT_VERSION && header->file_size == size &&
+         header->doc_count > 0 &&
+         header->docs_offset + (uint64_t)header->doc_count * sizeof(SegmentDoc) <= header->terms_offset &&
+         header->terms_offset + (uint64_t)header->term_count * sizeof(SegmentTerm) <= header->strings_offset &&
+         header->strings_offset <= header->postings_offset && header->postings_offset <= size;
+    if (!ok)
+    {
+        // Tin của segment này chỉ được index lại khi xóa nó cùng các segment mới hơn
+        log_message(ERROR, "Index segment %s is corrupt, ignoring it", path);
+        munmap(map, size);
+        return false;
+    }
+
+    out->map = map;
+    out->size = size;
+    out->header = header;
+    out->docs = (const SegmentDoc *)(map + header->docs_offset);
+    out->terms = (const SegmentTerm *)(map + header->terms_offset);
+    out->strings = (const char *)(map + header->strings_offset);
+    out->postings = map + header->postings_offset;
+    out->max_id = out->docs[header->doc_count - 1].message_id;
+    return true;
+}
+
+static int compare_active_terms(const void *a, const void *b)
+{
+    const ActiveTerm *x = *(const ActiveTerm *const *)a;
+    const ActiveTerm *y = *(const ActiveTerm *const *)b;
+    return compare_terms(x->term, x->length, y->term, y->length);
+}
+
+static bool buffer_reserve(uint8_t **buffer, size_t *capacity, size_t needed)
+{
+    if (needed <= *capacity)
+    {
+        return true;
+    }
+    size_t grown = *capacity > 0 ? *capacity : 4096;
+    while (grown < needed)
+    {
+        grown *= 2;
+    }
+    uint8_t *resized = realloc(*buffer, grown);
+    if (!resized)
+    {
+        return false;
+    }
+    *buffer = resized;
+    *capacity = grown;
+    return true;
+}
+
+static bool write_all(int fd, const void *data, size_t length)
+{
+    const uint8_t *p = data;
+    while (length > 0)
+    {
+        ssize_t written = write(fd, p, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+/**
+ * Ghi active ra file tạm, fsync rồi rename để segment chỉ xuất hiện khi đã đầy đủ
+ */
+static bool segment_write(const ActiveSegment *active, const char *path)
+{
+    ActiveTerm **sorted = malloc((active->term_count > 0 ? active->term_count : 1) * sizeof(ActiveTerm *));
+    SegmentTerm *terms = calloc(active->term_count > 0 ? active->term_count : 1, sizeof(SegmentTerm));
+    if (!sorted || !terms)
+    {
+        free(sorted);
+        free(terms);
+        return false;
+    }
+    int term_count = 0;
+    for (int i = 0; i < ACTIVE_BUCKETS; i++)
+    {
+        for (ActiveTerm *entry = active->buckets[i]; entry; entry = entry->next)
+        {
+            sorted[term_count++] = entry;
+        }
+    }
+    qsort(sorted, term_count, sizeof(ActiveTerm *), compare_active_terms);
+
+    uint8_t *postings = NULL;
+    size_t postings_size = 0, postings_capacity = 0;
+    uint32_t strings_size = 0;
+    bool ok = true;
+    for (int i = 0; i < term_count && ok; i++)
+    {
+        ActiveTerm *entry = sorted[i];
+        terms[i].string_offset = strings_size;
+        terms[i].length = (uint16_t)entry->length;
+        terms[i].doc_freq = (uint32_t)entry->count;
+        terms[i].postings_offset = postings_size;
+        strings_size += entry->length;
+
+        // Mỗi số tối đa 5 byte varint
+        ok = buffer_reserve(&postings, &postings_capacity, postings_size + (size_t)entry->count * 5);
+        uint32_t previous = 0;
+        for (int k = 0; ok && k < entry->count; k++)
+        {
+            uint32_t delta = entry->docs[k] - previous;
+            previous = entry->docs[k];
+            while (delta >= 0x80)
+            {
+                postings[postings_size++] = (uint8_t)(delta | 0x80);
+                delta >>= 7;
+            }
+            postings[postings_size++] = (uint8_t)delta;
+        }
+        terms[i].postings_length = (uint32_t)(postings_size - terms[i].postings_offset);
+    }
+
+    SegmentHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SEGMENT_MAGIC;
+    header.version = SEGMENT_VERSION;
+    header.doc_count = (uint32_t)active->doc_count;
+    header.term_count = (uint32_t)term_count;
+    header.docs_offset = sizeof(SegmentHeader);
+    header.terms_offset = header.docs_offset + (uint64_t)active->doc_count * sizeof(SegmentDoc);
+    header.strings_offset = header.terms_offset + (uint64_t)term_count * sizeof(SegmentTerm);
+    header.postings_offset = header.strings_offset + strings_size;
+    header.file_size = header.postings_offset + postings_size;
+
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = ok ? open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    ok = fd >= 0;
+    ok = ok && write_all(fd, &header, sizeof(header)) &&
+         write_all(fd, active->docs, (size_t)active->doc_count * sizeof(SegmentDoc)) &&
+         write_all(fd, terms, (size_t)term_count * sizeof(SegmentTerm));
+    for (int i = 0; i < term_count && ok; i++)
+    {
+        ok = write_all(fd, sorted[i]->term, sorted[i]->length);
+    }
+    ok = ok && write_all(fd, postings, postings_size) && fsync(fd) == 0;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok)
+    {
+        log_message(ERROR, "Failed to write index segment %s: %s", path, strerror(errno));
+        unlink(tmp_path);
+    }
+
+    free(sorted);
+    free(terms);
+    free(postings);
+    return ok;
+}
+
+static int compare_segments(const void *a, const void *b)
+{
+    const Segment *x = a, *y = b;
+    return (x->max_id > y->max_id) - (x->max_id < y->max_id);
+}
+
+static bool load_segments()
+{
+    if (mkdir(message_index.dir, 0755) != 0 && errno != EEXIST)
+    {
+        log_message(ERROR, "Failed to create index directory %s: %s", message_index.dir, strerror(errno));
+        return false;
+    }
+    DIR *dir = opendir(message_index.dir);
+    if (!dir)
+    {
+        log_message(ERROR, "Failed to open index directory %s: %s", message_index.dir, strerror(errno));
+        return false;
+    }
+
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL)
+    {
+        size_t length = strlen(dirent->d_name);
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", message_index.dir, dirent->d_name);
+        if (length > 4 && strcmp(dirent->d_name + length - 4, ".tmp") == 0)
+        {
+            // Segment ghi dở lúc crash, phần tin của nó sẽ được đọc lại từ database
+            unlink(path);
+            continue;
+        }
+        if (strncmp(dirent->d_name, "seg-", 4) != 0)
+        {
+            continue;
+        }
+
+        Segment segment;
+        if (!segment_open(path, &segment))
+        {
+            continue;
+        }
+        Segment *segments = realloc(message_index.segments, (message_index.segment_count + 1) * sizeof(Segment));
+        if (!segments)
+        {
+            segment_close(&segment);
+            continue;
+        }
+        message_index.segments = segments;
+        message_index.segments[message_index.segment_count++] = segment;
+    }
+    closedir(dir);
+
+    qsort(message_index.segments, message_index.segment_count, sizeof(Segment), compare_segments);
+    if (message_index.segment_count > 0)
+    {
+        message_index.last_id = message_index.segments[message_index.segment_count - 1].max_id;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------- indexer
+
+// Chỉ thread indexer (hoặc stop sau khi đã join) gọi
+static void flush_active()
+{
+    ActiveSegment *active = &message_index.active;
+    if (active->doc_count == 0)
+    {
+        return;
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/seg-%020lld.idx", message_index.dir,
+             (long long)active->docs[active->doc_count - 1].message_id);
+    long long started = utils_now_ms();
+    Segment segment;
+    // Active chỉ bị thread này sửa nên được đọc mà không cần lock trong lúc ghi file
+    if (!segment_write(active, path) || !segment_open(path, &segment))
+    {
+        // Giữ active trong bộ nhớ, lần sau thử lại
+        return;
+    }
+
+    pthread_rwlock_wrlock(&message_index.lock);
+    Segment *segments = realloc(message_index.segments, (message_index.segment_count + 1) * sizeof(Segment));
+    ActiveSegment flushed = *active;
+    if (segments)
+    {
+        message_index.segments = segments;
+        message_index.segments[message_index.segment_count++] = segment;
+        memset(active, 0, sizeof(ActiveSegment));
+    }
+    pthread_rwlock_unlock(&message_index.lock);
+
+    if (!segments)
+    {
+        segment_close(&segment);
+        return;
+    }
+    log_message(INFO, "Wrote index segment %s: %d messages, %d terms in %lldms", path, flushed.doc_count,
+                flushed.term_count, utils_now_ms() - started);
+    active_free(&flushed);
+}
+
+// Đọc các tin mới hơn last_id từ database, trả về số tin đã đọc, -1 nếu lỗi
+static int index_next_rows()
+{
+    MessageSearchResult *rows = NULL;
+    int count = 0;
+    if (!storage()->messages_after(message_index.last_id, MESSAGE_INDEX_FETCH_ROWS, &rows, &count))
+    {
+        return -1;
+    }
+    // Tin trong archive có id nhỏ hơn mọi tin còn trong bảng nên được index trước. Đọc archive
+    // sau bảng: tin bị chuyển đi giữa hai lần đọc thì lần này thấy trong archive
+    MessageSearchResult *archived = NULL;
+    int archived_count = 0;
+    bool archive_ok = message_archive_after(message_index.last_id, MESSAGE_INDEX_FETCH_ROWS, &archived, &archived_count);
+    if (!archive_ok || archived_count > 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            free(rows[i].content);
+        }
+        free(rows);
+        if (!archive_ok)
+        {
+            return -1;
+        }
+        rows = archived;
+        count = archived_count;
+    }
+
+    pthread_rwlock_wrlock(&message_index.lock);
+    int added = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (added == i && active_add(&message_index.active, rows[i].id, rows[i].conversation_id,
+                                     rows[i].content ? rows[i].content : ""))
+        {
+            message_index.last_id = rows[i].id;
+            added++;
+        }
+        else if (added == i)
+        {
+            log_message(ERROR, "Message index out of memory at message %lld", (long long)rows[i].id);
+        }
+        free(rows[i].content);
+    }
+    pthread_rwlock_unlock(&message_index.lock);
+    free(rows);
+    return added < count ? -1 : count;
+}
+
+static void catch_up()
+{
+    int rows;
+    do
+    {
+        rows = index_next_rows();
+        if (message_index.active.doc_count >= message_index.segment_docs)
+        {
+            flush_active();
+        }
+    } while (rows == MESSAGE_INDEX_FETCH_ROWS);
+}
+
+static void *indexer_thread(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&message_index.mutex);
+    while (!message_index.stopping)
+    {
+        if (!message_index.notified)
+        {
+            long long deadline_ms = utils_now_ms() + message_index.poll_ms;
+            struct timespec deadline = {.tv_sec = deadline_ms / 1000, .tv_nsec = (deadline_ms % 1000) * 1000000};
+            pthread_cond_timedwait(&message_index.wake, &message_index.mutex, &deadline);
+        }
+        message_index.notified = false;
+        pthread_mutex_unlock(&message_index.mutex);
+
+        catch_up();
+
+        pthread_mutex_lock(&message_index.mutex);
+    }
+    pthread_mutex_unlock(&message_index.mutex);
+
+    catch_up();
+    flush_active();
+    return NULL;
+}
+
+bool message_index_start()
+{
+    if (message_index.running)
+    {
+        return true;
+    }
+
+    const char *dir = config_get_index_path();
+    int segment_docs = config_get_index_segment_docs();
+    int poll_ms = config_get_index_poll_ms();
+    message_index.dir = strdup(dir && *dir ? dir : MESSAGE_INDEX_DEFAULT_PATH);
+    message_index.segment_docs = segment_docs > 0 ? segment_docs : MESSAGE_INDEX_DEFAULT_SEGMENT_DOCS;
+    message_index.poll_ms = poll_ms > 0 ? poll_ms : MESSAGE_INDEX_DEFAULT_POLL_MS;
+    if (!message_index.dir || !load_segments())
+    {
+        free(message_index.dir);
+        message_index.dir = NULL;
+        return false;
+    }
+
+    // Deadline của timedwait tính bằng utils_now_ms (CLOCK_MONOTONIC)
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&message_index.wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    message_index.stopping = false;
+    message_index.notified = true;
+    message_index.running = true;
+    if (pthread_create(&message_index.thread, NULL, indexer_thread, NULL) != 0)
+    {
+        log_message(ERROR, "Failed to create message indexer thread");
+        message_index.running = false;
+        return false;
+    }
+
+    log_message(INFO, "Message index started: %d segments in %s, resuming after message %lld",
+                message_index.segment_count, message_index.dir, message_index.last_id);
+    return true;
+}
+
+void message_index_stop()
+{
+    pthread_mutex_lock(&message_index.mutex);
+    if (!message_index.running)
+    {
+        pthread_mutex_unlock(&message_index.mutex);
+        return;
+    }
+    message_index.stopping = true;
+    pthread_cond_signal(&message_index.wake);
+    pthread_mutex_unlock(&message_index.mutex);
+
+    pthread_join(message_index.thread, NULL);
+
+    pthread_rwlock_wrlock(&message_index.lock);
+    message_index.running = false;
+    for (int i = 0; i < message_index.segment_count; i++)
+    {
+        segment_close(&message_index.segments[i]);
+    }
+    free(message_index.segments);
+    message_index.segments = NULL;
+    message_index.segment_count = 0;
+    active_free(&message_index.active);
+    pthread_rwlock_unlock(&message_index.lock);
+
+    free(message_index.dir);
+    message_index.dir = NULL;
+    log_message(INFO, "Message index stopped at message %lld", message_index.last_id);
+}
+
+void message_index_notify()
+{
+    pthread_mutex_lock(&message_index.mutex);
+    if (message_index.running && !message_index.notified)
+    {
+        message_index.notified = true;
+        pthread_cond_signal(&message_index.wake);
+    }
+    pthread_mutex_unlock(&message_index.mutex);
+}
+
+// ---------------------------------------------------------------- search
+
+typedef struct
+{
+    Token tokens[MESSAGE_INDEX_MAX_TERMS];
+    int count;
+} QueryTerms;
+
+static void query_add_token(const Token *token, void *arg)
+{
+    QueryTerms *query = (QueryTerms *)arg;
+    for (int i = 0; i < query->count; i++)
+    {
+        if (query->tokens[i].length == token->length && memcmp(query->tokens[i].term, token->term, token->length) == 0)
+        {
+            return;
+        }
+    }
+    if (query->count < MESSAGE_INDEX_MAX_TERMS)
+    {
+        query->tokens[query->count++] = *token;
+    }
+}
+
+static int compare_ints(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct
+{
+    int user_id;
+    const int *groups;
+    int group_count;
+} SearchScope;
+
+static bool in_scope(const SearchScope *scope, long long conversation_id)
+{
+    if (conversation_id < 0)
+    {
+        int group_id = (int)-conversation_id;
+        return bsearch(&group_id, scope->groups, scope->group_count, sizeof(int), compare_ints) != NULL;
+    }
+    // Tin riêng: conversation_id = (id nhỏ << 32) | id lớn
+    int low = (int)(conversation_id >> 32);
+    int high = (int)(conversation_id & 0xFFFFFFFF);
+    return low == scope->user_id || high == scope->user_id;
+}
+
+// Giữ lại trong a các phần tử cũng có trong b, cả hai tăng dần
+static int intersect(uint32_t *a, int a_count, const uint32_t *b, int b_count)
+{
+    int i = 0, j = 0, kept = 0;
+    while (i < a_count && j < b_count)
+    {
+        if (a[i] < b[j])
+            i++;
+        else if (a[i] > b[j])
+            j++;
+        else
+        {
+            a[kept++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    return kept;
+}
+
+static const SegmentTerm *segment_find(const Segment *segment, const Token *token)
+{
+    int lo = 0, hi = (int)segment->header->term_count - 1;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        const SegmentTerm *term = &segment->terms[mid];
+        int cmp = compare_terms(segment->strings + term->string_offset, term->length, token->term, token->length);
+        if (cmp == 0)
+            return term;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return NULL;
+}
+
+static uint32_t *segment_decode(const Segment *segment, const SegmentTerm *term)
+{
+    uint32_t *docs = malloc((term->doc_freq > 0 ? term->doc_freq : 1) * sizeof(uint32_t));
+    if (!docs)
+    {
+        return NULL;
+    }
+    const uint8_t *p = segment->postings + term->postings_offset;
+    const uint8_t *end = p + term->postings_length;
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < term->doc_freq && p < end; i++)
+    {
+        uint32_t delta = 0;
+        int shift = 0;
+        while (p < end && (*p & 0x80))
+        {
+            delta |= (uint32_t)(*p++ & 0x7F) << shift;
+            shift += 7;
+        }
+        if (p < end)
+        {
+            delta |= (uint32_t)*p++ << shift;
+        }
+        value += delta;
+        docs[i] = value;
+    }
+    return docs;
+}
+
+/**
+ * Các doc (chỉ số trong segment) chứa mọi term của query, NULL nếu không có.
+ * Bắt đầu từ term hiếm nhất để mảng trung gian nhỏ nhất
+ */
+static uint32_t *match_segment(const Segment *segment, const QueryTerms *query, int *out_count)
+{
+    *out_count = 0;
+    const SegmentTerm *terms[MESSAGE_INDEX_MAX_TERMS];
+    int rarest = 0;
+    for (int i = 0; i < query->count; i++)
+    {
+        terms[i] = segment_find(segment, &query->tokens[i]);
+        if (!terms[i])
+        {
+            return NULL;
+        }
+        if (terms[i]->doc_freq < terms[rarest]->doc_freq)
+        {
+            rarest = i;
+        }
+    }
+
+    uint32_t *docs = segment_decode(segment, terms[rarest]);
+    int count = docs ? (int)terms[rarest]->doc_freq : 0;
+    for (int i = 0; i < query->count && count > 0; i++)
+    {
+        if (i == rarest)
+        {
+            continue;
+        }
+        uint32_t *other = segment_decode(segment, terms[i]);
+        count = other ? intersect(docs, count, other, (int)terms[i]->doc_freq) : 0;
+        free(other);
+    }
+    *out_count = count;
+    return docs;
+}
+
+static uint32_t *match_active(const ActiveSegment *active, const QueryTerms *query, int *out_count)
+{
+    *out_count = 0;
+    if (!active->buckets)
+    {
+        return NULL;
+    }
+    const ActiveTerm *terms[MESSAGE_INDEX_MAX_TERMS];
+    int rarest = 0;
+    for (int i = 0; i < query->count; i++)
+    {
+        terms[i] = active_find(active, query->tokens[i].term, query->tokens[i].length);
+        if (!terms[i])
+        {
+            return NULL;
+        }
+        if (terms[i]->count < terms[rarest]->count)
+        {
+            rarest = i;
+        }
+    }
+
+    uint32_t *docs = malloc(terms[rarest]->count * sizeof(uint32_t));
+    if (!docs)
+    {
+        return NULL;
+    }
+    memcpy(docs, terms[rarest]->docs, terms[rarest]->count * sizeof(uint32_t));
+    int count = terms[rarest]->count;
+    for (int i = 0; i < query->count && count > 0; i++)
+    {
+        if (i != rarest)
+        {
+            count = intersect(docs, count, terms[i]->docs, terms[i]->count);
+        }
+    }
+    *out_count = count;
+    return docs;
+}
+
+// Duyệt từ doc mới nhất, thêm các tin thuộc phạm vi user cho tới khi đủ limit
+static int collect(const SegmentDoc *table, const uint32_t *docs, int count, const SearchScope *scope,
+                   MessageIndexHit *hits, int hit_count, int limit)
+{
+    for (int i = count - 1; i >= 0 && hit_count < limit; i--)
+    {
+        const SegmentDoc *doc = &table[docs[i]];
+        if (in_scope(scope, doc->conversation_id))
+        {
+            hits[hit_count].message_id = doc->message_id;
+            hits[hit_count].conversation_id = doc->conversation_id;
+            hit_count++;
+        }
+    }
+    return hit_count;
+}
+
+MessageIndexHit *message_index_search(int user_id, const char *query_text, int limit, int *out_count)
+{
+    *out_count = 0;
+    if (!query_text)
+    {
+        return NULL;
+    }
+    if (limit <= 0 || limit > MESSAGE_INDEX_MAX_RESULTS)
+    {
+        limit = MESSAGE_INDEX_MAX_RESULTS;
+    }
+
+    QueryTerms query;
+    query.count = 0;
+    tokenize(query_text, query_add_token, &query);
+    if (query.count == 0)
+    {
+        return NULL;
+    }
+
+    // Nhóm hiện tại của user lấy từ membership index, đã sắp xếp tăng dần
+    SearchScope scope = {user_id, NULL, 0};
+    int *groups = membership_index_groups(user_id, &scope.group_count);
+    scope.groups = groups;
+
+    MessageIndexHit *hits = malloc(limit * sizeof(MessageIndexHit));
+    if (!hits)
+    {
+        free(groups);
+        return NULL;
+    }
+
+    long long started = utils_now_ms();
+    int hit_count = 0;
+    pthread_rwlock_rdlock(&message_index.lock);
+    if (message_index.running)
+    {
+        // Active chứa các tin mới nhất, sau đó tới segment mới nhất trở về trước
+        int count = 0;
+        uint32_t *docs = match_active(&message_index.active, &query, &count);
+        hit_count = collect(message_index.active.docs, docs, count, &scope, hits, hit_count, limit);
+        free(docs);
+        for (int s = message_index.segment_count - 1; s >= 0 && hit_count < limit; s--)
+        {
+            const Segment *segment = &message_index.segments[s];
+            docs = match_segment(segment, &query, &count);
+            hit_count = collect(segment->docs, docs, count, &scope, hits, hit_count, limit);
+            free(docs);
+        }
+    }
+    pthread_rwlock_unlock(&message_index.lock);
+    free(groups);
+
+    log_message(LOG_DEBUG, "Message search for user %d: %d terms, %d hits in %lldms", user_id, query.count, hit_count,
+                utils_now_ms() - started);
+    if (hit_count == 0)
+    {
+        free(hits);
+        return NULL;
+    }
+    *out_count = hit_count;
+    return hits;
+}
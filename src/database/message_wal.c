@@ -0,0 +1,570 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "message_wal.h"
+#include "persist_queue.h"
+#include "storage.h"
+#include "config.h"
+#include "log.h"
+
+/*
+ * Record: magic | payload length | crc32(payload) | payload
+ * Payload: seq (8) | sender (4) | receiver (4) | group (4) | timestamp (8) | content
+ * Số nguyên ghi theo byte order của máy, file chỉ dùng lại trên chính server này.
+ */
+#define WAL_MAGIC 0x4C41574Du
+#define WAL_HEADER_SIZE 12
+#define WAL_FIXED_PAYLOAD 28
+#define WAL_MAX_PAYLOAD (WAL_FIXED_PAYLOAD + 1024 * 1024)
+
+typedef struct
+{
+    int fd;
+    char *path;
+    char *checkpoint_path;
+    // Bản ghi bỏ cuộc sau nhiều lần ghi database lỗi, cùng định dạng với WAL
+    char *dead_path;
+    bool open;
+    off_t size;
+
+    long long next_seq;
+    // seq lớn nhất đã write() và đã fdatasync
+    long long written_seq;
+    long long durable_seq;
+    bool syncing;
+    // Một lần fdatasync lỗi là không biết gì đã lên đĩa: mọi append sau đó đều lỗi cho tới khi khởi động lại
+    bool failed;
+
+    // Số bản ghi phải vào MySQL và số đã vào hoặc đã chuyển sang dead letter, bằng nhau thì được cắt file
+    long long appended;
+    long long applied;
+    // seq lớn nhất đã đẩy lại vào persist queue lúc open
+    atomic_llong replayed_seq;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t synced;
+} MessageWal;
+
+static MessageWal wal = {
+    .fd = -1,
+    .open = false,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .synced = PTHREAD_COND_INITIALIZER};
+
+static uint32_t crc_table[256];
+
+static void crc_init()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_of(const unsigned char *data, size_t length)
+{
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++)
+    {
+        c = crc_table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+static bool write_all(int fd, const void *buffer, size_t length)
+{
+    const char *p = buffer;
+    while (length > 0)
+    {
+        ssize_t n = write(fd, p, length);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+static bool read_all(int fd, off_t offset, void *buffer, size_t length)
+{
+    char *p = buffer;
+    while (length > 0)
+    {
+        ssize_t n = pread(fd, p, length, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        offset += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+// Không có file checkpoint thì seq = 0; file có mà không đọc được thì lỗi, replay lại từ 0 có thể cấp trùng seq
+static bool read_checkpoint(long long *seq)
+{
+    *seq = 0;
+    FILE *file = fopen(wal.checkpoint_path, "r");
+    if (!file)
+    {
+        if (errno == ENOENT)
+        {
+            return true;
+        }
+        log_message(ERROR, "Failed to open WAL checkpoint %s: %s", wal.checkpoint_path, strerror(errno));
+        return false;
+    }
+    bool ok = fscanf(file, "%lld", seq) == 1 && *seq >= 0;
+    fclose(file);
+    if (!ok)
+    {
+        log_message(ERROR, "Unreadable WAL checkpoint %s", wal.checkpoint_path);
+    }
+    return ok;
+}
+
+// Ghi file tạm rồi rename để checkpoint không bao giờ bị ghi dở
+static bool write_checkpoint(long long seq)
+{
+    size_t length = strlen(wal.checkpoint_path) + 5;
+    char *tmp_path = malloc(length);
+    if (!tmp_path)
+    {
+        return false;
+    }
+    snprintf(tmp_path, length, "%s.tmp", wal.checkpoint_path);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+    {
+        log_message(ERROR, "Failed to open WAL checkpoint %s: %s", tmp_path, strerror(errno));
+        free(tmp_path);
+        return false;
+    }
+
+    char text[32];
+    int text_length = snprintf(text, sizeof(text), "%lld\n", seq);
+    bool ok = write_all(fd, text, (size_t)text_length) && fsync(fd) == 0;
+    close(fd);
+    ok = ok && rename(tmp_path, wal.checkpoint_path) == 0;
+    if (!ok)
+    {
+        log_message(ERROR, "Failed to write WAL checkpoint: %s", strerror(errno));
+    }
+    free(tmp_path);
+    return ok;
+}
+
+// Bản ghi chưa có seq và CRC, xem seal_record
+static unsigned char *build_record(int sender_id, int receiver_id, int group_id, const char *content,
+                                   time_t timestamp, uint32_t *length)
+{
+    size_t content_length = strlen(content);
+    *length = (uint32_t)(WAL_FIXED_PAYLOAD + content_length);
+    if (*length > WAL_MAX_PAYLOAD)
+    {
+        log_message(ERROR, "Message of %zu bytes is too large for the WAL", content_length);
+        return NULL;
+    }
+
+    unsigned char *record = malloc(WAL_HEADER_SIZE + *length);
+    if (!record)
+    {
+        return NULL;
+    }
+
+    unsigned char *payload = record + WAL_HEADER_SIZE;
+    int32_t ids[3] = {sender_id, receiver_id, group_id};
+    long long ts = (long long)timestamp;
+    memcpy(payload + 8, ids, sizeof(ids));
+    memcpy(payload + 20, &ts, 8);
+    memcpy(payload + WAL_FIXED_PAYLOAD, content, content_length);
+    return record;
+}
+
+static void seal_record(unsigned char *record, long long seq, uint32_t length)
+{
+    unsigned char *payload = record + WAL_HEADER_SIZE;
+    memcpy(payload, &seq, 8);
+    uint32_t magic = WAL_MAGIC;
+    uint32_t crc = crc32_of(payload, length);
+    memcpy(record, &magic, 4);
+    memcpy(record + 4, &length, 4);
+    memcpy(record + 8, &crc, 4);
+}
+
+// Gọi khi đang giữ mutex. Chỉ cắt khi mọi bản ghi đã fsync và đã vào MySQL
+static void maybe_truncate(bool force)
+{
+    if (!wal.open || wal.failed || wal.syncing || wal.applied != wal.appended ||
+        wal.durable_seq != wal.written_seq || wal.size == 0)
+    {
+        return;
+    }
+    if (!force && wal.size < MESSAGE_WAL_TRUNCATE_BYTES)
+    {
+        return;
+    }
+
+    if (!write_checkpoint(wal.next_seq - 1))
+    {
+        return;
+    }
+    if (ftruncate(wal.fd, 0) != 0 || fdatasync(wal.fd) != 0)
+    {
+        log_message(ERROR, "Failed to truncate WAL %s: %s", wal.path, strerror(errno));
+        return;
+    }
+    log_message(LOG_DEBUG, "WAL truncated at seq %lld", wal.next_seq - 1);
+    wal.size = 0;
+}
+
+// Đọc lại log, đẩy các bản ghi sau checkpoint vào persist queue
+static int replay(long long checkpoint, long long *max_seq)
+{
+    int replayed = 0;
+    off_t offset = 0;
+    unsigned char header[WAL_HEADER_SIZE];
+    *max_seq = checkpoint;
+
+    while (read_all(wal.fd, offset, header, WAL_HEADER_SIZE))
+    {
+        uint32_t magic, length, crc;
+        memcpy(&magic, header, 4);
+        memcpy(&length, header + 4, 4);
+        memcpy(&crc, header + 8, 4);
+        if (magic != WAL_MAGIC || length < WAL_FIXED_PAYLOAD || length > WAL_MAX_PAYLOAD)
+        {
+            break;
+        }
+
+        unsigned char *payload = malloc(length + 1);
+        if (!payload)
+        {
+            log_message(ERROR, "Failed to allocate WAL record of %u bytes", length);
+            break;
+        }
+        if (!read_all(wal.fd, offset + WAL_HEADER_SIZE, payload, length) || crc32_of(payload, length) != crc)
+        {
+            free(payload);
+            break;
+        }
+        payload[length] = '\0';
+
+        long long seq, timestamp;
+        int32_t sender_id, receiver_id, group_id;
+        memcpy(&seq, payload, 8);
+        memcpy(&sender_id, payload + 8, 4);
+        memcpy(&receiver_id, payload + 12, 4);
+        memcpy(&group_id, payload + 16, 4);
+        memcpy(&timestamp, payload + 20, 8);
+
+        if (seq > checkpoint)
+        {
+            // Trước push để backend thấy bản ghi này là replay khi nó tới
+            atomic_store(&wal.replayed_seq, seq);
+            pthread_mutex_lock(&wal.mutex);
+            wal.appended++;
+            pthread_mutex_unlock(&wal.mutex);
+            persist_queue_push(sender_id, receiver_id, group_id, (char *)payload + WAL_FIXED_PAYLOAD,
+                               (time_t)timestamp, seq);
+            replayed++;
+        }
+        if (seq > *max_seq)
+        {
+            *max_seq = seq;
+        }
+
+        free(payload);
+        offset += WAL_HEADER_SIZE + length;
+    }
+
+    // Phần đuôi hỏng là bản ghi ghi dở lúc crash, chưa từng được xác nhận với client
+    if (offset < wal.size)
+    {
+        log_message(WARN, "Discarding %lld bytes of torn WAL tail", (long long)(wal.size - offset));
+        if (ftruncate(wal.fd, offset) != 0)
+        {
+            log_message(ERROR, "Failed to cut WAL tail: %s", strerror(errno));
+        }
+        wal.size = offset;
+    }
+    return replayed;
+}
+
+bool message_wal_open()
+{
+    if (wal.open)
+    {
+        return true;
+    }
+
+    crc_init();
+
+    const char *path = config_get_wal_path();
+    wal.path = strdup(path && path[0] ? path : MESSAGE_WAL_DEFAULT_PATH);
+    size_t length = wal.path ? strlen(wal.path) + 6 : 0;
+    wal.checkpoint_path = wal.path ? malloc(length) : NULL;
+    wal.dead_path = wal.path ? malloc(length) : NULL;
+    if (!wal.path || !wal.checkpoint_path || !wal.dead_path)
+    {
+        log_message(ERROR, "Failed to allocate WAL paths");
+        free(wal.path);
+        free(wal.checkpoint_path);
+        free(wal.dead_path);
+        return false;
+    }
+    snprintf(wal.checkpoint_path, length, "%s.ckpt", wal.path);
+    snprintf(wal.dead_path, length, "%s.dead", wal.path);
+
+    wal.fd = open(wal.path, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (wal.fd < 0)
+    {
+        log_message(ERROR, "Failed to open WAL %s: %s", wal.path, strerror(errno));
+        free(wal.path);
+        free(wal.checkpoint_path);
+        free(wal.dead_path);
+        return false;
+    }
+    wal.size = lseek(wal.fd, 0, SEEK_END);
+
+    // seq đã cấp có thể lớn hơn checkpoint và file WAL (file bị mất, chạy từ thư mục khác),
+    // nên seq mới cũng phải lớn hơn mọi wal_id trong database, nếu không tin mới bị bỏ như bản trùng
+    long long checkpoint = 0;
+    long long stored_seq = 0;
+    if (!read_checkpoint(&checkpoint) || !storage()->max_wal_id(&stored_seq))
+    {
+        log_message(ERROR, "Failed to find the last WAL sequence");
+        close(wal.fd);
+        wal.fd = -1;
+        free(wal.path);
+        free(wal.checkpoint_path);
+        free(wal.dead_path);
+        return false;
+    }
+    wal.appended = 0;
+    wal.applied = 0;
+    wal.failed = false;
+    atomic_store(&wal.replayed_seq, 0);
+
+    // wal.open vẫn false trong lúc replay nên flusher không thể cắt file đang đọc
+    long long max_seq = checkpoint;
+    int replayed = replay(checkpoint, &max_seq);
+
+    if (stored_seq > max_seq)
+    {
+        log_message(WARN, "WAL %s is behind the database (seq %lld < %lld), continuing after the database",
+                    wal.path, max_seq, stored_seq);
+        max_seq = stored_seq;
+    }
+
+    pthread_mutex_lock(&wal.mutex);
+    wal.open = true;
+    wal.next_seq = max_seq + 1;
+    wal.written_seq = max_seq;
+    wal.durable_seq = max_seq;
+    pthread_mutex_unlock(&wal.mutex);
+
+    if (replayed > 0)
+    {
+        // Đợi phần đuôi vào MySQL trước khi nhận client
+        persist_queue_flush();
+        log_message(INFO, "Replayed %d messages from WAL %s", replayed, wal.path);
+    }
+
+    log_message(INFO, "Message WAL %s opened at seq %lld", wal.path, max_seq);
+    return true;
+}
+
+void message_wal_close()
+{
+    pthread_mutex_lock(&wal.mutex);
+    if (!wal.open)
+    {
+        pthread_mutex_unlock(&wal.mutex);
+        return;
+    }
+
+    while (wal.syncing)
+    {
+        pthread_cond_wait(&wal.synced, &wal.mutex);
+    }
+    if (!wal.failed && wal.durable_seq != wal.written_seq && fdatasync(wal.fd) == 0)
+    {
+        wal.durable_seq = wal.written_seq;
+    }
+    maybe_truncate(true);
+    if (wal.size > 0)
+    {
+        log_message(WARN, "WAL %s kept with %lld unapplied messages, they are replayed on next start",
+                    wal.path, wal.appended - wal.applied);
+    }
+
+    wal.open = false;
+    close(wal.fd);
+    wal.fd = -1;
+    free(wal.path);
+    free(wal.checkpoint_path);
+    free(wal.dead_path);
+    wal.path = NULL;
+    wal.checkpoint_path = NULL;
+    wal.dead_path = NULL;
+    pthread_mutex_unlock(&wal.mutex);
+}
+
+long long message_wal_append(int sender_id, int receiver_id, int group_id, const char *content, time_t timestamp)
+{
+    if (!content)
+    {
+        return -1;
+    }
+
+    uint32_t length = 0;
+    unsigned char *record = build_record(sender_id, receiver_id, group_id, content, timestamp, &length);
+    if (!record)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&wal.mutex);
+    if (!wal.open || wal.failed)
+    {
+        bool failed = wal.failed;
+        pthread_mutex_unlock(&wal.mutex);
+        free(record);
+        return failed ? -1 : 0;
+    }
+
+    // seq phải được cấp và ghi theo cùng thứ tự, nên CRC tính trong lock
+    long long seq = wal.next_seq;
+    seal_record(record, seq, length);
+
+    if (!write_all(wal.fd, record, WAL_HEADER_SIZE + length))
+    {
+        log_message(ERROR, "Failed to append to WAL %s: %s", wal.path, strerror(errno));
+        // Bỏ phần ghi dở để bản ghi sau không nằm sau rác
+        if (ftruncate(wal.fd, wal.size) != 0)
+        {
+            log_message(ERROR, "Failed to roll back WAL append: %s", strerror(errno));
+            wal.failed = true;
+        }
+        pthread_mutex_unlock(&wal.mutex);
+        free(record);
+        return -1;
+    }
+    free(record);
+
+    wal.next_seq++;
+    wal.size += WAL_HEADER_SIZE + length;
+    wal.written_seq = seq;
+    wal.appended++;
+
+    // Group commit: một thread fdatasync cho mọi bản ghi đã write, các thread khác chờ
+    while (wal.durable_seq < seq)
+    {
+        if (wal.failed)
+        {
+            pthread_mutex_unlock(&wal.mutex);
+            return -1;
+        }
+        if (wal.syncing)
+        {
+            pthread_cond_wait(&wal.synced, &wal.mutex);
+            continue;
+        }
+
+        wal.syncing = true;
+        long long target = wal.written_seq;
+        int fd = wal.fd;
+        pthread_mutex_unlock(&wal.mutex);
+        int rc = fdatasync(fd);
+        pthread_mutex_lock(&wal.mutex);
+        wal.syncing = false;
+        if (rc != 0)
+        {
+            // Linux xóa lỗi sau lần báo đầu tiên: fdatasync lại sẽ thành công dù dữ liệu chưa lên đĩa,
+            // nên không thread nào được coi bản ghi của mình là durable nữa
+            log_message(ERROR, "WAL fdatasync failed, rejecting every further message: %s", strerror(errno));
+            wal.failed = true;
+            pthread_cond_broadcast(&wal.synced);
+            pthread_mutex_unlock(&wal.mutex);
+            return -1;
+        }
+        wal.durable_seq = target;
+        pthread_cond_broadcast(&wal.synced);
+    }
+
+    pthread_mutex_unlock(&wal.mutex);
+    return seq;
+}
+
+long long message_wal_replayed_seq()
+{
+    return atomic_load(&wal.replayed_seq);
+}
+
+void message_wal_applied(int applied)
+{
+    pthread_mutex_lock(&wal.mutex);
+    wal.applied += applied;
+    maybe_truncate(false);
+    pthread_mutex_unlock(&wal.mutex);
+}
+
+bool message_wal_dead_letter(long long seq, int sender_id, int receiver_id, int group_id, const char *content,
+                             time_t timestamp)
+{
+    uint32_t length = 0;
+    unsigned char *record = content ? build_record(sender_id, receiver_id, group_id, content, timestamp, &length) : NULL;
+    if (!record)
+    {
+        return false;
+    }
+    seal_record(record, seq, length);
+
+    pthread_mutex_lock(&wal.mutex);
+    if (!wal.open)
+    {
+        pthread_mutex_unlock(&wal.mutex);
+        free(record);
+        return false;
+    }
+    // Hiếm khi xảy ra nên mở file cho từng bản ghi; WAL chỉ được cắt sau khi bản ghi đã lên đĩa ở đây
+    int fd = open(wal.dead_path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    bool ok = fd >= 0 && write_all(fd, record, WAL_HEADER_SIZE + length) && fdatasync(fd) == 0;
+    if (!ok)
+    {
+        log_message(ERROR, "Failed to write WAL dead letter %s: %s", wal.dead_path, strerror(errno));
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (ok)
+    {
+        log_message(ERROR, "Message %lld from %d (receiver=%d, group=%d) moved to %s", seq, sender_id, receiver_id,
+                    group_id, wal.dead_path);
+        wal.applied++;
+        maybe_truncate(false);
+    }
+    pthread_mutex_unlock(&wal.mutex);
+    free(record);
+    return ok;
+}
@@ -0,0 +1,577 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "persist_queue.h"
+#include "message_wal.h"
+#include "conversation_summary.h"
+#include "message_index.h"
+#include "storage.h"
+#include "config.h"
+#include "m_utils.h"
+#include "log.h"
+
+// Flush chậm hơn ngưỡng này sẽ được log WARN
+#define PERSIST_SLOW_FLUSH_MS 1000
+
+typedef struct
+{
+    StoredMessage message;
+    // Số lần đã ghi lỗi và thời điểm được ghi lại (monotonic ms)
+    int attempts;
+    long long due_ms;
+} RetryMessage;
+
+typedef struct
+{
+    StoredMessage *pending;
+    int pending_count;
+    int pending_capacity;
+    // Thời điểm tin cũ nhất trong pending được đưa vào (monotonic ms)
+    long long oldest_ms;
+
+    // Số tin đã nhận và đã xử lý xong (ghi được hoặc lỗi), dùng cho flush
+    long long enqueued_seq;
+    long long completed_seq;
+    int flush_waiters;
+
+    // Tin trong WAL bị storage từ chối, chờ ghi lại; chỉ thread flusher dùng
+    RetryMessage *retries;
+    int retry_count;
+    int retry_capacity;
+
+    PersistQueueStats stats;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    pthread_t thread;
+    bool running;
+    bool stopping;
+    int flush_ms;
+    int batch_size;
+    int max_pending;
+} PersistQueue;
+
+static PersistQueue queue = {
+    .pending = NULL,
+    .pending_count = 0,
+    .pending_capacity = 0,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .running = false,
+    .stopping = false,
+    .flush_ms = PERSIST_DEFAULT_FLUSH_MS,
+    .batch_size = PERSIST_DEFAULT_BATCH_SIZE,
+    .max_pending = PERSIST_DEFAULT_MAX_PENDING};
+
+// Trả về số tin không ghi được, tin lỗi được đánh dấu failed
+static int write_batch(StoredMessage *messages, int count)
+{
+    int failed = storage()->messages_insert(messages, count);
+    for (int i = 0; failed > 0 && i < count; i++)
+    {
+        if (messages[i].failed)
+        {
+            StoredMessage *message = &messages[i];
+            log_message(ERROR, "Failed to write message from %d (receiver=%d, group=%d, wal=%lld)",
+                        message->sender_id, message->receiver_id, message->group_id, message->wal_id);
+        }
+    }
+    return failed;
+}
+
+// Báo cho WAL số bản ghi đã vào database để nó biết khi nào được cắt file
+static void report_to_wal(const StoredMessage *messages, int count)
+{
+    int applied = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (messages[i].wal_id > 0 && !messages[i].failed)
+        {
+            applied++;
+        }
+    }
+    if (applied > 0)
+    {
+        message_wal_applied(applied);
+    }
+}
+
+/**
+ * Đưa các tin lỗi có trong WAL vào hàng ghi lại, tin đã hết lượt thử thì chuyển sang dead letter
+ * để lỗi vĩnh viễn (vd. nhóm đã bị xóa) không giữ WAL mãi. attempts NULL nghĩa là lần ghi đầu.
+ * Content của tin được chuyển vào hàng ghi lại thì được gán NULL.
+ */
+static void schedule_retries(StoredMessage *messages, const int *attempts, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        StoredMessage *message = &messages[i];
+        if (!message->failed || message->wal_id <= 0)
+        {
+            continue;
+        }
+
+        int attempt = (attempts ? attempts[i] : 0) + 1;
+        if (attempt >= PERSIST_RETRY_ATTEMPTS)
+        {
+            // Dead letter lỗi thì bản ghi vẫn chưa applied, lần khởi động sau replay lại
+            message_wal_dead_letter(message->wal_id, message->sender_id, message->receiver_id, message->group_id,
+                                    message->content, message->timestamp);
+            continue;
+        }
+
+        if (queue.retry_count >= queue.retry_capacity)
+        {
+            int capacity = queue.retry_capacity > 0 ? queue.retry_capacity * 2 : 16;
+            RetryMessage *retries = realloc(queue.retries, sizeof(RetryMessage) * capacity);
+            if (!retries)
+            {
+                log_message(ERROR, "Failed to queue message %lld for retry, it is replayed on next start",
+                            message->wal_id);
+                continue;
+            }
+            queue.retries = retries;
+            queue.retry_capacity = capacity;
+        }
+
+        long long delay = (long long)queue.flush_ms << attempt;
+        RetryMessage *retry = &queue.retries[queue.retry_count++];
+        retry->message = *message;
+        retry->message.failed = false;
+        retry->attempts = attempt;
+        retry->due_ms = utils_now_ms() + (delay < PERSIST_RETRY_MAX_MS ? delay : PERSIST_RETRY_MAX_MS);
+        message->content = NULL;
+    }
+}
+
+// Cập nhật bảng tóm tắt hội thoại từ các tin vừa vào database và báo cho message index
+static void update_summaries(const StoredMessage *messages, int count)
+{
+    SummaryMessage *written = malloc(sizeof(SummaryMessage) * (count > 0 ? count : 1));
+    if (!written)
+    {
+        log_message(ERROR, "Memory allocation failed for conversation summaries");
+        return;
+    }
+
+    int n = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (!messages[i].failed)
+        {
+            SummaryMessage *summary = &written[n++];
+            summary->sender_id = messages[i].sender_id;
+            summary->receiver_id = messages[i].receiver_id;
+            summary->group_id = messages[i].group_id;
+            summary->content = messages[i].content;
+            summary->timestamp = messages[i].timestamp;
+        }
+    }
+    conversation_summary_apply(written, n);
+    free(written);
+    if (n > 0)
+    {
+        message_index_notify();
+    }
+}
+
+static void free_messages(StoredMessage *messages, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        free(messages[i].content);
+    }
+    free(messages);
+}
+
+// Ghi một tin ngay trên thread gọi, xem write_unqueued
+static bool write_now(StoredMessage *message)
+{
+    bool ok = write_batch(message, 1) == 0;
+    if (ok)
+    {
+        update_summaries(message, 1);
+    }
+    report_to_wal(message, 1);
+    return ok;
+}
+
+/**
+ * Tin không vào được queue: ghi ngay trên thread gọi. Tin đã nằm trong WAL thì dù ghi lỗi vẫn được coi là
+ * đã lưu: báo lỗi thì người gửi gửi lại, còn bản trong WAL được replay thành bản thứ hai.
+ * Queue đã dừng thì server đang tắt, bản ghi để lại trong WAL cho lần khởi động sau; đang chạy thì chuyển
+ * sang dead letter, nếu không nó không bao giờ applied và WAL không được cắt.
+ */
+static bool write_unqueued(StoredMessage *message, bool stopped)
+{
+    if (write_now(message))
+    {
+        return true;
+    }
+    if (message->wal_id <= 0)
+    {
+        return false;
+    }
+    if (!stopped)
+    {
+        // Dead letter lỗi thì bản ghi vẫn chưa applied, lần khởi động sau replay lại
+        message_wal_dead_letter(message->wal_id, message->sender_id, message->receiver_id, message->group_id,
+                                message->content, message->timestamp);
+    }
+    return true;
+}
+
+// Gọi khi đang giữ mutex
+static long long next_retry_ms()
+{
+    long long due = queue.retries[0].due_ms;
+    for (int i = 1; i < queue.retry_count; i++)
+    {
+        if (queue.retries[i].due_ms < due)
+        {
+            due = queue.retries[i].due_ms;
+        }
+    }
+    return due;
+}
+
+// Gọi khi đang giữ mutex
+static void wait_until(long long deadline_ms)
+{
+    struct timespec deadline = {.tv_sec = deadline_ms / 1000, .tv_nsec = (deadline_ms % 1000) * 1000000};
+    pthread_cond_timedwait(&queue.wake, &queue.mutex, &deadline);
+}
+
+// Ghi lại các tin đã tới hạn thử lại, gọi khi không giữ mutex
+static void retry_due()
+{
+    long long now = utils_now_ms();
+    int due = 0;
+    for (int i = 0; i < queue.retry_count; i++)
+    {
+        due += queue.retries[i].due_ms <= now;
+    }
+    if (due == 0)
+    {
+        return;
+    }
+
+    StoredMessage *messages = malloc(sizeof(StoredMessage) * due);
+    int *attempts = malloc(sizeof(int) * due);
+    if (!messages || !attempts)
+    {
+        free(messages);
+        free(attempts);
+        return;
+    }
+    int count = 0;
+    int kept = 0;
+    for (int i = 0; i < queue.retry_count; i++)
+    {
+        if (queue.retries[i].due_ms <= now)
+        {
+            messages[count] = queue.retries[i].message;
+            attempts[count++] = queue.retries[i].attempts;
+        }
+        else
+        {
+            queue.retries[kept++] = queue.retries[i];
+        }
+    }
+    queue.retry_count = kept;
+
+    int failed = write_batch(messages, count);
+    update_summaries(messages, count);
+    report_to_wal(messages, count);
+    schedule_retries(messages, attempts, count);
+    free_messages(messages, count);
+    free(attempts);
+
+    pthread_mutex_lock(&queue.mutex);
+    queue.stats.written += count - failed;
+    queue.stats.failed += failed;
+    pthread_mutex_unlock(&queue.mutex);
+}
+
+// Gọi khi đang giữ mutex
+static bool batch_ready()
+{
+    if (queue.pending_count == 0)
+    {
+        return false;
+    }
+    return queue.stopping || queue.flush_waiters > 0 || queue.pending_count >= queue.batch_size ||
+           utils_now_ms() - queue.oldest_ms >= queue.flush_ms;
+}
+
+static void *persist_thread(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&queue.mutex);
+    while (!queue.stopping || queue.pending_count > 0)
+    {
+        if (queue.pending_count == 0)
+        {
+            if (queue.retry_count == 0)
+            {
+                pthread_cond_wait(&queue.wake, &queue.mutex);
+            }
+            else if (utils_now_ms() < next_retry_ms())
+            {
+                wait_until(next_retry_ms());
+            }
+            else
+            {
+                pthread_mutex_unlock(&queue.mutex);
+                retry_due();
+                pthread_mutex_lock(&queue.mutex);
+            }
+            continue;
+        }
+
+        if (!batch_ready())
+        {
+            wait_until(queue.oldest_ms + queue.flush_ms);
+            continue;
+        }
+
+        StoredMessage *messages = queue.pending;
+        int count = queue.pending_count;
+        queue.pending = NULL;
+        queue.pending_count = 0;
+        queue.pending_capacity = 0;
+        queue.stats.depth = 0;
+        // Producer đang chờ chỗ trống có thể tiếp tục
+        pthread_cond_broadcast(&queue.done);
+        pthread_mutex_unlock(&queue.mutex);
+
+        long long started = utils_now_ms();
+        int failed = write_batch(messages, count);
+        update_summaries(messages, count);
+        long long elapsed = utils_now_ms() - started;
+        report_to_wal(messages, count);
+        schedule_retries(messages, NULL, count);
+        free_messages(messages, count);
+        // Dưới tải liên tục pending không bao giờ rỗng, ghi lại các tin tới hạn sau mỗi batch
+        retry_due();
+
+        if (elapsed >= PERSIST_SLOW_FLUSH_MS)
+        {
+            log_message(WARN, "Slow message flush: %d messages in %lldms", count, elapsed);
+        }
+        else
+        {
+            log_message(LOG_DEBUG, "Flushed %d messages in %lldms", count, elapsed);
+        }
+
+        pthread_mutex_lock(&queue.mutex);
+        queue.completed_seq += count;
+        queue.stats.written += count - failed;
+        queue.stats.failed += failed;
+        queue.stats.flushes++;
+        queue.stats.last_flush_ms = elapsed;
+        queue.stats.total_flush_ms += elapsed;
+        if (elapsed > queue.stats.max_flush_ms)
+        {
+            queue.stats.max_flush_ms = elapsed;
+        }
+        pthread_cond_broadcast(&queue.done);
+    }
+    pthread_mutex_unlock(&queue.mutex);
+    return NULL;
+}
+
+bool persist_queue_start()
+{
+    if (queue.running)
+    {
+        return true;
+    }
+
+    int flush_ms = config_get_persist_flush_ms();
+    int batch_size = config_get_persist_batch_size();
+    int max_pending = config_get_persist_max_pending();
+    queue.flush_ms = flush_ms > 0 ? flush_ms : PERSIST_DEFAULT_FLUSH_MS;
+    queue.batch_size = batch_size > 0 ? batch_size : PERSIST_DEFAULT_BATCH_SIZE;
+    queue.max_pending = max_pending > 0 ? max_pending : PERSIST_DEFAULT_MAX_PENDING;
+    if (queue.max_pending < queue.batch_size)
+    {
+        queue.max_pending = queue.batch_size;
+    }
+
+    // Deadline của timedwait tính bằng utils_now_ms (CLOCK_MONOTONIC)
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue.wake, &attr);
+    pthread_cond_init(&queue.done, &attr);
+    pthread_condattr_destroy(&attr);
+
+    queue.stopping = false;
+    queue.running = true;
+    if (pthread_create(&queue.thread, NULL, persist_thread, NULL) != 0)
+    {
+        log_message(ERROR, "Failed to create message persistence thread");
+        queue.running = false;
+        return false;
+    }
+
+    log_message(INFO, "Message write-behind started (flush=%dms, batch=%d, max_pending=%d)",
+                queue.flush_ms, queue.batch_size, queue.max_pending);
+    return true;
+}
+
+void persist_queue_stop()
+{
+    pthread_mutex_lock(&queue.mutex);
+    if (!queue.running)
+    {
+        pthread_mutex_unlock(&queue.mutex);
+        return;
+    }
+    log_message(INFO, "Draining %d queued messages", queue.pending_count);
+    queue.stopping = true;
+    pthread_cond_signal(&queue.wake);
+    pthread_mutex_unlock(&queue.mutex);
+
+    pthread_join(queue.thread, NULL);
+
+    // Tin còn chờ ghi lại vẫn chưa applied trong WAL, lần khởi động sau replay chúng
+    if (queue.retry_count > 0)
+    {
+        log_message(WARN, "%d failed messages left for the WAL to replay", queue.retry_count);
+    }
+    for (int i = 0; i < queue.retry_count; i++)
+    {
+        free(queue.retries[i].message.content);
+    }
+    free(queue.retries);
+    queue.retries = NULL;
+    queue.retry_count = 0;
+    queue.retry_capacity = 0;
+
+    pthread_mutex_lock(&queue.mutex);
+    queue.running = false;
+    PersistQueueStats stats = queue.stats;
+    // Đánh thức những ai còn chờ chỗ trống, push sẽ ghi trực tiếp
+    pthread_cond_broadcast(&queue.done);
+    pthread_mutex_unlock(&queue.mutex);
+
+    log_message(INFO, "Message write-behind stopped: %lld written, %lld failed, %lld flushes, max flush %lldms",
+                stats.written, stats.failed, stats.flushes, stats.max_flush_ms);
+}
+
+bool persist_queue_push(int sender_id, int receiver_id, int group_id, const char *content, time_t timestamp,
+                        long long wal_id)
+{
+    if (!content)
+    {
+        return false;
+    }
+
+    char *copy = strdup(content);
+    if (!copy)
+    {
+        log_message(ERROR, "Failed to copy message for persistence");
+        StoredMessage message = {sender_id, receiver_id, group_id, (char *)content, timestamp, wal_id, false};
+        return write_unqueued(&message, false);
+    }
+
+    pthread_mutex_lock(&queue.mutex);
+
+    // Hàng đợi đầy: chờ flusher lấy batch đi thay vì tăng bộ nhớ vô hạn
+    while (queue.running && !queue.stopping && queue.pending_count >= queue.max_pending)
+    {
+        pthread_cond_signal(&queue.wake);
+        pthread_cond_wait(&queue.done, &queue.mutex);
+    }
+
+    if (!queue.running || queue.stopping)
+    {
+        pthread_mutex_unlock(&queue.mutex);
+        StoredMessage message = {sender_id, receiver_id, group_id, copy, timestamp, wal_id, false};
+        bool ok = write_unqueued(&message, true);
+        free(copy);
+        return ok;
+    }
+
+    if (queue.pending_count >= queue.pending_capacity)
+    {
+        int capacity = queue.pending_capacity > 0 ? queue.pending_capacity * 2 : queue.batch_size;
+        StoredMessage *pending = realloc(queue.pending, sizeof(StoredMessage) * capacity);
+        if (!pending)
+        {
+            pthread_mutex_unlock(&queue.mutex);
+            log_message(ERROR, "Failed to grow message persistence queue");
+            StoredMessage message = {sender_id, receiver_id, group_id, copy, timestamp, wal_id, false};
+            bool ok = write_unqueued(&message, false);
+            free(copy);
+            return ok;
+        }
+        queue.pending = pending;
+        queue.pending_capacity = capacity;
+    }
+
+    if (queue.pending_count == 0)
+    {
+        queue.oldest_ms = utils_now_ms();
+    }
+
+    StoredMessage *message = &queue.pending[queue.pending_count++];
+    message->sender_id = sender_id;
+    message->receiver_id = receiver_id;
+    message->group_id = group_id;
+    message->content = copy;
+    message->timestamp = timestamp;
+    message->wal_id = wal_id;
+    message->failed = false;
+
+    queue.enqueued_seq++;
+    queue.stats.enqueued++;
+    queue.stats.depth = queue.pending_count;
+    if (queue.pending_count > queue.stats.max_depth)
+    {
+        queue.stats.max_depth = queue.pending_count;
+    }
+
+    // Chỉ đánh thức flusher khi tin đầu tiên vào hoặc đủ batch, còn lại để timer lo
+    if (queue.pending_count == 1 || queue.pending_count >= queue.batch_size)
+    {
+        pthread_cond_signal(&queue.wake);
+    }
+
+    pthread_mutex_unlock(&queue.mutex);
+    return true;
+}
+
+void persist_queue_flush()
+{
+    pthread_mutex_lock(&queue.mutex);
+    if (!queue.running)
+    {
+        pthread_mutex_unlock(&queue.mutex);
+        return;
+    }
+
+    long long target = queue.enqueued_seq;
+    if (queue.completed_seq < target)
+    {
+        queue.flush_waiters++;
+        pthread_cond_signal(&queue.wake);
+        while (queue.completed_seq < target)
+        {
+            pthread_cond_wait(&queue.done, &queue.mutex);
+        }
+        queue.flush_waiters--;
+    }
+    pthread_mutex_unlock(&queue.mutex);
+}
+
+PersistQueueStats persist_queue_get_stats()
+{
+    pthread_mutex_lock(&queue.mutex);
+    PersistQueueStats stats = queue.stats;
+    pthread_mutex_unlock(&queue.mutex);
+    return stats;
+}
@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <string.h>
+#include "storage.h"
+#include "message_log.h"
+#include "sql_catalog.h"
+#include "db_result.h"
+#include "config.h"
+#include "log.h"
+
+static const StorageBackend *backend = &MYSQL_STORAGE;
+static const StorageBackend *base = &MYSQL_STORAGE;
+// base với phần tin nhắn chuyển sang message log
+static StorageBackend routed;
+
+static bool routed_group_delete(int group_id)
+{
+    bool deleted = base->group_delete(group_id);
+    return message_log_drop(message_conversation_id(0, 0, group_id)) && deleted;
+}
+
+static bool route_messages_to_log()
+{
+    if (!message_log_open())
+    {
+        return false;
+    }
+    routed = *base;
+    routed.messages_insert = message_log_append;
+    routed.max_wal_id = message_log_max_wal_id;
+    routed.conversation_messages = message_log_read;
+    routed.conversation_messages_each = message_log_each;
+    routed.messages_after = message_log_after;
+    routed.messages_by_ids = message_log_by_ids;
+    routed.group_delete = routed_group_delete;
+    backend = &routed;
+    return true;
+}
+
+bool storage_start()
+{
+    const char *name = config_get_storage_backend();
+    if (!name || name[0] == '\0')
+    {
+        name = STORAGE_DEFAULT_BACKEND;
+    }
+
+    if (strcmp(name, MYSQL_STORAGE.name) == 0)
+    {
+        base = &MYSQL_STORAGE;
+    }
+#ifdef HAVE_SQLITE3
+    else if (strcmp(name, SQLITE_STORAGE.name) == 0)
+    {
+        base = &SQLITE_STORAGE;
+    }
+#endif
+    else
+    {
+        log_message(ERROR, "Unknown or unavailable storage backend '%s'", name);
+        return false;
+    }
+
+    if (!base->start())
+    {
+        log_message(ERROR, "Failed to start %s storage", base->name);
+        return false;
+    }
+    backend = base;
+    if (config_get_message_log_enabled() && !route_messages_to_log())
+    {
+        log_message(ERROR, "Failed to open the message log");
+        base->stop();
+        return false;
+    }
+    log_message(INFO, "Using %s storage%s", base->name, backend == base ? "" : " with messages in the message log");
+    return true;
+}
+
+void storage_stop()
+{
+    if (backend != base)
+    {
+        message_log_close();
+    }
+    base->stop();
+}
+
+const StorageBackend *storage()
+{
+    return backend;
+}
+
+bool storage_map_rows(const DbRowMapper *mapper, DbResult *result, void **out, int *count)
+{
+    *out = NULL;
+    *count = 0;
+    if (!result)
+    {
+        return false;
+    }
+    *out = db_map_rows(mapper, result, count);
+    // db_map_rows trả NULL cho cả kết quả rỗng lẫn lỗi decode
+    bool ok = *out != NULL || result->row_count == 0;
+    db_result_free(result);
+    return ok;
+}
+
+bool storage_map_groups(DbResult *result, Group ***out, int *count)
+{
+    *out = NULL;
+    *count = 0;
+    if (!result)
+    {
+        return false;
+    }
+    if (result->row_count == 0)
+    {
+        db_result_free(result);
+        return true;
+    }
+
+    // Các cột được tra theo tên một lần, mỗi hàng sau đó decode theo chỉ số
+    int columns[8];
+    Group **groups = NULL;
+    if (db_mapper_resolve(&SQL_MAP_GROUPS_BY_USER, result, columns))
+    {
+        groups = calloc(result->row_count, sizeof(Group *));
+    }
+    if (!groups)
+    {
+        log_message(ERROR, "Failed to decode groups by user");
+        db_result_free(result);
+        return false;
+    }
+    int creator_name_column = db_result_column_index(result, "creator_name");
+
+    int decoded = 0;
+    for (int i = 0; i < result->row_count; i++)
+    {
+        Group *group = calloc(1, sizeof(Group));
+        if (!group)
+        {
+            log_message(ERROR, "Memory allocation failed for group at row %d", i);
+            continue;
+        }
+
+        db_mapper_decode(&SQL_MAP_GROUPS_BY_USER, result, columns, i, group);
+        // Chủ nhóm không còn tồn tại thì created_by để NULL
+        const char *creator_name = creator_name_column >= 0 ? db_result_string(result, i, creator_name_column) : NULL;
+        if (creator_name)
+        {
+            User *creator = calloc(1, sizeof(User));
+            if (creator)
+            {
+                creator->id = group->creator_id;
+                creator->username = strdup(creator_name);
+            }
+            if (creator && creator->username)
+            {
+                group->created_by = creator;
+            }
+            else
+            {
+                free(creator);
+            }
+        }
+        groups[decoded++] = group;
+    }
+
+    db_result_free(result);
+    *out = groups;
+    *count = decoded;
+    return true;
+}
@@ -0,0 +1,814 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "storage.h"
+#include "database_connector.h"
+#include "db_statement.h"
+#include "db_result.h"
+#include "sql_statement.h"
+#include "sql_catalog.h"
+#include "log.h"
+
+// Kích thước các câu INSERT nhiều dòng, batch được chia theo thứ tự này
+static const int CHUNK_SIZES[] = DB_ARRAY_CHUNK_SIZES;
+#define CHUNK_SIZE_COUNT (int)(sizeof(CHUNK_SIZES) / sizeof(CHUNK_SIZES[0]))
+// Số lần ghi cả batch trong một transaction trước khi chuyển sang ghi từng dòng
+#define INSERT_BATCH_ATTEMPTS 2
+
+static const DbArrayStatement MESSAGE_INSERT = {SQL_INSERT_MESSAGE_BATCH_PREFIX, SQL_INSERT_MESSAGE_BATCH_ROW,
+                                                SQL_INSERT_MESSAGE_BATCH_SUFFIX, SQL_INSERT_MESSAGE_BATCH_PARAMS};
+static const DbArrayStatement DM_SUMMARY_UPSERT = {SQL_UPSERT_DM_SUMMARY_PREFIX, SQL_UPSERT_DM_SUMMARY_ROW,
+                                                   SQL_SUMMARY_UPSERT_SUFFIX, SQL_UPSERT_DM_SUMMARY_PARAMS};
+static const DbArrayStatement GROUP_SUMMARY_UPSERT = {SQL_UPSERT_GROUP_SUMMARY_PREFIX, SQL_UPSERT_GROUP_SUMMARY_ROW,
+                                                      SQL_SUMMARY_UPSERT_SUFFIX, SQL_UPSERT_GROUP_SUMMARY_PARAMS};
+
+// Câu INSERT tin nhắn cho từng kích thước chunk, giữ đến hết process
+static char *chunk_sql[CHUNK_SIZE_COUNT];
+static pthread_once_t chunk_sql_once = PTHREAD_ONCE_INIT;
+
+static void build_chunk_sql()
+{
+    for (int i = 0; i < CHUNK_SIZE_COUNT; i++)
+    {
+        chunk_sql[i] = db_array_sql(&MESSAGE_INSERT, CHUNK_SIZES[i]);
+    }
+}
+
+static bool mysql_start()
+{
+    pthread_once(&chunk_sql_once, build_chunk_sql);
+    for (int i = 0; i < CHUNK_SIZE_COUNT; i++)
+    {
+        if (!chunk_sql[i])
+        {
+            log_message(ERROR, "Failed to build batch insert statement");
+            return false;
+        }
+    }
+    return db_manager_start();
+}
+
+static void mysql_stop()
+{
+    db_manager_shutdown();
+}
+
+// Chạy stmt đã bind rồi decode bằng mapper; khác db_query_rows, lỗi và kết quả rỗng được phân biệt
+static bool query_rows(const DbRowMapper *mapper, DbStatement *stmt, void **out, int *count)
+{
+    DbResult *result = db_execute_rows(stmt);
+    db_statement_free(stmt);
+    return storage_map_rows(mapper, result, out, count);
+}
+
+// Như query_rows nhưng đọc stmt bằng cursor: từng hàng được decode vào row rồi chuyển cho visit,
+// chuỗi trong row trỏ vào buffer của cursor
+static bool stream_rows(const DbRowMapper *mapper, DbStatement *stmt, void *row, bool (*visit)(void *row, void *context),
+                        void *context)
+{
+    int columns[DB_MAPPER_MAX_FIELDS];
+    DbCursor *cursor = db_cursor_open(stmt);
+    bool ok = cursor != NULL && mapper->field_count <= DB_MAPPER_MAX_FIELDS &&
+              db_mapper_resolve_cursor(mapper, cursor, columns);
+    while (ok && db_cursor_next(cursor))
+    {
+        db_mapper_decode_cursor(mapper, cursor, columns, row);
+        if (!visit(row, context))
+        {
+            break;
+        }
+    }
+    ok = ok && !db_cursor_failed(cursor);
+    db_cursor_close(cursor);
+    db_statement_free(stmt);
+    return ok;
+}
+
+typedef struct
+{
+    UserRowFn each;
+    void *arg;
+} UserVisit;
+
+typedef struct
+{
+    MessageRowFn each;
+    void *arg;
+} MessageVisit;
+
+static bool visit_user(void *row, void *context)
+{
+    UserVisit *visit = context;
+    return visit->each(row, visit->arg);
+}
+
+static bool visit_message(void *row, void *context)
+{
+    MessageVisit *visit = context;
+    return visit->each(row, visit->arg);
+}
+
+// Cột đầu tiên của mỗi hàng, bỏ qua NULL
+static bool query_ids(const char *sql, int key, int **out, int *count)
+{
+    *out = NULL;
+    *count = 0;
+    DbStatement *stmt = db_prepare(sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    if (!db_bind_int(stmt, 0, key))
+    {
+        db_statement_free(stmt);
+        return false;
+    }
+
+    DbResult *result = db_execute_rows(stmt);
+    db_statement_free(stmt);
+    if (!result)
+    {
+        return false;
+    }
+    int *ids = result->row_count > 0 ? malloc(result->row_count * sizeof(int)) : NULL;
+    if (result->row_count > 0 && !ids)
+    {
+        db_result_free(result);
+        return false;
+    }
+    int n = 0;
+    for (int i = 0; i < result->row_count; i++)
+    {
+        if (!db_result_is_null(result, i, 0))
+        {
+            ids[n++] = db_result_int(result, i, 0);
+        }
+    }
+    db_result_free(result);
+    *out = ids;
+    *count = n;
+    return true;
+}
+
+static int mysql_user_lookup(const char *username, char *password, size_t password_size)
+{
+    DbStatement *stmt = db_prepare(SQL_LOGIN);
+    if (!stmt)
+    {
+        return -1;
+    }
+    if (!db_bind_string(stmt, 0, username))
+    {
+        db_statement_free(stmt);
+        return -1;
+    }
+    DbResult *result = db_execute_rows(stmt);
+    db_statement_free(stmt);
+    if (!result)
+    {
+        return -1;
+    }
+
+    int id = 0;
+    if (result->row_count > 0)
+    {
+        const char *stored = db_result_string(result, 0, 1);
+        id = db_result_int(result, 0, 0);
+        snprintf(password, password_size, "%s", stored ? stored : "");
+    }
+    db_result_free(result);
+    return id;
+}
+
+static int mysql_user_insert(const char *username, const char *password)
+{
+    DbStatement *stmt = db_prepare(SQL_REGISTER);
+    if (!stmt)
+    {
+        return 0;
+    }
+    int id = 0;
+    if (db_bind_string(stmt, 0, username) && db_bind_string(stmt, 1, password) && db_execute(stmt))
+    {
+        id = db_get_insert_id(stmt);
+    }
+    db_statement_free(stmt);
+    return id;
+}
+
+static bool mysql_user_name(int id, char *username, size_t username_size)
+{
+    DbStatement *stmt = db_prepare(SQL_MAP_USER_BY_ID.sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    if (!db_bind_int(stmt, 0, id))
+    {
+        db_statement_free(stmt);
+        return false;
+    }
+
+    // id là khóa chính nên chỉ có một phần tử
+    int count = 0;
+    User *user = NULL;
+    if (!query_rows(&SQL_MAP_USER_BY_ID, stmt, (void **)&user, &count) || !user)
+    {
+        return false;
+    }
+    snprintf(username, username_size, "%s", user->username ? user->username : "");
+    free(user->username);
+    free(user);
+    return true;
+}
+
+static bool mysql_users_list(int except_id, User **out, int *count)
+{
+    const DbRowMapper *mapper = except_id > 0 ? &SQL_MAP_ALL_USERS_EXCEPT : &SQL_MAP_ALL_USERS;
+    DbStatement *stmt = db_prepare(mapper->sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    if (except_id > 0 && !db_bind_int(stmt, 0, except_id))
+    {
+        db_statement_free(stmt);
+        return false;
+    }
+    return query_rows(mapper, stmt, (void **)out, count);
+}
+
+static bool mysql_users_each(UserRowFn each, void *arg)
+{
+    DbStatement *stmt = db_prepare(SQL_MAP_ALL_USERS.sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    User user = {0};
+    UserVisit visit = {each, arg};
+    return stream_rows(&SQL_MAP_ALL_USERS, stmt, &user, visit_user, &visit);
+}
+
+static bool mysql_users_search(const char *pattern, int limit, User **out, int *count)
+{
+    // LIMIT của câu MySQL cố định bằng USERNAME_SEARCH_LIMIT
+    (void)limit;
+    DbStatement *stmt = db_prepare(SQL_MAP_USERS_BY_USERNAME.sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    if (!db_bind_string(stmt, 0, pattern))
+    {
+        db_statement_free(stmt);
+        return false;
+    }
+    return query_rows(&SQL_MAP_USERS_BY_USERNAME, stmt, (void **)out, count);
+}
+
+static bool mysql_usernames(User **out, int *count)
+{
+    DbStatement *stmt = db_prepare(SQL_MAP_ALL_USERNAMES.sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    return query_rows(&SQL_MAP_ALL_USERNAMES, stmt, (void **)out, count);
+}
+
+static int mysql_group_insert(const Group *group)
+{
+    DbStatement *stmt = db_prepare(SQL_CREATE_GROUP);
+    if (!stmt)
+    {
+        return 0;
+    }
+    int id = 0;
+    if (db_bind_string(stmt, 0, group->name) && db_bind_int(stmt, 1, group->creator_id) &&
+        db_bind_long(stmt, 2, group->created_at) && db_bind_string(stmt, 3, group->password) && db_execute(stmt))
+    {
+        id = db_get_insert_id(stmt);
+    }
+    db_statement_free(stmt);
+    return id;
+}
+
+static bool mysql_group_delete(int group_id)
+{
+    const char *queries[] = {
+        SQL_DELETE_GROUP_MEMBERS,
+        SQL_DELETE_MESSAGES,
+        SQL_DELETE_GROUP_SUMMARY,
+        SQL_DELETE_GROUP_ONLY};
+    int query_count = sizeof(queries) / sizeof(queries[0]);
+    DbParam key = DB_INT(group_id);
+
+    // Cùng một transaction: lỗi giữa chừng không để lại nhóm mất nửa dữ liệu, và chỉ một lần commit
+    DbTransaction *tx = db_begin();
+    bool ok = tx != NULL;
+    for (int i = 0; i < query_count && ok; i++)
+    {
+        ok = db_transaction_execute(tx, queries[i], &key, 1);
+        if (!ok)
+        {
+            log_message(ERROR, "Failed to delete group %d at step %d", group_id, i);
+        }
+    }
+    if (ok)
+    {
+        return db_commit(tx);
+    }
+    db_rollback(tx);
+    return false;
+}
+
+static bool mysql_group_get(int group_id, Group *out)
+{
+    DbStatement *stmt = db_prepare(SQL_MAP_GROUP.sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    if (!db_bind_int(stmt, 0, group_id))
+    {
+        db_statement_free(stmt);
+        return false;
+    }
+
+    // group_id là khóa chính nên chỉ có một hàng
+    int count = 0;
+    Group *group = NULL;
+    if (!query_rows(&SQL_MAP_GROUP, stmt, (void **)&group, &count) || !group)
+    {
+        return false;
+    }
+    *out = *group;
+    free(group);
+    return true;
+}
+
+static bool mysql_groups_by_name(const char *name, Group **out, int *count)
+{
+    DbStatement *stmt = db_prepare(SQL_MAP_GROUP_BY_NAME.sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    if (!db_bind_string(stmt, 0, name))
+    {
+        db_statement_free(stmt);
+        return false;
+    }
+    return query_rows(&SQL_MAP_GROUP_BY_NAME, stmt, (void **)out, count);
+}
+
+static bool mysql_groups_by_user(int user_id, Group ***out, int *count)
+{
+    DbStatement *stmt = db_prepare(SQL_MAP_GROUPS_BY_USER.sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    if (!db_bind_int(stmt, 0, user_id))
+    {
+        db_statement_free(stmt);
+        return false;
+    }
+    DbResult *result = db_execute_rows(stmt);
+    db_statement_free(stmt);
+    return storage_map_groups(result, out, count);
+}
+
+static bool mysql_member_insert(int group_id, int user_id, time_t joined_at)
+{
+    DbStatement *stmt = db_prepare(SQL_ADD_GROUP_MEMBER);
+    bool ok = stmt && db_bind_int(stmt, 0, group_id) && db_bind_int(stmt, 1, user_id) &&
+              db_bind_long(stmt, 2, (long)joined_at) && db_bind_int(stmt, 3, 0) && db_execute(stmt);
+    db_statement_free(stmt);
+    return ok;
+}
+
+static bool mysql_member_delete(int group_id, int user_id)
+{
+    DbStatement *stmt = db_prepare(SQL_REMOVE_GROUP_MEMBER);
+    bool ok = stmt && db_bind_int(stmt, 0, group_id) && db_bind_int(stmt, 1, user_id) && db_execute(stmt);
+    db_statement_free(stmt);
+    return ok;
+}
+
+static bool mysql_group_member_ids(int group_id, int **out, int *count)
+{
+    return query_ids(SQL_GET_GROUP_MEMBER_IDS, group_id, out, count);
+}
+
+static bool mysql_user_group_ids(int user_id, int **out, int *count)
+{
+    return query_ids(SQL_GET_USER_GROUP_IDS, user_id, out, count);
+}
+
+static bool bind_message_row(DbStatement *stmt, int row, const StoredMessage *message)
+{
+    int base = row * SQL_INSERT_MESSAGE_BATCH_PARAMS;
+    bool ok = db_bind_int(stmt, base, message->sender_id);
+    if (message->group_id > 0)
+    {
+        ok = ok && db_bind_null(stmt, base + 1) && db_bind_int(stmt, base + 2, message->group_id);
+    }
+    else
+    {
+        ok = ok && db_bind_int(stmt, base + 1, message->receiver_id) && db_bind_null(stmt, base + 2);
+    }
+    ok = ok && db_bind_long(stmt, base + 3, (long)message_conversation_id(message->sender_id, message->receiver_id, message->group_id)) &&
+         db_bind_string(stmt, base + 4, message->content) &&
+         db_bind_long(stmt, base + 5, (long)message->timestamp);
+    return ok && (message->wal_id > 0 ? db_bind_long(stmt, base + 6, (long)message->wal_id) : db_bind_null(stmt, base + 6));
+}
+
+// Ghi rows tin bằng một câu INSERT có đúng rows bộ giá trị
+static bool insert_chunk(DbTransaction *tx, int chunk, const StoredMessage *messages)
+{
+    DbStatement *stmt = chunk_sql[chunk] ? db_transaction_prepare(tx, chunk_sql[chunk]) : NULL;
+    if (!stmt)
+    {
+        return false;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < CHUNK_SIZES[chunk] && ok; i++)
+    {
+        ok = bind_message_row(stmt, i, &messages[i]);
+    }
+    ok = ok && db_execute(stmt);
+    db_statement_free(stmt);
+    return ok;
+}
+
+// Ghi cả batch trong một transaction. Lỗi giữa chừng (deadlock 1213, lock wait timeout, ...) có thể
+// đã rollback cả transaction chứ không chỉ câu lỗi, nên không giữ lại phần nào của lần ghi hỏng.
+// started = false khi không mở được transaction
+static bool insert_batch(StoredMessage *messages, int count, bool *started)
+{
+    DbTransaction *tx = db_begin();
+    *started = tx != NULL;
+    if (!tx)
+    {
+        return false;
+    }
+
+    int offset = 0;
+    while (offset < count)
+    {
+        int chunk = 0;
+        while (CHUNK_SIZES[chunk] > count - offset)
+        {
+            chunk++;
+        }
+        if (!insert_chunk(tx, chunk, &messages[offset]))
+        {
+            db_rollback(tx);
+            return false;
+        }
+        offset += CHUNK_SIZES[chunk];
+    }
+    return db_commit(tx);
+}
+
+static int mysql_messages_insert(StoredMessage *messages, int count)
+{
+    // Cả batch một lần commit thay vì một lần cho mỗi câu INSERT; thử lại một lần vì deadlock thường chỉ tạm thời
+    bool started = true;
+    for (int attempt = 0; attempt < INSERT_BATCH_ATTEMPTS && started; attempt++)
+    {
+        if (insert_batch(messages, count, &started))
+        {
+            return 0;
+        }
+    }
+
+    // Vẫn lỗi: ghi từng dòng trong transaction riêng để một dòng hỏng không kéo theo các dòng khác
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (!started || !insert_batch(&messages[i], 1, &started))
+        {
+            messages[i].failed = true;
+            failed++;
+        }
+    }
+    return failed;
+}
+
+static bool mysql_max_wal_id(long long *out)
+{
+    *out = 0;
+    DbStatement *stmt = db_prepare(SQL_GET_MAX_WAL_ID);
+    if (!stmt)
+    {
+        return false;
+    }
+    DbResult *result = db_execute_rows(stmt);
+    db_statement_free(stmt);
+    if (!result)
+    {
+        return false;
+    }
+    if (result->row_count > 0)
+    {
+        *out = db_result_long(result, 0, 0);
+    }
+    db_result_free(result);
+    return true;
+}
+
+static bool upsert_summaries(const DbArrayStatement *table, const SummaryRow *rows, int count)
+{
+    if (count <= 0)
+    {
+        return true;
+    }
+    DbParam *params = malloc(sizeof(DbParam) * (size_t)count * table->params);
+    if (!params)
+    {
+        return false;
+    }
+    DbParam *p = params;
+    for (int i = 0; i < count; i++)
+    {
+        *p++ = DB_INT(rows[i].key);
+        if (table == &DM_SUMMARY_UPSERT)
+        {
+            *p++ = DB_INT(rows[i].peer_id);
+        }
+        *p++ = DB_INT(rows[i].sender_id);
+        *p++ = DB_STRING(rows[i].preview);
+        *p++ = DB_LONG((long)rows[i].timestamp);
+    }
+
+    DbTransaction *tx = db_begin();
+    bool ok = tx && db_transaction_execute_array(tx, table, params, count);
+    if (ok)
+    {
+        ok = db_commit(tx);
+    }
+    else
+    {
+        db_rollback(tx);
+    }
+    free(params);
+    return ok;
+}
+
+static bool mysql_dm_summaries_upsert(const SummaryRow *rows, int count)
+{
+    return upsert_summaries(&DM_SUMMARY_UPSERT, rows, count);
+}
+
+static bool mysql_group_summaries_upsert(const SummaryRow *rows, int count)
+{
+    return upsert_summaries(&GROUP_SUMMARY_UPSERT, rows, count);
+}
+
+static bool mysql_conversation_messages(long long conversation_id, MessageData **out, int *count)
+{
+    DbStatement *stmt = db_prepare(SQL_MAP_CONVERSATION_MESSAGES.sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    if (!db_bind_long(stmt, 0, (long)conversation_id))
+    {
+        db_statement_free(stmt);
+        return false;
+    }
+    return query_rows(&SQL_MAP_CONVERSATION_MESSAGES, stmt, (void **)out, count);
+}
+
+static bool mysql_conversation_messages_each(long long conversation_id, MessageRowFn each, void *arg)
+{
+    DbStatement *stmt = db_prepare(SQL_MAP_CONVERSATION_MESSAGES.sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    if (!db_bind_long(stmt, 0, (long)conversation_id))
+    {
+        db_statement_free(stmt);
+        return false;
+    }
+    MessageData message = {0};
+    MessageVisit visit = {each, arg};
+    return stream_rows(&SQL_MAP_CONVERSATION_MESSAGES, stmt, &message, visit_message, &visit);
+}
+
+static bool mysql_chat_histories(int user_id, ChatHistory **out, int *count)
+{
+    DbStatement *stmt = db_prepare(SQL_MAP_CHAT_HISTORIES_BY_USER.sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    // dm_summaries.user_id = ? và group_members.user_id = ?
+    if (!db_bind_int(stmt, 0, user_id) || !db_bind_int(stmt, 1, user_id))
+    {
+        db_statement_free(stmt);
+        return false;
+    }
+    return query_rows(&SQL_MAP_CHAT_HISTORIES_BY_USER, stmt, (void **)out, count);
+}
+
+static bool mysql_messages_after(long long after_id, int limit, MessageSearchResult **out, int *count)
+{
+    DbStatement *stmt = db_prepare(SQL_MAP_MESSAGES_AFTER.sql);
+    if (!stmt)
+    {
+        return false;
+    }
+    if (!db_bind_long(stmt, 0, (long)after_id) || !db_bind_int(stmt, 1, limit))
+    {
+        db_statement_free(stmt);
+        return false;
+    }
+    return query_rows(&SQL_MAP_MESSAGES_AFTER, stmt, (void **)out, count);
+}
+
+// Câu IN chỉ có các độ dài trong CHUNK_SIZES để cache statement của connection không bị lấp đầy bởi
+// mỗi số lượng id một câu: id_count (<= CHUNK_SIZES[0]) được làm tròn lên độ dài gần nhất, chỗ thừa
+// lặp lại id cuối, không đổi kết quả của IN
+static DbStatement *prepare_id_list(const char *prefix, const char *suffix, const long long *ids, int id_count)
+{
+    int size = CHUNK_SIZES[0];
+    for (int i = 0; i < CHUNK_SIZE_COUNT && CHUNK_SIZES[i] >= id_count; i++)
+    {
+        size = CHUNK_SIZES[i];
+    }
+    size_t prefix_length = strlen(prefix);
+    size_t suffix_length = strlen(suffix);
+    char *sql = malloc(prefix_length + (size_t)size * 3 + suffix_length + 1);
+    if (!sql)
+    {
+        return NULL;
+    }
+    char *p = sql;
+    memcpy(p, prefix, prefix_length);
+    p += prefix_length;
+    for (int i = 0; i < size; i++)
+    {
+        if (i > 0)
+        {
+            *p++ = ',';
+            *p++ = ' ';
+        }
+        *p++ = '?';
+    }
+    memcpy(p, suffix, suffix_length);
+    p[suffix_length] = '\0';
+
+    DbStatement *stmt = db_prepare(sql);
+    free(sql);
+    if (!stmt)
+    {
+        return NULL;
+    }
+    bool bound = true;
+    for (int i = 0; i < size && bound; i++)
+    {
+        bound = db_bind_long(stmt, i, (long)ids[i < id_count ? i : id_count - 1]);
+    }
+    if (!bound)
+    {
+        db_statement_free(stmt);
+        return NULL;
+    }
+    return stmt;
+}
+
+static int compare_id_desc(const void *a, const void *b)
+{
+    long long left = *(const long long *)a;
+    long long right = *(const long long *)b;
+    return (left < right) - (left > right);
+}
+
+static bool mysql_messages_by_ids(const long long *ids, int id_count, MessageSearchResult **out, int *count)
+{
+    *out = NULL;
+    *count = 0;
+    if (id_count <= 0)
+    {
+        return true;
+    }
+    // Id được sắp giảm dần và bỏ trùng, nên nối kết quả các câu (mỗi câu ORDER BY id DESC) vẫn mới nhất trước
+    long long *sorted = malloc(sizeof(long long) * id_count);
+    if (!sorted)
+    {
+        return false;
+    }
+    memcpy(sorted, ids, sizeof(long long) * id_count);
+    qsort(sorted, id_count, sizeof(long long), compare_id_desc);
+    int unique = 0;
+    for (int i = 0; i < id_count; i++)
+    {
+        if (unique == 0 || sorted[unique - 1] != sorted[i])
+        {
+            sorted[unique++] = sorted[i];
+        }
+    }
+
+    bool ok = true;
+    for (int start = 0; ok && start < unique; start += CHUNK_SIZES[0])
+    {
+        int chunk = unique - start < CHUNK_SIZES[0] ? unique - start : CHUNK_SIZES[0];
+        DbStatement *stmt = prepare_id_list(SQL_GET_MESSAGES_BY_IDS_PREFIX, SQL_GET_MESSAGES_BY_IDS_SUFFIX,
+                                            sorted + start, chunk);
+        MessageSearchResult *rows = NULL;
+        int row_count = 0;
+        ok = stmt && query_rows(&SQL_MAP_MESSAGES_BY_IDS, stmt, (void **)&rows, &row_count);
+        if (!ok || row_count == 0)
+        {
+            continue;
+        }
+        MessageSearchResult *merged = realloc(*out, sizeof(MessageSearchResult) * (*count + row_count));
+        if (merged)
+        {
+            memcpy(merged + *count, rows, sizeof(MessageSearchResult) * row_count);
+            *out = merged;
+            *count += row_count;
+        }
+        else
+        {
+            for (int i = 0; i < row_count; i++)
+            {
+                free(rows[i].sender_name);
+                free(rows[i].content);
+            }
+            ok = false;
+        }
+        free(rows);
+    }
+    free(sorted);
+    if (!ok)
+    {
+        for (int i = 0; i < *count; i++)
+        {
+            free((*out)[i].sender_name);
+            free((*out)[i].content);
+        }
+        free(*out);
+        *out = NULL;
+        *count = 0;
+    }
+    return ok;
+}
+
+static bool mysql_messages_delete(const long long *ids, int id_count)
+{
+    // Xóa lại id đã xóa không có tác dụng, nên lỗi giữa chừng chỉ cần gọi lại cả danh sách
+    bool ok = true;
+    for (int start = 0; ok && start < id_count; start += CHUNK_SIZES[0])
+    {
+        int chunk = id_count - start < CHUNK_SIZES[0] ? id_count - start : CHUNK_SIZES[0];
+        DbStatement *stmt = prepare_id_list(SQL_DELETE_MESSAGES_BY_IDS_PREFIX, SQL_DELETE_MESSAGES_BY_IDS_SUFFIX,
+                                            ids + start, chunk);
+        ok = stmt && db_execute(stmt);
+        db_statement_free(stmt);
+    }
+    if (!ok)
+    {
+        log_message(ERROR, "Failed to delete %d messages", id_count);
+    }
+    return ok;
+}
+
+const StorageBackend MYSQL_STORAGE = {
+    .name = "mysql",
+    .kind = STORAGE_MYSQL,
+    .start = mysql_start,
+    .stop = mysql_stop,
+    .user_lookup = mysql_user_lookup,
+    .user_insert = mysql_user_insert,
+    .user_name = mysql_user_name,
+    .users_list = mysql_users_list,
+    .users_each = mysql_users_each,
+    .users_search = mysql_users_search,
+    .usernames = mysql_usernames,
+    .group_insert = mysql_group_insert,
+    .group_delete = mysql_group_delete,
+    .group_get = mysql_group_get,
+    .groups_by_name = mysql_groups_by_name,
+    .groups_by_user = mysql_groups_by_user,
+    .member_insert = mysql_member_insert,
+    .member_delete = mysql_member_delete,
+    .group_member_ids = mysql_group_member_ids,
+    .user_group_ids = mysql_user_group_ids,
+    .messages_insert = mysql_messages_insert,
+    .max_wal_id = mysql_max_wal_id,
+    .dm_summaries_upsert = mysql_dm_summaries_upsert,
+    .group_summaries_upsert = mysql_group_summaries_upsert,
+    .conversation_messages = mysql_conversation_messages,
+    .conversation_messages_each = mysql_conversation_messages_each,
+    .chat_histories = mysql_chat_histories,
+    .messages_after = mysql_messages_after,
+    .messages_by_ids = mysql_messages_by_ids,
+    .messages_delete = mysql_messages_delete};
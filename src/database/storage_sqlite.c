@@ -0,0 +1,823 @@
+#ifdef HAVE_SQLITE3
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include "storage.h"
+#include "database_connector.h"
+#include "db_result.h"
+#include "sql_statement_sqlite.h"
+#include "sql_catalog.h"
+#include "config.h"
+#include "log.h"
+
+typedef struct
+{
+    unsigned int hash;
+    const char *sql;
+    sqlite3_stmt *stmt;
+} SqliteCachedStatement;
+
+// Một connection cho mọi thread, tuần tự hóa bằng mutex: mỗi lời gọi chỉ là vài thao tác
+// B-tree trong process, pool nhiều connection chủ yếu thêm tranh chấp lock bên trong SQLite
+typedef struct
+{
+    sqlite3 *db;
+    pthread_mutex_t mutex;
+    SqliteCachedStatement statements[STORAGE_SQLITE_STATEMENT_CACHE_SIZE];
+    int statement_count;
+} SqliteStorage;
+
+static SqliteStorage sqlite_storage = {
+    .db = NULL,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .statement_count = 0};
+
+static unsigned int hash_sql(const char *sql)
+{
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)sql; *p; p++)
+    {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void log_error(const char *what)
+{
+    log_message(ERROR, "SQLite %s failed: %s", what, sqlite3_errmsg(sqlite_storage.db));
+}
+
+// Gọi khi đang giữ mutex. SQL phải là chuỗi hằng vì cache giữ con trỏ của nó
+static sqlite3_stmt *prepare(const char *sql)
+{
+    unsigned int hash = hash_sql(sql);
+    for (int i = 0; i < sqlite_storage.statement_count; i++)
+    {
+        SqliteCachedStatement *entry = &sqlite_storage.statements[i];
+        if (entry->hash == hash && strcmp(entry->sql, sql) == 0)
+        {
+            return entry->stmt;
+        }
+    }
+
+    sqlite3_stmt *stmt = NULL;
+    if (sqlite3_prepare_v3(sqlite_storage.db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL) != SQLITE_OK)
+    {
+        log_error("prepare");
+        return NULL;
+    }
+    if (sqlite_storage.statement_count < STORAGE_SQLITE_STATEMENT_CACHE_SIZE)
+    {
+        SqliteCachedStatement *entry = &sqlite_storage.statements[sqlite_storage.statement_count++];
+        entry->hash = hash;
+        entry->sql = sql;
+        entry->stmt = stmt;
+    }
+    return stmt;
+}
+
+// Trả statement về trạng thái sạch, statement không nằm trong cache thì finalize
+static void finish(sqlite3_stmt *stmt)
+{
+    if (!stmt)
+    {
+        return;
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    for (int i = 0; i < sqlite_storage.statement_count; i++)
+    {
+        if (sqlite_storage.statements[i].stmt == stmt)
+        {
+            return;
+        }
+    }
+    sqlite3_finalize(stmt);
+}
+
+static bool exec(const char *sql)
+{
+    sqlite3_stmt *stmt = prepare(sql);
+    db_manager_count_query();
+    bool ok = stmt && sqlite3_step(stmt) == SQLITE_DONE;
+    if (stmt && !ok)
+    {
+        log_error("statement");
+    }
+    finish(stmt);
+    return ok;
+}
+
+// Chạy một câu không trả về dòng, statement vẫn thuộc caller
+static bool step_done(sqlite3_stmt *stmt)
+{
+    db_manager_count_query();
+    int rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE)
+    {
+        log_error("step");
+    }
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE;
+}
+
+static DbResult *create_result(sqlite3_stmt *stmt)
+{
+    int column_count = sqlite3_column_count(stmt);
+    const char *names[column_count > 0 ? column_count : 1];
+    for (int i = 0; i < column_count; i++)
+    {
+        names[i] = sqlite3_column_name(stmt, i);
+    }
+    return db_result_create(column_count, names, NULL);
+}
+
+// Đọc hết các dòng của stmt vào result rồi reset stmt
+static bool append_rows(sqlite3_stmt *stmt, DbResult *result)
+{
+    int column_count = result->column_count;
+    const char *values[column_count > 0 ? column_count : 1];
+    unsigned long lengths[column_count > 0 ? column_count : 1];
+
+    db_manager_count_query();
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        for (int i = 0; i < column_count; i++)
+        {
+            values[i] = (const char *)sqlite3_column_text(stmt, i);
+            lengths[i] = (unsigned long)sqlite3_column_bytes(stmt, i);
+        }
+        if (!db_result_append_row(result, values, lengths))
+        {
+            log_message(ERROR, "Failed to grow result set");
+            sqlite3_reset(stmt);
+            return false;
+        }
+    }
+    if (rc != SQLITE_DONE)
+    {
+        log_error("query");
+    }
+    sqlite3_reset(stmt);
+    return rc == SQLITE_DONE;
+}
+
+static DbResult *query(sqlite3_stmt *stmt)
+{
+    DbResult *result = create_result(stmt);
+    if (!result || !append_rows(stmt, result))
+    {
+        db_result_free(result);
+        return NULL;
+    }
+    return result;
+}
+
+static bool query_rows(const DbRowMapper *mapper, sqlite3_stmt *stmt, void **out, int *count)
+{
+    DbResult *result = query(stmt);
+    return storage_map_rows(mapper, result, out, count);
+}
+
+static bool sqlite_start()
+{
+    const char *path = config_get_storage_sqlite_path();
+    if (!path || path[0] == '\0')
+    {
+        path = STORAGE_DEFAULT_SQLITE_PATH;
+    }
+
+    // Mutex của SQLite không cần: mọi lời gọi đã đi qua sqlite_storage.mutex
+    int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX;
+    if (sqlite3_open_v2(path, &sqlite_storage.db, flags, NULL) != SQLITE_OK)
+    {
+        log_message(ERROR, "Failed to open SQLite database %s: %s", path,
+                    sqlite_storage.db ? sqlite3_errmsg(sqlite_storage.db) : "out of memory");
+        sqlite3_close(sqlite_storage.db);
+        sqlite_storage.db = NULL;
+        return false;
+    }
+    sqlite3_busy_timeout(sqlite_storage.db, STORAGE_SQLITE_BUSY_TIMEOUT_MS);
+
+    char *error = NULL;
+    if (sqlite3_exec(sqlite_storage.db, SQLITE_PRAGMAS SQLITE_CREATE_SCHEMA, NULL, NULL, &error) != SQLITE_OK)
+    {
+        log_message(ERROR, "Failed to initialize SQLite database %s: %s", path, error ? error : "unknown error");
+        sqlite3_free(error);
+        sqlite3_close(sqlite_storage.db);
+        sqlite_storage.db = NULL;
+        return false;
+    }
+
+    log_message(INFO, "SQLite database %s opened (WAL, SQLite %s)", path, sqlite3_libversion());
+    return true;
+}
+
+static void sqlite_stop()
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    for (int i = 0; i < sqlite_storage.statement_count; i++)
+    {
+        sqlite3_finalize(sqlite_storage.statements[i].stmt);
+    }
+    sqlite_storage.statement_count = 0;
+    if (sqlite_storage.db)
+    {
+        sqlite3_close(sqlite_storage.db);
+        sqlite_storage.db = NULL;
+    }
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+}
+
+static int sqlite_user_lookup(const char *username, char *password, size_t password_size)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_LOGIN);
+    int id = -1;
+    if (stmt && sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC) == SQLITE_OK)
+    {
+        db_manager_count_query();
+        int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW)
+        {
+            const unsigned char *stored = sqlite3_column_text(stmt, 1);
+            id = sqlite3_column_int(stmt, 0);
+            snprintf(password, password_size, "%s", stored ? (const char *)stored : "");
+        }
+        else if (rc == SQLITE_DONE)
+        {
+            id = 0;
+        }
+        else
+        {
+            log_error("login query");
+        }
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return id;
+}
+
+static int sqlite_user_insert(const char *username, const char *password)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_REGISTER);
+    int id = 0;
+    if (stmt && sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC) == SQLITE_OK &&
+        sqlite3_bind_text(stmt, 2, password, -1, SQLITE_STATIC) == SQLITE_OK && step_done(stmt))
+    {
+        id = (int)sqlite3_last_insert_rowid(sqlite_storage.db);
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return id;
+}
+
+static bool sqlite_user_name(int id, char *username, size_t username_size)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_GET_USER_BY_ID);
+    bool found = false;
+    if (stmt && sqlite3_bind_int(stmt, 1, id) == SQLITE_OK)
+    {
+        db_manager_count_query();
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            const unsigned char *name = sqlite3_column_text(stmt, 1);
+            snprintf(username, username_size, "%s", name ? (const char *)name : "");
+            found = true;
+        }
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return found;
+}
+
+static bool sqlite_users_list(int except_id, User **out, int *count)
+{
+    const DbRowMapper *mapper = except_id > 0 ? &SQL_MAP_ALL_USERS_EXCEPT : &SQL_MAP_ALL_USERS;
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(except_id > 0 ? SQLITE_GET_ALL_USERS_EXCEPT : SQLITE_GET_ALL_USERS);
+    DbResult *result = NULL;
+    if (stmt && (except_id <= 0 || sqlite3_bind_int(stmt, 1, except_id) == SQLITE_OK))
+    {
+        result = query(stmt);
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return storage_map_rows(mapper, result, (void **)out, count);
+}
+
+// Một trang của câu *_PAGE: các dòng có id > after_id. key là tham số đầu nếu câu có.
+// Mutex chỉ được giữ lúc đọc trang, không giữ trong lúc caller xử lý các dòng
+static bool query_page(const char *sql, const long long *key, long long after_id, const DbRowMapper *mapper,
+                       void **out, int *count)
+{
+    int index = 1;
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(sql);
+    DbResult *result = NULL;
+    if (stmt && (!key || sqlite3_bind_int64(stmt, index++, *key) == SQLITE_OK) &&
+        sqlite3_bind_int64(stmt, index++, after_id) == SQLITE_OK &&
+        sqlite3_bind_int(stmt, index, STORAGE_SQLITE_PAGE_ROWS) == SQLITE_OK)
+    {
+        result = query(stmt);
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return storage_map_rows(mapper, result, out, count);
+}
+
+static bool sqlite_users_each(UserRowFn each, void *arg)
+{
+    long long after_id = 0;
+    bool stopped = false;
+    while (!stopped)
+    {
+        User *users = NULL;
+        int count = 0;
+        if (!query_page(SQLITE_GET_USERS_PAGE, NULL, after_id, &SQL_MAP_ALL_USERS, (void **)&users, &count))
+        {
+            return false;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            stopped = stopped || !each(&users[i], arg);
+            free(users[i].username);
+            free(users[i].password);
+        }
+        stopped = stopped || count < STORAGE_SQLITE_PAGE_ROWS;
+        after_id = count > 0 ? users[count - 1].id : after_id;
+        free(users);
+    }
+    return true;
+}
+
+static bool sqlite_users_search(const char *pattern, int limit, User **out, int *count)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_GET_USERS_BY_USERNAME);
+    DbResult *result = NULL;
+    if (stmt && sqlite3_bind_text(stmt, 1, pattern, -1, SQLITE_STATIC) == SQLITE_OK &&
+        sqlite3_bind_int(stmt, 2, limit) == SQLITE_OK)
+    {
+        result = query(stmt);
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return storage_map_rows(&SQL_MAP_USERS_BY_USERNAME, result, (void **)out, count);
+}
+
+static bool sqlite_usernames(User **out, int *count)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_GET_ALL_USERNAMES);
+    DbResult *result = stmt ? query(stmt) : NULL;
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return storage_map_rows(&SQL_MAP_ALL_USERNAMES, result, (void **)out, count);
+}
+
+static int sqlite_group_insert(const Group *group)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_CREATE_GROUP);
+    int id = 0;
+    if (stmt && sqlite3_bind_text(stmt, 1, group->name, -1, SQLITE_STATIC) == SQLITE_OK &&
+        sqlite3_bind_int(stmt, 2, group->creator_id) == SQLITE_OK &&
+        sqlite3_bind_int64(stmt, 3, group->created_at) == SQLITE_OK &&
+        sqlite3_bind_text(stmt, 4, group->password, -1, SQLITE_STATIC) == SQLITE_OK && step_done(stmt))
+    {
+        id = (int)sqlite3_last_insert_rowid(sqlite_storage.db);
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return id;
+}
+
+static bool sqlite_group_delete(int group_id)
+{
+    const char *queries[] = {
+        SQLITE_DELETE_GROUP_MEMBERS,
+        SQLITE_DELETE_MESSAGES,
+        SQLITE_DELETE_GROUP_SUMMARY,
+        SQLITE_DELETE_GROUP_ONLY};
+    int query_count = sizeof(queries) / sizeof(queries[0]);
+
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    // Cùng một transaction: lỗi giữa chừng không để lại nhóm mất nửa dữ liệu
+    bool ok = exec(SQLITE_BEGIN_TRANSACTION);
+    for (int i = 0; i < query_count && ok; i++)
+    {
+        sqlite3_stmt *stmt = prepare(queries[i]);
+        ok = stmt && sqlite3_bind_int(stmt, 1, group_id) == SQLITE_OK && step_done(stmt);
+        finish(stmt);
+    }
+    if (ok)
+    {
+        ok = exec(SQLITE_COMMIT_TRANSACTION);
+    }
+    if (!ok && !sqlite3_get_autocommit(sqlite_storage.db))
+    {
+        exec(SQLITE_ROLLBACK_TRANSACTION);
+    }
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return ok;
+}
+
+static bool sqlite_group_get(int group_id, Group *out)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_GET_GROUP);
+    DbResult *result = NULL;
+    if (stmt && sqlite3_bind_int(stmt, 1, group_id) == SQLITE_OK)
+    {
+        result = query(stmt);
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+
+    Group *group = NULL;
+    int count = 0;
+    if (!storage_map_rows(&SQL_MAP_GROUP, result, (void **)&group, &count) || !group)
+    {
+        return false;
+    }
+    *out = *group;
+    free(group);
+    return true;
+}
+
+static bool sqlite_groups_by_name(const char *name, Group **out, int *count)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_FIND_GROUP_BY_NAME);
+    DbResult *result = NULL;
+    if (stmt && sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC) == SQLITE_OK)
+    {
+        result = query(stmt);
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return storage_map_rows(&SQL_MAP_GROUP_BY_NAME, result, (void **)out, count);
+}
+
+static bool sqlite_groups_by_user(int user_id, Group ***out, int *count)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_GET_GROUPS_BY_USER);
+    DbResult *result = NULL;
+    if (stmt && sqlite3_bind_int(stmt, 1, user_id) == SQLITE_OK)
+    {
+        result = query(stmt);
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return storage_map_groups(result, out, count);
+}
+
+static bool sqlite_member_insert(int group_id, int user_id, time_t joined_at)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_ADD_GROUP_MEMBER);
+    bool ok = stmt && sqlite3_bind_int(stmt, 1, group_id) == SQLITE_OK &&
+              sqlite3_bind_int(stmt, 2, user_id) == SQLITE_OK &&
+              sqlite3_bind_int64(stmt, 3, (sqlite3_int64)joined_at) == SQLITE_OK &&
+              sqlite3_bind_int(stmt, 4, 0) == SQLITE_OK && step_done(stmt);
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return ok;
+}
+
+static bool sqlite_member_delete(int group_id, int user_id)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_REMOVE_GROUP_MEMBER);
+    bool ok = stmt && sqlite3_bind_int(stmt, 1, group_id) == SQLITE_OK &&
+              sqlite3_bind_int(stmt, 2, user_id) == SQLITE_OK && step_done(stmt);
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return ok;
+}
+
+static bool query_ids(const char *sql, int key, int **out, int *count)
+{
+    *out = NULL;
+    *count = 0;
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(sql);
+    bool ok = stmt && sqlite3_bind_int(stmt, 1, key) == SQLITE_OK;
+    int capacity = 0;
+    int rc = SQLITE_DONE;
+    if (ok)
+    {
+        db_manager_count_query();
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW && ok)
+        {
+            if (*count == capacity)
+            {
+                capacity = capacity > 0 ? capacity * 2 : 16;
+                int *ids = realloc(*out, capacity * sizeof(int));
+                if (!ids)
+                {
+                    ok = false;
+                    break;
+                }
+                *out = ids;
+            }
+            (*out)[(*count)++] = sqlite3_column_int(stmt, 0);
+        }
+        if (rc != SQLITE_DONE && rc != SQLITE_ROW)
+        {
+            log_error("membership query");
+            ok = false;
+        }
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    if (!ok)
+    {
+        free(*out);
+        *out = NULL;
+        *count = 0;
+    }
+    return ok;
+}
+
+static bool sqlite_group_member_ids(int group_id, int **out, int *count)
+{
+    return query_ids(SQLITE_GET_GROUP_MEMBER_IDS, group_id, out, count);
+}
+
+static bool sqlite_user_group_ids(int user_id, int **out, int *count)
+{
+    return query_ids(SQLITE_GET_USER_GROUP_IDS, user_id, out, count);
+}
+
+static bool bind_message(sqlite3_stmt *stmt, const StoredMessage *message)
+{
+    bool ok = sqlite3_bind_int(stmt, 1, message->sender_id) == SQLITE_OK;
+    if (message->group_id > 0)
+    {
+        ok = ok && sqlite3_bind_null(stmt, 2) == SQLITE_OK && sqlite3_bind_int(stmt, 3, message->group_id) == SQLITE_OK;
+    }
+    else
+    {
+        ok = ok && sqlite3_bind_int(stmt, 2, message->receiver_id) == SQLITE_OK && sqlite3_bind_null(stmt, 3) == SQLITE_OK;
+    }
+    ok = ok && sqlite3_bind_int64(stmt, 4, message_conversation_id(message->sender_id, message->receiver_id, message->group_id)) == SQLITE_OK &&
+         sqlite3_bind_text(stmt, 5, message->content, -1, SQLITE_STATIC) == SQLITE_OK &&
+         sqlite3_bind_int64(stmt, 6, (sqlite3_int64)message->timestamp) == SQLITE_OK;
+    return ok && (message->wal_id > 0 ? sqlite3_bind_int64(stmt, 7, message->wal_id) : sqlite3_bind_null(stmt, 7)) == SQLITE_OK;
+}
+
+static int sqlite_messages_insert(StoredMessage *messages, int count)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    // Cả batch là một transaction: một lần ghi WAL thay vì một lần mỗi tin
+    bool began = exec(SQLITE_BEGIN_TRANSACTION);
+    sqlite3_stmt *stmt = began ? prepare(SQLITE_INSERT_MESSAGE) : NULL;
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        // Một dòng lỗi chỉ hỏng chính nó, các dòng khác vẫn được commit
+        if (!stmt || !bind_message(stmt, &messages[i]) || !step_done(stmt))
+        {
+            messages[i].failed = true;
+            failed++;
+        }
+        if (stmt)
+        {
+            sqlite3_clear_bindings(stmt);
+        }
+    }
+    finish(stmt);
+    if (began && !exec(SQLITE_COMMIT_TRANSACTION))
+    {
+        exec(SQLITE_ROLLBACK_TRANSACTION);
+        for (int i = 0; i < count; i++)
+        {
+            if (!messages[i].failed)
+            {
+                messages[i].failed = true;
+                failed++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return failed;
+}
+
+static bool sqlite_max_wal_id(long long *out)
+{
+    *out = 0;
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_GET_MAX_WAL_ID);
+    bool ok = false;
+    if (stmt)
+    {
+        db_manager_count_query();
+        ok = sqlite3_step(stmt) == SQLITE_ROW;
+        if (ok)
+        {
+            *out = sqlite3_column_int64(stmt, 0);
+        }
+        else
+        {
+            log_error("max wal_id query");
+        }
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return ok;
+}
+
+static bool upsert_summaries(const char *sql, bool with_peer, const SummaryRow *rows, int count)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    bool ok = exec(SQLITE_BEGIN_TRANSACTION);
+    sqlite3_stmt *stmt = ok ? prepare(sql) : NULL;
+    ok = ok && stmt;
+    for (int i = 0; i < count && ok; i++)
+    {
+        int index = 1;
+        ok = sqlite3_bind_int(stmt, index++, rows[i].key) == SQLITE_OK;
+        if (with_peer)
+        {
+            ok = ok && sqlite3_bind_int(stmt, index++, rows[i].peer_id) == SQLITE_OK;
+        }
+        ok = ok && sqlite3_bind_int(stmt, index, rows[i].sender_id) == SQLITE_OK &&
+             sqlite3_bind_text(stmt, index + 1, rows[i].preview, -1, SQLITE_STATIC) == SQLITE_OK &&
+             sqlite3_bind_int64(stmt, index + 2, (sqlite3_int64)rows[i].timestamp) == SQLITE_OK && step_done(stmt);
+    }
+    finish(stmt);
+    if (ok)
+    {
+        ok = exec(SQLITE_COMMIT_TRANSACTION);
+    }
+    if (!ok && !sqlite3_get_autocommit(sqlite_storage.db))
+    {
+        exec(SQLITE_ROLLBACK_TRANSACTION);
+    }
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return ok;
+}
+
+static bool sqlite_dm_summaries_upsert(const SummaryRow *rows, int count)
+{
+    return upsert_summaries(SQLITE_UPSERT_DM_SUMMARY, true, rows, count);
+}
+
+static bool sqlite_group_summaries_upsert(const SummaryRow *rows, int count)
+{
+    return upsert_summaries(SQLITE_UPSERT_GROUP_SUMMARY, false, rows, count);
+}
+
+static bool sqlite_conversation_messages(long long conversation_id, MessageData **out, int *count)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_GET_CONVERSATION_MESSAGES);
+    DbResult *result = NULL;
+    if (stmt && sqlite3_bind_int64(stmt, 1, conversation_id) == SQLITE_OK)
+    {
+        result = query(stmt);
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return storage_map_rows(&SQL_MAP_CONVERSATION_MESSAGES, result, (void **)out, count);
+}
+
+static bool sqlite_conversation_messages_each(long long conversation_id, MessageRowFn each, void *arg)
+{
+    long long after_id = 0;
+    bool stopped = false;
+    while (!stopped)
+    {
+        MessageData *messages = NULL;
+        int count = 0;
+        if (!query_page(SQLITE_GET_CONVERSATION_MESSAGES_PAGE, &conversation_id, after_id,
+                        &SQL_MAP_CONVERSATION_MESSAGES, (void **)&messages, &count))
+        {
+            return false;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            stopped = stopped || !each(&messages[i], arg);
+            free(messages[i].sender_name);
+            free(messages[i].content);
+        }
+        stopped = stopped || count < STORAGE_SQLITE_PAGE_ROWS;
+        after_id = count > 0 ? messages[count - 1].id : after_id;
+        free(messages);
+    }
+    return true;
+}
+
+static bool sqlite_chat_histories(int user_id, ChatHistory **out, int *count)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_GET_CHAT_HISTORIES_BY_USER);
+    DbResult *result = NULL;
+    if (stmt && sqlite3_bind_int(stmt, 1, user_id) == SQLITE_OK && sqlite3_bind_int(stmt, 2, user_id) == SQLITE_OK)
+    {
+        result = query(stmt);
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return storage_map_rows(&SQL_MAP_CHAT_HISTORIES_BY_USER, result, (void **)out, count);
+}
+
+static bool sqlite_messages_after(long long after_id, int limit, MessageSearchResult **out, int *count)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_INDEX_MESSAGES_AFTER);
+    DbResult *result = NULL;
+    if (stmt && sqlite3_bind_int64(stmt, 1, after_id) == SQLITE_OK && sqlite3_bind_int(stmt, 2, limit) == SQLITE_OK)
+    {
+        result = query(stmt);
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return storage_map_rows(&SQL_MAP_MESSAGES_AFTER, result, (void **)out, count);
+}
+
+static bool sqlite_messages_by_ids(const long long *ids, int id_count, MessageSearchResult **out, int *count)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    sqlite3_stmt *stmt = prepare(SQLITE_GET_MESSAGE_BY_ID);
+    DbResult *result = stmt ? create_result(stmt) : NULL;
+    // Kết quả giữ thứ tự của ids (đã là mới nhất trước)
+    for (int i = 0; result && i < id_count; i++)
+    {
+        if (sqlite3_bind_int64(stmt, 1, ids[i]) != SQLITE_OK || !append_rows(stmt, result))
+        {
+            db_result_free(result);
+            result = NULL;
+        }
+    }
+    finish(stmt);
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return storage_map_rows(&SQL_MAP_MESSAGES_BY_IDS, result, (void **)out, count);
+}
+
+static bool sqlite_messages_delete(const long long *ids, int id_count)
+{
+    pthread_mutex_lock(&sqlite_storage.mutex);
+    bool ok = exec(SQLITE_BEGIN_TRANSACTION);
+    sqlite3_stmt *stmt = ok ? prepare(SQLITE_DELETE_MESSAGE_BY_ID) : NULL;
+    ok = ok && stmt;
+    for (int i = 0; i < id_count && ok; i++)
+    {
+        ok = sqlite3_bind_int64(stmt, 1, ids[i]) == SQLITE_OK && step_done(stmt);
+    }
+    finish(stmt);
+    if (ok)
+    {
+        ok = exec(SQLITE_COMMIT_TRANSACTION);
+    }
+    if (!ok && !sqlite3_get_autocommit(sqlite_storage.db))
+    {
+        exec(SQLITE_ROLLBACK_TRANSACTION);
+    }
+    pthread_mutex_unlock(&sqlite_storage.mutex);
+    return ok;
+}
+
+const StorageBackend SQLITE_STORAGE = {
+    .name = "sqlite",
+    .kind = STORAGE_SQLITE,
+    .start = sqlite_start,
+    .stop = sqlite_stop,
+    .user_lookup = sqlite_user_lookup,
+    .user_insert = sqlite_user_insert,
+    .user_name = sqlite_user_name,
+    .users_list = sqlite_users_list,
+    .users_each = sqlite_users_each,
+    .users_search = sqlite_users_search,
+    .usernames = sqlite_usernames,
+    .group_insert = sqlite_group_insert,
+    .group_delete = sqlite_group_delete,
+    .group_get = sqlite_group_get,
+    .groups_by_name = sqlite_groups_by_name,
+    .groups_by_user = sqlite_groups_by_user,
+    .member_insert = sqlite_member_insert,
+    .member_delete = sqlite_member_delete,
+    .group_member_ids = sqlite_group_member_ids,
+    .user_group_ids = sqlite_user_group_ids,
+    .messages_insert = sqlite_messages_insert,
+    .max_wal_id = sqlite_max_wal_id,
+    .dm_summaries_upsert = sqlite_dm_summaries_upsert,
+    .group_summaries_upsert = sqlite_group_summaries_upsert,
+    .conversation_messages = sqlite_conversation_messages,
+    .conversation_messages_each = sqlite_conversation_messages_each,
+    .chat_histories = sqlite_chat_histories,
+    .messages_after = sqlite_messages_after,
+    .messages_by_ids = sqlite_messages_by_ids,
+    .messages_delete = sqlite_messages_delete};
+
+#endif
@@ -1,17 +1,43 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <signal.h>
 #include "config.h"
-#include "database_connector.h"
-#include "config.h"
+#include "storage.h"
 #include "server.h"
 #include "log.h"
 #include "m_utils.h"
+#include "persist_queue.h"
+#include "message_wal.h"
+#include "db_executor.h"
+#include "db_async.h"
+#include "db_migrate.h"
+#include "username_index.h"
+#include "message_index.h"
+#include "message_archive.h"
+#include "user_cache.h"
+#include "group_cache.h"
+
+
+static volatile sig_atomic_t is_stop = 0;
+
+static void handle_stop_signal(int sig)
+{
+    (void)sig;
+    is_stop = 1;
+}
 
+static void log_cache_stats(const char* name, ClockCacheStats stats)
+{
+    long long lookups = stats.hits + stats.misses;
+    log_message(INFO, "%s cache: %lld hits, %lld misses (%.1f%% hit rate), %lld evictions, %d/%d entries", name,
+                stats.hits, stats.misses, lookups > 0 ? 100.0 * stats.hits / lookups : 0.0, stats.evictions,
+                stats.size, stats.capacity);
+}
 
-static bool is_stop = false;
 void* server_start_thread(void* arg) {
     server_start();
     return NULL;
@@ -19,9 +45,44 @@ void* server_start_thread(void* arg) {
 
 int main(int argc, char* argv[]) {
     if (config_load()) {
-        if (!db_manager_start()) {
+        if (!storage_start()) {
+            return EXIT_FAILURE;
+        }
+        bool mysql = storage()->kind == STORAGE_MYSQL;
+        // Chỉ chạy migration rồi thoát, server cũ vẫn có thể đang phục vụ.
+        // Schema SQLite được tạo mới ở storage_start nên không có gì để migrate
+        if (argc > 1 && strcmp(argv[1], "--migrate") == 0) {
+            bool migrated = !mysql || db_migrate_conversations();
+            storage_stop();
+            return migrated ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (!persist_queue_start()) {
+            log_message(WARN, "Message write-behind unavailable, messages are written synchronously");
+        } else if (!message_wal_open()) {
+            // Checkpoint hỏng hoặc không biết seq cuối: chạy tiếp có thể cấp trùng wal_id
+            log_message(ERROR, "Failed to open the message WAL");
+            persist_queue_stop();
+            storage_stop();
             return EXIT_FAILURE;
         }
+        if (!db_executor_start()) {
+            log_message(WARN, "DB executor unavailable, handlers run on their session threads");
+        }
+        if (mysql && !db_async_start()) {
+            log_message(WARN, "Async DB loop unavailable, queries run on the executor");
+        }
+        if (!username_index_build()) {
+            log_message(WARN, "Username index unavailable, user search runs LIKE queries");
+        }
+        // Trước message index, nó đọc các tin đã chuyển sang archive
+        if (!message_archive_start()) {
+            log_message(WARN, "Message archive unavailable, archived messages cannot be read");
+        }
+        if (!message_index_start()) {
+            log_message(WARN, "Message index unavailable, message search returns nothing");
+        }
+        signal(SIGINT, handle_stop_signal);
+        signal(SIGTERM, handle_stop_signal);
         
         
         if (is_port_available(config_get_port())) {
@@ -54,7 +115,21 @@ int main(int argc, char* argv[]) {
     while (!is_stop) {
         sleep(1);
     }
-    
+
+    // Ghi hết tin còn trong queue trước khi đóng pool
+    log_message(INFO, "Shutting down");
+    server_stop();
+    db_async_stop();
+    db_executor_stop();
+    // Không còn handler nào chạy, số liệu đã chốt
+    log_cache_stats("User", user_cache_get_stats());
+    log_cache_stats("Group", group_cache_get_stats());
+    persist_queue_stop();
+    message_wal_close();
+    // Sau persist_queue_stop để các tin cuối cùng cũng vào segment
+    message_index_stop();
+    message_archive_stop();
+    storage_stop();
     return EXIT_SUCCESS;
 }
 
@@ -3,278 +3,242 @@
 //
 #include "../../include/db_message.h"
 
-#include <database_connector.h>
-#include <db_statement.h>
+#include <storage.h>
 #include <log.h>
-#include <sql_statement.h>
+#include <persist_queue.h>
+#include <message_wal.h>
+#include <message_index.h>
+#include <message_archive.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "group.h"
 #include "group_member.h"
 ChatHistory* get_chat_histories_by_user(int user_id, int* out_count) {
-    DbStatement* stmt = db_prepare(SQL_GET_CHAT_HISTORIES_BY_USER);
-    if (!stmt) {
-        log_message(ERROR, "Failed to prepare chat history statement");
-        *out_count = 0;
+    *out_count = 0;
+    // Tin vừa gửi có thể còn trong queue
+    persist_queue_flush();
+    // Tên người gửi, tên hội thoại và quyền thành viên nhóm đều đã được JOIN trong SQL
+    ChatHistory* histories = NULL;
+    if (!storage()->chat_histories(user_id, &histories, out_count)) {
+        log_message(ERROR, "Failed to load chat histories of user %d", user_id);
         return NULL;
     }
+    return histories;
+}
 
-    // Bind đúng thứ tự các dấu `?` trong SQL
-    db_bind_int(stmt, 0, user_id); // CASE WHEN sender_id = ?
-    db_bind_int(stmt, 1, user_id); // WHERE sender_id = ?
-    db_bind_int(stmt, 2, user_id); // WHERE receiver_id = ?
-    db_bind_int(stmt, 3, user_id); // WHERE group_id IN ...
-    db_bind_int(stmt, 4, user_id); // JOIN CASE WHEN m.sender_id = ?
-
-    DbResultSet* result = db_execute_query(stmt);
-    db_statement_free(stmt);
+bool save_private_message(int sender_id, int receiver_id, const char* content) {
+    time_t now = time(NULL);
+    // Tin đã nằm trên đĩa (WAL) trước khi người gửi nhận phản hồi, MySQL được ghi sau.
+    // Push chỉ lỗi với tin không có trong WAL, nên false luôn nghĩa là không có gì được lưu
+    long long wal_id = message_wal_append(sender_id, receiver_id, 0, content, now);
+    if (wal_id < 0 || !persist_queue_push(sender_id, receiver_id, 0, content, now, wal_id)) {
+        log_message(ERROR, "Failed to persist private message from %d to %d", sender_id, receiver_id);
+        return false;
+    }
+    return true;
+}
 
-    if (!result || result->row_count == 0) {
-        *out_count = 0;
-        if (result) db_result_set_free(result);
-        return NULL;
+bool save_group_message(int sender_id, int group_id, const char* content) {
+    time_t now = time(NULL);
+    long long wal_id = message_wal_append(sender_id, 0, group_id, content, now);
+    if (wal_id < 0 || !persist_queue_push(sender_id, 0, group_id, content, now, wal_id)) {
+        log_message(ERROR, "Failed to persist group message from %d to group %d", sender_id, group_id);
+        return false;
     }
+    return true;
+}
 
-    // First pass to count actual valid entries
-    int valid_count = 0;
-    for (int i = 0; i < result->row_count; i++) {
-        DbResultRow* row = result->rows[i];
-        for (int j = 0; j < row->field_count; j++) {
-            DbResultField* field = row->fields[j];
-            if (!field) continue;
-            if (strcmp(field->key, "chat_id") == 0) {
-                int chat_id = *(int*)field->value;
-                if (chat_id < 0) {
-                    // This is a group chat, check if user is still a member
-                    bool is_member = check_member_exists(-chat_id, user_id);
-                    if (is_member) {
-                        valid_count++;
-                    }
-                } else {
-                    // This is a direct message, always valid
-                    valid_count++;
-                }
-                break;
-            }
-        }
+long long message_conversation_id(int sender_id, int receiver_id, int group_id) {
+    if (group_id > 0) {
+        return -(long long)group_id;
     }
+    // Hai chiều của một cuộc chat riêng phải ra cùng một id
+    unsigned int low = (unsigned int)(sender_id < receiver_id ? sender_id : receiver_id);
+    unsigned int high = (unsigned int)(sender_id < receiver_id ? receiver_id : sender_id);
+    return (long long)(((unsigned long long)low << 32) | high);
+}
 
-    // Cấp phát bộ nhớ cho lịch sử trò chuyện (only for valid entries)
-    ChatHistory* histories = (ChatHistory*)malloc(sizeof(ChatHistory) * valid_count);
-    if (!histories) {
-        db_result_set_free(result);
-        *out_count = 0;
+// Trộn hai dãy đã sắp theo id; tin có ở cả hai (đang được chuyển sang archive) chỉ giữ một bản
+static MessageData* merge_archived(MessageData* hot, int hot_count, MessageData* cold, int cold_count, int* count) {
+    MessageData* merged = malloc(sizeof(MessageData) * (hot_count + cold_count));
+    if (!merged) {
         return NULL;
     }
-
-    // Second pass to fill the array
-    int valid_index = 0;
-    for (int i = 0; i < result->row_count; i++) {
-        DbResultRow* row = result->rows[i];
-        bool skip_entry = false;
-        int chat_id = 0;
-
-        // First get the chat_id to check membership
-        for (int j = 0; j < row->field_count; j++) {
-            DbResultField* field = row->fields[j];
-            if (!field) continue;
-            if (strcmp(field->key, "chat_id") == 0) {
-                chat_id = *(int*)field->value;
-                if (chat_id < 0) {
-                    // Check if user is still a member
-                    bool is_member = check_member_exists(-chat_id, user_id);
-                    if (!is_member) {
-                        skip_entry = true;
-                    }
-                }
-                break;
-            }
-        }
-
-        if (skip_entry) continue;
-
-        // Now fill in the data
-        ChatHistory* history = &histories[valid_index];
-        memset(history, 0, sizeof(ChatHistory));
-
-        for (int j = 0; j < row->field_count; j++) {
-            DbResultField* field = row->fields[j];
-            if (!field) continue;
-
-            if (strcmp(field->key, "chat_id") == 0) {
-                history->id = chat_id;
-                // Format chat_with information
-                if (history->id < 0) {
-                    Group* g = get_group_by_id(-history->id);
-                    if (g) {
-                        snprintf(history->chat_with, sizeof(history->chat_with), "%s", g->name);
-                        free(g);
-                    } else {
-                        snprintf(history->chat_with, sizeof(history->chat_with), "Unknown Group");
-                    }
-                } else if (history->id != user_id) {
-                    User* u = findUserById(history->id);
-                    if (u) {
-                        snprintf(history->chat_with, sizeof(history->chat_with), "%s", u->username);
-                        free(u);
-                    } else {
-                        snprintf(history->chat_with, sizeof(history->chat_with), "Unknown User");
-                    }
-                }
-            } else if (strcmp(field->key, "last_message") == 0) {
-                strncpy(history->last_message, (char*)field->value, sizeof(history->last_message) - 1);
-                history->last_message[sizeof(history->last_message) - 1] = '\0'; // Ensure null termination
-            } else if (strcmp(field->key, "last_time") == 0) {
-                history->last_time = *(long*)field->value;
-            } else if (strcmp(field->key, "sender_name") == 0) {
-                strncpy(history->sender_name, (char*)field->value, sizeof(history->sender_name) - 1);
-                history->sender_name[sizeof(history->sender_name) - 1] = '\0'; // Ensure null termination
-            }
+    int h = 0, c = 0, n = 0;
+    while (h < hot_count || c < cold_count) {
+        if (c == cold_count || (h < hot_count && hot[h].id < cold[c].id)) {
+            merged[n++] = hot[h++];
+        } else if (h == hot_count || cold[c].id < hot[h].id) {
+            merged[n++] = cold[c++];
+        } else {
+            free(cold[c].sender_name);
+            free(cold[c].content);
+            c++;
         }
-
-        valid_index++;
     }
-
-    *out_count = valid_count;
-    db_result_set_free(result);
-
-    return histories;
+    *count = n;
+    return merged;
 }
 
-void save_private_message(int sender_id, int receiver_id, const char* content) {
-    DbStatement* stmt = db_prepare(SQL_INSERT_PRIVATE_MESSAGE);
-    if (!stmt) return;
-
-    time_t now = time(NULL);
-
-    db_bind_int(stmt, 0, sender_id);
-    db_bind_int(stmt, 1, receiver_id);
-    db_bind_string(stmt, 2, content);
-    char datetime_str[20];
-    struct tm* tm_info = localtime(&now);
-    strftime(datetime_str, sizeof(datetime_str), "%Y-%m-%d %H:%M:%S", tm_info);
-
-    if (!db_bind_string(stmt, 3, datetime_str)) {
-        log_message(ERROR, "Failed to bind time parameter");
-        db_statement_free(stmt);
-        return;
-    }
-
-
-    if (!db_execute(stmt)) {
-        log_message(ERROR, "Failed to execute statement");
-        db_statement_free(stmt);
-        return;
+static void free_messages(MessageData* messages, int count) {
+    for (int i = 0; i < count; i++) {
+        free(messages[i].sender_name);
+        free(messages[i].content);
     }
-    stmt = NULL;
-    db_statement_free(stmt);
-    log_message(INFO, "Saved private message from %d to %d: %s", sender_id, receiver_id, content);
+    free(messages);
 }
 
-void save_group_message(int sender_id, int group_id, const char* content) {
-    DbStatement* stmt = db_prepare(SQL_INSERT_GROUP_MESSAGE);
-    if (!stmt) return;
-
-    if (!stmt) {
-        log_message(ERROR, "Failed to prepare delete group statement");
-        return;
+MessageData* get_chat_messages(int user_id, int chat_with_id, int group_id, int* count) {
+    *count = 0;
+    persist_queue_flush();
+    long long conversation_id = message_conversation_id(user_id, chat_with_id, group_id);
+    MessageData* messages = NULL;
+    if (!storage()->conversation_messages(conversation_id, &messages, count)) {
+        log_message(ERROR, "Failed to load %s messages", group_id > 0 ? "group" : "user");
+        return NULL;
     }
-    time_t now = time(NULL);
-    if (!db_bind_int(stmt, 0, sender_id)) {
-        log_message(ERROR, "Failed to bind sender_id parameter");
-        db_statement_free(stmt);
-        return;
+    // Đọc bảng trước rồi mới tới archive: tin bị chuyển đi giữa hai lần đọc đã nằm sẵn trong archive
+    MessageData* archived = NULL;
+    int archived_count = 0;
+    if (!message_archive_read(conversation_id, &archived, &archived_count)) {
+        log_message(ERROR, "Failed to load archived messages of conversation %lld", conversation_id);
+        free_messages(messages, *count);
+        *count = 0;
+        return NULL;
     }
-    if (!db_bind_int(stmt, 1, group_id)) {
-        log_message(ERROR, "Failed to bind group_id parameter");
-        db_statement_free(stmt);
-        return;
+    if (archived_count > 0) {
+        int merged_count = 0;
+        MessageData* merged = merge_archived(messages, *count, archived, archived_count, &merged_count);
+        if (!merged) {
+            free_messages(messages, *count);
+            free_messages(archived, archived_count);
+            *count = 0;
+            return NULL;
+        }
+        free(messages);
+        free(archived);
+        messages = merged;
+        *count = merged_count;
     }
-    if (!db_bind_string(stmt, 2, content)) {
-        log_message(ERROR, "Failed to bind content parameter");
-        db_statement_free(stmt);
-        return;
+    if (!messages) {
+        return NULL;
     }
+    log_message(INFO, "Load history success");
+    return messages;
+}
 
-    char datetime_str[20];
-    struct tm* tm_info = localtime(&now);
-    strftime(datetime_str, sizeof(datetime_str), "%Y-%m-%d %H:%M:%S", tm_info);
-
-    if (!db_bind_string(stmt, 3, datetime_str)) {
-        log_message(ERROR, "Failed to bind time parameter");
-        db_statement_free(stmt);
-        return;
-    }
+typedef struct {
+    MessageRowFn each;
+    void* arg;
+    // id lớn nhất đã chuyển cho each
+    long last_id;
+    bool stopped;
+} ChatStream;
+
+static bool stream_message(const MessageData* message, void* arg) {
+    ChatStream* stream = (ChatStream*)arg;
+    // Tin đã archive còn nằm trong bảng tới khi tiering xóa nó
+    if (message->id <= stream->last_id) {
+        return true;
+    }
+    stream->last_id = message->id;
+    stream->stopped = !stream->each(message, stream->arg);
+    return !stream->stopped;
+}
 
-    if (!db_execute(stmt)) {
-        log_message(ERROR, "Failed to execute statement");
-        db_statement_free(stmt);
-        return;
-    }
-    stmt = NULL;
-    db_statement_free(stmt);
-    log_message(INFO, "Saved group message from %d to group %d: %s", sender_id, group_id, content);
+bool for_each_chat_message(int user_id, int chat_with_id, int group_id, MessageRowFn each, void* arg) {
+    persist_queue_flush();
+    long long conversation_id = message_conversation_id(user_id, chat_with_id, group_id);
+    ChatStream stream = {each, arg, 0, false};
+    // Archive trước rồi mới tới bảng để tin ra theo thứ tự id; pin giữ tiering không xóa
+    // tin khỏi bảng giữa hai lần đọc
+    message_archive_pin();
+    bool ok = message_archive_each(conversation_id, stream_message, &stream);
+    if (ok && !stream.stopped) {
+        ok = storage()->conversation_messages_each(conversation_id, stream_message, &stream);
+    }
+    message_archive_unpin();
+    if (!ok) {
+        log_message(ERROR, "Failed to stream %s messages", group_id > 0 ? "group" : "user");
+    }
+    return ok;
 }
 
-MessageData* get_chat_messages(int user_id, int chat_with_id, int group_id, int* count) {
-    *count = 0;
-    DbStatement* stmt = NULL;
+static int compare_newest_first(const void* a, const void* b) {
+    long x = ((const MessageSearchResult*)a)->id;
+    long y = ((const MessageSearchResult*)b)->id;
+    return (y > x) - (y < x);
+}
 
-    if (group_id > 0) {
-        stmt = db_prepare(SQL_GET_MESSAGES_WITH_GROUP);
-        if (!stmt) {
-            log_message(ERROR, "Failed to prepare statement for group messages");
-            return NULL;
+// Id tìm được mà không còn trong bảng có thể đã được chuyển sang archive
+static MessageSearchResult* add_archived_results(MessageSearchResult* results, int* count,
+                                                 const long long* ids, int id_count) {
+    long long* missing = malloc(sizeof(long long) * id_count);
+    if (!missing) {
+        return results;
+    }
+    int missing_count = 0;
+    for (int i = 0; i < id_count; i++) {
+        bool found = false;
+        for (int j = 0; j < *count && !found; j++) {
+            found = results[j].id == ids[i];
         }
-        db_bind_int(stmt, 0, group_id);
-    } else {
-        stmt = db_prepare(SQL_GET_MESSAGES_WITH_USER);
-        if (!stmt) {
-            log_message(ERROR, "Failed to prepare statement for user messages");
-            return NULL;
+        if (!found) {
+            missing[missing_count++] = ids[i];
         }
-        db_bind_int(stmt, 0, user_id);
-        db_bind_int(stmt, 1, chat_with_id);
-        db_bind_int(stmt, 2, chat_with_id);
-        db_bind_int(stmt, 3, user_id);
     }
 
-    DbResultSet* result = db_execute_query(stmt);
-    db_statement_free(stmt);
+    MessageSearchResult* archived = NULL;
+    int archived_count = 0;
+    if (missing_count > 0 && !message_archive_by_ids(missing, missing_count, &archived, &archived_count)) {
+        log_message(ERROR, "Failed to load archived message search results");
+    }
+    free(missing);
+    if (archived_count == 0) {
+        return results;
+    }
+    MessageSearchResult* merged = realloc(results, sizeof(MessageSearchResult) * (*count + archived_count));
+    if (!merged) {
+        for (int i = 0; i < archived_count; i++) {
+            free(archived[i].sender_name);
+            free(archived[i].content);
+        }
+        free(archived);
+        return results;
+    }
+    memcpy(merged + *count, archived, sizeof(MessageSearchResult) * archived_count);
+    free(archived);
+    *count += archived_count;
+    qsort(merged, *count, sizeof(MessageSearchResult), compare_newest_first);
+    return merged;
+}
 
-    if (!result || result->row_count == 0) {
-        if (result) db_result_set_free(result);
+MessageSearchResult* search_messages(int user_id, const char* query, int limit, int* count) {
+    *count = 0;
+    int hit_count = 0;
+    MessageIndexHit* hits = message_index_search(user_id, query, limit, &hit_count);
+    if (!hits) {
         return NULL;
     }
 
-    MessageData* messages = (MessageData*)malloc(sizeof(MessageData) * result->row_count);
-    if (!messages) {
-        db_result_set_free(result);
+    long long* ids = malloc(sizeof(long long) * hit_count);
+    if (!ids) {
+        free(hits);
         return NULL;
     }
+    for (int i = 0; i < hit_count; i++) {
+        ids[i] = hits[i].message_id;
+    }
+    free(hits);
 
-    for (int i = 0; i < result->row_count; i++) {
-        DbResultRow* row = result->rows[i];
-        MessageData* m = &messages[i];
-
-        for (int j = 0; j < row->field_count; j++) {
-            DbResultField* field = row->fields[j];
-            if (!field) continue;
-
-            if (strcmp(field->key, "sender_id") == 0) {
-                m->sender_id = *(int*)field->value;
-            } else if (strcmp(field->key, "sender_name") == 0) {
-                m->sender_name = strdup((char*)field->value);
-            }else if (strcmp(field->key, "message_content") == 0) {
-                m->content = strdup((char*)field->value);
-            } else if (strcmp(field->key, "timestamp") == 0) {
-                m->timestamp = *(long*)field->value;
-            }
-        }
+    // Tin đã bị xóa cùng nhóm thì không còn trong database và tự rơi khỏi kết quả
+    MessageSearchResult* results = NULL;
+    if (!storage()->messages_by_ids(ids, hit_count, &results, count)) {
+        log_message(ERROR, "Failed to load message search results");
+    } else if (*count < hit_count) {
+        results = add_archived_results(results, count, ids, hit_count);
     }
-    log_message(INFO, "Load history success");
-    *count = result->row_count;
-    db_result_set_free(result);
-    return messages;
+    free(ids);
+    return results;
 }
@@ -2,10 +2,12 @@
 // Created by vawnwuyest on 4/1/25
 
 #include "../../include/group.h"
-#include <db_statement.h>
 #include "../../include/log.h"
-#include "../../include/sql_statement.h"
+#include "../../include/storage.h"
+#include "../../include/persist_queue.h"
 #include "../../include/user.h"
+#include "../../include/membership_index.h"
+#include "../../include/group_cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,65 +27,29 @@ Group *create_group(const char *group_name, const char *password, User *creator,
     }
 
     group->created_by = creator;
+    group->creator_id = creator->id;
     group->member_count = 1;
 
-    DbStatement *stmt = db_prepare(SQL_CREATE_GROUP);
-    if (stmt == NULL) {
-        snprintf(error_message, 256, "Failed to prepare create group statement");
-        free(group);
-        return NULL;
-    }
-
-    if (!db_bind_string(stmt, 0, group->name)) {
-        snprintf(error_message, 256, "Failed to bind group_name");
-        db_statement_free(stmt);
-        free(group);
-        return NULL;
-    }
-
-    if (!db_bind_int(stmt, 1, creator->id)) {
-        snprintf(error_message, 256, "Failed to bind created_by");
-        db_statement_free(stmt);
-        free(group);
-        return NULL;
-    }
-
-    if (!db_bind_long(stmt, 2, group->created_at)) {
-        snprintf(error_message, 256, "Failed to bind created_at");
-        db_statement_free(stmt);
-        free(group);
-        return NULL;
-    }
-
-    if (!db_bind_string(stmt, 3, group->password)) {
-        snprintf(error_message, 256, "Failed to bind password");
-        db_statement_free(stmt);
-        free(group);
-        return NULL;
-    }
-    log_message(INFO, "[DEBUG] Full SQL:\nINSERT INTO `groups` (group_name, created_by, created_at, password) VALUES ('%s', %d, %ld, '%s')\n",
-            group->name,
-            creator->id,
-            group->created_at,
-            group->password);
-
-    if (!db_execute(stmt)) {
+    group->id = storage()->group_insert(group);
+    if (group->id <= 0) {
         snprintf(error_message, 256, "Failed to execute create group query");
-        db_statement_free(stmt);
         free(group);
         return NULL;
     }
 
-    group->id = db_get_insert_id(stmt);
-    stmt = NULL;
-    db_statement_free(stmt);
-
     if (!add_group_member(group->id, creator->id, "")) {
         snprintf(error_message, 256, "Failed to add creator to group");
         free(group);
         return NULL;
     }
 
+    GroupCacheEntry entry = {0};
+    entry.id = group->id;
+    snprintf(entry.name, sizeof(entry.name), "%s", group->name);
+    entry.created_at = group->created_at;
+    entry.creator_id = group->creator_id;
+    group_cache_put(&entry);
+
     snprintf(error_message, 256, "Group created successfully");
     return group;
 }
@@ -97,37 +63,24 @@ bool delete_group(Group *self, User *user, char *error_message) {
         return false;
     }
 
-    if (self->created_by == NULL || self->created_by->id != user->id) {
+    if (self->creator_id != user->id) {
         snprintf(error_message, 256, "User %d is not the owner of group %d", user->id, self->id);
         return false;
     }
 
-    const char *queries[] = {
-        SQL_DELETE_GROUP_MEMBERS,
-        SQL_DELETE_MESSAGES,
-        SQL_DELETE_GROUP_ONLY
-    };
-
-    for (int i = 0; i < 3; i++) {
-        DbStatement *stmt = db_prepare(queries[i]);
-        if (!stmt) {
-            snprintf(error_message, 256, "Failed to prepare delete statement (%d)", i);
-            return false;
-        }
-
-        if (!db_bind_int(stmt, 0, self->id)) {
-            snprintf(error_message, 256, "Failed to bind group_id at step %d", i);
-            db_statement_free(stmt);
-            return false;
-        }
+    // Tin nhóm còn trong queue phải được ghi trước khi xóa messages của nhóm
+    persist_queue_flush();
 
-        if (!db_execute(stmt)) {
-            snprintf(error_message, 256, "Execution failed at step %d", i);
-            db_statement_free(stmt);
-            return false;
-        }
+    bool ok = storage()->group_delete(self->id);
+    if (!ok) {
+        snprintf(error_message, 256, "Failed to delete group %d", self->id);
+    }
 
-        db_statement_free(stmt);
+    // Kể cả khi lỗi giữa chừng, thành viên có thể đã bị xóa khỏi DB
+    membership_index_drop_group(self->id);
+    group_cache_invalidate(self->id);
+    if (!ok) {
+        return false;
     }
 
     snprintf(error_message, 256, "Group '%s' (ID: %d) deleted successfully", self->name, self->id);
@@ -140,59 +93,25 @@ Group *get_group_by_id(int group_id) {
         return NULL;
     }
 
-    // Chuẩn bị câu lệnh SQL để lấy thông tin nhóm
-    DbStatement *stmt = db_prepare(SQL_GET_GROUP);
-    if (!stmt) {
-        log_message(ERROR, "Failed to prepare statement for retrieving group");
-        return NULL;
-    }
-
-    // Bind ID của nhóm vào câu lệnh SQL
-    if (!db_bind_int(stmt, 0, group_id)) {
-        log_message(ERROR, "Failed to bind group 2ID");
-        db_statement_free(stmt);
-        return NULL;
-    }
-
-    // Thực thi truy vấn và lấy kết quả
-    DbResultSet *result = db_execute_query(stmt);
-    db_statement_free(stmt);
-    if (!result || result->row_count == 0) {
+    // Metadata lấy từ group cache, chỉ lần đầu mới hỏi MySQL
+    GroupCacheEntry entry;
+    if (!group_cache_get(group_id, &entry)) {
         log_message(WARN, "Group ID %d not found", group_id);
-        db_result_set_free(result);
         return NULL;
     }
 
-    // Cấp phát bộ nhớ cho đối tượng Group
-    Group *group = (Group *)malloc(sizeof(Group));
+    Group *group = calloc(1, sizeof(Group));
     if (!group) {
-        log_message(ERROR, "Failed to allocate memory for Group");
-        db_result_set_free(result);
+        log_message(ERROR, "Failed to allocate memory for group");
         return NULL;
     }
-    memset(group, 0, sizeof(Group));
-
-    // Lấy dữ liệu từ hàng đầu tiên của kết quả truy vấn
-    DbResultRow *row = result->rows[0];
-    for (int j = 0; j < row->field_count; j++) {
-        DbResultField *field = row->fields[j];
-        if (!field) continue;
-
-        if (strcmp(field->key, "group_id") == 0) {
-            group->id = *(int *)field->value;
-        } else if (strcmp(field->key, "group_name") == 0) {
-            strncpy(group->name, (char *)field->value, sizeof(group->name) - 1);
-            group->name[sizeof(group->name) - 1] = '\0';
-        } else if (strcmp(field->key, "created_at") == 0) {
-            group->created_at = *(long *)field->value;
-        } else if (strcmp(field->key, "created_by") == 0) {
-            int creator_id = *(int *)field->value;
-            group->created_by = findUserById(creator_id); // Hàm này lấy thông tin User
-        }
-    }
-
-    db_result_set_free(result);
-    log_message(INFO, "Retrieved group %d: %s", group->id, group->name);
+    group->id = entry.id;
+    snprintf(group->name, sizeof(group->name), "%s", entry.name);
+    group->created_at = entry.created_at;
+    group->creator_id = entry.creator_id;
+    group->member_count = entry.member_count;
+    // created_by để NULL: người gọi chỉ cần creator_id, tên thì tra findUserById
+    group->created_by = NULL;
     return group;
 }
 
@@ -216,68 +135,38 @@ Group *create_new_group(char* group_name, char *password) {
 }
 
 Group *get_group(Group *self, char *errorMsg, size_t errorSize) {
-    DbStatement *stmt = db_prepare(SQL_FIND_GROUP_BY_NAME);
-    if (!stmt) {
-        snprintf(errorMsg, errorSize, "Failed to prepare group lookup query");
-        return NULL;
-    }
-
-    if (!db_bind_string(stmt, 0, self->name)) {
-        snprintf(errorMsg, errorSize, "Failed to bind group_name parameter");
-        db_statement_free(stmt);
+    int count = 0;
+    Group *rows = NULL;
+    if (!storage()->groups_by_name(self->name, &rows, &count)) {
+        snprintf(errorMsg, errorSize, "Failed to look up group");
         return NULL;
     }
-
-    DbResultSet *result = db_execute_query(stmt);
-    db_statement_free(stmt);
-
-    if (!result || result->row_count == 0) {
+    if (!rows) {
         snprintf(errorMsg, errorSize, "Group not found");
-        if (result) db_result_set_free(result);
         return NULL;
     }
 
-    for (int rowIndex = 0; rowIndex < result->row_count; rowIndex++) {
-        DbResultRow *row = result->rows[rowIndex];
-        int groupId = -1;
-        char *dbPassword = NULL;
-        long createdAt = 0;
-        int createdBy = -1;
-
-        for (int i = 0; i < row->field_count; i++) {
-            DbResultField *field = row->fields[i];
-            if (!field) continue;
-
-            if (strcmp(field->key, "group_id") == 0 && (field->type == MYSQL_TYPE_LONG || field->type == MYSQL_TYPE_LONGLONG)) {
-                groupId = *(int *)field->value;
-            } else if (strcmp(field->key, "password") == 0 &&
-                       (field->type == MYSQL_TYPE_STRING || field->type == MYSQL_TYPE_VAR_STRING)) {
-                dbPassword = (char *)field->value;
-            } else if (strcmp(field->key, "created_at") == 0) {
-                createdAt = *(long *)field->value;
-            } else if (strcmp(field->key, "created_by") == 0) {
-                createdBy = *(int *)field->value;
-            }
-        }
-
-        if (dbPassword && strcmp(dbPassword, self->password) == 0) {
+    for (int rowIndex = 0; rowIndex < count; rowIndex++) {
+        Group *row = &rows[rowIndex];
+        if (strcmp(row->password, self->password) == 0) {
             Group *group = create_new_group(self->name, "");
             if (!group) {
                 snprintf(errorMsg, errorSize, "Memory allocation failed");
-                db_result_set_free(result);
+                free(rows);
                 return NULL;
             }
 
-            group->id = groupId;
-            group->created_at = createdAt;
+            group->id = row->id;
+            group->created_at = row->created_at;
+            group->creator_id = row->creator_id;
 
-            db_result_set_free(result);
+            free(rows);
             return group;
         }
     }
 
     snprintf(errorMsg, errorSize, "Group name or password incorrect");
-    db_result_set_free(result);
+    free(rows);
     return NULL;
 }
 
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "group_cache.h"
+#include "group.h"
+#include "membership_index.h"
+#include "storage.h"
+#include "config.h"
+#include "log.h"
+
+typedef struct
+{
+    ClockCache *cache;
+    pthread_once_t once;
+} GroupCache;
+
+static GroupCache group_cache = {
+    .cache = NULL,
+    .once = PTHREAD_ONCE_INIT};
+
+static void group_cache_init()
+{
+    int capacity = config_get_group_cache_capacity();
+    group_cache.cache = clock_cache_create(capacity > 0 ? capacity : GROUP_CACHE_DEFAULT_CAPACITY, sizeof(GroupCacheEntry));
+    if (!group_cache.cache)
+    {
+        log_message(ERROR, "Failed to create group cache, lookups go to the database");
+    }
+}
+
+static ClockCache *get_cache()
+{
+    pthread_once(&group_cache.once, group_cache_init);
+    return group_cache.cache;
+}
+
+static bool load_group(int group_id, GroupCacheEntry *out)
+{
+    Group group = {0};
+    if (!storage()->group_get(group_id, &group))
+    {
+        return false;
+    }
+
+    memset(out, 0, sizeof(GroupCacheEntry));
+    out->id = group.id;
+    snprintf(out->name, sizeof(out->name), "%s", group.name);
+    out->created_at = group.created_at;
+    out->creator_id = group.creator_id;
+    return true;
+}
+
+bool group_cache_get(int group_id, GroupCacheEntry *out)
+{
+    ClockCache *cache = get_cache();
+    if (!cache || !clock_cache_get(cache, group_id, out))
+    {
+        // Load chồng lên một lần invalidate thì không được ghi vào cache
+        unsigned long long version = cache ? clock_cache_version(cache) : 0;
+        if (!load_group(group_id, out))
+        {
+            return false;
+        }
+        if (cache)
+        {
+            clock_cache_put_if(cache, group_id, out, version);
+        }
+    }
+
+    int members = membership_index_count(group_id);
+    out->member_count = members > 0 ? members : 0;
+    return true;
+}
+
+void group_cache_put(const GroupCacheEntry *entry)
+{
+    ClockCache *cache = get_cache();
+    if (cache && entry)
+    {
+        clock_cache_put(cache, entry->id, entry);
+    }
+}
+
+void group_cache_invalidate(int group_id)
+{
+    ClockCache *cache = get_cache();
+    if (cache)
+    {
+        clock_cache_remove(cache, group_id);
+    }
+}
+
+ClockCacheStats group_cache_get_stats()
+{
+    ClockCache *cache = get_cache();
+    if (!cache)
+    {
+        ClockCacheStats empty = {0};
+        return empty;
+    }
+    return clock_cache_get_stats(cache);
+}
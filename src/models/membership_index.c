@@ -0,0 +1,397 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "membership_index.h"
+#include "storage.h"
+#include "log.h"
+
+// Danh sách id đã sắp xếp của một group (thành viên) hoặc một user (các group)
+typedef struct MembershipEntry
+{
+    int key;
+    int *ids;
+    int count;
+    int capacity;
+    struct MembershipEntry *next;
+} MembershipEntry;
+
+// Một lần nạp từ DB đang chạy, lần miss khác cùng key chờ nó thay vì truy vấn lần nữa
+typedef struct PendingLoad
+{
+    MembershipEntry **map;
+    int key;
+    struct PendingLoad *next;
+} PendingLoad;
+
+typedef struct
+{
+    MembershipEntry *groups[MEMBERSHIP_INDEX_BUCKETS];
+    MembershipEntry *users[MEMBERSHIP_INDEX_BUCKETS];
+    // Tăng ở mỗi lần ghi, lần nạp nào chồng lên một lần ghi thì không được giữ lại
+    unsigned long long write_seq;
+    pthread_rwlock_t lock;
+
+    PendingLoad *loading;
+    pthread_mutex_t loading_mutex;
+    pthread_cond_t loaded;
+} MembershipIndex;
+
+static MembershipIndex membership = {
+    .write_seq = 0,
+    .lock = PTHREAD_RWLOCK_INITIALIZER,
+    .loading = NULL,
+    .loading_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .loaded = PTHREAD_COND_INITIALIZER};
+
+static inline uint32_t bucket_of(int key)
+{
+    uint32_t h = (uint32_t)key * 2654435769u;
+    return (h ^ (h >> 16)) % MEMBERSHIP_INDEX_BUCKETS;
+}
+
+static MembershipEntry *find_entry(MembershipEntry **map, int key)
+{
+    for (MembershipEntry *entry = map[bucket_of(key)]; entry; entry = entry->next)
+    {
+        if (entry->key == key)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void free_entry(MembershipEntry *entry)
+{
+    free(entry->ids);
+    free(entry);
+}
+
+static void unlink_entry(MembershipEntry **map, int key)
+{
+    MembershipEntry **link = &map[bucket_of(key)];
+    while (*link)
+    {
+        if ((*link)->key == key)
+        {
+            MembershipEntry *entry = *link;
+            *link = entry->next;
+            free_entry(entry);
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+// Vị trí đầu tiên có giá trị >= id
+static int lower_bound(const int *ids, int count, int id)
+{
+    int lo = 0, hi = count;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (ids[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static bool entry_contains(const MembershipEntry *entry, int id)
+{
+    int pos = lower_bound(entry->ids, entry->count, id);
+    return pos < entry->count && entry->ids[pos] == id;
+}
+
+static bool entry_insert(MembershipEntry *entry, int id)
+{
+    int pos = lower_bound(entry->ids, entry->count, id);
+    if (pos < entry->count && entry->ids[pos] == id)
+    {
+        return true;
+    }
+    if (entry->count == entry->capacity)
+    {
+        int capacity = entry->capacity > 0 ? entry->capacity * 2 : 4;
+        int *ids = realloc(entry->ids, capacity * sizeof(int));
+        if (!ids)
+        {
+            return false;
+        }
+        entry->ids = ids;
+        entry->capacity = capacity;
+    }
+    memmove(&entry->ids[pos + 1], &entry->ids[pos], (entry->count - pos) * sizeof(int));
+    entry->ids[pos] = id;
+    entry->count++;
+    return true;
+}
+
+static void entry_erase(MembershipEntry *entry, int id)
+{
+    int pos = lower_bound(entry->ids, entry->count, id);
+    if (pos < entry->count && entry->ids[pos] == id)
+    {
+        memmove(&entry->ids[pos], &entry->ids[pos + 1], (entry->count - pos - 1) * sizeof(int));
+        entry->count--;
+    }
+}
+
+// Gọi khi đang giữ write lock. Hết bộ nhớ thì bỏ entry để lần sau nạp lại từ DB
+static void insert_or_forget(MembershipEntry **map, int key, int id)
+{
+    MembershipEntry *entry = find_entry(map, key);
+    if (entry && !entry_insert(entry, id))
+    {
+        log_message(WARN, "Membership index out of memory, reloading %d later", key);
+        unlink_entry(map, key);
+    }
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+typedef bool (*IdLoader)(int key, int **out, int *count);
+
+static int *load_ids(IdLoader loader, int key, int *out_count)
+{
+    int *ids = NULL;
+    int count = 0;
+    if (!loader(key, &ids, &count))
+    {
+        log_message(ERROR, "Failed to load membership of %d", key);
+        return NULL;
+    }
+    // NULL là lỗi, danh sách rỗng vẫn cần một mảng
+    if (!ids)
+    {
+        ids = malloc(sizeof(int));
+        if (!ids)
+        {
+            log_message(ERROR, "Memory allocation failed for membership ids");
+            return NULL;
+        }
+    }
+
+    qsort(ids, count, sizeof(int), compare_ids);
+    *out_count = count;
+    return ids;
+}
+
+static int *copy_ids(const MembershipEntry *entry, int *out_count)
+{
+    int *ids = malloc((entry->count > 0 ? entry->count : 1) * sizeof(int));
+    if (!ids)
+    {
+        log_message(ERROR, "Memory allocation failed for membership ids");
+        return NULL;
+    }
+    memcpy(ids, entry->ids, entry->count * sizeof(int));
+    *out_count = entry->count;
+    return ids;
+}
+
+// Gọi khi đang giữ loading_mutex
+static bool is_loading(MembershipEntry **map, int key)
+{
+    for (PendingLoad *load = membership.loading; load; load = load->next)
+    {
+        if (load->map == map && load->key == key)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void finish_load(PendingLoad *pending)
+{
+    pthread_mutex_lock(&membership.loading_mutex);
+    PendingLoad **link = &membership.loading;
+    while (*link != pending)
+    {
+        link = &(*link)->next;
+    }
+    *link = pending->next;
+    pthread_cond_broadcast(&membership.loaded);
+    pthread_mutex_unlock(&membership.loading_mutex);
+}
+
+/**
+ * Bản sao danh sách id của key, nạp từ DB nếu chưa có trong index
+ */
+static int *read_ids(MembershipEntry **map, IdLoader loader, int key, int *out_count)
+{
+    *out_count = 0;
+
+    PendingLoad pending = {map, key, NULL};
+    unsigned long long seq;
+    for (;;)
+    {
+        pthread_rwlock_rdlock(&membership.lock);
+        MembershipEntry *entry = find_entry(map, key);
+        if (entry)
+        {
+            int *ids = copy_ids(entry, out_count);
+            pthread_rwlock_unlock(&membership.lock);
+            return ids;
+        }
+        seq = membership.write_seq;
+        pthread_rwlock_unlock(&membership.lock);
+
+        pthread_mutex_lock(&membership.loading_mutex);
+        if (!is_loading(map, key))
+        {
+            pending.next = membership.loading;
+            membership.loading = &pending;
+            pthread_mutex_unlock(&membership.loading_mutex);
+            break;
+        }
+        // Lần nạp kia có thể không được giữ lại (chồng lên một lần ghi), khi đó tự nạp
+        while (is_loading(map, key))
+        {
+            pthread_cond_wait(&membership.loaded, &membership.loading_mutex);
+        }
+        pthread_mutex_unlock(&membership.loading_mutex);
+    }
+
+    int count = 0;
+    int *ids = load_ids(loader, key, &count);
+    if (!ids)
+    {
+        finish_load(&pending);
+        return NULL;
+    }
+    *out_count = count;
+
+    // Group không có thành viên nào (thường là group_id không tồn tại, client gửi gì cũng được) không
+    // được giữ lại, nếu không mỗi id lạ chiếm một entry mãi mãi
+    bool keep = count > 0 || map != membership.groups;
+    pthread_rwlock_wrlock(&membership.lock);
+    if (keep && membership.write_seq == seq && !find_entry(map, key))
+    {
+        MembershipEntry *entry = calloc(1, sizeof(MembershipEntry));
+        int *kept = malloc((count > 0 ? count : 1) * sizeof(int));
+        if (entry && kept)
+        {
+            memcpy(kept, ids, count * sizeof(int));
+            entry->key = key;
+            entry->ids = kept;
+            entry->count = count;
+            entry->capacity = count > 0 ? count : 1;
+            entry->next = map[bucket_of(key)];
+            map[bucket_of(key)] = entry;
+        }
+        else
+        {
+            free(entry);
+            free(kept);
+        }
+    }
+    pthread_rwlock_unlock(&membership.lock);
+    finish_load(&pending);
+    return ids;
+}
+
+bool membership_index_contains(int group_id, int user_id)
+{
+    pthread_rwlock_rdlock(&membership.lock);
+    MembershipEntry *entry = find_entry(membership.groups, group_id);
+    if (entry)
+    {
+        bool member = entry_contains(entry, user_id);
+        pthread_rwlock_unlock(&membership.lock);
+        return member;
+    }
+    pthread_rwlock_unlock(&membership.lock);
+
+    // Lần đầu gặp group: nạp cả danh sách, các lần sau không cần DB
+    int count = 0;
+    int *ids = read_ids(membership.groups, storage()->group_member_ids, group_id, &count);
+    if (!ids)
+    {
+        return false;
+    }
+    int pos = lower_bound(ids, count, user_id);
+    bool member = pos < count && ids[pos] == user_id;
+    free(ids);
+    return member;
+}
+
+int *membership_index_members(int group_id, int *out_count)
+{
+    return read_ids(membership.groups, storage()->group_member_ids, group_id, out_count);
+}
+
+int membership_index_count(int group_id)
+{
+    pthread_rwlock_rdlock(&membership.lock);
+    MembershipEntry *entry = find_entry(membership.groups, group_id);
+    int count = entry ? entry->count : -1;
+    pthread_rwlock_unlock(&membership.lock);
+    if (entry)
+    {
+        return count;
+    }
+
+    int *ids = read_ids(membership.groups, storage()->group_member_ids, group_id, &count);
+    if (!ids)
+    {
+        return -1;
+    }
+    free(ids);
+    return count;
+}
+
+int *membership_index_groups(int user_id, int *out_count)
+{
+    return read_ids(membership.users, storage()->user_group_ids, user_id, out_count);
+}
+
+void membership_index_add(int group_id, int user_id)
+{
+    pthread_rwlock_wrlock(&membership.lock);
+    membership.write_seq++;
+    // Phía nào chưa nạp thì bỏ qua, lần nạp sau đọc DB đã có hàng mới
+    insert_or_forget(membership.groups, group_id, user_id);
+    insert_or_forget(membership.users, user_id, group_id);
+    pthread_rwlock_unlock(&membership.lock);
+}
+
+void membership_index_remove(int group_id, int user_id)
+{
+    pthread_rwlock_wrlock(&membership.lock);
+    membership.write_seq++;
+    MembershipEntry *entry = find_entry(membership.groups, group_id);
+    if (entry)
+    {
+        entry_erase(entry, user_id);
+    }
+    entry = find_entry(membership.users, user_id);
+    if (entry)
+    {
+        entry_erase(entry, group_id);
+    }
+    pthread_rwlock_unlock(&membership.lock);
+}
+
+void membership_index_drop_group(int group_id)
+{
+    pthread_rwlock_wrlock(&membership.lock);
+    membership.write_seq++;
+    unlink_entry(membership.groups, group_id);
+    // Danh sách thành viên có thể chưa nạp nên duyệt hết các user đã nạp
+    for (int i = 0; i < MEMBERSHIP_INDEX_BUCKETS; i++)
+    {
+        for (MembershipEntry *entry = membership.users[i]; entry; entry = entry->next)
+        {
+            entry_erase(entry, group_id);
+        }
+    }
+    pthread_rwlock_unlock(&membership.lock);
+}
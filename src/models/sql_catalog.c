@@ -0,0 +1,86 @@
+#include "sql_catalog.h"
+#include "user.h"
+#include "group.h"
+#include "db_message.h"
+
+static const DbFieldBinding USER_FIELDS[] = {
+    DB_FIELD("id", DB_FIELD_INT, User, id),
+    DB_FIELD("username", DB_FIELD_STRDUP, User, username),
+    DB_FIELD("password", DB_FIELD_STRDUP, User, password),
+    DB_FIELD("online", DB_FIELD_BOOL, User, isOnline),
+    DB_FIELD("last_attendance_at", DB_FIELD_LONG, User, lastLogin),
+};
+
+static const DbFieldBinding USER_NAME_FIELDS[] = {
+    DB_FIELD("id", DB_FIELD_INT, User, id),
+    DB_FIELD("username", DB_FIELD_STRDUP, User, username),
+};
+
+const DbRowMapper SQL_MAP_USER_BY_ID = DB_ROW_MAPPER("user_by_id", SQL_GET_USER_BY_ID, User, USER_NAME_FIELDS);
+const DbRowMapper SQL_MAP_ALL_USERS = DB_ROW_MAPPER("all_users", SQL_GET_ALL_USERS, User, USER_FIELDS);
+const DbRowMapper SQL_MAP_ALL_USERS_EXCEPT = DB_ROW_MAPPER("all_users_except", SQL_GET_ALL_USERS_EXCEPT, User, USER_FIELDS);
+const DbRowMapper SQL_MAP_USERS_BY_USERNAME = DB_ROW_MAPPER("users_by_username", SQL_GET_ALL_USERS_BY_USERNAME, User, USER_NAME_FIELDS);
+const DbRowMapper SQL_MAP_ALL_USERNAMES = DB_ROW_MAPPER("all_usernames", SQL_GET_ALL_USERNAMES, User, USER_NAME_FIELDS);
+
+static const DbFieldBinding GROUP_FIELDS[] = {
+    DB_FIELD("group_id", DB_FIELD_INT, Group, id),
+    DB_FIELD("group_name", DB_FIELD_CHARS, Group, name),
+    DB_FIELD("created_at", DB_FIELD_LONG, Group, created_at),
+    DB_FIELD("created_by", DB_FIELD_INT, Group, creator_id),
+};
+
+// Chỉ dùng khi cần so khớp mật khẩu nhóm
+static const DbFieldBinding GROUP_AUTH_FIELDS[] = {
+    DB_FIELD("group_id", DB_FIELD_INT, Group, id),
+    DB_FIELD("group_name", DB_FIELD_CHARS, Group, name),
+    DB_FIELD("created_at", DB_FIELD_LONG, Group, created_at),
+    DB_FIELD("created_by", DB_FIELD_INT, Group, creator_id),
+    DB_FIELD("password", DB_FIELD_CHARS, Group, password),
+};
+
+const DbRowMapper SQL_MAP_GROUP = DB_ROW_MAPPER("group", SQL_GET_GROUP, Group, GROUP_FIELDS);
+const DbRowMapper SQL_MAP_GROUP_BY_NAME = DB_ROW_MAPPER("group_by_name", SQL_FIND_GROUP_BY_NAME, Group, GROUP_AUTH_FIELDS);
+const DbRowMapper SQL_MAP_GROUPS_BY_USER = DB_ROW_MAPPER("groups_by_user", SQL_GET_GROUPS_BY_USER, Group, GROUP_FIELDS);
+
+static const DbFieldBinding MESSAGE_FIELDS[] = {
+    DB_FIELD("id", DB_FIELD_LONG, MessageData, id),
+    DB_FIELD("sender_id", DB_FIELD_INT, MessageData, sender_id),
+    DB_FIELD("sender_name", DB_FIELD_STRDUP, MessageData, sender_name),
+    DB_FIELD("message_content", DB_FIELD_STRDUP, MessageData, content),
+    DB_FIELD("timestamp", DB_FIELD_LONG, MessageData, timestamp),
+};
+
+const DbRowMapper SQL_MAP_CONVERSATION_MESSAGES = DB_ROW_MAPPER("conversation_messages", SQL_GET_CONVERSATION_MESSAGES, MessageData, MESSAGE_FIELDS);
+
+static const DbFieldBinding MESSAGE_SEARCH_FIELDS[] = {
+    DB_FIELD("id", DB_FIELD_LONG, MessageSearchResult, id),
+    DB_FIELD("conversation_id", DB_FIELD_LONG, MessageSearchResult, conversation_id),
+    DB_FIELD("sender_id", DB_FIELD_INT, MessageSearchResult, sender_id),
+    DB_FIELD("sender_name", DB_FIELD_STRDUP, MessageSearchResult, sender_name),
+    DB_FIELD("message_content", DB_FIELD_STRDUP, MessageSearchResult, content),
+    DB_FIELD("timestamp", DB_FIELD_LONG, MessageSearchResult, timestamp),
+};
+
+// SQL thật được ghép theo số id tìm được, xem search_messages
+const DbRowMapper SQL_MAP_MESSAGES_BY_IDS = DB_ROW_MAPPER("messages_by_ids", SQL_GET_MESSAGES_BY_IDS_PREFIX, MessageSearchResult, MESSAGE_SEARCH_FIELDS);
+
+// Những cột message index và archive cần, không JOIN users
+static const DbFieldBinding MESSAGE_TAIL_FIELDS[] = {
+    DB_FIELD("id", DB_FIELD_LONG, MessageSearchResult, id),
+    DB_FIELD("conversation_id", DB_FIELD_LONG, MessageSearchResult, conversation_id),
+    DB_FIELD("sender_id", DB_FIELD_INT, MessageSearchResult, sender_id),
+    DB_FIELD("message_content", DB_FIELD_STRDUP, MessageSearchResult, content),
+    DB_FIELD("timestamp", DB_FIELD_LONG, MessageSearchResult, timestamp),
+};
+
+const DbRowMapper SQL_MAP_MESSAGES_AFTER = DB_ROW_MAPPER("messages_after", SQL_INDEX_MESSAGES_AFTER, MessageSearchResult, MESSAGE_TAIL_FIELDS);
+
+static const DbFieldBinding CHAT_HISTORY_FIELDS[] = {
+    DB_FIELD("chat_id", DB_FIELD_INT, ChatHistory, id),
+    DB_FIELD("last_time", DB_FIELD_LONG, ChatHistory, last_time),
+    DB_FIELD("last_message", DB_FIELD_CHARS, ChatHistory, last_message),
+    DB_FIELD("sender_name", DB_FIELD_CHARS, ChatHistory, sender_name),
+    DB_FIELD("chat_with", DB_FIELD_CHARS, ChatHistory, chat_with),
+};
+
+const DbRowMapper SQL_MAP_CHAT_HISTORIES_BY_USER = DB_ROW_MAPPER("chat_histories_by_user", SQL_GET_CHAT_HISTORIES_BY_USER, ChatHistory, CHAT_HISTORY_FIELDS);
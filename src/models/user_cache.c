@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "user_cache.h"
+#include "user.h"
+#include "storage.h"
+#include "config.h"
+#include "log.h"
+
+typedef struct
+{
+    ClockCache *cache;
+    pthread_once_t once;
+} UserCache;
+
+static UserCache user_cache = {
+    .cache = NULL,
+    .once = PTHREAD_ONCE_INIT};
+
+static void user_cache_init()
+{
+    int capacity = config_get_user_cache_capacity();
+    user_cache.cache = clock_cache_create(capacity > 0 ? capacity : USER_CACHE_DEFAULT_CAPACITY, sizeof(UserCacheEntry));
+    if (!user_cache.cache)
+    {
+        log_message(ERROR, "Failed to create user cache, lookups go to the database");
+    }
+}
+
+static ClockCache *get_cache()
+{
+    pthread_once(&user_cache.once, user_cache_init);
+    return user_cache.cache;
+}
+
+static bool load_user(int id, UserCacheEntry *out)
+{
+    out->id = id;
+    return storage()->user_name(id, out->username, sizeof(out->username));
+}
+
+bool user_cache_get(int id, UserCacheEntry *out)
+{
+    ClockCache *cache = get_cache();
+    if (cache && clock_cache_get(cache, id, out))
+    {
+        return true;
+    }
+
+    // Load chồng lên một lần invalidate thì không được ghi vào cache
+    unsigned long long version = cache ? clock_cache_version(cache) : 0;
+    if (!load_user(id, out))
+    {
+        return false;
+    }
+    if (cache)
+    {
+        clock_cache_put_if(cache, id, out, version);
+    }
+    return true;
+}
+
+void user_cache_put(int id, const char *username)
+{
+    ClockCache *cache = get_cache();
+    if (!cache || !username)
+    {
+        return;
+    }
+
+    UserCacheEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.id = id;
+    snprintf(entry.username, sizeof(entry.username), "%s", username);
+    clock_cache_put(cache, id, &entry);
+}
+
+void user_cache_invalidate(int id)
+{
+    ClockCache *cache = get_cache();
+    if (cache)
+    {
+        clock_cache_remove(cache, id);
+    }
+}
+
+ClockCacheStats user_cache_get_stats()
+{
+    ClockCache *cache = get_cache();
+    if (!cache)
+    {
+        ClockCacheStats empty = {0};
+        return empty;
+    }
+    return clock_cache_get_stats(cache);
+}
@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "username_index.h"
+#include "storage.h"
+#include "log.h"
+
+typedef struct
+{
+    int id;
+    char *name;
+    // Bản chữ thường của name, dùng để so khớp
+    char *folded;
+    int length;
+} IndexedName;
+
+// Danh sách vị trí (trong names) các username chứa một trigram, tăng dần
+typedef struct Posting
+{
+    uint32_t trigram;
+    int *items;
+    int count;
+    int capacity;
+    struct Posting *next;
+} Posting;
+
+typedef struct
+{
+    IndexedName *names;
+    int count;
+    int capacity;
+    Posting *buckets[USERNAME_INDEX_BUCKETS];
+    bool ready;
+    pthread_rwlock_t lock;
+} UsernameIndex;
+
+static UsernameIndex username_index = {
+    .names = NULL,
+    .count = 0,
+    .capacity = 0,
+    .ready = false,
+    .lock = PTHREAD_RWLOCK_INITIALIZER};
+
+typedef struct
+{
+    int index;
+    // 0: trùng hẳn, 1: tiền tố, 2: chuỗi con
+    int tier;
+} Candidate;
+
+static inline uint32_t trigram_at(const char *s)
+{
+    return ((uint32_t)(unsigned char)s[0] << 16) | ((uint32_t)(unsigned char)s[1] << 8) | (unsigned char)s[2];
+}
+
+static inline uint32_t bucket_of(uint32_t trigram)
+{
+    uint32_t h = trigram * 2654435769u;
+    return (h ^ (h >> 16)) % USERNAME_INDEX_BUCKETS;
+}
+
+static char *fold(const char *s)
+{
+    char *folded = strdup(s);
+    if (folded)
+    {
+        for (char *p = folded; *p; p++)
+        {
+            *p = (char)tolower((unsigned char)*p);
+        }
+    }
+    return folded;
+}
+
+static Posting *find_posting(uint32_t trigram)
+{
+    for (Posting *posting = username_index.buckets[bucket_of(trigram)]; posting; posting = posting->next)
+    {
+        if (posting->trigram == trigram)
+        {
+            return posting;
+        }
+    }
+    return NULL;
+}
+
+// Gọi khi đang giữ write lock
+static bool posting_append(uint32_t trigram, int index)
+{
+    Posting *posting = find_posting(trigram);
+    if (!posting)
+    {
+        posting = calloc(1, sizeof(Posting));
+        if (!posting)
+        {
+            return false;
+        }
+        posting->trigram = trigram;
+        posting->next = username_index.buckets[bucket_of(trigram)];
+        username_index.buckets[bucket_of(trigram)] = posting;
+    }
+
+    // Một tên có thể chứa cùng trigram nhiều lần, chỉ ghi một lần
+    if (posting->count > 0 && posting->items[posting->count - 1] == index)
+    {
+        return true;
+    }
+    if (posting->count == posting->capacity)
+    {
+        int capacity = posting->capacity > 0 ? posting->capacity * 2 : 4;
+        int *items = realloc(posting->items, capacity * sizeof(int));
+        if (!items)
+        {
+            return false;
+        }
+        posting->items = items;
+        posting->capacity = capacity;
+    }
+    posting->items[posting->count++] = index;
+    return true;
+}
+
+// Gọi khi đang giữ write lock
+static bool insert_name(int id, const char *username)
+{
+    if (username_index.count == username_index.capacity)
+    {
+        int capacity = username_index.capacity > 0 ? username_index.capacity * 2 : 256;
+        IndexedName *names = realloc(username_index.names, capacity * sizeof(IndexedName));
+        if (!names)
+        {
+            return false;
+        }
+        username_index.names = names;
+        username_index.capacity = capacity;
+    }
+
+    IndexedName *entry = &username_index.names[username_index.count];
+    entry->id = id;
+    entry->name = strdup(username);
+    entry->folded = fold(username);
+    if (!entry->name || !entry->folded)
+    {
+        free(entry->name);
+        free(entry->folded);
+        return false;
+    }
+    entry->length = (int)strlen(entry->folded);
+
+    int index = username_index.count++;
+    for (int i = 0; i + 3 <= entry->length; i++)
+    {
+        // Thiếu một trigram là tên có thể không bao giờ được tìm thấy, coi như cả index hỏng
+        if (!posting_append(trigram_at(entry->folded + i), index))
+        {
+            log_message(WARN, "Username index out of memory while indexing user %d", id);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool username_index_build()
+{
+    int count = 0;
+    User *users = NULL;
+    if (!storage()->usernames(&users, &count))
+    {
+        log_message(ERROR, "Failed to load usernames, searches go to the database");
+        return false;
+    }
+
+    pthread_rwlock_wrlock(&username_index.lock);
+    bool ok = true;
+    for (int i = 0; i < count; i++)
+    {
+        if (ok && users[i].username)
+        {
+            ok = insert_name(users[i].id, users[i].username);
+        }
+        free(users[i].username);
+    }
+    username_index.ready = ok;
+    int indexed = username_index.count;
+    pthread_rwlock_unlock(&username_index.lock);
+    free(users);
+
+    if (!ok)
+    {
+        log_message(ERROR, "Failed to build username index, searches go to the database");
+        return false;
+    }
+    log_message(INFO, "Username index built: %d users", indexed);
+    return true;
+}
+
+bool username_index_ready()
+{
+    pthread_rwlock_rdlock(&username_index.lock);
+    bool ready = username_index.ready;
+    pthread_rwlock_unlock(&username_index.lock);
+    return ready;
+}
+
+void username_index_add(int id, const char *username)
+{
+    if (!username)
+    {
+        return;
+    }
+    pthread_rwlock_wrlock(&username_index.lock);
+    // Chưa build thì lần build sau đọc DB đã có user mới
+    if (username_index.ready && !insert_name(id, username))
+    {
+        // Thiếu một tên thì kết quả sai, quay về tìm bằng MySQL
+        log_message(ERROR, "Failed to index user %d, searches go to the database", id);
+        username_index.ready = false;
+    }
+    pthread_rwlock_unlock(&username_index.lock);
+}
+
+// Gọi khi đang giữ read lock
+static bool match(int index, const char *query, int query_length, Candidate *out)
+{
+    const IndexedName *entry = &username_index.names[index];
+    const char *found = strstr(entry->folded, query);
+    if (!found)
+    {
+        return false;
+    }
+    out->index = index;
+    out->tier = found != entry->folded ? 2 : (entry->length == query_length ? 0 : 1);
+    return true;
+}
+
+static int compare_candidates(const void *a, const void *b)
+{
+    const Candidate *x = a, *y = b;
+    if (x->tier != y->tier)
+    {
+        return x->tier - y->tier;
+    }
+    const IndexedName *nx = &username_index.names[x->index];
+    const IndexedName *ny = &username_index.names[y->index];
+    if (nx->length != ny->length)
+    {
+        return nx->length - ny->length;
+    }
+    return strcmp(nx->folded, ny->folded);
+}
+
+User *username_index_search(const char *query, int limit, int *out_count)
+{
+    *out_count = 0;
+    char *folded = fold(query ? query : "");
+    if (!folded)
+    {
+        return NULL;
+    }
+    int query_length = (int)strlen(folded);
+    if (limit <= 0)
+    {
+        limit = USERNAME_SEARCH_LIMIT;
+    }
+
+    pthread_rwlock_rdlock(&username_index.lock);
+
+    // Từ 3 ký tự trở lên chỉ xét các tên chứa trigram hiếm nhất của query
+    const int *items = NULL;
+    int item_count = username_index.count;
+    bool scan = query_length < 3;
+    for (int i = 0; !scan && i + 3 <= query_length; i++)
+    {
+        Posting *posting = find_posting(trigram_at(folded + i));
+        if (!posting)
+        {
+            item_count = 0;
+            break;
+        }
+        if (!items || posting->count < item_count)
+        {
+            items = posting->items;
+            item_count = posting->count;
+        }
+    }
+
+    Candidate *candidates = malloc((item_count > 0 ? item_count : 1) * sizeof(Candidate));
+    int matched = 0;
+    for (int i = 0; candidates && i < item_count; i++)
+    {
+        if (match(scan ? i : items[i], folded, query_length, &candidates[matched]))
+        {
+            matched++;
+        }
+    }
+    if (candidates && matched > 0)
+    {
+        qsort(candidates, matched, sizeof(Candidate), compare_candidates);
+    }
+
+    int count = matched < limit ? matched : limit;
+    User *users = count > 0 ? calloc(count, sizeof(User)) : NULL;
+    for (int i = 0; users && i < count; i++)
+    {
+        const IndexedName *entry = &username_index.names[candidates[i].index];
+        users[i].id = entry->id;
+        users[i].username = strdup(entry->name);
+    }
+    pthread_rwlock_unlock(&username_index.lock);
+
+    free(candidates);
+    free(folded);
+    if (count > 0 && !users)
+    {
+        log_message(ERROR, "Memory allocation failed for username search");
+        return NULL;
+    }
+    *out_count = users ? count : 0;
+    return users;
+}
@@ -13,6 +13,13 @@
 #include "group_member.h"
 #include "json_utils.h"
 #include "server_manager.h"
+#include "presence.h"
+#include "session_table.h"
+#include "db_executor.h"
+#include "db_async.h"
+#include "sql_catalog.h"
+#include "database_connector.h"
+#include "message_stream.h"
 
 
 void controller_on_message(Controller* self, Message* message);
@@ -24,7 +31,7 @@ void controller_message_not_in_chat(Controller* self, Message* ms);
 void controller_new_message(Controller* self, Message* ms);
 
 
-void get_users(Session* session);
+void get_users(Session* session, Message* msg);
 
 Controller* createController(Session* client){
     Controller* controller = (Controller*)malloc(sizeof(Controller));
@@ -60,13 +67,63 @@ void controller_set_user(Controller* controller, User* user){
     }
 }
 
+typedef struct {
+    SessionHandle handle;
+    Message* message;
+} ControllerTask;
+
+// Lệnh nào gửi nhiều câu SQL hơn ngưỡng này bị log WARN (dấu hiệu N+1)
+#define COMMAND_QUERY_WARN 16
+
+static void controller_dispatch(Controller* self, Message* message);
+
+// Key executor của session: các lệnh cùng key chạy lần lượt theo thứ tự nhận
+static uint64_t session_key(SessionHandle handle){
+    return ((uint64_t)handle.index << 32) | handle.generation;
+}
+
+static void controller_run_task(void* arg){
+    ControllerTask* task = (ControllerTask*)arg;
+    // Session có thể đã đóng trong lúc lệnh còn nằm trong queue
+    Session* session = session_table_acquire(task->handle);
+    if (session != NULL) {
+        if (session->handler != NULL) {
+            controller_dispatch(session->handler, task->message);
+        }
+        session_table_release(task->handle);
+    } else {
+        log_message(LOG_DEBUG, "Dropping command %d for closed session", task->message->command);
+        message_destroy(task->message);
+    }
+    free(task);
+}
+
 void controller_on_message(Controller* self, Message* message){
     if(self == NULL || message == NULL){
         log_message(ERROR, "Client %d: message is NULL", self->client->id);
         return;
     }
 
+    // Handler chạy trên DB executor để thread đọc socket không chờ MySQL.
+    // Key là handle của session nên các lệnh của một client vẫn chạy đúng thứ tự
+    SessionHandle handle = self->client->handle;
+    if (handle.generation != 0) {
+        ControllerTask* task = (ControllerTask*)malloc(sizeof(ControllerTask));
+        if (task != NULL) {
+            task->handle = handle;
+            task->message = message;
+            if (db_executor_submit(session_key(handle), controller_run_task, task)) {
+                return;
+            }
+            free(task);
+        }
+    }
+    controller_dispatch(self, message);
+}
+
+static void controller_dispatch(Controller* self, Message* message){
     uint8_t command = message->command;
+    unsigned long queries_before = db_manager_thread_queries();
     switch (command)
     {
     case LOGIN:
@@ -80,7 +137,7 @@ void controller_on_message(Controller* self, Message* message){
         handle_register(self->client, message);
         break;
     case GET_USERS:
-        get_users(self->client);
+        get_users(self->client, message);
         break;
     case GET_JOINED_GROUPS:
         get_joined_groups(self->client, message);
@@ -115,10 +172,20 @@ void controller_on_message(Controller* self, Message* message){
     case SEARCH_USERS:
         handle_search_user(self->client, message);
         break;
+    case SUBSCRIBE_PRESENCE:
+        handle_subscribe_presence(self->client, message);
+        break;
+    case SEARCH_MESSAGES:
+        handle_search_messages(self->client, message);
+        break;
     default:
         log_message(ERROR, "Client %d: unknown command %d", self->client->id, command);
         break;
     }
+
+    // Số round trip MySQL của một request, benchmark đọc dòng này để bắt lỗi N+1
+    unsigned long queries = db_manager_thread_queries() - queries_before;
+    log_message(queries > COMMAND_QUERY_WARN ? WARN : LOG_DEBUG, "Command 0x%02x ran %lu queries", command, queries);
 }
 
 void controller_on_connection_fail(Controller* self){
@@ -229,40 +296,98 @@ void handle_logout(Session* session, Message* message) {
     message_write_bool(msg, true);
     session_send_message(session, msg);
 }
-void get_users(Session* session){
+static void free_user_rows(User* users, int count){
+    for (int i = 0; i < count; i++) {
+        free(users[i].username);
+        free(users[i].password);
+    }
+    free(users);
+}
+
+static void get_users_done(DbResult* result, void* arg){
+    SessionHandle* handle = (SessionHandle*)arg;
+    if (result == NULL) {
+        Session* session = session_table_acquire(*handle);
+        if (session != NULL) {
+            service_server_message(session, "Failed to load users");
+            session_table_release(*handle);
+        }
+        free(handle);
+        return;
+    }
+    Message* msg = message_create(GET_USERS);
+    if (msg == NULL) {
+        log_message(ERROR, "Failed to create message");
+        db_result_free(result);
+        free(handle);
+        return;
+    }
+
+    // Ghi thẳng từ result vào response, không decode ra mảng User
+    int id_column = db_result_column_index(result, "id");
+    int name_column = db_result_column_index(result, "username");
+    int count = id_column >= 0 && name_column >= 0 ? result->row_count : 0;
+    message_write_int(msg, count);
+    for (int i = 0; i < count; i++) {
+        int id = db_result_int(result, i, id_column);
+        const char* username = db_result_string(result, i, name_column);
+        message_write_int(msg, id);
+        message_write_string(msg, username != NULL ? username : "");
+        message_write_bool(msg, server_manager_find_user_by_id(id) != NULL);
+    }
+    db_result_free(result);
+    session_table_send(*handle, msg);
+    free(handle);
+}
+
+static bool write_user_row(const User* user, void* arg){
+    Message* frame = message_stream_row((MessageStream*)arg);
+    if (frame == NULL) {
+        return false;
+    }
+    message_write_int(frame, user->id);
+    message_write_string(frame, user->username);
+    message_write_bool(frame, server_manager_find_user_by_id(user->id) != NULL);
+    return true;
+}
+
+void get_users(Session* session, Message* msg){
     ServerManager *manager = server_manager_get_instance();
     if(manager == NULL){
         return;
     }
-    if(session == NULL){
+    if(session == NULL || msg == NULL){
         return;
     }
-    int all_user_count = 0;
-    User* all_users = get_all_users(&all_user_count);
-    User *users[MAX_USERS];
-    int count = 0;
-    server_manager_get_users(users, &count);
-    for (int i = 0; i < all_user_count; i++) {
-        all_users[i].isOnline = false;
-        for (int j = 0; j < count; j++) {
-            if (all_users[i].id == users[j]->id) {
-                all_users[i].isOnline = true;
-                break;
+
+    // Client gửi thêm bool true thì nhận danh sách theo nhiều frame
+    msg->position = 0;
+    bool chunked = message_read_bool(msg);
+
+    // Query chạy trên async loop, worker của executor không phải ngồi chờ MySQL.
+    // Key của session được giữ tới khi callback gửi phản hồi, lệnh sau của client không vượt lên trước
+    uint64_t key = session_key(session->handle);
+    if (!chunked && session->handle.generation != 0 && db_executor_hold(key)) {
+        SessionHandle* handle = (SessionHandle*)malloc(sizeof(SessionHandle));
+        if (handle != NULL) {
+            *handle = session->handle;
+            if (db_async_query(key, SQL_MAP_ALL_USERS.sql, get_users_done, handle)) {
+                return;
             }
+            free(handle);
         }
+        db_executor_release(key);
     }
-    Message *msg = message_create(GET_USERS);
-    if(msg == NULL){
-        log_message(ERROR, "Failed to create message");
+
+    MessageStream stream;
+    if (!message_stream_begin(&stream, session, GET_USERS, chunked, false)) {
         return;
     }
-    message_write_int(msg, all_user_count);
-    for (int i = 0; i < all_user_count; i++) {
-        message_write_int(msg, all_users[i].id);
-        message_write_string(msg, all_users[i].username);
-        message_write_bool(msg, all_users[i].isOnline);
+    bool loaded = for_each_user(write_user_row, &stream);
+    message_stream_end(&stream);
+    if (!loaded) {
+        service_server_message(session, "Failed to load users");
     }
-    session_send_message(session, msg);
 }
 
 void get_joined_groups(Session* session, Message* msg){
@@ -306,6 +431,7 @@ void get_joined_groups(Session* session, Message* msg){
                 groups[i]->id, groups[i]->name,
                 groups[i]->created_by ? groups[i]->created_by->username : "Unknown",
                 groups[i]->created_by ? groups[i]->created_by->id : -1, groups[i]->created_at);
+            destroyUser(groups[i]->created_by);
             free(groups[i]);
         }
         free(groups);
@@ -361,6 +487,7 @@ void server_create_group(Session* session, Message* msg) {
     }
 
     session_send_message(session, res);
+    destroyUser(user);
 }
 
 void server_handle_join_group(Session* session, Message* msg) {
@@ -411,6 +538,7 @@ void server_handle_join_group(Session* session, Message* msg) {
             message_write_string(res, noti);
             save_group_message(user_id, group->id, noti);
             broad_cast_to_group(group->id, res);
+            destroyUser(user);
         }
     }
 
@@ -435,7 +563,7 @@ void server_handle_leave_group(Session* session, Message* msg) {
         return;
     }
 
-    if (group->created_by && group->created_by->id == user_id) {
+    if (group->creator_id == user_id) {
         message_write_bool(res, false);
         message_write_string(res, "You are the creator and cannot leave the group");
         session_send_message(session, res);
@@ -461,6 +589,7 @@ void server_handle_leave_group(Session* session, Message* msg) {
 
             save_group_message(user_id, group->id, noti);
             broad_cast_to_group(group_id, res);
+            destroyUser(user);
         }
     }
 
@@ -485,7 +614,7 @@ void server_delete_group(Session* session, Message* msg) {
         return;
     }
 
-    if (!group->created_by || group->created_by->id != user_id) {
+    if (group->creator_id != user_id) {
         message_write_bool(res, false);
         message_write_string(res, "You are not the creator and cannot delete this group");
         session_send_message(session, res);
@@ -518,6 +647,7 @@ void server_delete_group(Session* session, Message* msg) {
         }
         free(member_ids);
     }
+    destroyUser(user);
     //session_send_message(session, res);
 }
 
@@ -539,7 +669,11 @@ void server_receive_message(Session* session, Message* msg) {
         log_message(ERROR, "Failed to read data");
         return;
     }
-    save_private_message(sender_id, receiver_id, content);
+    // Không lưu được thì không chuyển tiếp, người gửi biết để gửi lại
+    if (!save_private_message(sender_id, receiver_id, content)) {
+        session->service->server_message(session, "Message could not be saved, please send it again");
+        return;
+    }
     //send to other client
     //session_send_message(session, msg);
     msg = message_create(USER_MESSAGE);
@@ -555,6 +689,30 @@ void server_receive_message(Session* session, Message* msg) {
     session->service->direct_message(receiver_id, msg);
     //session_send_message(session, msg);
 }
+typedef struct {
+    int group_id;
+    int sender_id;
+    Group* group;
+    bool is_member;
+    int* member_ids;
+    int member_count;
+} GroupMessageLookup;
+
+static void lookup_message_group(void* arg) {
+    GroupMessageLookup* lookup = (GroupMessageLookup*)arg;
+    lookup->group = get_group_by_id(lookup->group_id);
+}
+
+static void lookup_message_membership(void* arg) {
+    GroupMessageLookup* lookup = (GroupMessageLookup*)arg;
+    lookup->is_member = check_member_exists(lookup->group_id, lookup->sender_id);
+}
+
+static void lookup_message_members(void* arg) {
+    GroupMessageLookup* lookup = (GroupMessageLookup*)arg;
+    lookup->member_ids = get_group_members(lookup->group_id, &lookup->member_count);
+}
+
 void server_receive_group_message(Session* session, Message* msg) {
     ServerManager *manager = server_manager_get_instance();
     if (!manager || !session || !msg) {
@@ -567,17 +725,6 @@ void server_receive_group_message(Session* session, Message* msg) {
     char content[1024];
     char sender_name[1024];
 
-    Group *group = get_group_by_id(group_id);
-    if (!group || group->name == NULL) {
-        log_message(ERROR, "Group with ID %d not found", group_id);
-        Message* response = message_create(GROUP_MESSAGE);
-        if (!response) return;
-        message_write_bool(response, false);
-        message_write_string(response, "Group not found");
-        session_send_message(session, response);
-        return;
-    }
-
     if (!message_read_string(msg, sender_name, sizeof(sender_name))) {
         log_message(ERROR, "Failed to read sender name");
         return;
@@ -587,14 +734,46 @@ void server_receive_group_message(Session* session, Message* msg) {
         return;
     }
 
-    bool is_member = check_member_exists(group_id, sender_id);
+    // Ba truy vấn độc lập, chạy song song
+    GroupMessageLookup lookup = {group_id, sender_id, NULL, false, NULL, 0};
+    DbTask tasks[] = {
+        {lookup_message_group, &lookup},
+        {lookup_message_membership, &lookup},
+        {lookup_message_members, &lookup},
+    };
+    db_executor_run_all(tasks, 3);
+
+    Group *group = lookup.group;
+    if (!group) {
+        free(lookup.member_ids);
+        log_message(ERROR, "Group with ID %d not found", group_id);
+        Message* response = message_create(GROUP_MESSAGE);
+        if (!response) return;
+        message_write_bool(response, false);
+        message_write_string(response, "Group not found");
+        session_send_message(session, response);
+        return;
+    }
+
+    bool is_member = lookup.is_member;
     log_message(INFO, "User %d is member of group %d %s", sender_id, group_id, group->name);
 
     if (is_member) {
-        save_group_message(sender_id, group_id, content);
+        if (!save_group_message(sender_id, group_id, content)) {
+            free(lookup.member_ids);
+            free(group);
+            Message* response = message_create(GROUP_MESSAGE);
+            if (!response) return;
+            message_write_bool(response, false);
+            message_write_string(response, "Message could not be saved, please send it again");
+            session_send_message(session, response);
+            return;
+        }
         Message *response = message_create(GROUP_MESSAGE);
         if (!response) {
             log_message(ERROR, "Failed to create message");
+            free(lookup.member_ids);
+            free(group);
             return;
         }
         message_write_bool(response, true);
@@ -603,9 +782,16 @@ void server_receive_group_message(Session* session, Message* msg) {
         message_write_string(response, group->name);
         message_write_string(response, sender_name);
         message_write_string(response, content);
-        broad_cast_to_group_except(group_id, sender_id, response);
+        if (lookup.member_ids != NULL) {
+            broadcast_message_except(lookup.member_ids, lookup.member_count, response, sender_id);
+        }
+        message_destroy(response);
+        free(lookup.member_ids);
+        free(group);
         return;
     }
+    free(lookup.member_ids);
+    free(group);
 
     // Not a member
     Message* response = message_create(GROUP_MESSAGE);
@@ -648,75 +834,43 @@ void get_chat_history(Session* session, Message* msg) {
 
     session_send_message(session, message);
 }
-void get_user_message(Session* session, Message* msg) {
+static bool write_history_row(const MessageData* message, void* arg) {
+    Message* frame = message_stream_row((MessageStream*)arg);
+    if (frame == NULL) {
+        return false;
+    }
+    message_write_int(frame, message->sender_id);
+    message_write_string(frame, message->sender_name);
+    message_write_string(frame, message->content);
+    message_write_long(frame, message->timestamp);
+    return true;
+}
+
+// Tin được ghi thẳng vào frame trả về trong lúc đọc, không gom lại thành mảng
+static void send_chat_messages(Session* session, Message* msg, uint8_t command, bool group) {
     ServerManager *manager = server_manager_get_instance();
     if (manager == NULL || session == NULL || msg == NULL) return;
 
     msg->position = 0;
     int user_id = (int) message_read_int(msg);
     int target_id = (int) message_read_int(msg);
+    // Client gửi thêm bool true thì nhận lịch sử theo nhiều frame
+    bool chunked = message_read_bool(msg);
 
-    Message* response_msg = message_create(GET_USERS_MESSAGE);
-    if (response_msg == NULL) {
-        log_message(ERROR, "Failed to create message");
+    MessageStream stream;
+    if (!message_stream_begin(&stream, session, command, chunked, true)) {
         return;
     }
-
-    int count = 0;
-    MessageData* messages = get_chat_messages(user_id, target_id, -1, &count);
-
-    if (messages == NULL || count == 0) {
-        message_write_bool(response_msg, false);
-    } else {
-        message_write_bool(response_msg, true);
-        message_write_int(response_msg, count);
-
-        // Gửi từng tin nhắn
-        for (int i = 0; i < count; i++) {
-            message_write_int(response_msg, messages[i].sender_id);
-            message_write_string(response_msg, messages[i].sender_name);
-            message_write_string(response_msg, messages[i].content);
-            message_write_long(response_msg, messages[i].timestamp);
-        }
-
-        free(messages);
-    }
-    session_send_message(session, response_msg);
+    for_each_chat_message(user_id, group ? -1 : target_id, group ? target_id : -1, write_history_row, &stream);
+    message_stream_end(&stream);
 }
-void get_group_message(Session* session, Message* msg) {
-    ServerManager *manager = server_manager_get_instance();
-    if (manager == NULL || session == NULL || msg == NULL) return;
-
-    msg->position = 0;
-    int user_id = (int) message_read_int(msg);
-    int group_id = (int) message_read_int(msg);
-
-    Message* response_msg = message_create(GET_GROUPS_MESSAGE);
-    if (response_msg == NULL) {
-        log_message(ERROR, "Failed to create message");
-        return;
-    }
-
-    int count = 0;
-    MessageData* messages = get_chat_messages(user_id, -1, group_id, &count);
-
-    if (messages == NULL || count == 0) {
-        message_write_bool(response_msg, false);
-    } else {
-        message_write_bool(response_msg, true);
-        message_write_int(response_msg, count);
 
-        // Gửi từng tin nhắn
-        for (int i = 0; i < count; i++) {
-            message_write_int(response_msg, messages[i].sender_id);
-            message_write_string(response_msg, messages[i].sender_name);
-            message_write_string(response_msg, messages[i].content);
-            message_write_long(response_msg, messages[i].timestamp);
-        }
+void get_user_message(Session* session, Message* msg) {
+    send_chat_messages(session, msg, GET_USERS_MESSAGE, false);
+}
 
-        free(messages);
-    }
-    session_send_message(session, response_msg);
+void get_group_message(Session* session, Message* msg) {
+    send_chat_messages(session, msg, GET_GROUPS_MESSAGE, true);
 }
 
 void handle_search_user(Session* session, Message* msg) {
@@ -753,5 +907,102 @@ void handle_search_user(Session* session, Message* msg) {
             message_write_string(msg, user[i].username);
         }
     }
+    free_user_rows(user, count);
     session_send_message(session, msg);
-}
\ No newline at end of file
+}
+
+void handle_search_messages(Session* session, Message* msg) {
+    if (session == NULL || msg == NULL) return;
+
+    Message* res = message_create(SEARCH_MESSAGES);
+    if (res == NULL) {
+        log_message(ERROR, "Failed to create message");
+        return;
+    }
+
+    // Phạm vi tìm kiếm là user của phiên, không tin user_id do client gửi
+    if (session->user == NULL || !session->user->isLoaded) {
+        message_write_bool(res, false);
+        message_write_string(res, "You must login first");
+        session_send_message(session, res);
+        return;
+    }
+
+    msg->position = 0;
+    char query[1024] = {0};
+    if (!message_read_string(msg, query, sizeof(query))) {
+        message_write_bool(res, false);
+        message_write_string(res, "Invalid search query");
+        session_send_message(session, res);
+        return;
+    }
+    // limit không bắt buộc, thiếu thì đọc ra 0 và dùng mặc định
+    int limit = (int)message_read_int(msg);
+
+    int user_id = session->user->id;
+    int count = 0;
+    MessageSearchResult* results = search_messages(user_id, query, limit, &count);
+    message_write_bool(res, true);
+    message_write_int(res, count);
+    for (int i = 0; i < count; i++) {
+        // Cùng quy ước với GET_CHAT_HISTORY: id người kia, hoặc -group_id
+        long long conversation_id = results[i].conversation_id;
+        int low = (int)(conversation_id >> 32);
+        int high = (int)(conversation_id & 0xFFFFFFFF);
+        int chat_id = conversation_id < 0 ? (int)conversation_id : (low == user_id ? high : low);
+        message_write_int(res, chat_id);
+        message_write_int(res, results[i].sender_id);
+        message_write_string(res, results[i].sender_name ? results[i].sender_name : "");
+        message_write_long(res, results[i].timestamp);
+        message_write_string(res, results[i].content ? results[i].content : "");
+        free(results[i].sender_name);
+        free(results[i].content);
+    }
+    free(results);
+    session_send_message(session, res);
+}
+
+void handle_subscribe_presence(Session* session, Message* msg) {
+    if (session == NULL || msg == NULL) return;
+
+    Message* res = message_create(SUBSCRIBE_PRESENCE);
+    if (res == NULL) {
+        log_message(ERROR, "Failed to create message");
+        return;
+    }
+
+    if (session->user == NULL || !session->user->isLoaded) {
+        message_write_bool(res, false);
+        message_write_string(res, "You must login first");
+        session_send_message(session, res);
+        return;
+    }
+
+    msg->position = 0;
+    bool subscribe = message_read_bool(msg);
+    if (!subscribe) {
+        presence_unsubscribe(session->user->id);
+        message_write_bool(res, true);
+        message_write_int(res, 0);
+        session_send_message(session, res);
+        return;
+    }
+
+    if (!presence_subscribe(session->user->id)) {
+        message_write_bool(res, false);
+        message_write_string(res, "Failed to subscribe");
+        session_send_message(session, res);
+        return;
+    }
+
+    // Gửi danh sách online hiện tại, sau đó chỉ đẩy các thay đổi
+    int count = 0;
+    int *ids = server_manager_get_online_ids(&count);
+    message_write_bool(res, true);
+    message_write_int(res, count);
+    for (int i = 0; i < count; i++) {
+        message_write_int(res, ids[i]);
+    }
+    free(ids);
+    session_send_message(session, res);
+}
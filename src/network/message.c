@@ -299,7 +299,8 @@ bool message_decrypt(Message *msg, const unsigned char *key, const unsigned char
 
     free(msg->buffer);
     msg->buffer = plaintext;
-    msg->size = msg->position;
+    // Đọc quá phần plaintext trả về 0 thay vì byte padding, trường thêm ở cuối request là tùy chọn
+    msg->size = plaintext_len;
     msg->position = plaintext_len;
 
     return true;
@@ -0,0 +1,121 @@
+#include "message_stream.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include "log.h"
+
+static bool open_frame(MessageStream *stream)
+{
+    stream->frame = message_create(stream->command);
+    if (stream->frame == NULL)
+    {
+        log_message(ERROR, "Failed to create message");
+        stream->failed = true;
+        return false;
+    }
+    // Cờ đầu frame và số dòng được ghi lại khi frame đóng
+    if (stream->chunked || stream->flagged)
+    {
+        message_write_bool(stream->frame, false);
+    }
+    stream->count_position = stream->frame->position;
+    message_write_int(stream->frame, 0);
+    stream->frame_rows = 0;
+    return true;
+}
+
+static void close_frame(MessageStream *stream, bool more)
+{
+    Message *frame = stream->frame;
+    size_t end = frame->position;
+    frame->position = 0;
+    if (stream->chunked)
+    {
+        message_write_bool(frame, more);
+    }
+    else if (stream->flagged)
+    {
+        message_write_bool(frame, stream->rows > 0);
+    }
+    frame->position = stream->count_position;
+    message_write_int(frame, (uint32_t)stream->frame_rows);
+    frame->position = end;
+
+    // Response cũ không có dòng nào chỉ gồm bool false
+    if (!stream->chunked && stream->flagged && stream->rows == 0)
+    {
+        frame->position = stream->count_position;
+    }
+}
+
+// Chờ sender gửi bớt frame đang xếp hàng, false nếu session đã ngắt hoặc chờ quá MESSAGE_STREAM_WAIT_MAX_MS
+static bool wait_for_sender(MessageStream *stream)
+{
+    long waited_us = 0;
+    while (stream->session->connected && session_pending_messages(stream->session) >= MESSAGE_STREAM_MAX_PENDING)
+    {
+        if (waited_us >= MESSAGE_STREAM_WAIT_MAX_MS * 1000L)
+        {
+            // Producer vẫn giữ connection, cursor và pin của archive trong lúc chờ: client không nhận nổi
+            // một frame trong chừng ấy thời gian bị ngắt, response dở dang cũng không thể tiếp tục
+            log_message(WARN, "Client too slow to receive response %d, disconnecting", stream->command);
+            shutdown(stream->session->socket, SHUT_RDWR);
+            return false;
+        }
+        usleep(MESSAGE_STREAM_WAIT_US);
+        waited_us += MESSAGE_STREAM_WAIT_US;
+    }
+    return stream->session->connected;
+}
+
+bool message_stream_begin(MessageStream *stream, Session *session, uint8_t command, bool chunked, bool flagged)
+{
+    stream->session = session;
+    stream->command = command;
+    stream->chunked = chunked;
+    stream->flagged = flagged;
+    stream->frame = NULL;
+    stream->rows = 0;
+    stream->failed = false;
+    return open_frame(stream);
+}
+
+Message *message_stream_row(MessageStream *stream)
+{
+    if (stream->failed || stream->frame == NULL)
+    {
+        return NULL;
+    }
+
+    if (stream->chunked && stream->frame->position >= MESSAGE_STREAM_FRAME_BYTES)
+    {
+        close_frame(stream, true);
+        Message *full = stream->frame;
+        stream->frame = NULL;
+        if (!wait_for_sender(stream))
+        {
+            message_destroy(full);
+            stream->failed = true;
+            return NULL;
+        }
+        session_send_message(stream->session, full);
+        if (!open_frame(stream))
+        {
+            return NULL;
+        }
+    }
+
+    stream->frame_rows++;
+    stream->rows++;
+    return stream->frame;
+}
+
+void message_stream_end(MessageStream *stream)
+{
+    if (stream->frame == NULL)
+    {
+        return;
+    }
+    close_frame(stream, false);
+    session_send_message(stream->session, stream->frame);
+    stream->frame = NULL;
+}
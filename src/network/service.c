@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include "cmd.h"
 #include "message.h"
+#include "epoch.h"
+#include "session_table.h"
 
 
 
@@ -74,26 +76,33 @@ void service_server_message(Session* session, char *content) {
     log_message(LOG_DEBUG, "Server message sent: %s", content);
 }
 void broadcast_message(int user_id[], int num_users, Message *msg) {
+    // Một critical section cho cả vòng fan-out, không lấy lock_user
+    epoch_enter();
     for (int i = 0; i < num_users; i++) {
         User *user = server_manager_find_user_by_id(user_id[i]);
         if (user != NULL && user->session != NULL) {
-            session_send_message(user->session, message_clone(msg));
+            session_table_send(user->session->handle, message_clone(msg));
         }
     }
+    epoch_exit();
 }
 void broadcast_message_except(int user_id[], int num_users, Message *msg, int excep_id){
+    epoch_enter();
     for (int i = 0; i < num_users; i++) {
         User *user = server_manager_find_user_by_id(user_id[i]);
         if (user != NULL && user->id != excep_id && user->session != NULL) {
-            session_send_message(user->session, message_clone(msg));
+            session_table_send(user->session->handle, message_clone(msg));
         }
     }
+    epoch_exit();
 }
 
 
 void direct_message(int user_id, Message* msg) {
+    epoch_enter();
     User *user = server_manager_find_user_by_id(user_id);
-    if (user != NULL && user->session != NULL) {
-        session_send_message(user->session, msg);
-    }
+    SessionHandle handle = user != NULL && user->session != NULL ? user->session->handle : SESSION_HANDLE_INVALID;
+    epoch_exit();
+    // Handle đã cũ thì message bị hủy trong session_table_send
+    session_table_send(handle, msg);
 }
\ No newline at end of file
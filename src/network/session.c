@@ -105,6 +105,7 @@ Session *createSession(int socket, int id) {
 
   session->socket = socket;
   session->id = id;
+  session->handle = SESSION_HANDLE_INVALID;
   session->connected = true;
   session->clientOK = false;
   session->isLogin = false;
@@ -153,6 +154,9 @@ Session *createSession(int socket, int id) {
   session->handler->service = session->service;
   session->user = NULL;
 
+  // Đăng ký trước khi chạy thread để collector luôn có handle hợp lệ
+  session->handle = session_table_register(session);
+
   private->collector->running = true;
   pthread_create(&private->collector->thread, NULL, collector_thread,
                  private->collector);
@@ -228,9 +232,27 @@ void session_send_message(Session *session, Message *message) {
   if (session->connected && private->sender != NULL &&
       private->sender->running) {
     message_queue_add(private->sender->queue, message);
+  } else {
+    message_destroy(message);
   }
 }
 
+int session_pending_messages(Session *session) {
+  if (session == NULL) {
+    return 0;
+  }
+
+  SessionPrivate *private = (SessionPrivate *)session->_private;
+  if (private->sender == NULL || private->sender->queue == NULL) {
+    return 0;
+  }
+  MessageQueue *queue = private->sender->queue;
+  pthread_mutex_lock(&queue->mutex);
+  int size = queue->size;
+  pthread_mutex_unlock(&queue->mutex);
+  return size;
+}
+
 bool session_do_send_message(Session *session, Message *msg) {
   if (session == NULL || msg == NULL) {
     return false;
@@ -242,10 +264,7 @@ bool session_do_send_message(Session *session, Message *msg) {
   return true;
 }
 
-void session_close_message(Session *self) {
-  if (self == NULL) {
-    return;
-  }
+static void close_detached_session(Session *self) {
   SessionPrivate *private = (SessionPrivate *)self->_private;
   if (!private || private->isClosed) {
     return;
@@ -256,10 +275,10 @@ void session_close_message(Session *self) {
   if (self->IPAddress != NULL) {
     log_message(INFO, "Removing IP address %s", self->IPAddress);
     server_manager_remove_ip(self->IPAddress);
-    server_manager_remove_user(self->user);
   } else {
     log_message(ERROR, "Failed to remove IP address");
   }
+  server_manager_remove_user(self->user);
 
   if (self->handler != NULL) {
     self->handler->onDisconnected(self->handler);
@@ -269,9 +288,30 @@ void session_close_message(Session *self) {
 
   if (self->user != NULL) {
     self->user->clean_user(self->user);
+    self->user = NULL;
   }
   session_close(self);
 }
+
+void session_close_message(Session *self) {
+  if (self == NULL) {
+    return;
+  }
+
+  // Chỉ một caller detach thành công, các caller khác (timer, collector) bỏ qua
+  if (self->handle.generation != 0 && session_table_detach(self->handle) == NULL) {
+    return;
+  }
+  close_detached_session(self);
+}
+
+void session_close_handle(SessionHandle handle) {
+  Session *session = session_table_detach(handle);
+  if (session != NULL) {
+    close_detached_session(session);
+  }
+}
+
 void session_close(Session *self) {
   if (self == NULL) {
     return;
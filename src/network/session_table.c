@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include "session_table.h"
+#include "session.h"
+#include "message.h"
+#include "log.h"
+
+typedef struct {
+    // Lẻ = đang dùng, chẵn = trống; tăng mỗi lần register/detach
+    _Atomic uint32_t generation;
+    atomic_int refs;
+    Session *session;
+} SessionSlot;
+
+typedef struct {
+    // Các page không bao giờ bị di chuyển hay giải phóng, slot luôn có địa chỉ cố định
+    _Atomic(SessionSlot *) pages[SESSION_TABLE_MAX_PAGES];
+    uint32_t next_index;
+    uint32_t *free_slots;
+    int free_count;
+    int free_capacity;
+    pthread_mutex_t mutex;
+} SessionTable;
+
+static SessionTable table = {
+    .next_index = 0,
+    .free_slots = NULL,
+    .free_count = 0,
+    .free_capacity = 0,
+    .mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static SessionSlot *slot_at(uint32_t index)
+{
+    if (index / SESSION_TABLE_PAGE_SIZE >= SESSION_TABLE_MAX_PAGES) {
+        return NULL;
+    }
+    SessionSlot *page = atomic_load_explicit(&table.pages[index / SESSION_TABLE_PAGE_SIZE], memory_order_acquire);
+    return page != NULL ? &page[index % SESSION_TABLE_PAGE_SIZE] : NULL;
+}
+
+static bool take_index(uint32_t *index)
+{
+    if (table.free_count > 0) {
+        *index = table.free_slots[--table.free_count];
+        return true;
+    }
+
+    uint32_t page_index = table.next_index / SESSION_TABLE_PAGE_SIZE;
+    if (page_index >= SESSION_TABLE_MAX_PAGES) {
+        return false;
+    }
+
+    if (atomic_load_explicit(&table.pages[page_index], memory_order_relaxed) == NULL) {
+        SessionSlot *page = calloc(SESSION_TABLE_PAGE_SIZE, sizeof(SessionSlot));
+        if (page == NULL) {
+            return false;
+        }
+        for (int i = 0; i < SESSION_TABLE_PAGE_SIZE; i++) {
+            atomic_init(&page[i].generation, 0);
+            atomic_init(&page[i].refs, 0);
+        }
+        atomic_store_explicit(&table.pages[page_index], page, memory_order_release);
+    }
+
+    *index = table.next_index++;
+    return true;
+}
+
+SessionHandle session_table_register(Session *session)
+{
+    if (session == NULL) {
+        return SESSION_HANDLE_INVALID;
+    }
+
+    pthread_mutex_lock(&table.mutex);
+    uint32_t index;
+    if (!take_index(&index)) {
+        pthread_mutex_unlock(&table.mutex);
+        log_message(ERROR, "Session table is full");
+        return SESSION_HANDLE_INVALID;
+    }
+
+    SessionSlot *slot = slot_at(index);
+    slot->session = session;
+    uint32_t generation = atomic_load_explicit(&slot->generation, memory_order_relaxed) + 1;
+    atomic_store_explicit(&slot->generation, generation, memory_order_release);
+    pthread_mutex_unlock(&table.mutex);
+
+    return (SessionHandle){index, generation};
+}
+
+Session *session_table_acquire(SessionHandle handle)
+{
+    SessionSlot *slot = slot_at(handle.index);
+    if (slot == NULL || (handle.generation & 1) == 0) {
+        return NULL;
+    }
+
+    if (atomic_load_explicit(&slot->generation, memory_order_acquire) != handle.generation) {
+        return NULL;
+    }
+
+    atomic_fetch_add(&slot->refs, 1);
+    // Kiểm tra lại sau khi tăng refs: detach có thể đã chạy xen vào giữa
+    if (atomic_load(&slot->generation) != handle.generation) {
+        atomic_fetch_sub(&slot->refs, 1);
+        return NULL;
+    }
+    return slot->session;
+}
+
+void session_table_release(SessionHandle handle)
+{
+    SessionSlot *slot = slot_at(handle.index);
+    if (slot != NULL) {
+        atomic_fetch_sub_explicit(&slot->refs, 1, memory_order_release);
+    }
+}
+
+Session *session_table_detach(SessionHandle handle)
+{
+    SessionSlot *slot = slot_at(handle.index);
+    if (slot == NULL || (handle.generation & 1) == 0) {
+        return NULL;
+    }
+
+    uint32_t expected = handle.generation;
+    if (!atomic_compare_exchange_strong(&slot->generation, &expected, handle.generation + 1)) {
+        return NULL;
+    }
+
+    while (atomic_load(&slot->refs) > 0) {
+        sched_yield();
+    }
+
+    Session *session = slot->session;
+
+    pthread_mutex_lock(&table.mutex);
+    slot->session = NULL;
+    if (table.free_count >= table.free_capacity) {
+        int new_capacity = table.free_capacity > 0 ? table.free_capacity * 2 : 64;
+        uint32_t *free_slots = realloc(table.free_slots, sizeof(uint32_t) * new_capacity);
+        if (free_slots != NULL) {
+            table.free_slots = free_slots;
+            table.free_capacity = new_capacity;
+        }
+    }
+    if (table.free_count < table.free_capacity) {
+        table.free_slots[table.free_count++] = handle.index;
+    } else {
+        log_message(WARN, "Dropping session slot %u, free list is full", handle.index);
+    }
+    pthread_mutex_unlock(&table.mutex);
+
+    return session;
+}
+
+bool session_handle_is_valid(SessionHandle handle)
+{
+    SessionSlot *slot = slot_at(handle.index);
+    return slot != NULL && (handle.generation & 1) != 0 &&
+           atomic_load_explicit(&slot->generation, memory_order_acquire) == handle.generation;
+}
+
+bool session_table_send(SessionHandle handle, Message *msg)
+{
+    if (msg == NULL) {
+        return false;
+    }
+
+    Session *session = session_table_acquire(handle);
+    if (session == NULL) {
+        message_destroy(msg);
+        return false;
+    }
+
+    session_send_message(session, msg);
+    session_table_release(handle);
+    return true;
+}
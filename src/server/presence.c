@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "presence.h"
+#include "service.h"
+#include "message.h"
+#include "config.h"
+#include "cmd.h"
+#include "log.h"
+
+typedef struct
+{
+    int user_id;
+    bool online;
+    // Trạng thái subscriber đã thấy trước tick này
+    bool published;
+} PresenceChange;
+
+typedef struct
+{
+    int *subscribers;
+    int subscriber_count;
+    int subscriber_capacity;
+
+    PresenceChange *pending;
+    int pending_count;
+    int pending_capacity;
+
+    pthread_mutex_t mutex;
+    pthread_t thread;
+    // Ghi ở presence_start/stop, đọc ở thread ticker
+    atomic_bool running;
+    int tick_ms;
+} Presence;
+
+static Presence presence = {
+    .subscribers = NULL,
+    .subscriber_count = 0,
+    .subscriber_capacity = 0,
+    .pending = NULL,
+    .pending_count = 0,
+    .pending_capacity = 0,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .running = false,
+    .tick_ms = PRESENCE_DEFAULT_TICK_MS};
+
+static bool grow_array(void **array, int *capacity, size_t element_size)
+{
+    int new_capacity = *capacity > 0 ? *capacity * 2 : 16;
+    void *new_array = realloc(*array, element_size * new_capacity);
+    if (new_array == NULL)
+    {
+        return false;
+    }
+    *array = new_array;
+    *capacity = new_capacity;
+    return true;
+}
+
+void presence_notify(int user_id, bool online)
+{
+    pthread_mutex_lock(&presence.mutex);
+
+    for (int i = 0; i < presence.pending_count; i++)
+    {
+        if (presence.pending[i].user_id == user_id)
+        {
+            presence.pending[i].online = online;
+            pthread_mutex_unlock(&presence.mutex);
+            return;
+        }
+    }
+
+    if (presence.pending_count >= presence.pending_capacity &&
+        !grow_array((void **)&presence.pending, &presence.pending_capacity, sizeof(PresenceChange)))
+    {
+        log_message(ERROR, "Failed to queue presence change for user %d", user_id);
+        pthread_mutex_unlock(&presence.mutex);
+        return;
+    }
+
+    PresenceChange *change = &presence.pending[presence.pending_count++];
+    change->user_id = user_id;
+    change->online = online;
+    change->published = !online;
+
+    pthread_mutex_unlock(&presence.mutex);
+}
+
+bool presence_subscribe(int user_id)
+{
+    pthread_mutex_lock(&presence.mutex);
+
+    for (int i = 0; i < presence.subscriber_count; i++)
+    {
+        if (presence.subscribers[i] == user_id)
+        {
+            pthread_mutex_unlock(&presence.mutex);
+            return true;
+        }
+    }
+
+    if (presence.subscriber_count >= presence.subscriber_capacity &&
+        !grow_array((void **)&presence.subscribers, &presence.subscriber_capacity, sizeof(int)))
+    {
+        log_message(ERROR, "Failed to add presence subscriber %d", user_id);
+        pthread_mutex_unlock(&presence.mutex);
+        return false;
+    }
+
+    presence.subscribers[presence.subscriber_count++] = user_id;
+    pthread_mutex_unlock(&presence.mutex);
+    return true;
+}
+
+void presence_unsubscribe(int user_id)
+{
+    pthread_mutex_lock(&presence.mutex);
+    for (int i = 0; i < presence.subscriber_count; i++)
+    {
+        if (presence.subscribers[i] == user_id)
+        {
+            presence.subscribers[i] = presence.subscribers[--presence.subscriber_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&presence.mutex);
+}
+
+static void presence_flush()
+{
+    pthread_mutex_lock(&presence.mutex);
+
+    if (presence.pending_count == 0)
+    {
+        pthread_mutex_unlock(&presence.mutex);
+        return;
+    }
+
+    PresenceChange *changes = presence.pending;
+    int change_count = presence.pending_count;
+    presence.pending = NULL;
+    presence.pending_count = 0;
+    presence.pending_capacity = 0;
+
+    int subscriber_count = presence.subscriber_count;
+    int *subscribers = NULL;
+    if (subscriber_count > 0)
+    {
+        subscribers = malloc(sizeof(int) * subscriber_count);
+        if (subscribers != NULL)
+        {
+            memcpy(subscribers, presence.subscribers, sizeof(int) * subscriber_count);
+        }
+    }
+
+    pthread_mutex_unlock(&presence.mutex);
+
+    int event_count = 0;
+    for (int i = 0; i < change_count; i++)
+    {
+        if (changes[i].online != changes[i].published)
+        {
+            event_count++;
+        }
+    }
+
+    if (event_count > 0 && subscribers != NULL)
+    {
+        Message *msg = message_create(PRESENCE_UPDATE);
+        if (msg != NULL)
+        {
+            message_write_int(msg, event_count);
+            for (int i = 0; i < change_count; i++)
+            {
+                if (changes[i].online != changes[i].published)
+                {
+                    message_write_int(msg, changes[i].user_id);
+                    message_write_bool(msg, changes[i].online);
+                }
+            }
+            broadcast_message(subscribers, subscriber_count, msg);
+            message_destroy(msg);
+            log_message(LOG_DEBUG, "Pushed %d presence events to %d subscribers", event_count, subscriber_count);
+        }
+    }
+
+    free(subscribers);
+    free(changes);
+}
+
+static void *presence_thread(void *arg)
+{
+    (void)arg;
+    while (atomic_load(&presence.running))
+    {
+        usleep(presence.tick_ms * 1000);
+        presence_flush();
+    }
+    return NULL;
+}
+
+bool presence_start()
+{
+    if (atomic_load(&presence.running))
+    {
+        return true;
+    }
+
+    int tick_ms = config_get_presence_tick_ms();
+    presence.tick_ms = tick_ms > 0 ? tick_ms : PRESENCE_DEFAULT_TICK_MS;
+    atomic_store(&presence.running, true);
+
+    if (pthread_create(&presence.thread, NULL, presence_thread, NULL) != 0)
+    {
+        log_message(ERROR, "Failed to create presence thread");
+        atomic_store(&presence.running, false);
+        return false;
+    }
+
+    log_message(INFO, "Presence ticker started (tick=%dms)", presence.tick_ms);
+    return true;
+}
+
+void presence_stop()
+{
+    if (!atomic_exchange(&presence.running, false))
+    {
+        return;
+    }
+
+    pthread_join(presence.thread, NULL);
+
+    pthread_mutex_lock(&presence.mutex);
+    free(presence.subscribers);
+    presence.subscribers = NULL;
+    presence.subscriber_count = 0;
+    presence.subscriber_capacity = 0;
+    free(presence.pending);
+    presence.pending = NULL;
+    presence.pending_count = 0;
+    presence.pending_capacity = 0;
+    pthread_mutex_unlock(&presence.mutex);
+}
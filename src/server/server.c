@@ -13,6 +13,8 @@
 #include "config.h"
 #include "log.h"
 #include "server_manager.h"
+#include "presence.h"
+#include "epoch.h"
 
 static Server server = {
     .server_socket = -1,
@@ -27,7 +29,7 @@ bool server_init()
 {
     server.is_running = false;
     init_server_manager();
-    return true;
+    return presence_start();
 }
 
 void server_start()
@@ -127,30 +129,38 @@ void server_start()
         server_manager_add_ip(client_ip);
     }
 }
-/*
-void server_stop() {
-    if (!server.is_running) {
+void server_stop()
+{
+    if (!server.is_running)
+    {
         return;
     }
 
     server.is_running = false;
+    // Dừng ticker trước khi các session đóng và storage bị tắt
+    presence_stop();
 
-
-    ServerManager* manager = server_manager_get_instance();
-    User** users = server_manager_get_users(manager);
-    size_t user_count = server_manager_get_user_count(manager);
-
-    for (size_t i = 0; i < user_count; i++) {
-        if (!users[i]->is_cleaned) {
-            session_close(users[i]->session);
-        }
-    }
-
-
-    if (server.server_socket != -1) {
+    if (server.server_socket != -1)
+    {
+        shutdown(server.server_socket, SHUT_RDWR);
         close(server.server_socket);
         server.server_socket = -1;
     }
 
+    // Thread của mỗi session thấy socket đóng và tự dọn theo đường disconnect
+    int count = 0;
+    int *ids = server_manager_get_online_ids(&count);
+    for (int i = 0; ids != NULL && i < count; i++)
+    {
+        epoch_enter();
+        User *user = server_manager_find_user_by_id(ids[i]);
+        if (user != NULL && user->session != NULL && user->session->socket != -1)
+        {
+            shutdown(user->session->socket, SHUT_RDWR);
+        }
+        epoch_exit();
+    }
+    free(ids);
+
     log_message(INFO, "End socket");
-} */
\ No newline at end of file
+}
@@ -12,11 +12,12 @@
 #include <stdbool.h>
 #include "user.h"
 #include "server_manager.h"
+#include "presence.h"
+#include "epoch.h"
 #include "log.h"
 
 static ServerManager server_manager = {
     .initialized = false,
-    .user_count = 0,
     .ip_count = 0};
 
 static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -44,13 +45,17 @@ void init_server_manager()
 
     log_message(INFO, "Initializing server manager");
 
-    for (int i = 0; i < MAX_USERS; i++)
+    for (int i = 0; i < MAX_IPS; i++)
     {
-        server_manager.users[i] = NULL;
         server_manager.ips[i] = NULL;
     }
 
-    server_manager.user_count = 0;
+    if (!user_registry_init(&server_manager.users, USER_REGISTRY_INITIAL_CAPACITY))
+    {
+        log_message(FATAL, "Failed to initialize online user registry");
+        return;
+    }
+
     server_manager.ip_count = 0;
 
     pthread_rwlock_init(&server_manager.lock_user, NULL);
@@ -61,22 +66,24 @@ void init_server_manager()
     log_message(INFO, "Server manager initialized");
 }
 
-void server_manager_get_users(User *buffer[], int *count)
+int *server_manager_get_online_ids(int *count)
 {
     ServerManager *manager = server_manager_get_instance();
-    pthread_rwlock_rdlock(&manager->lock_user);
-    *count = manager->user_count;
-    memcpy(buffer, manager->users, sizeof(User *) * manager->user_count);
-    pthread_rwlock_unlock(&manager->lock_user);
+    *count = 0;
+    // Không cần lock: snapshot đọc bảng trong epoch, có thể lệch vài user so với thời điểm gọi
+    size_t online = user_registry_count(&manager->users);
+    int *buffer = malloc(sizeof(int) * (online > 0 ? online : 1));
+    if (buffer != NULL)
+    {
+        *count = (int)user_registry_snapshot_ids(&manager->users, buffer, online);
+    }
+    return buffer;
 }
 
 int server_manager_get_number_online()
 {
     ServerManager *manager = server_manager_get_instance();
-    pthread_rwlock_rdlock(&manager->lock_user);
-    int count = manager->user_count;
-    pthread_rwlock_unlock(&manager->lock_user);
-    return count;
+    return (int)user_registry_count(&manager->users);
 }
 
 int server_manager_frequency(const char *ip)
@@ -98,39 +105,14 @@ int server_manager_frequency(const char *ip)
 User *server_manager_find_user_by_id(int id)
 {
     ServerManager *manager = server_manager_get_instance();
-    pthread_rwlock_rdlock(&manager->lock_user);
-    for (int i = 0; i < manager->user_count; i++)
-    {
-        if (manager->users[i]->id == id)
-        {
-            pthread_rwlock_unlock(&manager->lock_user);
-            return manager->users[i];
-        }
-    }
-    pthread_rwlock_unlock(&manager->lock_user);
-    return NULL;
+    return user_registry_find_by_id(&manager->users, id);
 }
 
+// skipLock giữ lại cho tương thích: đường đọc không còn lấy lock_user
 User *server_manager_find_user_by_username_internal(const char *username, bool skipLock) {
+    (void)skipLock;
     ServerManager *manager = server_manager_get_instance();
-    
-    if (!skipLock) {
-        pthread_rwlock_rdlock(&manager->lock_user);
-    }
-    
-    User *found = NULL;
-    for (int i = 0; i < manager->user_count; i++) {
-        if (strcmp(manager->users[i]->username, username) == 0) {
-            found = manager->users[i];
-            break;
-        }
-    }
-    
-    if (!skipLock) {
-        pthread_rwlock_unlock(&manager->lock_user);
-    }
-    
-    return found;
+    return user_registry_find_by_username(&manager->users, username);
 }
 
 User *server_manager_find_user_by_username(const char *username) {
@@ -144,8 +126,10 @@ void server_manager_add_user_internal(User *user, bool skipLock) {
         pthread_rwlock_wrlock(&manager->lock_user);
     }
     
-    if (manager->user_count < MAX_USERS) {
-        manager->users[manager->user_count++] = user;
+    if (user_registry_insert(&manager->users, user)) {
+        presence_notify(user->id, true);
+    } else {
+        log_message(ERROR, "Failed to register online user %d", user->id);
     }
     
     if (!skipLock) {
@@ -166,22 +150,27 @@ void server_manager_remove_user(User *user)
 
     ServerManager *manager = server_manager_get_instance();
     pthread_rwlock_wrlock(&manager->lock_user);
-    for (int i = 0; i < manager->user_count; i++)
+    bool removed = user_registry_remove(&manager->users, user->id) != NULL;
+    pthread_rwlock_unlock(&manager->lock_user);
+
+    // Chờ các reader đang giữ con trỏ rời epoch để caller có thể free user
+    if (removed)
     {
-        if (manager->users[i] != NULL && manager->users[i]->id == user->id)
-        {
-            manager->users[i] = manager->users[--manager->user_count];
-            break;
-        }
+        epoch_synchronize();
+    }
+
+    if (removed)
+    {
+        presence_unsubscribe(user->id);
+        presence_notify(user->id, false);
     }
-    pthread_rwlock_unlock(&manager->lock_user);
 }
 
 void server_manager_add_ip(const char *ip)
 {
     ServerManager *manager = server_manager_get_instance();
     pthread_rwlock_wrlock(&manager->lock_session);
-    if (manager->ip_count < MAX_USERS)
+    if (manager->ip_count < MAX_IPS)
     {
         manager->ips[manager->ip_count++] = strdup(ip);
     }
@@ -216,12 +205,10 @@ void destroy_server_manager()
         return;
     }
 
-    for (int i = 0; i < MAX_USERS; i++)
+    user_registry_destroy(&server_manager.users);
+
+    for (int i = 0; i < MAX_IPS; i++)
     {
-        if (server_manager.users[i] != NULL)
-        {
-            server_manager.users[i] = NULL;
-        }
         if (server_manager.ips[i] != NULL)
         {
             free(server_manager.ips[i]);
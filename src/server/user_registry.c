@@ -0,0 +1,358 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "user_registry.h"
+#include "epoch.h"
+#include "log.h"
+
+// Slot đã xóa, giữ lại để chuỗi probe không bị đứt
+#define TOMBSTONE ((User *)(uintptr_t)1)
+
+static inline bool slot_used(const User *slot)
+{
+    return slot != NULL && slot != TOMBSTONE;
+}
+
+static inline User *slot_load(_Atomic(User *) *slot)
+{
+    return atomic_load_explicit(slot, memory_order_acquire);
+}
+
+static inline void slot_store(_Atomic(User *) *slot, User *value)
+{
+    atomic_store_explicit(slot, value, memory_order_release);
+}
+
+static inline size_t hash_id(int id, size_t mask)
+{
+    uint32_t h = (uint32_t)id * 2654435769u;
+    return (size_t)(h ^ (h >> 16)) & mask;
+}
+
+static inline size_t hash_name(const char *name, size_t mask)
+{
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++)
+    {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return (size_t)h & mask;
+}
+
+static size_t round_capacity(size_t wanted)
+{
+    size_t capacity = 16;
+    while (capacity < wanted)
+    {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+static size_t probe_id(_Atomic(User *) *slots, size_t capacity, int id, bool for_insert)
+{
+    size_t mask = capacity - 1;
+    size_t index = hash_id(id, mask);
+    size_t first_free = SIZE_MAX;
+
+    for (size_t i = 0; i < capacity; i++)
+    {
+        User *slot = slot_load(&slots[index]);
+        if (slot == NULL)
+        {
+            return (for_insert && first_free != SIZE_MAX) ? first_free : index;
+        }
+        if (slot == TOMBSTONE)
+        {
+            if (first_free == SIZE_MAX)
+                first_free = index;
+        }
+        else if (slot->id == id)
+        {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+    return first_free;
+}
+
+static size_t probe_name(_Atomic(User *) *slots, size_t capacity, const char *username, bool for_insert)
+{
+    size_t mask = capacity - 1;
+    size_t index = hash_name(username, mask);
+    size_t first_free = SIZE_MAX;
+
+    for (size_t i = 0; i < capacity; i++)
+    {
+        User *slot = slot_load(&slots[index]);
+        if (slot == NULL)
+        {
+            return (for_insert && first_free != SIZE_MAX) ? first_free : index;
+        }
+        if (slot == TOMBSTONE)
+        {
+            if (first_free == SIZE_MAX)
+                first_free = index;
+        }
+        else if (slot->username != NULL && strcmp(slot->username, username) == 0)
+        {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+    return first_free;
+}
+
+static UserRegistryTable *table_create(size_t capacity)
+{
+    // Một lần cấp phát cho header và cả hai mảng slot
+    UserRegistryTable *table = calloc(1, sizeof(UserRegistryTable) + 2 * capacity * sizeof(_Atomic(User *)));
+    if (table == NULL)
+    {
+        return NULL;
+    }
+    table->capacity = capacity;
+    table->by_id = (_Atomic(User *) *)(table + 1);
+    table->by_name = table->by_id + capacity;
+    for (size_t i = 0; i < capacity; i++)
+    {
+        atomic_init(&table->by_id[i], NULL);
+        atomic_init(&table->by_name[i], NULL);
+    }
+    return table;
+}
+
+static inline UserRegistryTable *table_load(UserRegistry *registry)
+{
+    return atomic_load_explicit(&registry->table, memory_order_acquire);
+}
+
+bool user_registry_init(UserRegistry *registry, size_t initial_capacity)
+{
+    if (registry == NULL)
+    {
+        return false;
+    }
+
+    UserRegistryTable *table = table_create(round_capacity(initial_capacity));
+    if (table == NULL)
+    {
+        log_message(ERROR, "Failed to allocate user registry");
+        return false;
+    }
+
+    atomic_init(&registry->table, table);
+    atomic_init(&registry->count, 0);
+    registry->tombstones = 0;
+    return true;
+}
+
+void user_registry_destroy(UserRegistry *registry)
+{
+    if (registry == NULL)
+    {
+        return;
+    }
+    UserRegistryTable *table = atomic_exchange(&registry->table, NULL);
+    epoch_synchronize();
+    free(table);
+    atomic_store(&registry->count, 0);
+    registry->tombstones = 0;
+}
+
+static bool rehash(UserRegistry *registry, size_t new_capacity)
+{
+    UserRegistryTable *old_table = table_load(registry);
+    UserRegistryTable *new_table = table_create(new_capacity);
+    if (new_table == NULL)
+    {
+        log_message(ERROR, "Failed to grow user registry to %zu slots", new_capacity);
+        return false;
+    }
+
+    for (size_t i = 0; i < old_table->capacity; i++)
+    {
+        User *user = slot_load(&old_table->by_id[i]);
+        if (!slot_used(user))
+            continue;
+        atomic_init(&new_table->by_id[probe_id(new_table->by_id, new_capacity, user->id, true)], user);
+        if (user->username != NULL)
+        {
+            atomic_init(&new_table->by_name[probe_name(new_table->by_name, new_capacity, user->username, true)], user);
+        }
+    }
+
+    // Công bố bảng mới, reader cũ có thể vẫn đang probe bảng cũ
+    atomic_store_explicit(&registry->table, new_table, memory_order_release);
+    registry->tombstones = 0;
+
+    epoch_synchronize();
+    free(old_table);
+    return true;
+}
+
+bool user_registry_insert(UserRegistry *registry, User *user)
+{
+    if (registry == NULL || user == NULL || table_load(registry) == NULL)
+    {
+        return false;
+    }
+
+    size_t count = atomic_load_explicit(&registry->count, memory_order_relaxed);
+    UserRegistryTable *table = table_load(registry);
+
+    // Giữ load factor (kể cả tombstone) dưới 0.7
+    if ((count + registry->tombstones + 1) * 10 > table->capacity * 7)
+    {
+        size_t wanted = (count + 1) * 2;
+        size_t new_capacity = round_capacity(wanted > table->capacity ? wanted : table->capacity);
+        if (!rehash(registry, new_capacity))
+        {
+            return false;
+        }
+        table = table_load(registry);
+    }
+
+    size_t id_index = probe_id(table->by_id, table->capacity, user->id, true);
+    User *previous = slot_load(&table->by_id[id_index]);
+    if (slot_used(previous))
+    {
+        // Cùng id đã tồn tại: thay thế cả bản ghi theo username cũ
+        if (previous->username != NULL)
+        {
+            size_t old_name = probe_name(table->by_name, table->capacity, previous->username, false);
+            if (old_name != SIZE_MAX && slot_load(&table->by_name[old_name]) == previous)
+            {
+                slot_store(&table->by_name[old_name], TOMBSTONE);
+                registry->tombstones++;
+            }
+        }
+        count--;
+    }
+    else if (previous == TOMBSTONE)
+    {
+        registry->tombstones--;
+    }
+
+    if (user->username != NULL)
+    {
+        size_t name_index = probe_name(table->by_name, table->capacity, user->username, true);
+        if (slot_load(&table->by_name[name_index]) == TOMBSTONE)
+        {
+            registry->tombstones--;
+        }
+        slot_store(&table->by_name[name_index], user);
+    }
+    slot_store(&table->by_id[id_index], user);
+    atomic_store_explicit(&registry->count, count + 1, memory_order_relaxed);
+    return true;
+}
+
+User *user_registry_remove(UserRegistry *registry, int id)
+{
+    UserRegistryTable *table = registry != NULL ? table_load(registry) : NULL;
+    if (table == NULL)
+    {
+        return NULL;
+    }
+
+    size_t id_index = probe_id(table->by_id, table->capacity, id, false);
+    if (id_index == SIZE_MAX)
+    {
+        return NULL;
+    }
+
+    User *user = slot_load(&table->by_id[id_index]);
+    if (!slot_used(user))
+    {
+        return NULL;
+    }
+
+    slot_store(&table->by_id[id_index], TOMBSTONE);
+    registry->tombstones++;
+
+    if (user->username != NULL)
+    {
+        size_t name_index = probe_name(table->by_name, table->capacity, user->username, false);
+        if (name_index != SIZE_MAX && slot_load(&table->by_name[name_index]) == user)
+        {
+            slot_store(&table->by_name[name_index], TOMBSTONE);
+            registry->tombstones++;
+        }
+    }
+
+    atomic_fetch_sub_explicit(&registry->count, 1, memory_order_relaxed);
+    return user;
+}
+
+User *user_registry_find_by_id(UserRegistry *registry, int id)
+{
+    if (registry == NULL)
+    {
+        return NULL;
+    }
+
+    User *user = NULL;
+    epoch_enter();
+    UserRegistryTable *table = table_load(registry);
+    if (table != NULL)
+    {
+        size_t index = probe_id(table->by_id, table->capacity, id, false);
+        if (index != SIZE_MAX)
+        {
+            user = slot_load(&table->by_id[index]);
+        }
+    }
+    epoch_exit();
+    return slot_used(user) ? user : NULL;
+}
+
+User *user_registry_find_by_username(UserRegistry *registry, const char *username)
+{
+    if (registry == NULL || username == NULL)
+    {
+        return NULL;
+    }
+
+    User *user = NULL;
+    epoch_enter();
+    UserRegistryTable *table = table_load(registry);
+    if (table != NULL)
+    {
+        size_t index = probe_name(table->by_name, table->capacity, username, false);
+        if (index != SIZE_MAX)
+        {
+            user = slot_load(&table->by_name[index]);
+        }
+    }
+    epoch_exit();
+    return slot_used(user) ? user : NULL;
+}
+
+size_t user_registry_count(UserRegistry *registry)
+{
+    return registry != NULL ? atomic_load_explicit(&registry->count, memory_order_relaxed) : 0;
+}
+
+size_t user_registry_snapshot_ids(UserRegistry *registry, int *buffer, size_t max_count)
+{
+    if (registry == NULL || buffer == NULL)
+    {
+        return 0;
+    }
+
+    size_t copied = 0;
+    epoch_enter();
+    UserRegistryTable *table = table_load(registry);
+    for (size_t i = 0; table != NULL && i < table->capacity && copied < max_count; i++)
+    {
+        User *user = slot_load(&table->by_id[i]);
+        if (slot_used(user))
+        {
+            buffer[copied++] = user->id;
+        }
+    }
+    epoch_exit();
+    return copied;
+}
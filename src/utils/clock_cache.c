@@ -0,0 +1,257 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "clock_cache.h"
+
+typedef struct
+{
+    int key;
+    bool used;
+    bool referenced;
+} ClockSlot;
+
+struct ClockCache
+{
+    int capacity;
+    size_t value_size;
+    ClockSlot *slots;
+    unsigned char *values;
+
+    // Bảng băm linear probing: số thứ tự slot + 1, 0 là ô trống
+    int *index;
+    uint32_t index_mask;
+
+    int size;
+    int hand;
+    long long hits;
+    long long misses;
+    long long evictions;
+    // Số lần remove, dùng làm version cho clock_cache_put_if
+    unsigned long long removals;
+    pthread_mutex_t mutex;
+};
+
+static uint32_t hash_key(int key)
+{
+    return (uint32_t)key * 2654435761u;
+}
+
+// Vị trí của key trong index, -1 nếu không có
+static int find_pos(ClockCache *cache, int key)
+{
+    uint32_t pos = hash_key(key) & cache->index_mask;
+    while (cache->index[pos] != 0)
+    {
+        if (cache->slots[cache->index[pos] - 1].key == key)
+        {
+            return (int)pos;
+        }
+        pos = (pos + 1) & cache->index_mask;
+    }
+    return -1;
+}
+
+static void index_insert(ClockCache *cache, int key, int slot)
+{
+    uint32_t pos = hash_key(key) & cache->index_mask;
+    while (cache->index[pos] != 0)
+    {
+        pos = (pos + 1) & cache->index_mask;
+    }
+    cache->index[pos] = slot + 1;
+}
+
+// Xóa bằng cách dời lùi các phần tử phía sau, không cần tombstone
+static void index_remove(ClockCache *cache, uint32_t pos)
+{
+    uint32_t mask = cache->index_mask;
+    uint32_t hole = pos;
+    uint32_t next = pos;
+    cache->index[hole] = 0;
+    while (true)
+    {
+        next = (next + 1) & mask;
+        if (cache->index[next] == 0)
+        {
+            return;
+        }
+        uint32_t home = hash_key(cache->slots[cache->index[next] - 1].key) & mask;
+        // Phần tử ở next chỉ được dời về hole nếu home của nó không nằm trong (hole, next]
+        bool movable = hole <= next ? (home <= hole || home > next) : (home <= hole && home > next);
+        if (movable)
+        {
+            cache->index[hole] = cache->index[next];
+            cache->index[next] = 0;
+            hole = next;
+        }
+    }
+}
+
+// Tìm slot cho entry mới: slot trống hoặc slot đầu tiên kim đồng hồ gặp mà chưa được dùng lại
+static int claim_slot(ClockCache *cache)
+{
+    while (true)
+    {
+        int slot = cache->hand;
+        ClockSlot *entry = &cache->slots[slot];
+        cache->hand = (cache->hand + 1) % cache->capacity;
+
+        if (!entry->used)
+        {
+            return slot;
+        }
+        if (entry->referenced)
+        {
+            entry->referenced = false;
+            continue;
+        }
+        index_remove(cache, (uint32_t)find_pos(cache, entry->key));
+        entry->used = false;
+        cache->size--;
+        cache->evictions++;
+        return slot;
+    }
+}
+
+ClockCache *clock_cache_create(int capacity, size_t value_size)
+{
+    if (capacity <= 0 || value_size == 0)
+    {
+        return NULL;
+    }
+
+    ClockCache *cache = calloc(1, sizeof(ClockCache));
+    if (!cache)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&cache->mutex, NULL);
+
+    // Giữ load factor của index dưới 0.5
+    uint32_t index_size = 16;
+    while (index_size < (uint32_t)capacity * 2)
+    {
+        index_size <<= 1;
+    }
+
+    cache->capacity = capacity;
+    cache->value_size = value_size;
+    cache->slots = calloc(capacity, sizeof(ClockSlot));
+    cache->values = calloc(capacity, value_size);
+    cache->index = calloc(index_size, sizeof(int));
+    cache->index_mask = index_size - 1;
+    if (!cache->slots || !cache->values || !cache->index)
+    {
+        clock_cache_destroy(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void clock_cache_destroy(ClockCache *cache)
+{
+    if (!cache)
+    {
+        return;
+    }
+    free(cache->slots);
+    free(cache->values);
+    free(cache->index);
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache);
+}
+
+bool clock_cache_get(ClockCache *cache, int key, void *out)
+{
+    pthread_mutex_lock(&cache->mutex);
+    int pos = find_pos(cache, key);
+    if (pos < 0)
+    {
+        cache->misses++;
+        pthread_mutex_unlock(&cache->mutex);
+        return false;
+    }
+    int slot = cache->index[pos] - 1;
+    cache->slots[slot].referenced = true;
+    memcpy(out, cache->values + (size_t)slot * cache->value_size, cache->value_size);
+    cache->hits++;
+    pthread_mutex_unlock(&cache->mutex);
+    return true;
+}
+
+// Gọi khi đang giữ mutex
+static void put_locked(ClockCache *cache, int key, const void *value)
+{
+    int slot;
+    int pos = find_pos(cache, key);
+    if (pos >= 0)
+    {
+        slot = cache->index[pos] - 1;
+    }
+    else
+    {
+        slot = claim_slot(cache);
+        cache->slots[slot].key = key;
+        cache->slots[slot].used = true;
+        // Entry mới chưa có bit tham chiếu, chỉ sống qua vòng kế nếu được đọc lại
+        cache->slots[slot].referenced = false;
+        index_insert(cache, key, slot);
+        cache->size++;
+    }
+    memcpy(cache->values + (size_t)slot * cache->value_size, value, cache->value_size);
+}
+
+void clock_cache_put(ClockCache *cache, int key, const void *value)
+{
+    pthread_mutex_lock(&cache->mutex);
+    put_locked(cache, key, value);
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+bool clock_cache_put_if(ClockCache *cache, int key, const void *value, unsigned long long version)
+{
+    pthread_mutex_lock(&cache->mutex);
+    bool current = cache->removals == version;
+    if (current)
+    {
+        put_locked(cache, key, value);
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    return current;
+}
+
+unsigned long long clock_cache_version(ClockCache *cache)
+{
+    pthread_mutex_lock(&cache->mutex);
+    unsigned long long version = cache->removals;
+    pthread_mutex_unlock(&cache->mutex);
+    return version;
+}
+
+void clock_cache_remove(ClockCache *cache, int key)
+{
+    pthread_mutex_lock(&cache->mutex);
+    cache->removals++;
+    int pos = find_pos(cache, key);
+    if (pos >= 0)
+    {
+        cache->slots[cache->index[pos] - 1].used = false;
+        index_remove(cache, (uint32_t)pos);
+        cache->size--;
+    }
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+ClockCacheStats clock_cache_get_stats(ClockCache *cache)
+{
+    ClockCacheStats stats;
+    pthread_mutex_lock(&cache->mutex);
+    stats.hits = cache->hits;
+    stats.misses = cache->misses;
+    stats.evictions = cache->evictions;
+    stats.size = cache->size;
+    stats.capacity = cache->capacity;
+    pthread_mutex_unlock(&cache->mutex);
+    return stats;
+}
@@ -96,6 +96,134 @@ bool config_load()
         {
             config->db_name = strdup(v);
         }
+        else if (strcmp(k, "presence.tick_ms") == 0)
+        {
+            config->presence_tick_ms = atoi(v);
+        }
+        else if (strcmp(k, "db.pool.min") == 0)
+        {
+            config->db_pool_min = atoi(v);
+        }
+        else if (strcmp(k, "db.pool.max") == 0)
+        {
+            config->db_pool_max = atoi(v);
+        }
+        else if (strcmp(k, "db.pool.wait_ms") == 0)
+        {
+            config->db_pool_wait_ms = atoi(v);
+        }
+        else if (strcmp(k, "db.pool.idle_check_ms") == 0)
+        {
+            config->db_pool_idle_check_ms = atoi(v);
+        }
+        else if (strcmp(k, "persist.flush_ms") == 0)
+        {
+            config->persist_flush_ms = atoi(v);
+        }
+        else if (strcmp(k, "persist.batch_size") == 0)
+        {
+            config->persist_batch_size = atoi(v);
+        }
+        else if (strcmp(k, "persist.max_pending") == 0)
+        {
+            config->persist_max_pending = atoi(v);
+        }
+        else if (strcmp(k, "wal.path") == 0)
+        {
+            config->wal_path = strdup(v);
+        }
+        else if (strcmp(k, "db.executor.threads") == 0)
+        {
+            config->db_executor_threads = atoi(v);
+        }
+        else if (strcmp(k, "db.executor.queue_max") == 0)
+        {
+            config->db_executor_queue_max = atoi(v);
+        }
+        else if (strcmp(k, "db.async.connections") == 0)
+        {
+            config->db_async_connections = atoi(v);
+        }
+        else if (strcmp(k, "user_cache.capacity") == 0)
+        {
+            config->user_cache_capacity = atoi(v);
+        }
+        else if (strcmp(k, "group_cache.capacity") == 0)
+        {
+            config->group_cache_capacity = atoi(v);
+        }
+        else if (strcmp(k, "migrate.batch_size") == 0)
+        {
+            config->migrate_batch_size = atoi(v);
+        }
+        else if (strcmp(k, "migrate.pause_ms") == 0)
+        {
+            config->migrate_pause_ms = atoi(v);
+        }
+        else if (strcmp(k, "index.path") == 0)
+        {
+            config->index_path = strdup(v);
+        }
+        else if (strcmp(k, "index.segment_docs") == 0)
+        {
+            config->index_segment_docs = atoi(v);
+        }
+        else if (strcmp(k, "index.poll_ms") == 0)
+        {
+            config->index_poll_ms = atoi(v);
+        }
+        else if (strcmp(k, "storage.backend") == 0)
+        {
+            config->storage_backend = strdup(v);
+        }
+        else if (strcmp(k, "storage.sqlite_path") == 0)
+        {
+            config->storage_sqlite_path = strdup(v);
+        }
+        else if (strcmp(k, "message_log.enabled") == 0)
+        {
+            config->message_log_enabled = atoi(v);
+        }
+        else if (strcmp(k, "message_log.path") == 0)
+        {
+            config->message_log_path = strdup(v);
+        }
+        else if (strcmp(k, "message_log.segment_bytes") == 0)
+        {
+            config->message_log_segment_bytes = atoi(v);
+        }
+        else if (strcmp(k, "message_log.index_interval") == 0)
+        {
+            config->message_log_index_interval = atoi(v);
+        }
+        else if (strcmp(k, "message_log.compact_ms") == 0)
+        {
+            config->message_log_compact_ms = atoi(v);
+        }
+        else if (strcmp(k, "message_log.compact_segments") == 0)
+        {
+            config->message_log_compact_segments = atoi(v);
+        }
+        else if (strcmp(k, "archive.enabled") == 0)
+        {
+            config->archive_enabled = atoi(v);
+        }
+        else if (strcmp(k, "archive.path") == 0)
+        {
+            config->archive_path = strdup(v);
+        }
+        else if (strcmp(k, "archive.age_days") == 0)
+        {
+            config->archive_age_days = atoi(v);
+        }
+        else if (strcmp(k, "archive.interval_ms") == 0)
+        {
+            config->archive_interval_ms = atoi(v);
+        }
+        else if (strcmp(k, "archive.segment_rows") == 0)
+        {
+            config->archive_segment_rows = atoi(v);
+        }
     }
 
     log_message(INFO, "Config loaded: show_log=%d, port=%d, ip_address_limit=%d, db_host=%s, db_port=%d, db_user=%s, db_password=%s, db_name=%s",
@@ -145,6 +273,166 @@ const char *config_get_db_name()
     return config_get_instance()->db_name;
 }
 
+int config_get_presence_tick_ms()
+{
+    return config_get_instance()->presence_tick_ms;
+}
+
+int config_get_db_pool_min()
+{
+    return config_get_instance()->db_pool_min;
+}
+
+int config_get_db_pool_max()
+{
+    return config_get_instance()->db_pool_max;
+}
+
+int config_get_db_pool_wait_ms()
+{
+    return config_get_instance()->db_pool_wait_ms;
+}
+
+int config_get_db_pool_idle_check_ms()
+{
+    return config_get_instance()->db_pool_idle_check_ms;
+}
+
+int config_get_persist_flush_ms()
+{
+    return config_get_instance()->persist_flush_ms;
+}
+
+int config_get_persist_batch_size()
+{
+    return config_get_instance()->persist_batch_size;
+}
+
+int config_get_persist_max_pending()
+{
+    return config_get_instance()->persist_max_pending;
+}
+
+const char *config_get_wal_path()
+{
+    return config_get_instance()->wal_path;
+}
+
+int config_get_db_executor_threads()
+{
+    return config_get_instance()->db_executor_threads;
+}
+
+int config_get_db_executor_queue_max()
+{
+    return config_get_instance()->db_executor_queue_max;
+}
+
+int config_get_db_async_connections()
+{
+    return config_get_instance()->db_async_connections;
+}
+
+int config_get_user_cache_capacity()
+{
+    return config_get_instance()->user_cache_capacity;
+}
+
+int config_get_group_cache_capacity()
+{
+    return config_get_instance()->group_cache_capacity;
+}
+
+int config_get_migrate_batch_size()
+{
+    return config_get_instance()->migrate_batch_size;
+}
+
+int config_get_migrate_pause_ms()
+{
+    return config_get_instance()->migrate_pause_ms;
+}
+
+const char *config_get_index_path()
+{
+    return config_get_instance()->index_path;
+}
+
+int config_get_index_segment_docs()
+{
+    return config_get_instance()->index_segment_docs;
+}
+
+int config_get_index_poll_ms()
+{
+    return config_get_instance()->index_poll_ms;
+}
+
+const char *config_get_storage_backend()
+{
+    return config_get_instance()->storage_backend;
+}
+
+const char *config_get_storage_sqlite_path()
+{
+    return config_get_instance()->storage_sqlite_path;
+}
+
+int config_get_message_log_enabled()
+{
+    return config_get_instance()->message_log_enabled;
+}
+
+const char *config_get_message_log_path()
+{
+    return config_get_instance()->message_log_path;
+}
+
+int config_get_message_log_segment_bytes()
+{
+    return config_get_instance()->message_log_segment_bytes;
+}
+
+int config_get_message_log_index_interval()
+{
+    return config_get_instance()->message_log_index_interval;
+}
+
+int config_get_message_log_compact_ms()
+{
+    return config_get_instance()->message_log_compact_ms;
+}
+
+int config_get_message_log_compact_segments()
+{
+    return config_get_instance()->message_log_compact_segments;
+}
+
+int config_get_archive_enabled()
+{
+    return config_get_instance()->archive_enabled;
+}
+
+const char *config_get_archive_path()
+{
+    return config_get_instance()->archive_path;
+}
+
+int config_get_archive_age_days()
+{
+    return config_get_instance()->archive_age_days;
+}
+
+int config_get_archive_interval_ms()
+{
+    return config_get_instance()->archive_interval_ms;
+}
+
+int config_get_archive_segment_rows()
+{
+    return config_get_instance()->archive_segment_rows;
+}
+
 void config_cleanup()
 {
     if (instance != NULL)
@@ -153,6 +441,12 @@ void config_cleanup()
         free(instance->db_user);
         free(instance->db_password);
         free(instance->db_name);
+        free(instance->wal_path);
+        free(instance->index_path);
+        free(instance->storage_backend);
+        free(instance->storage_sqlite_path);
+        free(instance->message_log_path);
+        free(instance->archive_path);
         free(instance);
         instance = NULL;
     }
@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include "epoch.h"
+#include "log.h"
+
+typedef struct EpochRecord EpochRecord;
+struct EpochRecord {
+    // 0 = không ở trong critical section
+    _Atomic uint64_t epoch;
+    atomic_bool in_use;
+    int nesting;
+    EpochRecord *next;
+};
+
+static _Atomic uint64_t global_epoch = 1;
+static _Atomic(EpochRecord *) records = NULL;
+static pthread_key_t record_key;
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+static __thread EpochRecord *local_record = NULL;
+
+static void release_record(void *arg)
+{
+    EpochRecord *record = (EpochRecord *)arg;
+    atomic_store_explicit(&record->epoch, 0, memory_order_release);
+    record->nesting = 0;
+    atomic_store_explicit(&record->in_use, false, memory_order_release);
+}
+
+static void create_record_key()
+{
+    pthread_key_create(&record_key, release_record);
+}
+
+static EpochRecord *acquire_record()
+{
+    pthread_once(&record_key_once, create_record_key);
+
+    // Tái sử dụng record của các thread đã kết thúc
+    for (EpochRecord *record = atomic_load_explicit(&records, memory_order_acquire);
+         record != NULL; record = record->next)
+    {
+        bool expected = false;
+        if (!atomic_load_explicit(&record->in_use, memory_order_relaxed) &&
+            atomic_compare_exchange_strong(&record->in_use, &expected, true))
+        {
+            pthread_setspecific(record_key, record);
+            return record;
+        }
+    }
+
+    EpochRecord *record = calloc(1, sizeof(EpochRecord));
+    if (record == NULL)
+    {
+        log_message(FATAL, "Failed to allocate epoch record");
+        abort();
+    }
+    atomic_init(&record->epoch, 0);
+    atomic_init(&record->in_use, true);
+
+    EpochRecord *head = atomic_load_explicit(&records, memory_order_relaxed);
+    do
+    {
+        record->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&records, &head, record,
+                                                    memory_order_release, memory_order_relaxed));
+
+    pthread_setspecific(record_key, record);
+    return record;
+}
+
+void epoch_enter()
+{
+    EpochRecord *record = local_record;
+    if (record == NULL)
+    {
+        record = acquire_record();
+        local_record = record;
+    }
+
+    if (record->nesting++ > 0)
+    {
+        return;
+    }
+
+    atomic_store_explicit(&record->epoch,
+                          atomic_load_explicit(&global_epoch, memory_order_relaxed),
+                          memory_order_relaxed);
+    // Thông báo epoch phải được nhìn thấy trước mọi lần đọc con trỏ chia sẻ
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void epoch_exit()
+{
+    EpochRecord *record = local_record;
+    if (record == NULL || record->nesting == 0)
+    {
+        log_message(ERROR, "epoch_exit called outside of a critical section");
+        return;
+    }
+
+    if (--record->nesting == 0)
+    {
+        atomic_store_explicit(&record->epoch, 0, memory_order_release);
+    }
+}
+
+void epoch_synchronize()
+{
+    if (local_record != NULL && local_record->nesting > 0)
+    {
+        log_message(ERROR, "epoch_synchronize called inside a critical section");
+        return;
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+    uint64_t target = atomic_fetch_add_explicit(&global_epoch, 1, memory_order_seq_cst) + 1;
+
+    for (EpochRecord *record = atomic_load_explicit(&records, memory_order_acquire);
+         record != NULL; record = record->next)
+    {
+        for (;;)
+        {
+            uint64_t epoch = atomic_load_explicit(&record->epoch, memory_order_acquire);
+            if (epoch == 0 || epoch >= target)
+            {
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <regex.h>
 #include <stdbool.h>
+#include <time.h>
 
 void *timeout_thread(void *arg)
 {
@@ -49,6 +50,13 @@ void utils_set_timeout(TimeoutCallback callback, void *data, int milliseconds)
     pthread_detach(thread_id);
 }
 
+long long utils_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 bool is_port_available(int port)
 {
     int sock = socket(AF_INET, SOCK_STREAM, 0);